@@ -29,9 +29,11 @@ MEDIA_FILE_TYPE_ENUM = {
     "WAV": MediaFileType.WAV,
     "MP3": MediaFileType.MP3,
     "FLAC": MediaFileType.FLAC,
+    "RAW": MediaFileType.RAW,
 }
 
 CONF_MEDIA_FILE = "media_file"
+CONF_ENQUEUE = "enqueue"
 
 
 
@@ -148,6 +150,7 @@ MEDIA_PLAYER_ACTION_SCHEMA = maybe_simple_id({cv.GenerateID(): cv.use_id(MediaPl
         {
             cv.GenerateID(): cv.use_id(MediaPlayer),
             cv.Required(CONF_MEDIA_URL): cv.templatable(cv.url),
+            cv.Optional(CONF_ENQUEUE, default=False): cv.templatable(cv.boolean),
         },
         key=CONF_MEDIA_URL,
     ),
@@ -157,6 +160,8 @@ async def media_player_play_media_action(config, action_id, template_arg, args):
     await cg.register_parented(var, config[CONF_ID])
     media_url = await cg.templatable(config[CONF_MEDIA_URL], args, cg.std_string)
     cg.add(var.set_media_url(media_url))
+    enqueue = await cg.templatable(config[CONF_ENQUEUE], args, bool)
+    cg.add(var.set_enqueue(enqueue))
     return var
 
 # @automation.register_action(
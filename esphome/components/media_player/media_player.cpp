@@ -56,6 +56,8 @@ const char *media_player_file_type_to_string(MediaFileType file_type) {
       return "MP3";
     case MediaFileType::WAV:
       return "WAV";
+    case MediaFileType::RAW:
+      return "RAW";
     default:
       return "unknonw";
   }
@@ -92,6 +94,9 @@ void MediaPlayerCall::perform() {
   if (this->announcement_.has_value()) {
     ESP_LOGD(TAG, " Announcement: %s", this->announcement_.value() ? "yes" : "no");
   }
+  if (this->enqueue_.has_value()) {
+    ESP_LOGD(TAG, " Enqueue: %s", this->enqueue_.value() ? "yes" : "no");
+  }
   this->parent_->control(*this);
 }
 
@@ -142,6 +147,11 @@ MediaPlayerCall &MediaPlayerCall::set_announcement(bool announce) {
   return *this;
 }
 
+MediaPlayerCall &MediaPlayerCall::set_enqueue(bool enqueue) {
+  this->enqueue_ = enqueue;
+  return *this;
+}
+
 void MediaPlayer::add_on_state_callback(std::function<void()> &&callback) {
   this->state_callback_.add(std::move(callback));
 }
@@ -42,6 +42,7 @@ enum class MediaFileType : uint8_t {
   WAV,
   MP3,
   FLAC,
+  RAW,
 };
 const char *media_player_file_type_to_string(MediaFileType file_type);
 
@@ -49,6 +50,7 @@ struct MediaFile {
   const uint8_t *data;
   size_t length;
   MediaFileType file_type;
+  StreamInfo stream_info;  // Only used by RAW files, which are headerless PCM
 };
 
 class MediaPlayer;
@@ -78,6 +80,8 @@ class MediaPlayerCall {
 
   MediaPlayerCall &set_volume(float volume);
   MediaPlayerCall &set_announcement(bool announce);
+  /// @brief Plays the media after the current media finishes instead of replacing it
+  MediaPlayerCall &set_enqueue(bool enqueue);
 
   void perform();
 
@@ -85,6 +89,7 @@ class MediaPlayerCall {
   const optional<std::string> &get_media_url() const { return media_url_; }
   const optional<float> &get_volume() const { return volume_; }
   const optional<bool> &get_announcement() const { return announcement_; }
+  const optional<bool> &get_enqueue() const { return enqueue_; }
   const optional<MediaFile *> &get_local_media_file() const { return media_file_; }
 
  protected:
@@ -94,6 +99,7 @@ class MediaPlayerCall {
   optional<std::string> media_url_;
   optional<float> volume_;
   optional<bool> announcement_;
+  optional<bool> enqueue_;
   optional<MediaFile *> media_file_;
 };
 
@@ -4,26 +4,46 @@
 
 #include "mp3_decoder.h"
 
-#include "esphome/core/ring_buffer.h"
+#include <algorithm>
+#include <cstring>
 
 namespace esphome {
 namespace nabu {
 
-AudioDecoder::AudioDecoder(RingBuffer *input_ring_buffer, RingBuffer *output_ring_buffer, size_t internal_buffer_size) {
+// Samples per channel the MP3 synthesis filter bank delays its output by, on top of the encoder's own delay
+static const uint32_t MP3_DECODER_DELAY = 529;
+
+static uint32_t read_big_endian_32(const uint8_t *data) {
+  return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+size_t id3v2_tag_size(const uint8_t *header) {
+  if (std::memcmp(header, "ID3", 3) != 0) {
+    return 0;
+  }
+  // The size is stored in 4 bytes of 7 bits each and excludes the header and the optional footer
+  size_t size = ((header[6] & 0x7F) << 21) | ((header[7] & 0x7F) << 14) | ((header[8] & 0x7F) << 7) |
+                (header[9] & 0x7F);
+  const bool has_footer = header[5] & 0x10;
+  return ID3V2_HEADER_SIZE + size + (has_footer ? ID3V2_HEADER_SIZE : 0);
+}
+
+AudioDecoder::AudioDecoder(AudioRingBuffer *input_ring_buffer, AudioRingBuffer *output_ring_buffer,
+                           size_t internal_buffer_size) {
   this->input_ring_buffer_ = input_ring_buffer;
   this->output_ring_buffer_ = output_ring_buffer;
   this->internal_buffer_size_ = internal_buffer_size;
 }
 
-AudioDecoder::~AudioDecoder() {
-  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
-  if (this->input_buffer_ != nullptr) {
-    allocator.deallocate(this->input_buffer_, this->internal_buffer_size_);
-  }
-  if (this->output_buffer_ != nullptr) {
-    allocator.deallocate(this->output_buffer_, this->internal_buffer_size_);
-  }
+AudioDecoder::AudioDecoder(const uint8_t *input_data, size_t input_length, AudioRingBuffer *output_ring_buffer,
+                           size_t internal_buffer_size) {
+  this->input_data_ = input_data;
+  this->input_data_length_ = input_length;
+  this->output_ring_buffer_ = output_ring_buffer;
+  this->internal_buffer_size_ = internal_buffer_size;
+}
 
+AudioDecoder::~AudioDecoder() {
   if (this->flac_decoder_ != nullptr) {
     this->flac_decoder_->free_buffers();
     this->flac_decoder_.reset();  // Free the unique_ptr
@@ -40,26 +60,30 @@ AudioDecoder::~AudioDecoder() {
   }
 }
 
-esp_err_t AudioDecoder::start(media_player::MediaFileType media_file_type) {
-  esp_err_t err = this->allocate_buffers_();
-
-  if (err != ESP_OK) {
-    return err;
-  }
-
+esp_err_t AudioDecoder::start(media_player::MediaFileType media_file_type,
+                               optional<media_player::StreamInfo> raw_stream_info) {
   this->media_file_type_ = media_file_type;
 
-  this->input_buffer_current_ = this->input_buffer_;
+  this->input_buffer_current_ = nullptr;
   this->input_buffer_length_ = 0;
-  this->output_buffer_current_ = this->output_buffer_;
+  this->input_bytes_consumed_ = 0;
+  this->output_buffer_ = nullptr;
+  this->output_buffer_free_ = 0;
   this->output_buffer_length_ = 0;
 
+  this->input_data_consumed_ = 0;
+
   this->potentially_failed_count_ = 0;
   this->end_of_file_ = false;
 
+  this->duration_ms_.reset();
+  this->mp3_skip_bytes_ = 0;
+  this->mp3_skip_samples_ = 0;
+  this->mp3_samples_left_.reset();
+
   switch (this->media_file_type_) {
     case media_player::MediaFileType::FLAC:
-      this->flac_decoder_ = make_unique<flac::FLACDecoder>(this->input_buffer_);
+      this->flac_decoder_ = make_unique<flac::FLACDecoder>();
       break;
     case media_player::MediaFileType::MP3:
       this->mp3_decoder_ = MP3InitDecoder();
@@ -68,6 +92,13 @@ esp_err_t AudioDecoder::start(media_player::MediaFileType media_file_type) {
       this->wav_decoder_ = make_unique<wav_decoder::WAVDecoder>(&this->input_buffer_current_);
       this->wav_decoder_->reset();
       break;
+    case media_player::MediaFileType::RAW:
+      if (!raw_stream_info.has_value()) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      // Nothing to parse; the samples are already in their final format
+      this->stream_info_ = raw_stream_info;
+      break;
     case media_player::MediaFileType::NONE:
       break;
   }
@@ -77,15 +108,13 @@ esp_err_t AudioDecoder::start(media_player::MediaFileType media_file_type) {
 
 AudioDecoderState AudioDecoder::decode(bool stop_gracefully) {
   if (stop_gracefully) {
-    if (this->output_buffer_length_ == 0) {
-      // If the file decoder believes it the end of file
-      if (this->end_of_file_) {
-        return AudioDecoderState::FINISHED;
-      }
-      // If all the internal buffers are empty, the decoding is done
-      if ((this->input_ring_buffer_->available() == 0) && (this->input_buffer_length_ == 0)) {
-        return AudioDecoderState::FINISHED;
-      }
+    // If the file decoder believes it the end of file
+    if (this->end_of_file_) {
+      return AudioDecoderState::FINISHED;
+    }
+    // If the input is empty, the decoding is done
+    if (this->input_available_() == 0) {
+      return AudioDecoderState::FINISHED;
     }
   }
 
@@ -93,73 +122,91 @@ AudioDecoderState AudioDecoder::decode(bool stop_gracefully) {
     return AudioDecoderState::FAILED;
   }
 
+  const bool had_stream_info = this->stream_info_.has_value();
+
   FileDecoderState state = FileDecoderState::MORE_TO_PROCESS;
 
   while (state == FileDecoderState::MORE_TO_PROCESS) {
-    if (this->output_buffer_length_ > 0) {
-      // Have decoded data, feed into output ring buffer
-      size_t bytes_free = this->output_ring_buffer_->free();
-      size_t bytes_to_write = std::min(this->output_buffer_length_, bytes_free);
-
-      if (bytes_to_write > 0) {
-        size_t bytes_written = this->output_ring_buffer_->write((void *) this->output_buffer_current_, bytes_to_write);
-
-        this->output_buffer_length_ -= bytes_written;
-        this->output_buffer_current_ += bytes_written;
-      }
+    // Decode straight into the output ring buffer, but only once it has room for everything a single step produces
+    this->output_buffer_free_ =
+        this->output_ring_buffer_->acquire_write(&this->output_buffer_, this->internal_buffer_size_);
+    if (this->output_buffer_free_ < this->min_output_bytes_()) {
+      // Output ring buffer is full, so we can't do any more processing
+      return AudioDecoderState::DECODING;
+    }
 
-      if (this->output_buffer_length_ > 0) {
-        // Output ring buffer is full, so we can't do any more processing
-        return AudioDecoderState::DECODING;
-      }
+    // Parse straight from the input ring buffer or the file in memory
+    size_t bytes_available;
+    if (this->input_ring_buffer_ != nullptr) {
+      bytes_available =
+          this->input_ring_buffer_->acquire_read(&this->input_buffer_current_, this->internal_buffer_size_);
     } else {
-      // Try to decode more data
-      size_t bytes_available = this->input_ring_buffer_->available();
-      size_t bytes_to_read = std::min(bytes_available, this->internal_buffer_size_ - this->input_buffer_length_);
+      // The file decoders only read their input, but the WAV and MP3 decoders take it as non-const
+      this->input_buffer_current_ = const_cast<uint8_t *>(this->input_data_ + this->input_data_consumed_);
+      bytes_available = this->input_data_length_ - this->input_data_consumed_;
+    }
 
-      if ((this->potentially_failed_count_ > 0) && (bytes_to_read == 0)) {
-        // We didn't have enough data last time, and we have no new data, so just return
-        return AudioDecoderState::DECODING;
+    const bool new_input = (bytes_available != this->input_buffer_length_);
+    if ((this->potentially_failed_count_ > 0) && (this->input_bytes_consumed_ == 0) && !new_input) {
+      // We didn't have enough data last time and made no progress, and we have no new data
+      if (stop_gracefully) {
+        // No more data is coming, so the rest of the input can't be decoded
+        return AudioDecoderState::FINISHED;
       }
-
-      // Shift unread data in input buffer to start
-      if (this->input_buffer_length_ > 0) {
-        memmove(this->input_buffer_, this->input_buffer_current_, this->input_buffer_length_);
+      if ((this->input_ring_buffer_ != nullptr) && (bytes_available < this->internal_buffer_size_) &&
+          (this->input_ring_buffer_->free() > 0)) {
+        // More data can still arrive
+        return AudioDecoderState::DECODING;
       }
-      this->input_buffer_current_ = this->input_buffer_;
-
-      // read in new ring buffer data to fill the remaining input buffer
-      size_t bytes_read = 0;
+      // The input can't grow any further, so only retrying tells whether it can ever be decoded
+    }
 
-      if (bytes_to_read > 0) {
-        uint8_t *new_audio_data = this->input_buffer_ + this->input_buffer_length_;
-        bytes_read = this->input_ring_buffer_->read((void *) new_audio_data, bytes_to_read);
+    this->input_buffer_length_ = bytes_available;
+    this->output_buffer_length_ = 0;
 
-        this->input_buffer_length_ += bytes_read;
+    if (this->input_buffer_length_ == 0) {
+      // No input data available, so we can't do any more processing
+      state = FileDecoderState::IDLE;
+    } else {
+      switch (this->media_file_type_) {
+        case media_player::MediaFileType::FLAC:
+          state = this->decode_flac_();
+          break;
+        case media_player::MediaFileType::MP3:
+          state = this->decode_mp3_();
+          break;
+        case media_player::MediaFileType::WAV:
+          state = this->decode_wav_();
+          break;
+        case media_player::MediaFileType::RAW:
+          state = this->decode_raw_();
+          break;
+        case media_player::MediaFileType::NONE:
+          state = FileDecoderState::IDLE;
+          break;
       }
 
-      if (this->input_buffer_length_ == 0) {
-        // No input data available, so we can't do any more processing
-        state = FileDecoderState::IDLE;
+      // Release the parsed input bytes and publish the decoded output
+      size_t bytes_consumed = bytes_available - this->input_buffer_length_;
+      this->input_bytes_consumed_ = bytes_consumed;
+      if (this->input_ring_buffer_ != nullptr) {
+        this->input_ring_buffer_->commit_read(bytes_consumed);
       } else {
-        switch (this->media_file_type_) {
-          case media_player::MediaFileType::FLAC:
-            state = this->decode_flac_();
-            break;
-          case media_player::MediaFileType::MP3:
-            state = this->decode_mp3_();
-            break;
-          case media_player::MediaFileType::WAV:
-            state = this->decode_wav_();
-            break;
-          case media_player::MediaFileType::NONE:
-            state = FileDecoderState::IDLE;
-            break;
-        }
+        this->input_data_consumed_ += bytes_consumed;
       }
+      this->stats_.bytes_read += bytes_consumed;
+
+      this->output_ring_buffer_->commit_write(this->output_buffer_length_);
+      this->stats_.bytes_written += this->output_buffer_length_;
     }
+
     if (state == FileDecoderState::POTENTIALLY_FAILED) {
-      ++this->potentially_failed_count_;
+      if (new_input || (this->input_bytes_consumed_ > 0)) {
+        // A frame arriving over several writes, or input still being worked through, isn't a failure yet
+        this->potentially_failed_count_ = 1;
+      } else {
+        ++this->potentially_failed_count_;
+      }
     } else if (state == FileDecoderState::END_OF_FILE) {
       this->end_of_file_ = true;
     } else if (state == FileDecoderState::FAILED) {
@@ -167,32 +214,56 @@ AudioDecoderState AudioDecoder::decode(bool stop_gracefully) {
     } else {
       this->potentially_failed_count_ = 0;
     }
+
+    if (!had_stream_info && this->stream_info_.has_value()) {
+      // Hand back the stream info as soon as the header is parsed, so the resampler is set up while the first frames
+      // are decoded
+      return AudioDecoderState::DECODING;
+    }
   }
   return AudioDecoderState::DECODING;
 }
 
-esp_err_t AudioDecoder::allocate_buffers_() {
-  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
-
-  if (this->input_buffer_ == nullptr)
-    this->input_buffer_ = allocator.allocate(this->internal_buffer_size_);
-
-  if (this->output_buffer_ == nullptr)
-    this->output_buffer_ = allocator.allocate(this->internal_buffer_size_);
-
-  if ((this->input_buffer_ == nullptr) || (this->output_buffer_ == nullptr)) {
-    return ESP_ERR_NO_MEM;
+size_t AudioDecoder::input_available_() {
+  if (this->input_ring_buffer_ != nullptr) {
+    return this->input_ring_buffer_->available();
   }
+  return this->input_data_length_ - this->input_data_consumed_;
+}
 
-  return ESP_OK;
+size_t AudioDecoder::min_output_bytes_() {
+  switch (this->media_file_type_) {
+    case media_player::MediaFileType::FLAC:
+      if (this->stream_info_.has_value()) {
+        return this->flac_decoder_->get_output_buffer_size() * this->flac_decoder_->get_output_bytes_per_sample();
+      }
+      return 0;  // Reading the header doesn't output anything
+    case media_player::MediaFileType::MP3:
+      return MAX_NCHAN * MAX_NGRAN * MAX_NSAMP * sizeof(int16_t);
+    case media_player::MediaFileType::WAV:
+    case media_player::MediaFileType::RAW:
+      return 1;  // Any amount of space can be filled by copying samples
+    case media_player::MediaFileType::NONE:
+      break;
+  }
+  return 0;
 }
 
 FileDecoderState AudioDecoder::decode_flac_() {
   if (!this->stream_info_.has_value()) {
     // Header hasn't been read
-    auto result = this->flac_decoder_->read_header(this->input_buffer_length_);
+    auto result = this->flac_decoder_->read_header(this->input_buffer_current_, this->input_buffer_length_);
 
     if (result == flac::FLAC_DECODER_HEADER_OUT_OF_DATA) {
+      // Keep the metadata blocks that were already parsed or skipped, so large headers (e.g., album art) that don't
+      // fit in the input buffer can still be read across several calls
+      size_t bytes_consumed = this->flac_decoder_->get_bytes_index();
+      this->input_buffer_current_ += bytes_consumed;
+      this->input_buffer_length_ = this->flac_decoder_->get_bytes_left();
+
+      if (bytes_consumed > 0) {
+        return FileDecoderState::MORE_TO_PROCESS;
+      }
       return FileDecoderState::POTENTIALLY_FAILED;
     }
 
@@ -208,13 +279,15 @@ FileDecoderState AudioDecoder::decode_flac_() {
     media_player::StreamInfo stream_info;
     stream_info.channels = this->flac_decoder_->get_num_channels();
     stream_info.sample_rate = this->flac_decoder_->get_sample_rate();
-    stream_info.bits_per_sample = this->flac_decoder_->get_sample_depth();
-    
+    // Deeper streams are decoded into 32 bit samples
+    stream_info.bits_per_sample = this->flac_decoder_->get_output_bytes_per_sample() == sizeof(int32_t)
+                                      ? 32
+                                      : this->flac_decoder_->get_sample_depth();
+
     this->stream_info_ = stream_info;
 
-    size_t flac_decoder_output_buffer_min_size = flac_decoder_->get_output_buffer_size();
-    if (this->internal_buffer_size_ < flac_decoder_output_buffer_min_size * sizeof(int16_t)) {
-      // Output buffer is not big enough
+    if (this->internal_buffer_size_ < this->min_output_bytes_()) {
+      // Output ring buffer can't hand out a region big enough for a frame
       return FileDecoderState::FAILED;
     }
 
@@ -222,8 +295,8 @@ FileDecoderState AudioDecoder::decode_flac_() {
   }
 
   uint32_t output_samples = 0;
-  auto result =
-      this->flac_decoder_->decode_frame(this->input_buffer_length_, (int16_t *) this->output_buffer_, &output_samples);
+  auto result = this->flac_decoder_->decode_frame(this->input_buffer_current_, this->input_buffer_length_,
+                                                 this->output_buffer_, &output_samples);
 
   if (result == flac::FLAC_DECODER_ERROR_OUT_OF_DATA) {
     // Not an issue, just needs more data that we'll get next time.
@@ -238,8 +311,7 @@ FileDecoderState AudioDecoder::decode_flac_() {
   this->input_buffer_current_ += bytes_consumed;
   this->input_buffer_length_ = this->flac_decoder_->get_bytes_left();
 
-  this->output_buffer_current_ = this->output_buffer_;
-  this->output_buffer_length_ = output_samples * sizeof(int16_t);
+  this->output_buffer_length_ = output_samples * this->flac_decoder_->get_output_bytes_per_sample();
 
   if (result == flac::FLAC_DECODER_NO_MORE_FRAMES) {
     return FileDecoderState::END_OF_FILE;
@@ -249,6 +321,32 @@ FileDecoderState AudioDecoder::decode_flac_() {
 }
 
 FileDecoderState AudioDecoder::decode_mp3_() {
+  if (this->mp3_skip_bytes_ > 0) {
+    const size_t bytes_skipped = std::min(this->mp3_skip_bytes_, this->input_buffer_length_);
+    this->input_buffer_current_ += bytes_skipped;
+    this->input_buffer_length_ -= bytes_skipped;
+    this->mp3_skip_bytes_ -= bytes_skipped;
+    return FileDecoderState::MORE_TO_PROCESS;
+  }
+
+  if (this->mp3_samples_left_.has_value() && (this->mp3_samples_left_.value() == 0)) {
+    // Everything after the last frame's padding, such as an ID3v1 tag, isn't audio
+    this->input_buffer_current_ += this->input_buffer_length_;
+    this->input_buffer_length_ = 0;
+    return FileDecoderState::END_OF_FILE;
+  }
+
+  if (!this->stream_info_.has_value()) {
+    if (this->input_buffer_length_ < ID3V2_HEADER_SIZE) {
+      return FileDecoderState::POTENTIALLY_FAILED;
+    }
+    // Skip an ID3v2 tag outright; scanning it for a sync word is slow and finds false ones in embedded images
+    this->mp3_skip_bytes_ = id3v2_tag_size(this->input_buffer_current_);
+    if (this->mp3_skip_bytes_ > 0) {
+      return FileDecoderState::MORE_TO_PROCESS;
+    }
+  }
+
   // Look for the next sync word
   int32_t offset = MP3FindSyncWord(this->input_buffer_current_, this->input_buffer_length_);
   if (offset < 0) {
@@ -260,10 +358,25 @@ FileDecoderState AudioDecoder::decode_mp3_() {
   this->input_buffer_current_ += offset;
   this->input_buffer_length_ -= offset;
 
+  if (!this->stream_info_.has_value() && (this->input_buffer_length_ >= 4)) {
+    FileDecoderState state = this->start_mp3_();
+    if (state != FileDecoderState::IDLE) {
+      return state;
+    }
+  }
+
+  uint8_t *frame_start = this->input_buffer_current_;
+  const size_t frame_start_length = this->input_buffer_length_;
+
   int err = MP3Decode(this->mp3_decoder_, &this->input_buffer_current_, (int *) &this->input_buffer_length_,
                       (int16_t *) this->output_buffer_, 0);
   if (err) {
     switch (err) {
+      case ERR_MP3_INDATA_UNDERFLOW:
+        // Only part of the frame has arrived; decode it from its start once the rest is here
+        this->input_buffer_current_ = frame_start;
+        this->input_buffer_length_ = frame_start_length;
+        return FileDecoderState::POTENTIALLY_FAILED;
       case ERR_MP3_MAINDATA_UNDERFLOW:
         // Not a problem. Next call to decode will provide more data.
         return FileDecoderState::POTENTIALLY_FAILED;
@@ -277,9 +390,23 @@ FileDecoderState AudioDecoder::decode_mp3_() {
     MP3FrameInfo mp3_frame_info;
     MP3GetLastFrameInfo(this->mp3_decoder_, &mp3_frame_info);
     if (mp3_frame_info.outputSamps > 0) {
-      int bytes_per_sample = (mp3_frame_info.bitsPerSample / 8);
-      this->output_buffer_length_ = mp3_frame_info.outputSamps * bytes_per_sample;
-      this->output_buffer_current_ = this->output_buffer_;
+      const size_t bytes_per_frame = mp3_frame_info.nChans * (mp3_frame_info.bitsPerSample / 8);
+      uint32_t frames = mp3_frame_info.outputSamps / mp3_frame_info.nChans;
+
+      // Trim the encoder and decoder delay from the start and the encoder padding from the end, so consecutive
+      // tracks play gaplessly
+      const uint32_t frames_skipped = std::min(this->mp3_skip_samples_, frames);
+      if (frames_skipped > 0) {
+        frames -= frames_skipped;
+        this->mp3_skip_samples_ -= frames_skipped;
+        std::memmove(this->output_buffer_, this->output_buffer_ + frames_skipped * bytes_per_frame,
+                     frames * bytes_per_frame);
+      }
+      if (this->mp3_samples_left_.has_value()) {
+        frames = std::min<uint64_t>(frames, this->mp3_samples_left_.value());
+        this->mp3_samples_left_ = this->mp3_samples_left_.value() - frames;
+      }
+      this->output_buffer_length_ = frames * bytes_per_frame;
 
       media_player::StreamInfo stream_info;
       stream_info.channels = mp3_frame_info.nChans;
@@ -292,10 +419,82 @@ FileDecoderState AudioDecoder::decode_mp3_() {
   return FileDecoderState::MORE_TO_PROCESS;
 }
 
+FileDecoderState AudioDecoder::start_mp3_() {
+  MP3FrameInfo mp3_frame_info;
+  if (MP3GetNextFrameInfo(this->mp3_decoder_, &mp3_frame_info, this->input_buffer_current_) != ERR_MP3_NONE) {
+    // Not a valid header, so leave it to the decoder to skip
+    return FileDecoderState::IDLE;
+  }
+
+  const uint8_t *frame = this->input_buffer_current_;
+  const bool is_mpeg1 = (mp3_frame_info.version == MPEG1);
+  const bool is_mono = (mp3_frame_info.nChans == 1);
+  const bool is_padded = frame[2] & 0x02;
+  const size_t frame_size = (is_mpeg1 ? 144 : 72) * mp3_frame_info.bitrate / mp3_frame_info.samprate + is_padded;
+
+  // A Xing or Info header takes the place of the audio data right after the side info
+  const size_t side_info_size = is_mpeg1 ? (is_mono ? SIBYTES_MPEG1_MONO : SIBYTES_MPEG1_STEREO)
+                                         : (is_mono ? SIBYTES_MPEG2_MONO : SIBYTES_MPEG2_STEREO);
+  const size_t xing_offset = 4 + side_info_size;
+  if (frame_size > xing_offset + 8) {
+    if (this->input_buffer_length_ < frame_size) {
+      // Wait for the whole frame, as the headers may span most of it
+      return FileDecoderState::POTENTIALLY_FAILED;
+    }
+
+    const uint8_t *xing = frame + xing_offset;
+    if ((std::memcmp(xing, "Xing", 4) == 0) || (std::memcmp(xing, "Info", 4) == 0)) {
+      const uint32_t flags = read_big_endian_32(xing + 4);
+      size_t position = 8;
+
+      optional<uint64_t> total_samples;
+      if (flags & 0x1) {
+        total_samples = static_cast<uint64_t>(read_big_endian_32(xing + position)) *
+                        (mp3_frame_info.outputSamps / mp3_frame_info.nChans);
+        position += 4;
+      }
+      position += (flags & 0x2) ? 4 : 0;    // Byte count
+      position += (flags & 0x4) ? 100 : 0;  // Seek table
+      position += (flags & 0x8) ? 4 : 0;    // Quality
+
+      // LAME and FFmpeg both write a LAME tag holding the encoder delay and padding
+      const uint8_t *lame = xing + position;
+      if (total_samples.has_value() && (xing_offset + position + 24 <= frame_size) &&
+          ((std::memcmp(lame, "LAME", 4) == 0) || (std::memcmp(lame, "Lavc", 4) == 0) ||
+           (std::memcmp(lame, "Lavf", 4) == 0))) {
+        const uint32_t encoder_delay = (lame[21] << 4) | (lame[22] >> 4);
+        const uint32_t encoder_padding = ((lame[22] & 0x0F) << 8) | lame[23];
+        if (encoder_delay + encoder_padding < total_samples.value()) {
+          total_samples = total_samples.value() - encoder_delay - encoder_padding;
+          this->mp3_skip_samples_ = encoder_delay + MP3_DECODER_DELAY;
+          this->mp3_samples_left_ = total_samples;
+        }
+      }
+
+      if (total_samples.has_value()) {
+        this->duration_ms_ = total_samples.value() * 1000 / mp3_frame_info.samprate;
+      }
+
+      // The frame carries no audio
+      this->input_buffer_current_ += frame_size;
+      this->input_buffer_length_ -= frame_size;
+    }
+  }
+
+  // The first frame's header describes the stream, so it is known before the frame is decoded
+  media_player::StreamInfo stream_info;
+  stream_info.channels = mp3_frame_info.nChans;
+  stream_info.sample_rate = mp3_frame_info.samprate;
+  stream_info.bits_per_sample = mp3_frame_info.bitsPerSample;
+  this->stream_info_ = stream_info;
+  return FileDecoderState::MORE_TO_PROCESS;
+}
+
 FileDecoderState AudioDecoder::decode_wav_() {
   if (!this->stream_info_.has_value() && (this->input_buffer_length_ > 44)) {
     // Header hasn't been processed
 
+    uint8_t *original_buffer = this->input_buffer_current_;
     size_t original_buffer_length = this->input_buffer_length_;
 
     size_t wav_bytes_to_skip = this->wav_decoder_->bytes_to_skip();
@@ -336,7 +535,7 @@ FileDecoderState AudioDecoder::decode_wav_() {
         // Something unexpected has happened
         // Reset state and hope we have enough info next time
         this->input_buffer_length_ = original_buffer_length;
-        this->input_buffer_current_ = this->input_buffer_;
+        this->input_buffer_current_ = original_buffer;
         return FileDecoderState::POTENTIALLY_FAILED;
       }
     }
@@ -344,12 +543,11 @@ FileDecoderState AudioDecoder::decode_wav_() {
 
   if (this->wav_bytes_left_ > 0) {
     size_t bytes_to_write = std::min(this->wav_bytes_left_, this->input_buffer_length_);
-    bytes_to_write = std::min(bytes_to_write, this->internal_buffer_size_);
+    bytes_to_write = std::min(bytes_to_write, this->output_buffer_free_);
     if (bytes_to_write > 0) {
       std::memcpy(this->output_buffer_, this->input_buffer_current_, bytes_to_write);
       this->input_buffer_current_ += bytes_to_write;
       this->input_buffer_length_ -= bytes_to_write;
-      this->output_buffer_current_ = this->output_buffer_;
       this->output_buffer_length_ = bytes_to_write;
       this->wav_bytes_left_ -= bytes_to_write;
     }
@@ -360,6 +558,16 @@ FileDecoderState AudioDecoder::decode_wav_() {
   return FileDecoderState::END_OF_FILE;
 }
 
+FileDecoderState AudioDecoder::decode_raw_() {
+  size_t bytes_to_write = std::min(this->input_buffer_length_, this->output_buffer_free_);
+  std::memcpy(this->output_buffer_, this->input_buffer_current_, bytes_to_write);
+  this->input_buffer_current_ += bytes_to_write;
+  this->input_buffer_length_ -= bytes_to_write;
+  this->output_buffer_length_ = bytes_to_write;
+
+  return FileDecoderState::IDLE;
+}
+
 }  // namespace nabu
 }  // namespace esphome
 
@@ -2,16 +2,24 @@
 
 #ifdef USE_ESP_IDF
 
+#include "audio_ring_buffer.h"
+#include "audio_stats.h"
 #include "flac_decoder.h"
 #include "wav_decoder.h"
 #include "mp3_decoder.h"
 
 #include "esphome/components/media_player/media_player.h"
-#include "esphome/core/ring_buffer.h"
 
 namespace esphome {
 namespace nabu {
 
+static const size_t ID3V2_HEADER_SIZE = 10;
+
+/// @brief Reads the size of an ID3v2 tag from its header
+/// @param header at least ID3V2_HEADER_SIZE bytes from the start of a file
+/// @return the size of the tag including its header and footer, or 0 if the file doesn't start with one
+size_t id3v2_tag_size(const uint8_t *header);
+
 enum class AudioDecoderState : uint8_t {
   INITIALIZED = 0,
   DECODING,
@@ -30,47 +38,88 @@ enum class FileDecoderState : uint8_t {
 
 class AudioDecoder {
  public:
-  AudioDecoder(esphome::RingBuffer *input_ring_buffer, esphome::RingBuffer *output_ring_buffer,
+  /// @param internal_buffer_size the most bytes parsed or produced in one step; both ring buffers must hand out
+  /// regions this large
+  AudioDecoder(AudioRingBuffer *input_ring_buffer, AudioRingBuffer *output_ring_buffer, size_t internal_buffer_size);
+  /// @brief Decodes straight from memory holding the complete file, such as a media file embedded in the flash,
+  /// instead of from an input ring buffer
+  /// @param input_data the complete file; must stay valid until decoding finishes
+  /// @param input_length size of the file in bytes
+  AudioDecoder(const uint8_t *input_data, size_t input_length, AudioRingBuffer *output_ring_buffer,
                size_t internal_buffer_size);
   ~AudioDecoder();
 
-  esp_err_t start(media_player::MediaFileType media_file_type);
+  /// @param media_file_type format of the incoming data
+  /// @param raw_stream_info format of the samples; only used, and required, for RAW files as they have no header
+  esp_err_t start(media_player::MediaFileType media_file_type,
+                  optional<media_player::StreamInfo> raw_stream_info = {});
 
   AudioDecoderState decode(bool stop_gracefully);
 
   const optional<media_player::StreamInfo> &get_stream_info() const { return this->stream_info_; }
 
+  /// @brief Length of the audio, if the file states it; MP3 files only have it with a Xing or Info header
+  const optional<uint32_t> &get_duration_ms() const { return this->duration_ms_; }
+
+  const AudioStageStats &get_stats() const { return this->stats_; }
+
  protected:
-  esp_err_t allocate_buffers_();
+  /// @brief Output space the current file type needs to be sure a single decoding step fits
+  size_t min_output_bytes_();
 
   FileDecoderState decode_flac_();
   FileDecoderState decode_mp3_();
+  /// @brief Reads the stream info from the first frame's header. If the frame holds a Xing or Info header instead of
+  /// audio, it is parsed for the duration and the LAME tag's encoder delay and padding, then skipped.
+  FileDecoderState start_mp3_();
   FileDecoderState decode_wav_();
+  FileDecoderState decode_raw_();
 
-  esphome::RingBuffer *input_ring_buffer_;
-  esphome::RingBuffer *output_ring_buffer_;
+  /// @brief Bytes of the file not yet parsed that are available to the decoder
+  size_t input_available_();
+
+  // Either the input ring buffer or the complete file in memory is set
+  AudioRingBuffer *input_ring_buffer_{nullptr};
+  const uint8_t *input_data_{nullptr};
+  size_t input_data_length_{0};
+  size_t input_data_consumed_{0};
+
+  AudioRingBuffer *output_ring_buffer_;
   size_t internal_buffer_size_;
 
-  uint8_t *input_buffer_{nullptr};
+  // Region of the input ring buffer being parsed; file decoders advance past the bytes they consume
   uint8_t *input_buffer_current_{nullptr};
   size_t input_buffer_length_;
+  // Input bytes the last file decoder step consumed; a step may consume input and still ask for more
+  size_t input_bytes_consumed_{0};
 
+  // Region of the output ring buffer being decoded into; file decoders set the number of bytes they produce
   uint8_t *output_buffer_{nullptr};
-  uint8_t *output_buffer_current_{nullptr};
+  size_t output_buffer_free_;
   size_t output_buffer_length_;
 
   std::unique_ptr<flac::FLACDecoder> flac_decoder_;
 
   HMP3Decoder mp3_decoder_;
+  // Bytes of an ID3v2 tag left to skip before the first frame
+  size_t mp3_skip_bytes_{0};
+  // Samples per channel left to drop from the start, covering the encoder and decoder delay
+  uint32_t mp3_skip_samples_{0};
+  // Samples per channel left to output before the encoder padding; only known with a LAME tag
+  optional<uint64_t> mp3_samples_left_{};
 
   std::unique_ptr<wav_decoder::WAVDecoder> wav_decoder_;
   size_t wav_bytes_left_;
 
   media_player::MediaFileType media_file_type_{media_player::MediaFileType::NONE};
   optional<media_player::StreamInfo> stream_info_{};
+  optional<uint32_t> duration_ms_{};
 
+  // Attempts in a row that needed more input, without any arriving or any input being consumed
   size_t potentially_failed_count_{0};
   bool end_of_file_{false};
+
+  AudioStageStats stats_;
 };
 }  // namespace nabu
 }  // namespace esphome
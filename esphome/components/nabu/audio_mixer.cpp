@@ -4,6 +4,10 @@
 
 #include "esp_dsp.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include "esphome/core/hal.h"
 #include "esphome/core/helpers.h"
 
@@ -11,19 +15,284 @@ namespace esphome {
 namespace nabu {
 
 static const size_t INPUT_RING_BUFFER_SIZE = 32768;  // Audio samples
-static const size_t BUFFER_SIZE = 9600;              // Audio samples - keep small for fast pausing
+static const size_t BUFFER_SIZE = 9600;              // Audio samples
+static const size_t OUTPUT_RING_BUFFER_SIZE = 8192;  // Bytes - a power of two; keep small for fast pausing
+static const size_t INPUT_REGION_SIZE = 16384;       // Bytes - largest region pipelines resample directly into
 static const size_t QUEUE_COUNT = 20;
+// Channel count changes waiting to be read from a ring buffer; there is at most one per stream
+static const size_t CHANNEL_MARK_COUNT = 8;
+
+// Samples per linear segment of the mixing limiter's gain; also how far it looks ahead
+static const size_t LIMITER_BLOCK_SAMPLES = 64;
+static const int32_t Q30_ONE = DuckingRamp::UNITY_GAIN;
+// Frames per linear segment of the ducking gain while it transitions without an announcement; a 50 dB transition over
+// 1 second at 48 kHz changes by 0.03 dB per segment, so the segments don't deviate audibly from the curve
+static const size_t DUCKING_SEGMENT_FRAMES = 32;
+// Largest limiter gain increase per block; recovering from -6 dB takes about 340 ms for 48 kHz stereo
+static const int32_t LIMITER_RELEASE_STEP = Q30_ONE / 1024;
 
 static const uint32_t TASK_STACK_SIZE = 3072;
+// Longest the task blocks without new audio, space in the output, or a command before checking again
 static const size_t DURATION_TASK_DELAY_MS = 20;
 
-// Gives the Q15 fixed point scaling factor to reduce by 0 dB, 1dB, ..., 50 dB
-// dB to PCM scaling factor formula: floating_point_scale_factor = 2^(-db/6.014)
-// float to Q15 fixed point formula: q15_scale_factor = floating_point_scale_factor * 2^(15)
-static const std::vector<int16_t> decibel_reduction_q15_table = {
-    32767, 29201, 26022, 23189, 20665, 18415, 16410, 14624, 13032, 11613, 10349, 9222, 8218, 7324, 6527, 5816, 5183,
-    4619,  4116,  3668,  3269,  2913,  2596,  2313,  2061,  1837,  1637,  1459,  1300, 1158, 1032, 920,  820,  731,
-    651,   580,   517,   461,   411,   366,   326,   291,   259,   231,   206,   183,  163,  146,  130,  116,  103};
+// Scales samples by a Q15 fixed point factor; input and output may be the same buffer
+static void scale_samples(const int16_t *input, int16_t *output, size_t samples, int16_t q15_factor) {
+#if defined(USE_ESP32_VARIANT_ESP32S3) || defined(USE_ESP32_VARIANT_ESP32)
+  dsps_mulc_s16_ae32(input, output, samples, q15_factor, 1, 1);
+#else
+  dsps_mulc_s16_ansi(input, output, samples, q15_factor, 1, 1);
+#endif
+}
+
+static void scale_samples(const int32_t *input, int32_t *output, size_t samples, int16_t q15_factor) {
+  for (size_t i = 0; i < samples; ++i) {
+    output[i] = static_cast<int32_t>((static_cast<int64_t>(input[i]) * q15_factor) >> 15);
+  }
+}
+
+// Applies a Q30 fixed point gain (at most 1.0) to a sample
+static inline int32_t apply_q30_gain(int16_t sample, int32_t q30_gain) {
+  return (static_cast<int32_t>(sample) * (q30_gain >> 15)) >> 15;
+}
+
+static inline int64_t apply_q30_gain(int32_t sample, int32_t q30_gain) {
+  return (static_cast<int64_t>(sample) * q30_gain) >> 30;
+}
+
+// Scales samples by a Q30 gain that changes by q30_step before every sample, so the last sample gets q30_gain +
+// samples * q30_step; input and output may be the same buffer
+template<typename Sample>
+static void ramp_samples(const Sample *input, Sample *output, size_t samples, int32_t q30_gain, int32_t q30_step) {
+  for (size_t i = 0; i < samples; ++i) {
+    q30_gain += q30_step;
+    output[i] = static_cast<Sample>(apply_q30_gain(input[i], q30_gain));
+  }
+}
+
+// Scales the media samples by the ducking gain; input and output may be the same buffer. A steady gain takes a single
+// call to scale_samples. While transitioning, the gain is evaluated at the ends of each segment of
+// DUCKING_SEGMENT_FRAMES and ramped linearly across it.
+template<typename Sample>
+static void duck_samples(const Sample *input, Sample *output, size_t frames, uint8_t channels,
+                         const DuckingRamp &ducking) {
+  if (!ducking.is_transitioning()) {
+    // Below unity, so the gain fits in Q15
+    scale_samples(input, output, frames * channels, static_cast<int16_t>(ducking.get_gain(0) >> 15));
+    return;
+  }
+
+  int32_t gain = ducking.get_gain(0);
+  for (size_t start = 0; start < frames; start += DUCKING_SEGMENT_FRAMES) {
+    const size_t segment_frames = std::min(DUCKING_SEGMENT_FRAMES, frames - start);
+    const size_t segment_samples = segment_frames * channels;
+    const int32_t next_gain = ducking.get_gain(start + segment_frames);
+    ramp_samples(input + start * channels, output + start * channels, segment_samples, gain,
+                 (next_gain - gain) / static_cast<int32_t>(segment_samples));
+    gain = next_gain;
+  }
+}
+
+// Finds the largest Q30 gain for the media samples, on top of media_q30_factor, that keeps every sum with the
+// announcement samples in range. Samples are counted in the output's channels; a mono stream mixed into stereo output
+// has a shift of 1, so each of its samples is used for both channels of a frame. The smallest ratio of headroom to
+// media magnitude is tracked as a fraction and compared by cross multiplying, so there is a single division per call
+// rather than one per clipped sample.
+// Sample is int16_t or int32_t, and Sum is a type wide enough to add or multiply two of them without overflowing.
+template<typename Sample, typename Sum>
+static int32_t find_limiter_gain(const Sample *media, const Sample *announcement, size_t samples,
+                                 int32_t media_q30_factor, uint8_t media_shift, uint8_t announcement_shift) {
+  const Sum sample_max = std::numeric_limits<Sample>::max();
+  const Sum sample_min = std::numeric_limits<Sample>::min();
+
+  // Most blocks don't clip at all; check that first with a cheaper loop
+  Sum largest_sum = 0;
+  Sum smallest_sum = 0;
+  if (media_q30_factor == Q30_ONE) {
+    for (size_t i = 0; i < samples; ++i) {
+      Sum added_sample = static_cast<Sum>(media[i >> media_shift]) + announcement[i >> announcement_shift];
+      largest_sum = std::max(largest_sum, added_sample);
+      smallest_sum = std::min(smallest_sum, added_sample);
+    }
+  } else {
+    for (size_t i = 0; i < samples; ++i) {
+      Sum added_sample = static_cast<Sum>(apply_q30_gain(media[i >> media_shift], media_q30_factor)) +
+                         announcement[i >> announcement_shift];
+      largest_sum = std::max(largest_sum, added_sample);
+      smallest_sum = std::min(smallest_sum, added_sample);
+    }
+  }
+  if ((largest_sum <= sample_max) && (smallest_sum >= sample_min)) {
+    return Q30_ONE;
+  }
+
+  Sum limit_numerator = 1;
+  Sum limit_denominator = 1;
+  for (size_t i = 0; i < samples; ++i) {
+    Sum media_sample = apply_q30_gain(media[i >> media_shift], media_q30_factor);
+    Sum announcement_sample = announcement[i >> announcement_shift];
+    Sum added_sample = media_sample + announcement_sample;
+
+    // A sum only clips if both samples have the same sign, so scaling the media sample by the ratio of the headroom
+    // left by the announcement sample to the media sample's magnitude brings it back in range
+    bool clips = (added_sample > sample_max) || (added_sample < sample_min);
+    Sum numerator = clips ? sample_max - std::min(std::abs(announcement_sample), sample_max) : 1;
+    Sum denominator = clips ? std::abs(media_sample) : 1;
+
+    bool smaller = numerator * limit_denominator < limit_numerator * denominator;
+    limit_numerator = smaller ? numerator : limit_numerator;
+    limit_denominator = smaller ? denominator : limit_denominator;
+  }
+
+  return static_cast<int32_t>((static_cast<int64_t>(limit_numerator) << 30) / limit_denominator);
+}
+
+// Mixes the media and announcement samples into the output buffer. The announcement is added at full volume, and
+// the media is scaled by the ducking gain and by a limiter gain that avoids clipping the sum. Both gains move linearly
+// across each block of LIMITER_BLOCK_SAMPLES; by the end of a block, the limiter gain is low enough for both that
+// block and the next one, so the gain is already reduced when a peak arrives. It recovers by at most
+// LIMITER_RELEASE_STEP per block. The lookahead_samples after the mixed samples are only examined. Samples and shifts
+// are as for find_limiter_gain; frame_shift converts an output sample index to a frame. Returns the new limiter gain.
+template<typename Sample, typename Sum>
+static int32_t mix_samples(const Sample *media, const Sample *announcement, Sample *output, size_t samples,
+                           size_t lookahead_samples, const DuckingRamp &ducking, int32_t limiter_gain,
+                           uint8_t media_shift, uint8_t announcement_shift, uint8_t frame_shift) {
+  const Sum sample_max = std::numeric_limits<Sample>::max();
+  const Sum sample_min = std::numeric_limits<Sample>::min();
+
+  // While transitioning, a block is checked for clipping with the larger of the ducking gains at its ends
+  const size_t first_block_samples = std::min(LIMITER_BLOCK_SAMPLES, samples + lookahead_samples);
+  int32_t ducking_gain = ducking.get_gain(0);
+  int32_t block_limit = find_limiter_gain<Sample, Sum>(
+      media, announcement, first_block_samples,
+      std::max(ducking_gain, ducking.get_gain(first_block_samples >> frame_shift)), media_shift, announcement_shift);
+
+  for (size_t start = 0; start < samples; start += LIMITER_BLOCK_SAMPLES) {
+    const size_t block_samples = std::min(LIMITER_BLOCK_SAMPLES, samples - start);
+    const size_t next_start = start + block_samples;
+    const size_t next_block_samples = std::min(LIMITER_BLOCK_SAMPLES, samples + lookahead_samples - next_start);
+    const int32_t next_ducking_gain = ducking.get_gain(next_start >> frame_shift);
+
+    int32_t next_block_limit = Q30_ONE;
+    if (next_block_samples > 0) {
+      const int32_t next_block_ducking_gain =
+          std::max(next_ducking_gain, ducking.get_gain((next_start + next_block_samples) >> frame_shift));
+      next_block_limit = find_limiter_gain<Sample, Sum>(
+          media + (next_start >> media_shift), announcement + (next_start >> announcement_shift), next_block_samples,
+          next_block_ducking_gain, media_shift, announcement_shift);
+    }
+
+    int32_t target_gain = std::min({block_limit, next_block_limit, limiter_gain + LIMITER_RELEASE_STEP, Q30_ONE});
+
+    // Ramp the combined media factor rather than the two gains, so each sample needs a single multiply
+    int32_t factor = static_cast<int32_t>((static_cast<int64_t>(limiter_gain) * ducking_gain) >> 30);
+    const int32_t target_factor = static_cast<int32_t>((static_cast<int64_t>(target_gain) * next_ducking_gain) >> 30);
+    const int32_t factor_step = (target_factor - factor) / static_cast<int32_t>(block_samples);
+
+    if ((factor == Q30_ONE) && (factor_step == 0)) {
+      // Neither ducked nor limited, so just add
+      for (size_t i = start; i < next_start; ++i) {
+        Sum added_sample =
+            static_cast<Sum>(media[i >> media_shift]) + static_cast<Sum>(announcement[i >> announcement_shift]);
+        output[i] = static_cast<Sample>(std::max(std::min(added_sample, sample_max), sample_min));
+      }
+    } else {
+      for (size_t i = start; i < next_start; ++i) {
+        factor += factor_step;
+        Sum added_sample = static_cast<Sum>(apply_q30_gain(media[i >> media_shift], factor)) +
+                           static_cast<Sum>(announcement[i >> announcement_shift]);
+        output[i] = static_cast<Sample>(std::max(std::min(added_sample, sample_max), sample_min));
+      }
+    }
+
+    limiter_gain = target_gain;
+    block_limit = next_block_limit;
+    ducking_gain = next_ducking_gain;
+  }
+
+  return limiter_gain;
+}
+
+void DuckingRamp::set_target(float decibel_reduction, size_t transition_frames, DuckingCurve curve) {
+  this->start_reduction_ = this->get_reduction_(this->position_);
+  this->target_reduction_ = decibel_reduction;
+  this->target_gain_ = std::min(static_cast<int32_t>(std::pow(10.0f, -decibel_reduction / 20.0f) * Q30_ONE), Q30_ONE);
+  this->transition_frames_ = transition_frames;
+  this->position_ = 0;
+  this->curve_ = curve;
+}
+
+int32_t DuckingRamp::get_gain(size_t frames) const {
+  const size_t position = this->position_ + frames;
+  if (position >= this->transition_frames_) {
+    return this->target_gain_;
+  }
+  const float gain = std::pow(10.0f, -this->get_reduction_(position) / 20.0f);
+  return std::min(static_cast<int32_t>(gain * Q30_ONE), Q30_ONE);
+}
+
+float DuckingRamp::get_reduction_(size_t frames) const {
+  if (frames >= this->transition_frames_) {
+    return this->target_reduction_;
+  }
+  float progress = static_cast<float>(frames) / this->transition_frames_;
+  if (this->curve_ == DuckingCurve::SMOOTH) {
+    progress = progress * progress * (3.0f - 2.0f * progress);
+  }
+  return this->start_reduction_ + (this->target_reduction_ - this->start_reduction_) * progress;
+}
+
+esp_err_t ChannelTracker::allocate() {
+  if (this->marks_ == nullptr)
+    this->marks_ = xQueueCreate(CHANNEL_MARK_COUNT, sizeof(ChannelMark));
+
+  if (this->marks_ == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+void ChannelTracker::mark(AudioRingBuffer *ring_buffer, uint8_t channels) {
+  if (channels == this->marked_channels_) {
+    return;
+  }
+  ChannelMark mark = {ring_buffer->get_write_position(), channels};
+  xQueueSend(this->marks_, &mark, portMAX_DELAY);
+  this->marked_channels_ = channels;
+}
+
+size_t ChannelTracker::update(AudioRingBuffer *ring_buffer) {
+  while (true) {
+    if (!this->has_next_mark_) {
+      if (xQueueReceive(this->marks_, &this->next_mark_, 0) != pdTRUE) {
+        return SIZE_MAX;
+      }
+      this->has_next_mark_ = true;
+    }
+
+    // Positions wrap, so a mark at or behind the read position, e.g., after a reset, is one whose difference is
+    // larger than the ring buffer could ever hold
+    size_t bytes_until_mark = this->next_mark_.position - ring_buffer->get_read_position();
+    if ((bytes_until_mark > 0) && (bytes_until_mark <= ring_buffer->size())) {
+      return bytes_until_mark;
+    }
+
+    this->channels_ = this->next_mark_.channels;
+    this->has_next_mark_ = false;
+  }
+}
+
+size_t AudioMixer::read(uint8_t *buffer, size_t frames, uint8_t &channels) {
+  // Loaded before the marks, so every byte counted is covered by a mark already queued
+  const size_t available = this->output_ring_buffer_->available();
+  const size_t bytes_until_mark = this->output_channels_.update(this->output_ring_buffer_.get());
+
+  channels = this->output_channels_.get_channels();
+  const size_t frame_bytes = channels * (this->bits_per_sample_ / 8);
+  size_t bytes_to_read = std::min({frames * frame_bytes, available, bytes_until_mark});
+  bytes_to_read -= bytes_to_read % frame_bytes;
+
+  return this->output_ring_buffer_->read((void *) buffer, bytes_to_read) / frame_bytes;
+}
 
 size_t AudioMixer::write_media(uint8_t *buffer, size_t length) {
   size_t free_bytes = this->media_free();
@@ -46,16 +315,16 @@ size_t AudioMixer::write_announcement(uint8_t *buffer, size_t length) {
 
 esp_err_t AudioMixer::allocate_buffers_() {
   if (this->media_ring_buffer_ == nullptr)
-    this->media_ring_buffer_ = RingBuffer::create(INPUT_RING_BUFFER_SIZE);
+    this->media_ring_buffer_ = AudioRingBuffer::create(INPUT_RING_BUFFER_SIZE, INPUT_REGION_SIZE);
 
   if (this->announcement_ring_buffer_ == nullptr)
-    this->announcement_ring_buffer_ = RingBuffer::create(INPUT_RING_BUFFER_SIZE);
+    this->announcement_ring_buffer_ = AudioRingBuffer::create(INPUT_RING_BUFFER_SIZE, INPUT_REGION_SIZE);
 
   if (this->output_ring_buffer_ == nullptr)
-    this->output_ring_buffer_ = RingBuffer::create(BUFFER_SIZE);
+    this->output_ring_buffer_ = AudioRingBuffer::create(OUTPUT_RING_BUFFER_SIZE, 0);
 
   if ((this->output_ring_buffer_ == nullptr) || (this->media_ring_buffer_ == nullptr) ||
-      ((this->output_ring_buffer_ == nullptr))) {
+      (this->announcement_ring_buffer_ == nullptr)) {
     return ESP_ERR_NO_MEM;
   }
 
@@ -78,6 +347,11 @@ esp_err_t AudioMixer::allocate_buffers_() {
     return ESP_ERR_NO_MEM;
   }
 
+  if ((this->output_channels_.allocate() != ESP_OK) || (this->media_channels_.allocate() != ESP_OK) ||
+      (this->announcement_channels_.allocate() != ESP_OK)) {
+    return ESP_ERR_NO_MEM;
+  }
+
   return ESP_OK;
 }
 
@@ -101,7 +375,7 @@ esp_err_t AudioMixer::start(const std::string &task_name, UBaseType_t priority)
 }
 
 void AudioMixer::reset_ring_buffers() {
-  this->output_ring_buffer_->reset();
+  // The output ring buffer is left alone: resetting acts on the consumer side, which belongs to the speaker task
   this->media_ring_buffer_->reset();
   this->announcement_ring_buffer_->reset();
 }
@@ -112,12 +386,15 @@ void AudioMixer::mix_task_(void *params) {
   TaskEvent event;
   CommandEvent command_event;
 
+  // The input streams are read directly from their ring buffers; only the mixed or ducked samples are stored here
   ExternalRAMAllocator<int16_t> allocator(ExternalRAMAllocator<int16_t>::ALLOW_FAILURE);
-  int16_t *media_buffer = allocator.allocate(BUFFER_SIZE);
-  int16_t *announcement_buffer = allocator.allocate(BUFFER_SIZE);
   int16_t *combination_buffer = allocator.allocate(BUFFER_SIZE);
 
-  if ((media_buffer == nullptr) || (announcement_buffer == nullptr)) {
+  // 16 bit samples use the buffer directly; 32 bit samples reinterpret it, so it holds half as many samples
+  const size_t bytes_per_sample = this_mixer->bits_per_sample_ / 8;
+  int32_t *wide_combination_buffer = reinterpret_cast<int32_t *>(combination_buffer);
+
+  if (combination_buffer == nullptr) {
     event.type = EventType::WARNING;
     event.err = ESP_ERR_NO_MEM;
     xQueueSend(this_mixer->event_queue_, &event, portMAX_DELAY);
@@ -139,55 +416,32 @@ void AudioMixer::mix_task_(void *params) {
   // Handles media stream pausing
   bool transfer_media = true;
 
-  // Parameters to control the ducking dB reduction and its transitions
-  // There is a built in negative sign; e.g., reducing by 5 dB is changing the gain by -5 dB
-  int8_t target_ducking_db_reduction = 0;
-  int8_t current_ducking_db_reduction = 0;
+  // Gain applied to the media stream while ducking
+  DuckingRamp ducking;
 
-  // Each step represents a change in 1 dB. Positive 1 means the dB reduction is increasing. Negative 1 means the dB
-  // reduction is decreasing.
-  int8_t db_change_per_ducking_step = 1;
-
-  size_t ducking_transition_samples_remaining = 0;
-  size_t samples_per_ducking_step = 0;
+  // Q30 gain applied to the media stream while mixing to avoid clipping
+  int32_t limiter_gain = Q30_ONE;
 
   while (true) {
-    if (xQueueReceive(this_mixer->command_queue_, &command_event, pdMS_TO_TICKS(DURATION_TASK_DELAY_MS)) == pdTRUE) {
+    bool mixed = false;
+
+    if (xQueueReceive(this_mixer->command_queue_, &command_event, 0) == pdTRUE) {
       if (command_event.command == CommandEventType::STOP) {
         break;
       } else if (command_event.command == CommandEventType::DUCK) {
-        if (target_ducking_db_reduction != command_event.decibel_reduction) {
-          current_ducking_db_reduction = target_ducking_db_reduction;
-
-          target_ducking_db_reduction = command_event.decibel_reduction;
-
-          uint8_t total_ducking_steps = 0;
-          if (target_ducking_db_reduction > current_ducking_db_reduction) {
-            // The dB reduction level is increasing (which results in quiter audio)
-            total_ducking_steps = target_ducking_db_reduction - current_ducking_db_reduction - 1;
-            db_change_per_ducking_step = 1;
-          } else {
-            // The dB reduction level is decreasing (which results in louder audio)
-            total_ducking_steps = current_ducking_db_reduction - target_ducking_db_reduction - 1;
-            db_change_per_ducking_step = -1;
-          }
-          if (total_ducking_steps > 0) {
-            ducking_transition_samples_remaining = command_event.transition_samples;
-
-            samples_per_ducking_step = ducking_transition_samples_remaining / total_ducking_steps;
-          } else {
-            ducking_transition_samples_remaining = 0;
-          }
-        }
+        ducking.set_target(command_event.decibel_reduction, command_event.transition_frames,
+                           command_event.ducking_curve);
       } else if (command_event.command == CommandEventType::PAUSE_MEDIA) {
         transfer_media = false;
       } else if (command_event.command == CommandEventType::RESUME_MEDIA) {
         transfer_media = true;
       } else if (command_event.command == CommandEventType::CLEAR_MEDIA) {
-        ducking_transition_samples_remaining = 0;  // Reset ducking to the target level
+        ducking.finish();  // Reset ducking to the target level
         this_mixer->media_ring_buffer_->reset();
+        this_mixer->media_clears_.fetch_add(1, std::memory_order_release);
       } else if (command_event.command == CommandEventType::CLEAR_ANNOUNCEMENT) {
         this_mixer->announcement_ring_buffer_->reset();
+        this_mixer->announcement_clears_.fetch_add(1, std::memory_order_release);
       }
     }
 
@@ -195,171 +449,140 @@ void AudioMixer::mix_task_(void *params) {
     size_t announcement_available = this_mixer->announcement_ring_buffer_->available();
     size_t output_free = this_mixer->output_ring_buffer_->free();
 
-    if ((output_free > 0) && (media_available * transfer_media + announcement_available > 0)) {
-      size_t bytes_to_read = std::min(output_free, BUFFER_SIZE);
+    // Loaded after the fill levels, so every byte counted is covered by a mark already applied or pending
+    const size_t media_bytes_until_mark = this_mixer->media_channels_.update(this_mixer->media_ring_buffer_.get());
+    const size_t announcement_bytes_until_mark =
+        this_mixer->announcement_channels_.update(this_mixer->announcement_ring_buffer_.get());
 
-      if (media_available * transfer_media > 0) {
-        bytes_to_read = std::min(bytes_to_read, media_available);
-      }
+    const bool read_media = transfer_media && (media_available > 0);
+    const bool read_announcement = (announcement_available > 0);
 
-      if (announcement_available > 0) {
-        bytes_to_read = std::min(bytes_to_read, announcement_available);
-      }
+    if ((output_free > 0) && (read_media || read_announcement)) {
+      const uint8_t media_channels = this_mixer->media_channels_.get_channels();
+      const uint8_t announcement_channels = this_mixer->announcement_channels_.get_channels();
 
-      if (bytes_to_read > 0) {
-        size_t media_bytes_read = 0;
-        if (media_available * transfer_media > 0) {
-          media_bytes_read = this_mixer->media_ring_buffer_->read((void *) media_buffer, bytes_to_read, 0);
-          if (media_bytes_read > 0) {
-            size_t samples_read = media_bytes_read / sizeof(int16_t);
-            if (ducking_transition_samples_remaining > 0) {
-              // Ducking level is still transitioning
-
-              size_t samples_left = ducking_transition_samples_remaining;
-
-              int16_t *current_media_buffer = media_buffer;
-              int16_t *current_combination_buffer = combination_buffer;
-
-              size_t samples_left_in_step = samples_left % samples_per_ducking_step;
-              if (samples_left_in_step == 0) {
-                // Start of a new step
-                current_ducking_db_reduction += db_change_per_ducking_step;
-                samples_left_in_step = samples_per_ducking_step;
-              }
-              size_t samples_left_to_duck = std::min(samples_left_in_step, samples_read);
-
-              size_t total_samples_ducked = 0;
-
-              while (samples_left_to_duck > 0) {
-                // Ensure we only point to valid index for our Q15 int16 scaling factor table
-                uint8_t safe_db_reduction_index =
-                    clamp<uint8_t>(current_ducking_db_reduction, 0, decibel_reduction_q15_table.size() - 1);
-#if defined(USE_ESP32_VARIANT_ESP32S3) || defined(USE_ESP32_VARIANT_ESP32)
-                dsps_mulc_s16_ae32(current_media_buffer, current_combination_buffer, samples_left_to_duck,
-                                   decibel_reduction_q15_table[safe_db_reduction_index], 1, 1);
-#else
-                dsps_mulc_s16_ansi(current_media_buffer, current_combination_buffer, samples_left_to_duck,
-                                   decibel_reduction_q15_table[safe_db_reduction_index], 1, 1);
-#endif
-                current_media_buffer += samples_left_to_duck;
-                current_combination_buffer += samples_left_to_duck;
+      // The output is only stereo if a stream being read is; a mono stream mixed into stereo is used for both channels
+      const uint8_t output_channels =
+          std::max<uint8_t>(read_media ? media_channels : 1, read_announcement ? announcement_channels : 1);
+      const uint8_t media_shift = (output_channels > media_channels) ? 1 : 0;
+      const uint8_t announcement_shift = (output_channels > announcement_channels) ? 1 : 0;
 
-                samples_read -= samples_left_to_duck;
-                samples_left -= samples_left_to_duck;
+      const size_t media_frame_bytes = media_channels * bytes_per_sample;
+      const size_t announcement_frame_bytes = announcement_channels * bytes_per_sample;
+      const size_t output_frame_bytes = output_channels * bytes_per_sample;
 
-                total_samples_ducked += samples_left_to_duck;
+      size_t frames_to_read = std::min(output_free, BUFFER_SIZE) / output_frame_bytes;
 
-                samples_left_in_step = samples_left % samples_per_ducking_step;
-                if (samples_left_in_step == 0) {
-                  // Start of a new step
-                  current_ducking_db_reduction += db_change_per_ducking_step;
-                  samples_left_in_step = samples_per_ducking_step;
-                }
-                samples_left_to_duck = std::min(samples_left_in_step, samples_read);
-              }
+      // A region never crosses a mark, as the bytes after it have a different channel count
+      size_t media_readable = 0;
+      if (read_media) {
+        media_readable = std::min(media_available, media_bytes_until_mark);
+        frames_to_read = std::min(frames_to_read, media_readable / media_frame_bytes);
+      }
 
-              std::memcpy((void *) media_buffer, (void *) combination_buffer, total_samples_ducked * sizeof(int16_t));
-            } else if (target_ducking_db_reduction > 0) {
-              // Ducking reduction, but we are done transitioning
-              uint8_t safe_db_reduction_index =
-                  clamp<uint8_t>(target_ducking_db_reduction, 0, decibel_reduction_q15_table.size() - 1);
+      size_t announcement_readable = 0;
+      if (read_announcement) {
+        announcement_readable = std::min(announcement_available, announcement_bytes_until_mark);
+        frames_to_read = std::min(frames_to_read, announcement_readable / announcement_frame_bytes);
+      }
 
-#if defined(USE_ESP32_VARIANT_ESP32S3) || defined(USE_ESP32_VARIANT_ESP32)
-              dsps_mulc_s16_ae32(media_buffer, combination_buffer, samples_read,
-                                 decibel_reduction_q15_table[safe_db_reduction_index], 1, 1);
-#else
-              dsps_mulc_s16_ansi(media_buffer, combination_buffer, samples_read,
-                                 decibel_reduction_q15_table[safe_db_reduction_index], 1, 1);
-#endif
-              std::memcpy((void *) media_buffer, (void *) combination_buffer, media_bytes_read);
-            }
-          }
+      if (frames_to_read > 0) {
+        // Queued before the frames are written, like the pipelines do for the input ring buffers
+        this_mixer->output_channels_.mark(this_mixer->output_ring_buffer_.get(), output_channels);
+
+        // Regions extend past the frames to read when possible, so the limiter can look ahead
+        const size_t lookahead_frames = LIMITER_BLOCK_SAMPLES / output_channels;
+
+        uint8_t *media_region = nullptr;
+        size_t media_region_length = 0;
+        if (read_media) {
+          media_region_length = this_mixer->media_ring_buffer_->acquire_read(
+              &media_region, std::min((frames_to_read + lookahead_frames) * media_frame_bytes, media_readable));
         }
 
-        size_t announcement_bytes_read = 0;
-        if (announcement_available > 0) {
-          announcement_bytes_read =
-              this_mixer->announcement_ring_buffer_->read((void *) announcement_buffer, bytes_to_read, 0);
+        uint8_t *announcement_region = nullptr;
+        size_t announcement_region_length = 0;
+        if (read_announcement) {
+          announcement_region_length = this_mixer->announcement_ring_buffer_->acquire_read(
+              &announcement_region,
+              std::min((frames_to_read + lookahead_frames) * announcement_frame_bytes, announcement_readable));
         }
 
-        size_t bytes_written = 0;
-        if ((media_bytes_read > 0) && (announcement_bytes_read > 0)) {
-          // We have both a media and an announcement stream, so mix them together
-
-          size_t samples_read = bytes_to_read / sizeof(int16_t);
-
-          // We first test adding the two clips samples together and check for any clipping
-          // We want the announcement volume to be consistent, regardless if media is playing or not
-          // If there is clipping, we determine what factor we need to multiply that media sample by to avoid it
-          // We take the smallest factor necessary for all the samples so the media volume is consistent on this batch
-          // of samples
-          // Note: This may not be the best approach. Adding 2 audio samples together makes both sound louder, even if
-          // we are not clipping. As a result, the mixed announcement will sound louder (by around 3dB if the audio
-          // streams are independent?) than if it were by itself.
-          int16_t q15_scaling_factor = INT16_MAX;
-          for (int i = 0; i < samples_read; ++i) {
-            int32_t added_sample = static_cast<int32_t>(media_buffer[i]) + static_cast<int32_t>(announcement_buffer[i]);
-
-            if ((added_sample > INT16_MAX) || (added_sample < INT16_MIN)) {
-              // This is the largest magnitude the media sample can be to avoid clipping (converted to Q30 fixed point)
-              int32_t q30_media_sample_safe_max = static_cast<int32_t>(INT16_MAX - std::abs(announcement_buffer[i]))
-                                                  << 15;
-
-              // This is the actual media sample value (converted to Q30 fixed point)
-              int32_t media_sample_value = media_buffer[i];
-
-              // This is calculation performs the Q15 division for media_sample_safe_max/media_sample_value
-              // Reference: https://sestevenson.wordpress.com/2010/09/20/fixed-point-division-2/ (accessed August 15,
-              // 2024)
-              int16_t necessary_q15_factor = static_cast<int16_t>(q30_media_sample_safe_max / media_sample_value);
-              // Take the minimum scaling factor (the smaller the factor, the more it needs to be scaled down)
-              q15_scaling_factor = std::min(necessary_q15_factor, q15_scaling_factor);
-            } else {
-              // Store the combined samples in the combination buffer. If we do not need to scale, then we will already
-              // be done after the loop finishes
-              combination_buffer[i] = added_sample;
-            }
+        // The ducking gain is applied in the same pass that mixes or copies the media, changing every sample while
+        // it transitions
+        bool combined = false;
+        if ((media_region != nullptr) && (announcement_region != nullptr)) {
+          // Mix both streams, looking ahead as far as both regions allow
+          const size_t region_frames =
+              std::min(media_region_length / media_frame_bytes, announcement_region_length / announcement_frame_bytes);
+          const size_t lookahead_samples = (region_frames - frames_to_read) * output_channels;
+          const size_t samples = frames_to_read * output_channels;
+          const uint8_t frame_shift = output_channels - 1;
+
+          if (bytes_per_sample == sizeof(int16_t)) {
+            limiter_gain = mix_samples<int16_t, int32_t>(
+                reinterpret_cast<const int16_t *>(media_region), reinterpret_cast<const int16_t *>(announcement_region),
+                combination_buffer, samples, lookahead_samples, ducking, limiter_gain, media_shift, announcement_shift,
+                frame_shift);
+          } else {
+            limiter_gain = mix_samples<int32_t, int64_t>(
+                reinterpret_cast<const int32_t *>(media_region), reinterpret_cast<const int32_t *>(announcement_region),
+                wide_combination_buffer, samples, lookahead_samples, ducking, limiter_gain, media_shift,
+                announcement_shift, frame_shift);
           }
-
-          if (q15_scaling_factor < INT16_MAX) {
-            // Need to scale to avoid clipping
-
-            // Scale the media samples and temporarily store them in the combination buffer
-#if defined(USE_ESP32_VARIANT_ESP32S3) || defined(USE_ESP32_VARIANT_ESP32)
-            dsps_mulc_s16_ae32(media_buffer, combination_buffer, samples_read, q15_scaling_factor, 1, 1);
-#else
-            dsps_mulc_s16_ansi(media_buffer, combination_buffer, samples_read, q15_scaling_factor, 1, 1);
-#endif
-
-            // Move the scaled media samples back into the media befure
-            std::memcpy((void *) media_buffer, (void *) combination_buffer, media_bytes_read);
-
-            // Add together both streams, with no bitshift
-            // (input buffer 1, input buffer 2, output buffer, length, input buffer 1 step, input buffer 2 step, output
-            // buffer step, bitshift)
-
-#if defined(USE_ESP32_VARIANT_ESP32S3)
-            dsps_add_s16_aes3(media_buffer, announcement_buffer, combination_buffer, samples_read, 1, 1, 1, 0);
-#elif defined(USE_ESP32_VARIANT_ESP32)
-            dsps_add_s16_ae32(media_buffer, announcement_buffer, combination_buffer, samples_read, 1, 1, 1, 0);
-#else
-            dsps_add_s16_ansi(media_buffer, announcement_buffer, combination_buffer, samples_read, 1, 1, 1, 0);
-#endif
+          combined = true;
+        } else if ((media_region != nullptr) && !ducking.is_unity()) {
+          // Without an announcement, the output has the media's channels
+          if (bytes_per_sample == sizeof(int16_t)) {
+            duck_samples(reinterpret_cast<const int16_t *>(media_region), combination_buffer, frames_to_read,
+                         media_channels, ducking);
+          } else {
+            duck_samples(reinterpret_cast<const int32_t *>(media_region), wide_combination_buffer, frames_to_read,
+                         media_channels, ducking);
           }
+          combined = true;
+        }
 
-          bytes_written = this_mixer->output_ring_buffer_->write((void *) combination_buffer, bytes_to_read);
-        } else if (media_bytes_read > 0) {
-          bytes_written = this_mixer->output_ring_buffer_->write((void *) media_buffer, media_bytes_read);
+        if (announcement_region == nullptr) {
+          // The limiter isn't needed without an announcement; start the next one without any reduction
+          limiter_gain = Q30_ONE;
+        }
 
-        } else if (announcement_bytes_read > 0) {
-          bytes_written = this_mixer->output_ring_buffer_->write((void *) announcement_buffer, announcement_bytes_read);
+        // Unmodified streams are written straight from their ring buffer regions
+        size_t bytes_written = 0;
+        if (combined) {
+          bytes_written =
+              this_mixer->output_ring_buffer_->write((void *) combination_buffer, frames_to_read * output_frame_bytes);
+        } else if (media_region != nullptr) {
+          bytes_written =
+              this_mixer->output_ring_buffer_->write((void *) media_region, frames_to_read * output_frame_bytes);
+        } else if (announcement_region != nullptr) {
+          bytes_written =
+              this_mixer->output_ring_buffer_->write((void *) announcement_region, frames_to_read * output_frame_bytes);
         }
 
-        size_t samples_written = bytes_written / sizeof(int16_t);
-        if (ducking_transition_samples_remaining > 0) {
-          ducking_transition_samples_remaining -= std::min(samples_written, ducking_transition_samples_remaining);
+        const size_t frames_written = bytes_written / output_frame_bytes;
+        if (media_region != nullptr) {
+          this_mixer->media_ring_buffer_->commit_read(frames_written * media_frame_bytes);
+        }
+        if (announcement_region != nullptr) {
+          this_mixer->announcement_ring_buffer_->commit_read(frames_written * announcement_frame_bytes);
         }
+
+        ducking.advance(frames_written);
+
+        mixed = (bytes_written > 0);
+      }
+    }
+
+    if (!mixed && (uxQueueMessagesWaiting(this_mixer->command_queue_) == 0)) {
+      // Block until either stream has more audio, the speaker reads from the output, or a command is sent
+      this_mixer->output_ring_buffer_->notify_when_free(output_free + 1);
+      if (transfer_media) {
+        this_mixer->media_ring_buffer_->notify_when_available(media_available + 1);
       }
+      this_mixer->announcement_ring_buffer_->notify_when_available(announcement_available + 1);
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DURATION_TASK_DELAY_MS));
     }
   }
 
@@ -367,8 +590,6 @@ void AudioMixer::mix_task_(void *params) {
   xQueueSend(this_mixer->event_queue_, &event, portMAX_DELAY);
 
   this_mixer->reset_ring_buffers();
-  allocator.deallocate(media_buffer, BUFFER_SIZE);
-  allocator.deallocate(announcement_buffer, BUFFER_SIZE);
   allocator.deallocate(combination_buffer, BUFFER_SIZE);
 
   event.type = EventType::STOPPED;
@@ -2,15 +2,19 @@
 
 #ifdef USE_ESP_IDF
 
+#include "audio_ring_buffer.h"
+
 #include "esphome/components/media_player/media_player.h"
 
 #include "esphome/core/hal.h"
 #include "esphome/core/helpers.h"
-#include "esphome/core/ring_buffer.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 
+#include <algorithm>
+#include <atomic>
+
 namespace esphome {
 namespace nabu {
 
@@ -39,10 +43,91 @@ enum class CommandEventType : uint8_t {
   CLEAR_ANNOUNCEMENT,
 };
 
+enum class DuckingCurve : uint8_t {
+  LINEAR = 0,  // Changes the reduction by the same number of dB every second
+  SMOOTH,      // Eases in and out of the change, so the gain's slope never jumps
+};
+
 struct CommandEvent {
   CommandEventType command;
-  uint8_t decibel_reduction;
-  size_t transition_samples = 0;
+  float decibel_reduction;
+  size_t transition_frames = 0;
+  DuckingCurve ducking_curve = DuckingCurve::LINEAR;
+};
+
+/// @brief Follows the gain that ducks the media stream as it moves from one reduction to another.
+///
+/// The reduction follows the transition's curve in dB. Callers evaluate the gain every few dozen frames and interpolate
+/// linearly in between, so the gain changes a little every sample rather than in audible 1 dB steps. Starting a new
+/// transition during another continues from the current reduction.
+class DuckingRamp {
+ public:
+  /// @brief Starts moving from the current reduction to decibel_reduction over transition_frames
+  void set_target(float decibel_reduction, size_t transition_frames, DuckingCurve curve);
+
+  /// @brief Jumps to the end of any transition
+  void finish() { this->position_ = this->transition_frames_; }
+
+  /// @brief Moves the current position forward by frames
+  void advance(size_t frames) { this->position_ = std::min(this->position_ + frames, this->transition_frames_); }
+
+  bool is_transitioning() const { return this->position_ < this->transition_frames_; }
+
+  /// @brief Whether the media plays at full volume until the next transition
+  bool is_unity() const { return !this->is_transitioning() && (this->target_gain_ == UNITY_GAIN); }
+
+  /// @brief Gain frames after the current position, in Q30 fixed point
+  int32_t get_gain(size_t frames) const;
+
+  static const int32_t UNITY_GAIN = 1 << 30;
+
+ protected:
+  /// @brief Reduction in dB frames into the transition
+  float get_reduction_(size_t frames) const;
+
+  float start_reduction_{0.0f};
+  float target_reduction_{0.0f};
+  int32_t target_gain_{UNITY_GAIN};
+  size_t transition_frames_{0};
+  size_t position_{0};
+  DuckingCurve curve_{DuckingCurve::LINEAR};
+};
+
+/// @brief Follows the channel count of the audio in a ring buffer, which changes from stream to stream.
+///
+/// Mono audio is kept mono through the ring buffers, so the count travels alongside the bytes: the producer marks
+/// the position where audio with a new count starts, and the consumer applies each mark once its reads reach it.
+/// Marks are passed through a queue, and each is queued before any of the bytes it describes are written, so a
+/// consumer that loads the fill level before calling update never reads past a mark it hasn't seen.
+class ChannelTracker {
+ public:
+  esp_err_t allocate();
+
+  /// @brief Marks that the bytes written to ring_buffer from now on have channels channels. Producer only.
+  void mark(AudioRingBuffer *ring_buffer, uint8_t channels);
+
+  /// @brief Applies the marks the read position has reached. Consumer only.
+  /// @return the number of bytes that can be read before the next mark; SIZE_MAX if there is none
+  size_t update(AudioRingBuffer *ring_buffer);
+
+  /// @brief Channel count of the next bytes to read, as of the last update
+  uint8_t get_channels() const { return this->channels_; }
+
+ protected:
+  struct ChannelMark {
+    size_t position;  // Ring buffer write position of the first byte with the new count
+    uint8_t channels;
+  };
+
+  QueueHandle_t marks_{nullptr};
+
+  // Owned by the producer
+  uint8_t marked_channels_{2};
+
+  // Owned by the consumer
+  ChannelMark next_mark_;
+  bool has_next_mark_{false};
+  uint8_t channels_{2};
 };
 
 class AudioMixer {
@@ -51,11 +136,15 @@ class AudioMixer {
   size_t available() { return this->output_ring_buffer_->available(); }
 
   BaseType_t send_command(CommandEvent *command, TickType_t ticks_to_wait = portMAX_DELAY) {
-    return xQueueSend(this->command_queue_, command, ticks_to_wait);
+    BaseType_t sent = xQueueSend(this->command_queue_, command, ticks_to_wait);
+    this->wake_task_();
+    return sent;
   }
 
   BaseType_t send_command_to_front(CommandEvent *command, TickType_t ticks_to_wait = portMAX_DELAY) {
-    return xQueueSendToFront(this->command_queue_, command, ticks_to_wait);
+    BaseType_t sent = xQueueSendToFront(this->command_queue_, command, ticks_to_wait);
+    this->wake_task_();
+    return sent;
   }
 
   BaseType_t read_event(TaskEvent *event, TickType_t ticks_to_wait = 0) {
@@ -64,6 +153,11 @@ class AudioMixer {
 
   esp_err_t start(const std::string &task_name, UBaseType_t priority = 1);
 
+  /// @brief Sets the size of the samples in the input and output ring buffers. Must be set before starting.
+  /// @param bits_per_sample either 16 or 32 bits
+  void set_bits_per_sample(uint8_t bits_per_sample) { this->bits_per_sample_ = bits_per_sample; }
+  uint8_t get_bits_per_sample() const { return this->bits_per_sample_; }
+
   void stop() {
     vTaskDelete(this->task_handle_);
     this->task_handle_ = nullptr;
@@ -74,21 +168,28 @@ class AudioMixer {
 
   void reset_ring_buffers();
 
+  /// @brief Sets the channel count of the audio written to the media ring buffer from now on. Call before writing
+  /// the first samples of a stream.
+  /// @param channels 1 for mono or 2 for interleaved stereo
+  void set_media_channels(uint8_t channels) { this->media_channels_.mark(this->media_ring_buffer_.get(), channels); }
+
+  /// @brief Sets the channel count of the audio written to the announcement ring buffer from now on. Call before
+  /// writing the first samples of a stream.
+  /// @param channels 1 for mono or 2 for interleaved stereo
+  void set_announcement_channels(uint8_t channels) {
+    this->announcement_channels_.mark(this->announcement_ring_buffer_.get(), channels);
+  }
+
   size_t media_free() { return this->media_ring_buffer_->free(); }
   size_t announcement_free() { return this->announcement_ring_buffer_->free(); }
 
-  /// @brief Reads from the output ring buffer
-  /// @param buffer stores the read data
-  /// @param length how many bytes requested to read from the ring buffer
-  /// @return number of bytes actually read; will be less than length if not available in ring buffer
-  size_t read(uint8_t *buffer, size_t length, TickType_t ticks_to_wait = 0) {
-    size_t available_bytes = this->available();
-    size_t bytes_to_read = std::min(length, available_bytes);
-    if (bytes_to_read > 0) {
-      return this->output_ring_buffer_->read((void *) buffer, bytes_to_read, ticks_to_wait);
-    }
-    return 0;
-  }
+  /// @brief Reads mixed audio from the output ring buffer. The output is mono while every stream playing is mono, so
+  /// all frames read at once have the same channel count, and mono frames are left for the caller to expand.
+  /// @param buffer stores the read data; must have room for frames stereo frames
+  /// @param frames the most frames to read
+  /// @param channels set to the channel count of the frames read; 1 or 2
+  /// @return number of frames actually read; will be less than frames if not available in ring buffer
+  size_t read(uint8_t *buffer, size_t frames, uint8_t &channels);
 
   size_t write_media(uint8_t *buffer, size_t length);
   size_t write_announcement(uint8_t *buffer, size_t length);
@@ -100,26 +201,48 @@ class AudioMixer {
     return xQueueReceive(this->announcement_event_queue_, event, ticks_to_wait);
   }
 
-  RingBuffer *get_media_ring_buffer() { return this->media_ring_buffer_.get(); }
-  RingBuffer *get_announcement_ring_buffer() { return this->announcement_ring_buffer_.get(); }
+  AudioRingBuffer *get_media_ring_buffer() { return this->media_ring_buffer_.get(); }
+  AudioRingBuffer *get_announcement_ring_buffer() { return this->announcement_ring_buffer_.get(); }
+
+  /// @brief Number of CLEAR_MEDIA commands the mixing task has carried out. Once it passes the count from before a
+  /// command was sent, that command can no longer discard audio written to the media ring buffer.
+  uint32_t get_media_clears() const { return this->media_clears_.load(std::memory_order_acquire); }
+  /// @brief Number of CLEAR_ANNOUNCEMENT commands the mixing task has carried out
+  uint32_t get_announcement_clears() const { return this->announcement_clears_.load(std::memory_order_acquire); }
 
  protected:
   esp_err_t allocate_buffers_();
 
+  /// @brief Wakes the mixing task if it is blocked waiting for audio, output space, or a command
+  void wake_task_() {
+    if (this->task_handle_ != nullptr) {
+      xTaskNotifyGive(this->task_handle_);
+    }
+  }
+
   static void mix_task_(void *params);
   TaskHandle_t task_handle_{nullptr};
   StaticTask_t task_stack_;
   StackType_t *stack_buffer_{nullptr};
 
-  std::unique_ptr<RingBuffer> output_ring_buffer_;
+  std::unique_ptr<AudioRingBuffer> output_ring_buffer_;
   QueueHandle_t event_queue_;
   QueueHandle_t command_queue_;
 
-  std::unique_ptr<RingBuffer> media_ring_buffer_;
-  std::unique_ptr<RingBuffer> announcement_ring_buffer_;
+  std::unique_ptr<AudioRingBuffer> media_ring_buffer_;
+  std::unique_ptr<AudioRingBuffer> announcement_ring_buffer_;
+
+  ChannelTracker output_channels_;
+  ChannelTracker media_channels_;
+  ChannelTracker announcement_channels_;
 
   QueueHandle_t media_event_queue_;
   QueueHandle_t announcement_event_queue_;
+
+  std::atomic<uint32_t> media_clears_{0};
+  std::atomic<uint32_t> announcement_clears_{0};
+
+  uint8_t bits_per_sample_{16};
 };
 }  // namespace nabu
 }  // namespace esphome
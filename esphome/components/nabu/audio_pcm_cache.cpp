@@ -0,0 +1,131 @@
+#ifdef USE_ESP_IDF
+
+#include "audio_pcm_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace nabu {
+
+// Starting capacity of a capture; grows by doubling
+static const size_t INITIAL_CAPTURE_BYTES = 16384;
+
+CachedPcm::~CachedPcm() {
+  if (this->data != nullptr) {
+    ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+    allocator.deallocate(this->data, this->capacity);
+  }
+}
+
+PcmCapture::PcmCapture(const media_player::MediaFile *media_file, uint32_t sample_rate, uint8_t bits_per_sample,
+                       uint8_t channels, size_t max_length)
+    : max_length_(max_length) {
+  this->pcm_ = std::make_shared<CachedPcm>();
+  this->pcm_->media_file = media_file;
+  this->pcm_->sample_rate = sample_rate;
+  this->pcm_->bits_per_sample = bits_per_sample;
+  this->pcm_->channels = channels;
+}
+
+void PcmCapture::append(const uint8_t *data, size_t length) {
+  if (this->pcm_ == nullptr) {
+    return;
+  }
+
+  CachedPcm &pcm = *this->pcm_;
+  const size_t required = pcm.length + length;
+  if (required > this->max_length_) {
+    this->pcm_.reset();
+    return;
+  }
+
+  if (required > pcm.capacity) {
+    size_t capacity = std::max(pcm.capacity, INITIAL_CAPTURE_BYTES);
+    while (capacity < required) {
+      capacity *= 2;
+    }
+    capacity = std::min(capacity, this->max_length_);
+
+    ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+    uint8_t *data_grown = allocator.allocate(capacity);
+    if (data_grown == nullptr) {
+      this->pcm_.reset();
+      return;
+    }
+    if (pcm.data != nullptr) {
+      std::memcpy(data_grown, pcm.data, pcm.length);
+      allocator.deallocate(pcm.data, pcm.capacity);
+    }
+    pcm.data = data_grown;
+    pcm.capacity = capacity;
+  }
+
+  std::memcpy(pcm.data + pcm.length, data, length);
+  pcm.length = required;
+}
+
+std::shared_ptr<const CachedPcm> AudioPcmCache::find(const media_player::MediaFile *media_file, uint32_t sample_rate,
+                                                     uint8_t bits_per_sample) {
+  LockGuard guard(this->lock_);
+
+  for (Entry &entry : this->entries_) {
+    if ((entry.pcm->media_file == media_file) && (entry.pcm->sample_rate == sample_rate) &&
+        (entry.pcm->bits_per_sample == bits_per_sample)) {
+      entry.last_used = ++this->use_counter_;
+      return entry.pcm;
+    }
+  }
+
+  return nullptr;
+}
+
+std::unique_ptr<PcmCapture> AudioPcmCache::start_capture(const media_player::MediaFile *media_file,
+                                                         uint32_t sample_rate, uint8_t bits_per_sample,
+                                                         uint8_t channels) {
+  if (this->max_bytes_ == 0) {
+    return nullptr;
+  }
+  return make_unique<PcmCapture>(media_file, sample_rate, bits_per_sample, channels, this->max_bytes_);
+}
+
+void AudioPcmCache::insert(std::shared_ptr<CachedPcm> pcm) {
+  // Entries are charged for their allocated capacity, so the cap bounds the actual memory used
+  if ((pcm == nullptr) || (pcm->length == 0) || (pcm->capacity > this->max_bytes_)) {
+    return;
+  }
+
+  // Evicted entries are only released after the lock is dropped, as freeing them may take a while
+  std::vector<std::shared_ptr<CachedPcm>> evicted;
+
+  {
+    LockGuard guard(this->lock_);
+
+    auto existing = std::find_if(this->entries_.begin(), this->entries_.end(), [&pcm](const Entry &entry) {
+      return (entry.pcm->media_file == pcm->media_file) && (entry.pcm->sample_rate == pcm->sample_rate) &&
+             (entry.pcm->bits_per_sample == pcm->bits_per_sample);
+    });
+    if (existing != this->entries_.end()) {
+      this->used_bytes_ -= existing->pcm->capacity;
+      evicted.push_back(std::move(existing->pcm));
+      this->entries_.erase(existing);
+    }
+
+    while (this->used_bytes_ + pcm->capacity > this->max_bytes_) {
+      auto least_recent = std::min_element(
+          this->entries_.begin(), this->entries_.end(),
+          [](const Entry &a, const Entry &b) { return (int32_t) (a.last_used - b.last_used) < 0; });
+      this->used_bytes_ -= least_recent->pcm->capacity;
+      evicted.push_back(std::move(least_recent->pcm));
+      this->entries_.erase(least_recent);
+    }
+
+    this->used_bytes_ += pcm->capacity;
+    this->entries_.push_back({std::move(pcm), ++this->use_counter_});
+  }
+}
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+
+#ifdef USE_ESP_IDF
+
+#include "esphome/components/media_player/media_player.h"
+
+#include "esphome/core/helpers.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace esphome {
+namespace nabu {
+
+/// @brief A media file fully decoded and resampled to the mixer's format, ready to copy into a mixer ring buffer
+struct CachedPcm {
+  ~CachedPcm();
+
+  const media_player::MediaFile *media_file;
+  uint32_t sample_rate;
+  uint8_t bits_per_sample;
+  uint8_t channels;  // The file's own channel count; mono is kept mono
+
+  uint8_t *data{nullptr};
+  size_t length{0};
+  size_t capacity{0};
+};
+
+/// @brief Collects the resampled output of a pipeline while it plays a media file, so the result can be cached.
+class PcmCapture {
+ public:
+  PcmCapture(const media_player::MediaFile *media_file, uint32_t sample_rate, uint8_t bits_per_sample,
+             uint8_t channels, size_t max_length);
+
+  /// @brief Appends audio to the capture. Once the audio outgrows the maximum length or an allocation fails, the
+  /// captured audio is dropped and further appends are ignored.
+  void append(const uint8_t *data, size_t length);
+
+  /// @brief Hands over the captured audio
+  /// @return the audio or nullptr if the capture was dropped
+  std::shared_ptr<CachedPcm> release() { return std::move(this->pcm_); }
+
+ protected:
+  std::shared_ptr<CachedPcm> pcm_;
+  size_t max_length_;
+};
+
+/// @brief Least recently used cache of fully decoded and resampled media files, with a cap on its memory.
+///
+/// Repeat plays of short local sounds, such as the wake sound, are copied straight from the cache into the mixer
+/// without running the reader, decoder, and resampler. Entries are shared, so an entry evicted while playing stays
+/// allocated until playback finishes. All functions are safe to call from any task.
+class AudioPcmCache {
+ public:
+  /// @param max_bytes the most memory held across all entries; 0 disables caching
+  explicit AudioPcmCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+  /// @brief Looks up a media file decoded for the given output format and marks it as recently used
+  /// @return the cached audio or nullptr if it isn't cached
+  std::shared_ptr<const CachedPcm> find(const media_player::MediaFile *media_file, uint32_t sample_rate,
+                                        uint8_t bits_per_sample);
+
+  /// @brief Starts collecting the output of a pipeline playing a media file that isn't cached yet
+  /// @return the capture or nullptr if the cache can't hold the file
+  std::unique_ptr<PcmCapture> start_capture(const media_player::MediaFile *media_file, uint32_t sample_rate,
+                                            uint8_t bits_per_sample, uint8_t channels);
+
+  /// @brief Adds completely captured audio, evicting the least recently used entries until it fits. Replaces an
+  /// existing entry for the same media file and format.
+  void insert(std::shared_ptr<CachedPcm> pcm);
+
+  size_t get_used_bytes() const { return this->used_bytes_; }
+
+ protected:
+  struct Entry {
+    std::shared_ptr<CachedPcm> pcm;
+    uint32_t last_used;
+  };
+
+  Mutex lock_;
+  std::vector<Entry> entries_;
+  uint32_t use_counter_{0};
+  size_t used_bytes_{0};
+  size_t max_bytes_;
+};
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -5,24 +5,78 @@
 #include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
 
+#include <algorithm>
+
 namespace esphome {
 namespace nabu {
 
 static const size_t QUEUE_COUNT = 10;
 
 static const size_t HTTP_BUFFER_SIZE = 64 * 1024;
+// Largest region a stage parses from or decodes into at once; bounds a single compressed or decoded frame
+static const size_t MAX_FRAME_SIZE = 64 * 1024;
 static const size_t BUFFER_SIZE_SAMPLES = 32768;
 static const size_t BUFFER_SIZE_BYTES = BUFFER_SIZE_SAMPLES * sizeof(int16_t);
 
 static const uint32_t READER_TASK_STACK_SIZE = 4096;
 static const uint32_t DECODER_TASK_STACK_SIZE = 4096;
 static const uint32_t RESAMPLER_TASK_STACK_SIZE = 4096;
-static const size_t DURATION_TASK_DELAY_MS = 10;
+// Longest a stage blocks on its ring buffers before checking the event group again. Stages are normally woken sooner,
+// by their ring buffers or by the pipeline when a command or another stage's state changes.
+static const size_t DURATION_TASK_DELAY_MS = 100;
+// How often a pipeline waiting on a previous pipeline checks whether it was stopped
+static const size_t PREVIOUS_PIPELINE_POLL_MS = 20;
+// Longest stop() waits for the mixer task to clear the pipeline's ring buffer
+static const uint32_t MIXER_CLEAR_TIMEOUT_MS = 50;
 
 static const size_t INFO_ERROR_QUEUE_COUNT = 5;
 
+// Share of real time resampling may take before later streams drop to the next lower quality
+static const uint32_t MAX_RESAMPLER_LOAD_PERCENT = 30;
+// Share of real time below which later streams step back up to the next higher quality, up to the configured one
+static const uint32_t MIN_RESAMPLER_LOAD_PERCENT = 10;
+// Audio resampled per load measurement. A stream's busiest window decides; streams shorter than one window don't say
+// enough about the resampler's load to change its quality.
+static const uint32_t RESAMPLER_LOAD_WINDOW_MS = 5000;
+
+static const char *const RESAMPLER_QUALITY_NAMES[] = {"fast", "balanced", "high"};
+
 static const char *const TAG = "nabu_media_player.pipeline";
 
+static void log_stage_stats(const char *stage, const AudioStageStats &stats) {
+  float busy_percent = 0.0f;
+  float output_rate = 0.0f;
+  if (stats.duration_ms > 0) {
+    busy_percent = stats.processing_us / (10.0f * stats.duration_ms);
+    output_rate = static_cast<float>(stats.bytes_written) / stats.duration_ms;  // bytes per ms is kB/s
+  }
+  ESP_LOGD(TAG,
+           "%s read %" PRIu64 " bytes and wrote %" PRIu64 " bytes in %" PRIu32 " ms (%.2f kB/s); busy for %" PRIu64
+           " ms (%.1f%%); %zu bytes buffered; output peaked at %zu bytes",
+           stage, stats.bytes_read, stats.bytes_written, stats.duration_ms, output_rate, stats.processing_us / 1000,
+           busy_percent, stats.buffer_bytes, stats.peak_output_bytes);
+}
+
+// The stats are only logged, so a stage never blocks on a full info/error queue to report them
+static void send_stage_stats(QueueHandle_t info_error_queue, InfoErrorSource source, const AudioStageStats &stats) {
+  InfoErrorEvent stats_event;
+  stats_event.source = source;
+  stats_event.stats = stats;
+  xQueueSend(info_error_queue, &stats_event, 0);
+}
+
+// Blocks the calling stage until its input ring buffer has more data or its output ring buffer has more free space
+// than now, or until the pipeline notifies the task. Either ring buffer may be nullptr.
+static void wait_for_ring_buffers(AudioRingBuffer *input_ring_buffer, AudioRingBuffer *output_ring_buffer) {
+  if (input_ring_buffer != nullptr) {
+    input_ring_buffer->notify_when_available(input_ring_buffer->available() + 1);
+  }
+  if (output_ring_buffer != nullptr) {
+    output_ring_buffer->notify_when_free(output_ring_buffer->free() + 1);
+  }
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DURATION_TASK_DELAY_MS));
+}
+
 enum EventGroupBits : uint32_t {
   // The stop() function clears all unfinished bits
   // MESSAGE_* bits are only set by their respective tasks
@@ -32,10 +86,11 @@ enum EventGroupBits : uint32_t {
 
   // Read audio from an HTTP source; cleared by reader task and set by start(uri,...)
   READER_COMMAND_INIT_HTTP = (1 << 4),
-  // Read audio from an audio file from the flash; cleared by reader task and set by start(media_file,...)
-  READER_COMMAND_INIT_FILE = (1 << 5),
+  // Copy a media file's decoded audio from the PCM cache; cleared by reader task and set by start(media_file,...)
+  READER_COMMAND_INIT_CACHED_PCM = (1 << 5),
 
-  // Audio file type is read after checking it is supported; cleared by decoder task
+  // Audio file type is read after checking it is supported; cleared by decoder task. Set by start(media_file,...)
+  // for media files that aren't cached, as the decoder reads them straight from the flash.
   READER_MESSAGE_LOADED_MEDIA_TYPE = (1 << 6),
   // Reader is done (either through a failure or just end of the stream); cleared by reader task
   READER_MESSAGE_FINISHED = (1 << 7),
@@ -54,23 +109,47 @@ enum EventGroupBits : uint32_t {
   // Error resampling the file; cleared by get_state()
   RESAMPLER_MESSAGE_ERROR = (1 << 18),
 
-  // Cleared by respective tasks
+  // Set by the respective tasks once idle. Whatever wakes a task clears its bit first, so all the bits are only set
+  // once the pipeline is done with the current media.
   FINISHED_BITS = READER_MESSAGE_FINISHED | DECODER_MESSAGE_FINISHED | RESAMPLER_MESSAGE_FINISHED,
   UNFINISHED_BITS = ~(FINISHED_BITS | 0xff000000),  // Only 24 bits are valid for the event group, so make sure first 8
                                                     // bits of uint32 are not set; cleared by stop()
 };
 
-AudioPipeline::AudioPipeline(AudioMixer *mixer, AudioPipelineType pipeline_type) {
+AudioPipeline::AudioPipeline(AudioMixer *mixer, AudioPipelineType pipeline_type, AudioPcmCache *pcm_cache,
+                             HttpConnectionPool *connection_pool, FilterBankCache *filter_bank_cache,
+                             ResamplerQuality resampler_quality) {
   this->mixer_ = mixer;
   this->pipeline_type_ = pipeline_type;
+  this->pcm_cache_ = pcm_cache;
+  this->connection_pool_ = connection_pool;
+  this->filter_bank_cache_ = filter_bank_cache;
+  this->resampler_quality_ = resampler_quality;
+}
+
+void AudioPipeline::set_resampler_quality(ResamplerQuality resampler_quality) {
+  this->resampler_quality_ = resampler_quality;
+  this->resampler_quality_applied_ = false;
 }
 
 esp_err_t AudioPipeline::start(const std::string &uri, uint32_t target_sample_rate, const std::string &task_name,
-                               UBaseType_t priority) {
-  esp_err_t err = this->common_start_(target_sample_rate, task_name, priority);
+                               UBaseType_t priority, AudioPipeline *previous) {
+  esp_err_t err = this->common_start_(target_sample_rate, task_name, priority, previous);
+
+  if ((err == ESP_OK) && (this->raw_file_ring_buffer_ == nullptr)) {
+    // Only streams go through the reader, so a pipeline that only plays media files never allocates this
+    this->raw_file_ring_buffer_ = AudioRingBuffer::create(HTTP_BUFFER_SIZE, MAX_FRAME_SIZE);
+    if (this->raw_file_ring_buffer_ == nullptr) {
+      err = ESP_ERR_NO_MEM;
+    }
+  }
 
   if (err == ESP_OK) {
     this->current_uri_ = uri;
+    this->current_media_file_ = nullptr;
+    this->current_stream_live_ = false;
+    this->current_cached_pcm_.reset();
+    xEventGroupClearBits(this->event_group_, READER_MESSAGE_FINISHED);
     xEventGroupSetBits(this->event_group_, READER_COMMAND_INIT_HTTP);
   }
 
@@ -78,29 +157,43 @@ esp_err_t AudioPipeline::start(const std::string &uri, uint32_t target_sample_ra
 }
 
 esp_err_t AudioPipeline::start(media_player::MediaFile *media_file, uint32_t target_sample_rate,
-                               const std::string &task_name, UBaseType_t priority) {
-  esp_err_t err = this->common_start_(target_sample_rate, task_name, priority);
+                               const std::string &task_name, UBaseType_t priority, AudioPipeline *previous) {
+  esp_err_t err = this->common_start_(target_sample_rate, task_name, priority, previous);
 
   if (err == ESP_OK) {
     this->current_media_file_ = media_file;
-    xEventGroupSetBits(this->event_group_, READER_COMMAND_INIT_FILE);
+    this->current_stream_live_ = false;
+    if (this->pcm_cache_ != nullptr) {
+      this->current_cached_pcm_ =
+          this->pcm_cache_->find(media_file, this->target_sample_rate_, this->mixer_->get_bits_per_sample());
+    }
+
+    if (this->current_cached_pcm_ != nullptr) {
+      ESP_LOGD(TAG, "Playing decoded audio from the cache");
+      xEventGroupClearBits(this->event_group_, READER_MESSAGE_FINISHED);
+      xEventGroupSetBits(this->event_group_, READER_COMMAND_INIT_CACHED_PCM);
+    } else {
+      // The decoder reads the file straight from the flash, so the reader task stays idle
+      this->current_media_file_type_ = media_file->file_type;
+
+      InfoErrorEvent event;
+      event.source = InfoErrorSource::READER;
+      event.file_type = this->current_media_file_type_;
+      xQueueSend(this->info_error_queue_, &event, 0);
+
+      xEventGroupClearBits(this->event_group_, DECODER_MESSAGE_FINISHED);
+      xEventGroupSetBits(this->event_group_, READER_MESSAGE_LOADED_MEDIA_TYPE);
+    }
   }
 
   return err;
 }
 
 esp_err_t AudioPipeline::allocate_buffers_() {
-  if (this->raw_file_ring_buffer_ == nullptr)
-    this->raw_file_ring_buffer_ = RingBuffer::create(HTTP_BUFFER_SIZE);
-
   if (this->decoded_ring_buffer_ == nullptr)
-    this->decoded_ring_buffer_ = RingBuffer::create(BUFFER_SIZE_BYTES);
-
-  if (this->resampled_ring_buffer_ == nullptr)
-    this->resampled_ring_buffer_ = RingBuffer::create(BUFFER_SIZE_BYTES);
+    this->decoded_ring_buffer_ = AudioRingBuffer::create(BUFFER_SIZE_BYTES, MAX_FRAME_SIZE);
 
-  if ((this->raw_file_ring_buffer_ == nullptr) || (this->decoded_ring_buffer_ == nullptr) ||
-      (this->resampled_ring_buffer_ == nullptr)) {
+  if (this->decoded_ring_buffer_ == nullptr) {
     return ESP_ERR_NO_MEM;
   }
 
@@ -137,7 +230,7 @@ esp_err_t AudioPipeline::allocate_buffers_() {
 }
 
 esp_err_t AudioPipeline::common_start_(uint32_t target_sample_rate, const std::string &task_name,
-                                       UBaseType_t priority) {
+                                       UBaseType_t priority, AudioPipeline *previous) {
   esp_err_t err = this->allocate_buffers_();
   if (err != ESP_OK) {
     return err;
@@ -166,6 +259,9 @@ esp_err_t AudioPipeline::common_start_(uint32_t target_sample_rate, const std::s
 
   this->target_sample_rate_ = target_sample_rate;
 
+  // Set first, as stop() must not clear the mixer's ring buffer while it holds the previous pipeline's audio
+  this->previous_pipeline_.store(previous, std::memory_order_release);
+
   return this->stop();
 }
 
@@ -180,6 +276,8 @@ AudioPipelineState AudioPipeline::get_state() {
           } else if (event.file_type.has_value()) {
             ESP_LOGD(TAG, "Reading %s file type",
                      media_player::media_player_file_type_to_string(event.file_type.value()));
+          } else if (event.stats.has_value()) {
+            log_stage_stats("Reader", event.stats.value());
           }
 
           break;
@@ -190,28 +288,40 @@ AudioPipelineState AudioPipeline::get_state() {
             ESP_LOGD(TAG, "Decoded audio has %d channels, %d Hz sample rate, and %d bits per sample",
                      event.stream_info.value().channels, event.stream_info.value().sample_rate,
                      event.stream_info.value().bits_per_sample);
+            if (event.duration_ms.has_value()) {
+              ESP_LOGD(TAG, "Audio is %.1f seconds long", event.duration_ms.value() / 1000.0f);
+            }
+          } else if (event.stats.has_value()) {
+            log_stage_stats("Decoder", event.stats.value());
           }
           break;
         case InfoErrorSource::RESAMPLER:
           if (event.err.has_value()) {
             ESP_LOGE(TAG, "Resampler encountered an error: %s", esp_err_to_name(event.err.has_value()));
           } else if (event.resample_info.has_value()) {
-            if (event.resample_info.value().resample) {
-              ESP_LOGD(TAG, "Converting the audio sample rate");
+            const ResampleInfo &resample_info = event.resample_info.value();
+            if (resample_info.resample) {
+              ESP_LOGD(TAG, "Converting the audio sample rate at %s quality",
+                       RESAMPLER_QUALITY_NAMES[static_cast<uint8_t>(resample_info.quality)]);
+              if (resample_info.quality < this->resampler_quality_) {
+                ESP_LOGW(TAG, "Resampling quality was lowered, as resampling an earlier stream took too much CPU time");
+              }
             }
-            if (event.resample_info.value().mono_to_stereo) {
-              ESP_LOGD(TAG, "Converting mono channel audio to stereo channel audio");
+            if (resample_info.compensate_drift) {
+              ESP_LOGD(TAG, "Compensating for clock drift of the live stream");
             }
+          } else if (event.stats.has_value()) {
+            log_stage_stats("Resampler", event.stats.value());
           }
           break;
       }
     }
   }
 
-  EventBits_t event_bits = xEventGroupGetBits(this->event_group_);
   if (!this->read_task_handle_ && !this->decode_task_handle_ && !this->resample_task_handle_) {
     return AudioPipelineState::STOPPED;
   }
+  EventBits_t event_bits = xEventGroupGetBits(this->event_group_);
 
   if ((event_bits & READER_MESSAGE_ERROR)) {
     xEventGroupClearBits(this->event_group_, READER_MESSAGE_ERROR);
@@ -237,7 +347,7 @@ AudioPipelineState AudioPipeline::get_state() {
 }
 
 esp_err_t AudioPipeline::stop() {
-  xEventGroupSetBits(this->event_group_, PIPELINE_COMMAND_STOP);
+  this->set_event_bits_(PIPELINE_COMMAND_STOP);
 
   uint32_t event_group_bits = xEventGroupWaitBits(this->event_group_,
                                                   FINISHED_BITS,        // Bit message to read
@@ -250,14 +360,24 @@ esp_err_t AudioPipeline::stop() {
     return ESP_ERR_TIMEOUT;
   }
 
-  // Clear the ring buffer in the mixer; avoids playing incorrect audio when starting a new file while paused
-  CommandEvent command_event;
-  if (this->pipeline_type_ == AudioPipelineType::MEDIA) {
-    command_event.command = CommandEventType::CLEAR_MEDIA;
-  } else {
-    command_event.command = CommandEventType::CLEAR_ANNOUNCEMENT;
+  if (this->previous_pipeline_.load(std::memory_order_acquire) == nullptr) {
+    // Clear the ring buffer in the mixer; avoids playing incorrect audio when starting a new file while paused
+    CommandEvent command_event;
+    if (this->pipeline_type_ == AudioPipelineType::MEDIA) {
+      command_event.command = CommandEventType::CLEAR_MEDIA;
+    } else {
+      command_event.command = CommandEventType::CLEAR_ANNOUNCEMENT;
+    }
+    const uint32_t clears = this->get_mixer_clears_();
+    this->mixer_->send_command(&command_event);
+
+    // The mixer task clears the ring buffer, as its consumer. Wait for it, so the clear can't discard the first samples
+    // of a stream started right after this.
+    const uint32_t clear_start_ms = millis();
+    while ((this->get_mixer_clears_() == clears) && (millis() - clear_start_ms < MIXER_CLEAR_TIMEOUT_MS)) {
+      vTaskDelay(pdMS_TO_TICKS(1));
+    }
   }
-  this->mixer_->send_command(&command_event);
 
   xEventGroupClearBits(this->event_group_, UNFINISHED_BITS);
   this->reset_ring_buffers();
@@ -265,54 +385,153 @@ esp_err_t AudioPipeline::stop() {
   return ESP_OK;
 }
 
+void AudioPipeline::set_event_bits_(uint32_t bits) {
+  xEventGroupSetBits(this->event_group_, bits);
+
+  // Tasks blocked on their ring buffers check the event group when woken. A task may get here before start() has
+  // stored the handles of the tasks created after it; those can't be blocked yet, so skipping them is fine.
+  const TaskHandle_t task_handles[] = {this->read_task_handle_.load(std::memory_order_acquire),
+                                       this->decode_task_handle_.load(std::memory_order_acquire),
+                                       this->resample_task_handle_.load(std::memory_order_acquire)};
+  for (TaskHandle_t task_handle : task_handles) {
+    if (task_handle != nullptr) {
+      xTaskNotifyGive(task_handle);
+    }
+  }
+}
+
+bool AudioPipeline::wait_for_previous_pipeline_() {
+  AudioPipeline *previous;
+  while ((previous = this->previous_pipeline_.load(std::memory_order_acquire)) != nullptr) {
+    if (xEventGroupGetBits(this->event_group_) & PIPELINE_COMMAND_STOP) {
+      return false;
+    }
+
+    EventBits_t previous_bits = xEventGroupWaitBits(previous->event_group_,
+                                                    FINISHED_BITS,  // Bit message to read
+                                                    pdFALSE,        // Don't clear the bits on exit
+                                                    pdTRUE,         // Wait for all the bits
+                                                    pdMS_TO_TICKS(PREVIOUS_PIPELINE_POLL_MS));
+    if ((previous_bits & FINISHED_BITS) == FINISHED_BITS) {
+      // The previous pipeline committed its last samples, so this pipeline's audio follows them directly
+      this->previous_pipeline_.store(nullptr, std::memory_order_release);
+    }
+  }
+  return true;
+}
+
+AudioRingBuffer *AudioPipeline::get_mixer_ring_buffer_() {
+  if (this->pipeline_type_ == AudioPipelineType::MEDIA) {
+    return this->mixer_->get_media_ring_buffer();
+  }
+  return this->mixer_->get_announcement_ring_buffer();
+}
+
+uint32_t AudioPipeline::get_mixer_clears_() {
+  if (this->pipeline_type_ == AudioPipelineType::MEDIA) {
+    return this->mixer_->get_media_clears();
+  }
+  return this->mixer_->get_announcement_clears();
+}
+
+void AudioPipeline::set_mixer_channels_(uint8_t channels) {
+  if (this->pipeline_type_ == AudioPipelineType::MEDIA) {
+    this->mixer_->set_media_channels(channels);
+  } else {
+    this->mixer_->set_announcement_channels(channels);
+  }
+}
+
+AudioStageStats AudioPipeline::write_cached_pcm_() {
+  std::shared_ptr<const CachedPcm> pcm = std::move(this->current_cached_pcm_);
+  AudioRingBuffer *output_ring_buffer = this->get_mixer_ring_buffer_();
+
+  AudioStageStats stats;
+  if (!this->wait_for_previous_pipeline_()) {
+    return stats;
+  }
+  this->set_mixer_channels_(pcm->channels);
+
+  size_t bytes_copied = 0;
+  while ((bytes_copied < pcm->length) && !(xEventGroupGetBits(this->event_group_) & PIPELINE_COMMAND_STOP)) {
+    const uint32_t write_start_us = micros();
+    size_t bytes_written = output_ring_buffer->write(pcm->data + bytes_copied, pcm->length - bytes_copied);
+    stats.processing_us += micros() - write_start_us;
+
+    bytes_copied += bytes_written;
+    stats.peak_output_bytes = std::max(stats.peak_output_bytes, output_ring_buffer->available());
+    if (bytes_written == 0) {
+      wait_for_ring_buffers(nullptr, output_ring_buffer);
+    }
+  }
+
+  stats.bytes_read = bytes_copied;
+  stats.bytes_written = bytes_copied;
+  return stats;
+}
+
 void AudioPipeline::reset_ring_buffers() {
-  this->raw_file_ring_buffer_->reset();
+  if (this->raw_file_ring_buffer_ != nullptr) {
+    this->raw_file_ring_buffer_->reset();
+  }
   this->decoded_ring_buffer_->reset();
-  this->resampled_ring_buffer_->reset();
 }
 
 void AudioPipeline::read_task_(void *params) {
   AudioPipeline *this_pipeline = (AudioPipeline *) params;
 
   while (true) {
-    xEventGroupSetBits(this_pipeline->event_group_, EventGroupBits::READER_MESSAGE_FINISHED);
+    this_pipeline->set_event_bits_(EventGroupBits::READER_MESSAGE_FINISHED);
 
     // Wait until the pipeline notifies us the source of the media file
     EventBits_t event_bits =
         xEventGroupWaitBits(this_pipeline->event_group_,
-                            READER_COMMAND_INIT_FILE | READER_COMMAND_INIT_HTTP,  // Bit message to read
-                            pdTRUE,                                               // Clear the bit on exit
-                            pdFALSE,                                              // Wait for all the bits,
-                            portMAX_DELAY);                                       // Block indefinitely until bit is set
+                            READER_COMMAND_INIT_CACHED_PCM | READER_COMMAND_INIT_HTTP,  // Bit message to read
+                            pdTRUE,                                                     // Clear the bit on exit
+                            pdFALSE,                                                    // Wait for all the bits,
+                            portMAX_DELAY);  // Block indefinitely until bit is set
 
     xEventGroupClearBits(this_pipeline->event_group_, EventGroupBits::READER_MESSAGE_FINISHED);
 
+    if (event_bits & READER_COMMAND_INIT_CACHED_PCM) {
+      // The file is already decoded and resampled, so the decoder and resampler stay idle
+      const uint32_t start_ms = millis();
+
+      AudioStageStats stats = this_pipeline->write_cached_pcm_();
+      stats.duration_ms = millis() - start_ms;
+      send_stage_stats(this_pipeline->info_error_queue_, InfoErrorSource::READER, stats);
+      continue;
+    }
+
     {
       InfoErrorEvent event;
       event.source = InfoErrorSource::READER;
       esp_err_t err = ESP_OK;
 
-      AudioReader reader = AudioReader(this_pipeline->raw_file_ring_buffer_.get(), HTTP_BUFFER_SIZE);
+      AudioReader reader =
+          AudioReader(this_pipeline->raw_file_ring_buffer_.get(), MAX_FRAME_SIZE, this_pipeline->connection_pool_);
 
-      if (event_bits & READER_COMMAND_INIT_FILE) {
-        err = reader.start(this_pipeline->current_media_file_, this_pipeline->current_media_file_type_);
-      } else {
-        err = reader.start(this_pipeline->current_uri_, this_pipeline->current_media_file_type_);
-      }
+      const uint32_t start_ms = millis();
+      uint64_t processing_us = 0;
+      size_t peak_output_bytes = 0;
+
+      err = reader.start(this_pipeline->current_uri_, this_pipeline->current_media_file_type_);
       if (err != ESP_OK) {
         // Send specific error message
         event.err = err;
         xQueueSend(this_pipeline->info_error_queue_, &event, portMAX_DELAY);
 
         // Setting up the reader failed, stop the pipeline
-        xEventGroupSetBits(this_pipeline->event_group_,
-                           EventGroupBits::READER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
+        this_pipeline->set_event_bits_(EventGroupBits::READER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
       } else {
+        this_pipeline->current_stream_live_ = reader.is_live();
+
         // Send the file type to the pipeline
         event.file_type = this_pipeline->current_media_file_type_;
         xQueueSend(this_pipeline->info_error_queue_, &event, portMAX_DELAY);
 
         // Inform the decoder that the media type is available
+        xEventGroupClearBits(this_pipeline->event_group_, EventGroupBits::DECODER_MESSAGE_FINISHED);
         xEventGroupSetBits(this_pipeline->event_group_, EventGroupBits::READER_MESSAGE_LOADED_MEDIA_TYPE);
       }
 
@@ -323,19 +542,31 @@ void AudioPipeline::read_task_(void *params) {
           break;
         }
 
+        const uint64_t bytes_written = reader.get_stats().bytes_written;
+
+        const uint32_t read_start_us = micros();
         AudioReaderState reader_state = reader.read();
+        processing_us += micros() - read_start_us;
+        peak_output_bytes = std::max(peak_output_bytes, this_pipeline->raw_file_ring_buffer_->available());
 
         if (reader_state == AudioReaderState::FINISHED) {
           break;
         } else if (reader_state == AudioReaderState::FAILED) {
-          xEventGroupSetBits(this_pipeline->event_group_,
-                             EventGroupBits::READER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
+          this_pipeline->set_event_bits_(EventGroupBits::READER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
           break;
         }
 
-        // Block to give other tasks opportunity to run
-        delay(DURATION_TASK_DELAY_MS);
+        if (reader.get_stats().bytes_written == bytes_written) {
+          // The ring buffer is full
+          wait_for_ring_buffers(nullptr, this_pipeline->raw_file_ring_buffer_.get());
+        }
       }
+
+      AudioStageStats stats = reader.get_stats();
+      stats.processing_us = processing_us;
+      stats.duration_ms = millis() - start_ms;
+      stats.peak_output_bytes = peak_output_bytes;
+      send_stage_stats(this_pipeline->info_error_queue_, InfoErrorSource::READER, stats);
     }
   }
 }
@@ -344,7 +575,7 @@ void AudioPipeline::decode_task_(void *params) {
   AudioPipeline *this_pipeline = (AudioPipeline *) params;
 
   while (true) {
-    xEventGroupSetBits(this_pipeline->event_group_, EventGroupBits::DECODER_MESSAGE_FINISHED);
+    this_pipeline->set_event_bits_(EventGroupBits::DECODER_MESSAGE_FINISHED);
 
     // Wait until the reader notifies us that the media type is available
     EventBits_t event_bits = xEventGroupWaitBits(this_pipeline->event_group_,
@@ -359,9 +590,28 @@ void AudioPipeline::decode_task_(void *params) {
       InfoErrorEvent event;
       event.source = InfoErrorSource::DECODER;
 
-      std::unique_ptr<AudioDecoder> decoder = make_unique<AudioDecoder>(
-          this_pipeline->raw_file_ring_buffer_.get(), this_pipeline->decoded_ring_buffer_.get(), HTTP_BUFFER_SIZE);
-      esp_err_t err = decoder->start(this_pipeline->current_media_file_type_);
+      // Media files are decoded straight from the flash; streams from the reader's ring buffer
+      AudioRingBuffer *input_ring_buffer = nullptr;
+      std::unique_ptr<AudioDecoder> decoder;
+      if (this_pipeline->current_media_file_ != nullptr) {
+        decoder = make_unique<AudioDecoder>(this_pipeline->current_media_file_->data,
+                                            this_pipeline->current_media_file_->length,
+                                            this_pipeline->decoded_ring_buffer_.get(), MAX_FRAME_SIZE);
+      } else {
+        input_ring_buffer = this_pipeline->raw_file_ring_buffer_.get();
+        decoder = make_unique<AudioDecoder>(input_ring_buffer, this_pipeline->decoded_ring_buffer_.get(),
+                                            MAX_FRAME_SIZE);
+      }
+      optional<media_player::StreamInfo> raw_stream_info;
+      if ((this_pipeline->current_media_file_type_ == media_player::MediaFileType::RAW) &&
+          (this_pipeline->current_media_file_ != nullptr)) {
+        raw_stream_info = this_pipeline->current_media_file_->stream_info;
+      }
+      esp_err_t err = decoder->start(this_pipeline->current_media_file_type_, raw_stream_info);
+
+      const uint32_t start_ms = millis();
+      uint64_t processing_us = 0;
+      size_t peak_output_bytes = 0;
 
       if (err != ESP_OK) {
         // Send specific error message
@@ -369,8 +619,7 @@ void AudioPipeline::decode_task_(void *params) {
         xQueueSend(this_pipeline->info_error_queue_, &event, portMAX_DELAY);
 
         // Setting up the decoder failed, stop the pipeline
-        xEventGroupSetBits(this_pipeline->event_group_,
-                           EventGroupBits::DECODER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
+        this_pipeline->set_event_bits_(EventGroupBits::DECODER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
       }
 
       bool has_stream_info = false;
@@ -382,14 +631,18 @@ void AudioPipeline::decode_task_(void *params) {
           break;
         }
 
-        // Stop gracefully if the reader has finished
+        const AudioStageStats previous_stats = decoder->get_stats();
+
+        // Stop gracefully if the reader has finished; it stays finished while decoding a media file from the flash
+        const uint32_t decode_start_us = micros();
         AudioDecoderState decoder_state = decoder->decode(event_bits & READER_MESSAGE_FINISHED);
+        processing_us += micros() - decode_start_us;
+        peak_output_bytes = std::max(peak_output_bytes, this_pipeline->decoded_ring_buffer_->available());
 
         if (decoder_state == AudioDecoderState::FINISHED) {
           break;
         } else if (decoder_state == AudioDecoderState::FAILED) {
-          xEventGroupSetBits(this_pipeline->event_group_,
-                             EventGroupBits::DECODER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
+          this_pipeline->set_event_bits_(EventGroupBits::DECODER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
           break;
         }
 
@@ -400,15 +653,29 @@ void AudioPipeline::decode_task_(void *params) {
 
           // Send the stream information to the pipeline
           event.stream_info = this_pipeline->current_stream_info_;
+          event.duration_ms = decoder->get_duration_ms();
           xQueueSend(this_pipeline->info_error_queue_, &event, portMAX_DELAY);
 
           // Inform the resampler that the stream information is available
+          xEventGroupClearBits(this_pipeline->event_group_, EventGroupBits::RESAMPLER_MESSAGE_FINISHED);
           xEventGroupSetBits(this_pipeline->event_group_, EventGroupBits::DECODER_MESSAGE_LOADED_STREAM_INFO);
+
+          // The decoder returns right after parsing the header, so continue with the first frame without waiting
+          continue;
         }
 
-        // Block to give other tasks opportunity to run
-        delay(DURATION_TASK_DELAY_MS);
+        if ((decoder->get_stats().bytes_read == previous_stats.bytes_read) &&
+            (decoder->get_stats().bytes_written == previous_stats.bytes_written)) {
+          // Waiting on more encoded data or on space for the decoded samples
+          wait_for_ring_buffers(input_ring_buffer, this_pipeline->decoded_ring_buffer_.get());
+        }
       }
+
+      AudioStageStats stats = decoder->get_stats();
+      stats.processing_us = processing_us;
+      stats.duration_ms = millis() - start_ms;
+      stats.peak_output_bytes = peak_output_bytes;
+      send_stage_stats(this_pipeline->info_error_queue_, InfoErrorSource::DECODER, stats);
     }
   }
 }
@@ -416,8 +683,16 @@ void AudioPipeline::decode_task_(void *params) {
 void AudioPipeline::resample_task_(void *params) {
   AudioPipeline *this_pipeline = (AudioPipeline *) params;
 
+  AudioRingBuffer *output_ring_buffer = this_pipeline->get_mixer_ring_buffer_();
+
+  // Kept across streams, so a stream at the same rates as the previous one reuses its filters and buffers
+  AudioResampler resampler = AudioResampler(this_pipeline->decoded_ring_buffer_.get(), output_ring_buffer,
+                                            BUFFER_SIZE_SAMPLES, this_pipeline->filter_bank_cache_);
+  ResamplerQuality quality = this_pipeline->resampler_quality_;
+  DriftCompensator drift_compensator;
+
   while (true) {
-    xEventGroupSetBits(this_pipeline->event_group_, EventGroupBits::RESAMPLER_MESSAGE_FINISHED);
+    this_pipeline->set_event_bits_(EventGroupBits::RESAMPLER_MESSAGE_FINISHED);
 
     // Wait until the decoder notifies us that the stream information is available
     EventBits_t event_bits = xEventGroupWaitBits(this_pipeline->event_group_,
@@ -432,31 +707,64 @@ void AudioPipeline::resample_task_(void *params) {
       InfoErrorEvent event;
       event.source = InfoErrorSource::RESAMPLER;
 
-      RingBuffer *output_ring_buffer = nullptr;
-
-      if (this_pipeline->pipeline_type_ == AudioPipelineType::MEDIA) {
-        output_ring_buffer = this_pipeline->mixer_->get_media_ring_buffer();
-      } else {
-        output_ring_buffer = this_pipeline->mixer_->get_announcement_ring_buffer();
+      // Local media files are captured while they play, so the next play can come straight from the cache
+      std::unique_ptr<PcmCapture> capture;
+      if ((this_pipeline->pcm_cache_ != nullptr) && (this_pipeline->current_media_file_ != nullptr)) {
+        capture = this_pipeline->pcm_cache_->start_capture(this_pipeline->current_media_file_,
+                                                           this_pipeline->target_sample_rate_,
+                                                           this_pipeline->mixer_->get_bits_per_sample(),
+                                                           this_pipeline->current_stream_info_.channels);
+      }
+      resampler.set_capture(capture.get());
+      if (!this_pipeline->resampler_quality_applied_) {
+        // The quality was set again, so start over from it
+        quality = this_pipeline->resampler_quality_;
+        this_pipeline->resampler_quality_applied_ = true;
+      }
+      resampler.set_quality(quality);
+
+      // A live stream fills or drains the reader's ring buffer if the server's clock differs from the speaker's. The
+      // buffers after it are kept full by the mixer's backpressure, so only this one shows the drift.
+      const bool compensate_drift =
+          this_pipeline->current_stream_live_ && (this_pipeline->pipeline_type_ == AudioPipelineType::MEDIA);
+      resampler.set_drift_compensation(compensate_drift);
+      if (compensate_drift) {
+        drift_compensator.start(this_pipeline->raw_file_ring_buffer_->size());
       }
-
-      AudioResampler resampler =
-          AudioResampler(this_pipeline->decoded_ring_buffer_.get(), output_ring_buffer, BUFFER_SIZE_SAMPLES);
 
       esp_err_t err = resampler.start(this_pipeline->current_stream_info_, this_pipeline->target_sample_rate_,
+                                      this_pipeline->mixer_->get_bits_per_sample(),
                                       this_pipeline->current_resample_info_);
 
+      const uint32_t start_ms = millis();
+      uint64_t processing_us = 0;
+      size_t peak_output_bytes = 0;
+
+      // The resampler's load is measured over windows of RESAMPLER_LOAD_WINDOW_MS of output audio
+      const uint64_t output_bytes_per_second = static_cast<uint64_t>(this_pipeline->current_stream_info_.channels) *
+                                               (this_pipeline->mixer_->get_bits_per_sample() / 8) *
+                                               this_pipeline->target_sample_rate_;
+      const uint64_t load_window_bytes = output_bytes_per_second * RESAMPLER_LOAD_WINDOW_MS / 1000;
+      uint64_t load_window_start_bytes = 0;
+      uint64_t load_window_processing_us = 0;
+      optional<uint64_t> peak_load_percent;
+
       if (err != ESP_OK) {
         // Send specific error message
         event.err = err;
         xQueueSend(this_pipeline->info_error_queue_, &event, portMAX_DELAY);
 
         // Setting up the resampler failed, stop the pipeline
-        xEventGroupSetBits(this_pipeline->event_group_,
-                           EventGroupBits::RESAMPLER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
+        this_pipeline->set_event_bits_(EventGroupBits::RESAMPLER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
       } else {
         event.resample_info = this_pipeline->current_resample_info_;
         xQueueSend(this_pipeline->info_error_queue_, &event, portMAX_DELAY);
+
+        // Resampled audio goes straight into the mixer, so it can only start once a previous pipeline is done. The
+        // decoder keeps filling the decoded ring buffer meanwhile. Stopping while waiting is handled below.
+        if (this_pipeline->wait_for_previous_pipeline_()) {
+          this_pipeline->set_mixer_channels_(this_pipeline->current_stream_info_.channels);
+        }
       }
 
       while (true) {
@@ -466,19 +774,64 @@ void AudioPipeline::resample_task_(void *params) {
           break;
         }
 
+        const AudioStageStats previous_stats = resampler.get_stats();
+
+        if (compensate_drift) {
+          const AudioRingBuffer *raw_file_ring_buffer = this_pipeline->raw_file_ring_buffer_.get();
+          resampler.set_ratio_correction(
+              drift_compensator.update(raw_file_ring_buffer->available(), raw_file_ring_buffer->get_read_position(),
+                                       raw_file_ring_buffer->get_write_position(), millis()));
+        }
+
         // Stop gracefully if the decoder is done
+        const uint32_t resample_start_us = micros();
         AudioResamplerState resampler_state = resampler.resample(event_bits & DECODER_MESSAGE_FINISHED);
+        const uint32_t resample_us = micros() - resample_start_us;
+        processing_us += resample_us;
+        load_window_processing_us += resample_us;
+
+        const uint64_t load_window_bytes_written = resampler.get_stats().bytes_written - load_window_start_bytes;
+        if ((load_window_bytes > 0) && (load_window_bytes_written >= load_window_bytes)) {
+          const uint64_t audio_us = load_window_bytes_written * 1000000 / output_bytes_per_second;
+          const uint64_t load_percent = load_window_processing_us * 100 / audio_us;
+          peak_load_percent = std::max(peak_load_percent.value_or(0), load_percent);
+          load_window_start_bytes = resampler.get_stats().bytes_written;
+          load_window_processing_us = 0;
+        }
+        peak_output_bytes = std::max(peak_output_bytes, output_ring_buffer->available());
 
         if (resampler_state == AudioResamplerState::FINISHED) {
+          if (capture != nullptr) {
+            // Only a file played in full is cached
+            this_pipeline->pcm_cache_->insert(capture->release());
+          }
           break;
         } else if (resampler_state == AudioResamplerState::FAILED) {
-          xEventGroupSetBits(this_pipeline->event_group_,
-                             EventGroupBits::RESAMPLER_MESSAGE_ERROR | EventGroupBits::PIPELINE_COMMAND_STOP);
+          this_pipeline->set_event_bits_(EventGroupBits::RESAMPLER_MESSAGE_ERROR |
+                                         EventGroupBits::PIPELINE_COMMAND_STOP);
           break;
         }
 
-        // Block to give other tasks opportunity to run
-        delay(DURATION_TASK_DELAY_MS);
+        if ((resampler.get_stats().bytes_read == previous_stats.bytes_read) &&
+            (resampler.get_stats().bytes_written == previous_stats.bytes_written)) {
+          // Waiting on more decoded samples or on the mixer to make room
+          wait_for_ring_buffers(this_pipeline->decoded_ring_buffer_.get(), output_ring_buffer);
+        }
+      }
+
+      AudioStageStats stats = resampler.get_stats();
+      stats.processing_us = processing_us;
+      stats.duration_ms = millis() - start_ms;
+      stats.peak_output_bytes = peak_output_bytes;
+      send_stage_stats(this_pipeline->info_error_queue_, InfoErrorSource::RESAMPLER, stats);
+
+      if ((err == ESP_OK) && this_pipeline->current_resample_info_.resample && peak_load_percent.has_value()) {
+        if ((peak_load_percent.value() > MAX_RESAMPLER_LOAD_PERCENT) && (quality > ResamplerQuality::FAST)) {
+          quality = static_cast<ResamplerQuality>(static_cast<uint8_t>(quality) - 1);
+        } else if ((peak_load_percent.value() < MIN_RESAMPLER_LOAD_PERCENT) &&
+                   (quality < this_pipeline->resampler_quality_)) {
+          quality = static_cast<ResamplerQuality>(static_cast<uint8_t>(quality) + 1);
+        }
       }
     }
   }
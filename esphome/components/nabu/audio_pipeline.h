@@ -6,17 +6,23 @@
 #include "audio_decoder.h"
 #include "audio_resampler.h"
 #include "audio_mixer.h"
+#include "audio_pcm_cache.h"
+#include "audio_ring_buffer.h"
+#include "audio_stats.h"
+#include "drift_compensator.h"
+#include "http_connection_pool.h"
 
 #include "esphome/components/media_player/media_player.h"
 
 #include "esphome/core/hal.h"
 #include "esphome/core/helpers.h"
-#include "esphome/core/ring_buffer.h"
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <freertos/queue.h>
 
+#include <atomic>
+
 namespace esphome {
 namespace nabu {
 
@@ -44,34 +50,94 @@ struct InfoErrorEvent {
   optional<esp_err_t> err;
   optional<media_player::MediaFileType> file_type;
   optional<media_player::StreamInfo> stream_info;
+  optional<uint32_t> duration_ms;
   optional<ResampleInfo> resample_info;
+  optional<AudioStageStats> stats;
 };
 
 class AudioPipeline {
  public:
-  AudioPipeline(AudioMixer *mixer, AudioPipelineType pipeline_type);
-
+  /// @param pcm_cache optional cache shared between pipelines; local media files are played from it when cached, and
+  /// added to it after playing in full otherwise
+  /// @param connection_pool optional pool shared between pipelines; HTTP streams reuse its idle connections
+  /// @param filter_bank_cache optional cache shared between pipelines; resampling filters are designed once per rate
+  /// @param resampler_quality highest resampling quality; lowered for later streams if resampling can't keep up, and
+  /// raised again once it has headroom
+  AudioPipeline(AudioMixer *mixer, AudioPipelineType pipeline_type, AudioPcmCache *pcm_cache = nullptr,
+                HttpConnectionPool *connection_pool = nullptr, FilterBankCache *filter_bank_cache = nullptr,
+                ResamplerQuality resampler_quality = ResamplerQuality::HIGH);
+
+  /// @param previous a pipeline of the same type that is still playing, or nullptr. If set, this pipeline reads and
+  /// decodes ahead but only writes to the mixer once previous has finished, so its audio directly follows previous's
+  /// last sample. Otherwise the mixer's ring buffer is cleared and playback starts right away.
   esp_err_t start(const std::string &uri, uint32_t target_sample_rate, const std::string &task_name,
-                  UBaseType_t priority = 1);
+                  UBaseType_t priority = 1, AudioPipeline *previous = nullptr);
   esp_err_t start(media_player::MediaFile *media_file, uint32_t target_sample_rate, const std::string &task_name,
-                  UBaseType_t priority = 1);
+                  UBaseType_t priority = 1, AudioPipeline *previous = nullptr);
 
+  /// @brief Stops all tasks and clears the mixer's ring buffer, unless this pipeline was still waiting on a previous
+  /// pipeline and never wrote to it
   esp_err_t stop();
 
   AudioPipelineState get_state();
 
   void reset_ring_buffers();
 
+  /// @brief Sets the highest resampling quality. The next stream resamples at it, even if an earlier stream had
+  /// lowered the quality.
+  void set_resampler_quality(ResamplerQuality resampler_quality);
+
  protected:
   esp_err_t allocate_buffers_();
-  esp_err_t common_start_(uint32_t target_sample_rate, const std::string &task_name, UBaseType_t priority);
+  esp_err_t common_start_(uint32_t target_sample_rate, const std::string &task_name, UBaseType_t priority,
+                          AudioPipeline *previous);
+
+  /// @brief Sets bits in the event group and wakes every task, so any task blocked on a ring buffer sees them
+  void set_event_bits_(uint32_t bits);
+
+  /// @brief Blocks the calling task until the previous pipeline has finished writing to the mixer
+  /// @return false if this pipeline was stopped while waiting
+  bool wait_for_previous_pipeline_();
+
+  /// @brief Returns the mixer's input ring buffer for this pipeline's type
+  AudioRingBuffer *get_mixer_ring_buffer_();
+
+  /// @brief Returns how many times the mixer has cleared the ring buffer for this pipeline's type
+  uint32_t get_mixer_clears_();
+
+  /// @brief Tells the mixer the channel count of the audio this pipeline writes from now on. Only call once the
+  /// previous pipeline has finished, as both write to the same ring buffer.
+  void set_mixer_channels_(uint8_t channels);
+
+  /// @brief Copies current_cached_pcm_ into the mixer's ring buffer, then releases it. Runs in the reader task.
+  /// @return the bytes copied and the time spent copying
+  AudioStageStats write_cached_pcm_();
 
   uint32_t target_sample_rate_;
 
   AudioMixer *mixer_;
 
+  // Set while this pipeline waits for another to finish before writing to the mixer; cleared once it may write. Set by
+  // start() and read by stop() in the caller's task, and cleared by the task that writes this pipeline's audio.
+  std::atomic<AudioPipeline *> previous_pipeline_{nullptr};
+
   std::string current_uri_{};
   media_player::MediaFile *current_media_file_{nullptr};
+  // Set by the reader task when the stream comes from an internet radio server, so it arrives at the rate of the
+  // server's clock
+  bool current_stream_live_{false};
+
+  AudioPcmCache *pcm_cache_;
+  // Set by start() when the media file is cached; the reader task copies it to the mixer instead of reading the file
+  std::shared_ptr<const CachedPcm> current_cached_pcm_;
+
+  HttpConnectionPool *connection_pool_;
+
+  FilterBankCache *filter_bank_cache_;
+
+  ResamplerQuality resampler_quality_;
+  // Cleared by set_resampler_quality(); the resample task then starts its next stream at resampler_quality_
+  bool resampler_quality_applied_{false};
 
   media_player::MediaFileType current_media_file_type_;
   media_player::StreamInfo current_stream_info_;
@@ -79,9 +145,8 @@ class AudioPipeline {
 
   AudioPipelineType pipeline_type_;
 
-  std::unique_ptr<RingBuffer> raw_file_ring_buffer_;
-  std::unique_ptr<RingBuffer> decoded_ring_buffer_;
-  std::unique_ptr<RingBuffer> resampled_ring_buffer_;
+  std::unique_ptr<AudioRingBuffer> raw_file_ring_buffer_;
+  std::unique_ptr<AudioRingBuffer> decoded_ring_buffer_;
 
   // Handles basic control/state of the three tasks
   EventGroupHandle_t event_group_{nullptr};
@@ -89,18 +154,19 @@ class AudioPipeline {
   // Receives detailed info (file type, stream info, resampling info) or specific errors from the three tasks
   QueueHandle_t info_error_queue_{nullptr};
 
+  // Set by start() while the tasks may already be running; every task reads all three in set_event_bits_()
   static void read_task_(void *params);
-  TaskHandle_t read_task_handle_{nullptr};
+  std::atomic<TaskHandle_t> read_task_handle_{nullptr};
   StaticTask_t read_task_stack_;
   StackType_t *read_task_stack_buffer_{nullptr};
 
   static void decode_task_(void *params);
-  TaskHandle_t decode_task_handle_{nullptr};
+  std::atomic<TaskHandle_t> decode_task_handle_{nullptr};
   StaticTask_t decode_task_stack_;
   StackType_t *decode_task_stack_buffer_{nullptr};
 
   static void resample_task_(void *params);
-  TaskHandle_t resample_task_handle_{nullptr};
+  std::atomic<TaskHandle_t> resample_task_handle_{nullptr};
   StaticTask_t resample_task_stack_;
   StackType_t *resample_task_stack_buffer_{nullptr};
 };
@@ -2,86 +2,113 @@
 
 #include "audio_reader.h"
 
-#include "esphome/core/ring_buffer.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
 
 namespace esphome {
 namespace nabu {
 
-AudioReader::AudioReader(esphome::RingBuffer *output_ring_buffer, size_t transfer_buffer_size) {
-  this->output_ring_buffer_ = output_ring_buffer;
-  this->transfer_buffer_size_ = transfer_buffer_size;
-}
-
-AudioReader::~AudioReader() {
-  if (this->transfer_buffer_ != nullptr) {
-    ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
-    allocator.deallocate(this->transfer_buffer_, this->transfer_buffer_size_);
-  }
-
-  this->cleanup_connection_();
-}
-
-esp_err_t AudioReader::allocate_buffers_() {
-  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
-  if (this->transfer_buffer_ == nullptr)
-    this->transfer_buffer_ = allocator.allocate(this->transfer_buffer_size_);
+static const char *const TAG = "nabu_media_player.reader";
 
-  if (this->transfer_buffer_ == nullptr)
-    return ESP_ERR_NO_MEM;
+// Consecutive reconnects without receiving any data before the stream fails
+static const uint8_t MAX_RESUME_ATTEMPTS = 5;
+// Each further reconnect waits this much longer after losing the connection
+static const uint32_t RESUME_BACKOFF_MS = 500;
 
-  return ESP_OK;
-}
+// Enough for the longest signature checked, "RIFF????WAVE", and an ID3v2 header
+static const size_t PROBE_BYTES = 12;
+// Smaller ID3v2 tags download faster than reconnecting to skip them
+static const size_t ID3_RANGE_SKIP_MIN_BYTES = 65536;
 
-esp_err_t AudioReader::start(media_player::MediaFile *media_file, media_player::MediaFileType &file_type) {
-  file_type = media_player::MediaFileType::NONE;
-
-  esp_err_t err = this->allocate_buffers_();
-  if (err != ESP_OK) {
-    return err;
+static media_player::MediaFileType sniff_file_type(const uint8_t *data, size_t length) {
+  if ((length >= 12) && (std::memcmp(data, "RIFF", 4) == 0) && (std::memcmp(data + 8, "WAVE", 4) == 0)) {
+    return media_player::MediaFileType::WAV;
   }
+  if ((length >= 4) && (std::memcmp(data, "fLaC", 4) == 0)) {
+    return media_player::MediaFileType::FLAC;
+  }
+  if ((length >= 3) && (std::memcmp(data, "ID3", 3) == 0)) {
+    return media_player::MediaFileType::MP3;
+  }
+  // MPEG audio frame sync with a layer set; rules out ADTS AAC, which has layer 0
+  if ((length >= 2) && (data[0] == 0xFF) && ((data[1] & 0xE0) == 0xE0) && ((data[1] & 0x06) != 0)) {
+    return media_player::MediaFileType::MP3;
+  }
+  return media_player::MediaFileType::NONE;
+}
 
-  this->current_media_file_ = media_file;
-
-  this->media_file_data_current_ = media_file->data;
-  this->media_file_bytes_left_ = media_file->length;
-  file_type = media_file->file_type;
-
-  return ESP_OK;
+AudioReader::AudioReader(AudioRingBuffer *output_ring_buffer, size_t transfer_size,
+                         HttpConnectionPool *connection_pool) {
+  this->output_ring_buffer_ = output_ring_buffer;
+  this->transfer_size_ = transfer_size;
+  this->connection_pool_ = connection_pool;
 }
 
+AudioReader::~AudioReader() { this->cleanup_connection_(); }
+
 esp_err_t AudioReader::start(const std::string &uri, media_player::MediaFileType &file_type) {
   file_type = media_player::MediaFileType::NONE;
 
-  esp_err_t err = this->allocate_buffers_();
-  if (err != ESP_OK) {
-    return err;
-  }
-
   this->cleanup_connection_();
 
+  this->stream_offset_ = 0;
+  this->stream_length_ = -1;
+  this->connection_lost_ = false;
+  this->resume_attempts_ = 0;
+  this->content_file_type_ = media_player::MediaFileType::NONE;
+  this->accepts_ranges_ = false;
+  this->icy_headers_ = false;
+
   if (uri.empty()) {
     return ESP_ERR_INVALID_ARG;
   }
 
-  esp_http_client_config_t config = {
-      .url = uri.c_str(),
-      .cert_pem = nullptr,
-      .disable_auto_redirect = false,
-      .max_redirection_count = 10,
-  };
-  this->client_ = esp_http_client_init(&config);
+  esp_err_t err = ESP_FAIL;
+
+  if (this->connection_pool_ != nullptr) {
+    this->client_ = this->connection_pool_->acquire(uri);
+    if (this->client_ != nullptr) {
+      esp_http_client_set_user_data(this->client_, this);
+      err = this->open_connection_(true);
+      if (err != ESP_OK) {
+        // The server likely closed the idle connection; retry once on a new one
+        this->cleanup_connection_();
+      }
+    }
+  }
 
   if (this->client_ == nullptr) {
-    return ESP_FAIL;
-  }
+    esp_http_client_config_t config = {
+        .url = uri.c_str(),
+        .cert_pem = nullptr,
+        .disable_auto_redirect = false,
+        .max_redirection_count = 10,
+        .event_handler = http_event_handler_,
+    };
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    // This component doesn't enable session tickets, so this only applies to configurations that do. Even then, the
+    // session is kept per client and only shortens the handshake when this client reconnects, e.g., to resume a
+    // dropped stream. Across streams, only the connection pool avoids the handshake.
+    config.save_client_session = true;
+#endif
+    this->client_ = esp_http_client_init(&config);
+
+    if (this->client_ == nullptr) {
+      return ESP_FAIL;
+    }
+    esp_http_client_set_user_data(this->client_, this);
 
-  if ((err = esp_http_client_open(this->client_, 0)) != ESP_OK) {
-    this->cleanup_connection_();
-    return err;
+    err = this->open_connection_(false);
+    if (err != ESP_OK) {
+      this->cleanup_connection_();
+      return err;
+    }
   }
 
-  int content_length = esp_http_client_fetch_headers(this->client_);
-
   char url[500];
   err = esp_http_client_get_url(this->client_, url, 500);
   if (err != ESP_OK) {
@@ -90,6 +117,7 @@ esp_err_t AudioReader::start(const std::string &uri, media_player::MediaFileType
   }
 
   std::string url_string = url;
+  this->client_url_ = url_string;
 
   if (str_endswith(url_string, ".wav")) {
     file_type = media_player::MediaFileType::WAV;
@@ -99,59 +127,202 @@ esp_err_t AudioReader::start(const std::string &uri, media_player::MediaFileType
     file_type = media_player::MediaFileType::FLAC;
   }
 
+  if (this->content_file_type_ != media_player::MediaFileType::NONE) {
+    file_type = this->content_file_type_;
+  }
+
+  media_player::MediaFileType probed_file_type = this->probe_file_type_();
+  if (probed_file_type != media_player::MediaFileType::NONE) {
+    file_type = probed_file_type;
+  }
+
   return ESP_OK;
 }
 
 AudioReaderState AudioReader::read() {
   if (this->client_ != nullptr) {
     return this->http_read_();
-  } else if (this->current_media_file_ != nullptr) {
-    return this->file_read_();
   }
 
   return AudioReaderState::INITIALIZED;
 }
 
-AudioReaderState AudioReader::file_read_() {
-  if (this->media_file_bytes_left_ > 0) {
-    size_t bytes_to_write = std::min(this->media_file_bytes_left_, this->output_ring_buffer_->free());
-
-    if (bytes_to_write == 0) {
-      return AudioReaderState::READING;
-    }
-
-    size_t bytes_written = this->output_ring_buffer_->write((void *) this->media_file_data_current_, bytes_to_write);
-    this->media_file_bytes_left_ -= bytes_written;
-    this->media_file_data_current_ += bytes_written;
-
-    return AudioReaderState::READING;
+AudioReaderState AudioReader::http_read_() {
+  if (this->connection_lost_) {
+    return this->resume_();
   }
-  return AudioReaderState::FINISHED;
-}
 
-AudioReaderState AudioReader::http_read_() {
-  size_t bytes_to_read = this->output_ring_buffer_->free();
+  // Receive directly into the ring buffer
+  uint8_t *ring_buffer_data;
+  size_t bytes_to_read = this->output_ring_buffer_->acquire_write(&ring_buffer_data, this->transfer_size_);
 
   if (bytes_to_read == 0) {
     return AudioReaderState::READING;
   }
 
-  int received_len = esp_http_client_read(this->client_, (char *) this->transfer_buffer_, bytes_to_read);
+  int received_len = esp_http_client_read(this->client_, (char *) ring_buffer_data, bytes_to_read);
 
   if (received_len > 0) {
-    this->output_ring_buffer_->write((void *) this->transfer_buffer_, received_len);
-  } else if (received_len < 0) {
-    // TODO: Error situation. Should we mark failed..?
+    this->output_ring_buffer_->commit_write(received_len);
+    this->stats_.bytes_read += received_len;
+    this->stats_.bytes_written += received_len;
+    this->stream_offset_ += received_len;
+    this->resume_attempts_ = 0;
   }
 
   if (esp_http_client_is_complete_data_received(this->client_)) {
-    this->cleanup_connection_();
+    if (this->connection_pool_ != nullptr) {
+      // Pooled connections outlive this reader
+      esp_http_client_set_user_data(this->client_, nullptr);
+      this->connection_pool_->release(this->client_url_, this->client_);
+      this->client_ = nullptr;
+    } else {
+      this->cleanup_connection_();
+    }
     return AudioReaderState::FINISHED;
   }
 
+  // Without a known length, receiving nothing may just be the end of the stream. A server without range support can't
+  // resume, and the failed read may only have been a timeout on a slow link, so keep reading the same connection.
+  if (this->accepts_ranges_ && ((received_len < 0) || ((received_len == 0) && (this->stream_length_ >= 0)))) {
+    ESP_LOGW(TAG, "Connection lost after %" PRId64 " bytes", this->stream_offset_);
+    esp_http_client_close(this->client_);
+    this->connection_lost_ = true;
+    this->connection_lost_ms_ = millis();
+  }
+
   return AudioReaderState::READING;
 }
 
+AudioReaderState AudioReader::resume_() {
+  if (this->resume_attempts_ >= MAX_RESUME_ATTEMPTS) {
+    ESP_LOGE(TAG, "Couldn't resume the stream after %u attempts", this->resume_attempts_);
+    this->cleanup_connection_();
+    return AudioReaderState::FAILED;
+  }
+
+  if ((millis() - this->connection_lost_ms_) < RESUME_BACKOFF_MS * this->resume_attempts_) {
+    return AudioReaderState::READING;
+  }
+  ++this->resume_attempts_;
+
+  char range[32];
+  snprintf(range, sizeof(range), "bytes=%" PRId64 "-", this->stream_offset_);
+  esp_http_client_set_header(this->client_, "Range", range);
+  esp_err_t err = esp_http_client_open(this->client_, 0);
+  int64_t content_length = (err == ESP_OK) ? esp_http_client_fetch_headers(this->client_) : -1;
+  // The connection may be pooled and reused for other requests later
+  esp_http_client_delete_header(this->client_, "Range");
+
+  // A partial response always has a length or is chunked; without either the server didn't respond, so retry later
+  if ((err != ESP_OK) || ((content_length < 0) && !esp_http_client_is_chunked_response(this->client_))) {
+    esp_http_client_close(this->client_);
+    this->connection_lost_ms_ = millis();
+    return AudioReaderState::READING;
+  }
+
+  // Anything but the exact rest of the same response would leave a gap or a repeat in the audio
+  const int status_code = esp_http_client_get_status_code(this->client_);
+  if ((status_code != 206) ||
+      ((this->stream_length_ >= 0) && (content_length != this->stream_length_ - this->stream_offset_))) {
+    ESP_LOGE(TAG, "Server didn't resume the stream (HTTP status %d)", status_code);
+    this->cleanup_connection_();
+    return AudioReaderState::FAILED;
+  }
+
+  ESP_LOGD(TAG, "Resumed the stream at byte %" PRId64, this->stream_offset_);
+  this->connection_lost_ = false;
+  return AudioReaderState::READING;
+}
+
+esp_err_t AudioReader::http_event_handler_(esp_http_client_event_t *event) {
+  AudioReader *this_reader = (AudioReader *) event->user_data;
+  if ((this_reader == nullptr) || (event->event_id != HTTP_EVENT_ON_HEADER)) {
+    return ESP_OK;
+  }
+
+  if (str_equals_case_insensitive(event->header_key, "Accept-Ranges")) {
+    this_reader->accepts_ranges_ = str_equals_case_insensitive(event->header_value, "bytes");
+    return ESP_OK;
+  }
+
+  if (str_startswith(str_lower_case(event->header_key), "icy-")) {
+    this_reader->icy_headers_ = true;
+    return ESP_OK;
+  }
+
+  if (!str_equals_case_insensitive(event->header_key, "Content-Type")) {
+    return ESP_OK;
+  }
+
+  const std::string content_type = str_lower_case(event->header_value);
+  if (content_type.find("wav") != std::string::npos) {
+    this_reader->content_file_type_ = media_player::MediaFileType::WAV;
+  } else if (content_type.find("flac") != std::string::npos) {
+    this_reader->content_file_type_ = media_player::MediaFileType::FLAC;
+  } else if ((content_type.find("mpeg") != std::string::npos) || (content_type.find("mp3") != std::string::npos)) {
+    this_reader->content_file_type_ = media_player::MediaFileType::MP3;
+  }
+
+  return ESP_OK;
+}
+
+media_player::MediaFileType AudioReader::probe_file_type_() {
+  uint8_t header[PROBE_BYTES];
+  size_t header_length = 0;
+
+  while (header_length < PROBE_BYTES) {
+    // A lost connection is noticed, and resumed, by the next read
+    int received_len =
+        esp_http_client_read(this->client_, (char *) header + header_length, PROBE_BYTES - header_length);
+    if (received_len <= 0) {
+      break;
+    }
+    header_length += received_len;
+
+    if (esp_http_client_is_complete_data_received(this->client_)) {
+      break;
+    }
+  }
+
+  this->stats_.bytes_read += header_length;
+  this->stream_offset_ += header_length;
+
+  const size_t id3_tag_size = (header_length >= ID3V2_HEADER_SIZE) ? id3v2_tag_size(header) : 0;
+  if ((id3_tag_size >= ID3_RANGE_SKIP_MIN_BYTES) && this->accepts_ranges_ &&
+      ((this->stream_length_ < 0) || (id3_tag_size < this->stream_length_))) {
+    // Mostly album art; resume the stream after it as if the connection was lost there
+    ESP_LOGD(TAG, "Skipping a %zu byte ID3 tag", id3_tag_size);
+    esp_http_client_close(this->client_);
+    this->stream_offset_ = id3_tag_size;
+    this->connection_lost_ = true;
+    this->connection_lost_ms_ = millis();
+  } else {
+    this->output_ring_buffer_->write(header, header_length);
+    this->stats_.bytes_written += header_length;
+  }
+
+  return sniff_file_type(header, header_length);
+}
+
+esp_err_t AudioReader::open_connection_(bool reused) {
+  esp_err_t err = esp_http_client_open(this->client_, 0);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  int64_t content_length = esp_http_client_fetch_headers(this->client_);
+  this->stream_length_ = esp_http_client_is_chunked_response(this->client_) ? -1 : content_length;
+
+  // A reused connection only sees the server's close once it reads. Pooled connections ended with a complete
+  // response, so their server sends a content length or a chunked response.
+  if (reused && (content_length < 0) && !esp_http_client_is_chunked_response(this->client_)) {
+    return ESP_FAIL;
+  }
+
+  return ESP_OK;
+}
+
 void AudioReader::cleanup_connection_() {
   if (this->client_ != nullptr) {
     esp_http_client_close(this->client_);
@@ -2,8 +2,12 @@
 
 #ifdef USE_ESP_IDF
 
+#include "audio_decoder.h"
+#include "audio_ring_buffer.h"
+#include "audio_stats.h"
+#include "http_connection_pool.h"
+
 #include "esphome/components/media_player/media_player.h"
-#include "esphome/core/ring_buffer.h"
 
 #include <esp_http_client.h>
 
@@ -19,31 +23,72 @@ enum class AudioReaderState : uint8_t {
 
 class AudioReader {
  public:
-  AudioReader(esphome::RingBuffer *output_ring_buffer, size_t transfer_buffer_size);
+  /// @param transfer_size the most bytes received from an HTTP stream at once; received directly into the ring buffer
+  /// @param connection_pool optional pool shared between readers; connections are taken from it when possible and
+  /// handed back to it once a response is read completely
+  AudioReader(AudioRingBuffer *output_ring_buffer, size_t transfer_size,
+              HttpConnectionPool *connection_pool = nullptr);
   ~AudioReader();
 
+  /// @brief Connects to the uri and determines the file type from the first bytes received, the Content-Type header,
+  /// or the uri's extension, in that order
   esp_err_t start(const std::string &uri, media_player::MediaFileType &file_type);
-  esp_err_t start(media_player::MediaFile *media_file, media_player::MediaFileType &file_type);
 
   AudioReaderState read();
 
- protected:
-  esp_err_t allocate_buffers_();
+  const AudioStageStats &get_stats() const { return this->stats_; }
+
+  /// @brief Whether the response comes from an internet radio server, which sends the stream at the rate of its own
+  /// clock rather than as fast as it can be read. Recognized by its Icecast or SHOUTcast "icy-" headers; a response
+  /// without a length alone doesn't tell, as chunked file downloads have none either.
+  bool is_live() const { return (this->stream_length_ < 0) && this->icy_headers_; }
 
-  AudioReaderState file_read_();
+ protected:
   AudioReaderState http_read_();
 
+  static esp_err_t http_event_handler_(esp_http_client_event_t *event);
+
+  /// @brief Receives the first bytes of the response and identifies their format. Passes them on to the ring buffer,
+  /// unless they start a large ID3v2 tag that the server lets the reader skip with a range request.
+  /// @return the file type or NONE if the bytes aren't recognized
+  media_player::MediaFileType probe_file_type_();
+
+  /// @brief Reconnects a lost stream with a range request for the rest of the response
+  /// @return READING if resumed or to retry later, FAILED if the stream can't continue where it left off
+  AudioReaderState resume_();
+
+  /// @brief Sends the request for the client's uri and receives the response headers
+  /// @param reused whether the connection came from the pool, and so may have been closed by the server
+  /// @return ESP_OK unless the request failed
+  esp_err_t open_connection_(bool reused);
+
   void cleanup_connection_();
 
-  esphome::RingBuffer *output_ring_buffer_;
-  uint8_t *transfer_buffer_{nullptr};
-  size_t transfer_buffer_size_;
+  AudioRingBuffer *output_ring_buffer_;
+  size_t transfer_size_;
+
+  HttpConnectionPool *connection_pool_;
 
   esp_http_client_handle_t client_{nullptr};
+  // The uri the connection last requested after any redirects; the connection is pooled under its server
+  std::string client_url_{};
+  // File type named by the response's Content-Type header
+  media_player::MediaFileType content_file_type_{media_player::MediaFileType::NONE};
+  // Whether the response's Accept-Ranges header allows range requests
+  bool accepts_ranges_{false};
+  // Whether the response has Icecast or SHOUTcast "icy-" headers
+  bool icy_headers_{false};
+
+  // Bytes of the response received and the response's full length (-1 if unknown), so a dropped connection can
+  // resume where it left off
+  int64_t stream_offset_{0};
+  int64_t stream_length_{-1};
+
+  bool connection_lost_{false};
+  uint32_t connection_lost_ms_{0};
+  uint8_t resume_attempts_{0};
 
-  media_player::MediaFile *current_media_file_{nullptr};
-  size_t media_file_bytes_left_;
-  const uint8_t *media_file_data_current_;
+  AudioStageStats stats_;
 };
 }  // namespace nabu
 }  // namespace esphome
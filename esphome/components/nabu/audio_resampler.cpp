@@ -2,36 +2,98 @@
 
 #include "audio_resampler.h"
 
-#include "esphome/core/ring_buffer.h"
+#include "audio_samples.h"
 
 namespace esphome {
 namespace nabu {
 
-static const size_t NUM_TAPS = 32;
-static const size_t NUM_FILTERS = 32;
-static const bool USE_PRE_POST_FILTER = true;
+// Filter sizes for each quality, indexed by ResamplerQuality. Common rate pairs use the polyphase resampler; any other
+// pair uses the general sinc resampler, which interpolates between filters in float and costs more per tap.
+//
+// Host benchmark from tests/host/nabu/resampler_benchmark.cpp; 16 bit stereo in and out, a half scale tone, CPU
+// time per second of audio on x86 (best of 15, with the qualities taking turns; compare rows within a rate pair, as
+// whole runs vary by up to 1.5x):
+//
+//   quality    rates             path        CPU    THD+N at 1 kHz    THD+N near the top of the band
+//   fast       44.1 -> 48 kHz    polyphase   2.0 ms        -84 dB            -84 dB at 15 kHz
+//   balanced   44.1 -> 48 kHz    polyphase   1.9 ms        -84 dB            -84 dB at 15 kHz
+//   high       44.1 -> 48 kHz    polyphase   3.7 ms        -82 dB            -82 dB at 15 kHz
+//   fast       22.05 -> 48 kHz   polyphase   1.8 ms        -84 dB            -84 dB at 9 kHz
+//   balanced   22.05 -> 48 kHz   polyphase   2.2 ms        -84 dB            -84 dB at 9 kHz
+//   high       22.05 -> 48 kHz   polyphase   3.6 ms        -81 dB            -83 dB at 9 kHz
+//   fast       16 -> 48 kHz      polyphase   1.8 ms        -88 dB            -85 dB at 7 kHz
+//   balanced   16 -> 48 kHz      polyphase   2.1 ms        -88 dB            -85 dB at 7 kHz
+//   high       16 -> 48 kHz      polyphase   4.2 ms        -88 dB            -88 dB at 7 kHz
+//   fast       22.05 -> 16 kHz   polyphase   1.1 ms        -83 dB            -82 dB at 7 kHz
+//   balanced   22.05 -> 16 kHz   polyphase   1.1 ms        -83 dB            -82 dB at 7 kHz
+//   high       22.05 -> 16 kHz   polyphase   1.8 ms        -81 dB            -80 dB at 7 kHz
+//   fast       48.1 -> 48 kHz    sinc        3.2 ms        -76 dB            -40 dB at 15 kHz
+//   balanced   48.1 -> 48 kHz    sinc        4.6 ms        -88 dB            -59 dB at 15 kHz
+//   high       48.1 -> 48 kHz    sinc        6.8 ms        -83 dB            -61 dB at 15 kHz
+//   fast       11.025 -> 48 kHz  sinc        4.1 ms        -53 dB            -22 dB at 4 kHz
+//   balanced   11.025 -> 48 kHz  sinc        5.6 ms        -78 dB            -44 dB at 4 kHz
+//   high       11.025 -> 48 kHz  sinc        8.5 ms        -58 dB            -46 dB at 4 kHz
+//   fast       11.025 -> 16 kHz  sinc        1.4 ms        -53 dB            -22 dB at 4 kHz
+//   balanced   11.025 -> 16 kHz  sinc        2.1 ms        -79 dB            -65 dB at 4 kHz
+//   high       11.025 -> 16 kHz  sinc        2.9 ms        -76 dB            -64 dB at 4 kHz
+//
+// The polyphase results sit at the 16 bit noise floor at every quality, so fast only saves CPU on the sinc path. With
+// 16 taps, fast's polyphase filter let the images of tones in the top fifth of the band through: -35 dB at 9 kHz for
+// 22.05 -> 48 kHz and -21 dB at 7 kHz for 16 -> 48 kHz. The sinc filters used before these profiles existed, 32 taps
+// and 32 filters without interpolation, measured -59 dB and -35 dB at 48.1 -> 48 kHz.
+struct ResamplerProfile {
+  uint16_t polyphase_taps;  // Coefficients per phase when not downsampling
+  uint16_t sinc_taps;       // Taps per sinc filter; a multiple of 4
+  uint16_t sinc_filters;    // Sinc filters across one input sample period
+  int sinc_flags;           // SUBSAMPLE_INTERPOLATE and BLACKMAN_HARRIS from resampler.h
+  bool pre_post_filter;     // Adds a fourth order biquad lowpass to the sinc resampler
+};
+
+static const ResamplerProfile RESAMPLER_PROFILES[] = {
+    {32, 8, 16, SUBSAMPLE_INTERPOLATE, false},                   // FAST
+    {32, 16, 32, SUBSAMPLE_INTERPOLATE | BLACKMAN_HARRIS, true},  // BALANCED
+    {64, 32, 64, SUBSAMPLE_INTERPOLATE | BLACKMAN_HARRIS, true},  // HIGH
+};
+
+// Mono and stereo streams keep their channel count; the mixer and speaker handle both
+static const uint8_t MAX_CHANNELS = 2;
+
+static void convert_samples(const uint8_t *input, uint8_t input_bytes_per_sample, uint8_t *output,
+                            uint8_t output_bytes_per_sample, size_t samples) {
+  for (size_t i = 0; i < samples; ++i) {
+    write_aligned_sample(read_aligned_sample(input, input_bytes_per_sample), output, output_bytes_per_sample);
+    input += input_bytes_per_sample;
+    output += output_bytes_per_sample;
+  }
+}
 
-// These output parameters are currently hardcoded in the elements further down the pipeline (mixer and speaker)
-static const uint8_t OUTPUT_CHANNELS = 2;
-static const uint8_t OUTPUT_BITS_PER_SAMPLE = 16;
+// Clips samples outside of the full scale range, as the filters can overshoot
+static inline void write_float_sample(float sample, uint8_t *output, uint8_t bytes_per_sample) {
+  if (bytes_per_sample == sizeof(int16_t)) {
+    *reinterpret_cast<int16_t *>(output) = static_cast<int16_t>(clamp<float>(sample * 32767, INT16_MIN, INT16_MAX));
+  } else {
+    float scaled_sample = sample * 2147483648.0f;
+    if (scaled_sample >= 2147483647.0f) {
+      *reinterpret_cast<int32_t *>(output) = INT32_MAX;
+    } else if (scaled_sample <= -2147483648.0f) {
+      *reinterpret_cast<int32_t *>(output) = INT32_MIN;
+    } else {
+      *reinterpret_cast<int32_t *>(output) = static_cast<int32_t>(scaled_sample);
+    }
+  }
+}
 
-AudioResampler::AudioResampler(RingBuffer *input_ring_buffer, RingBuffer *output_ring_buffer,
-                               size_t internal_buffer_samples) {
+AudioResampler::AudioResampler(AudioRingBuffer *input_ring_buffer, AudioRingBuffer *output_ring_buffer,
+                               size_t internal_buffer_samples, FilterBankCache *filter_bank_cache) {
   this->input_ring_buffer_ = input_ring_buffer;
   this->output_ring_buffer_ = output_ring_buffer;
   this->internal_buffer_samples_ = internal_buffer_samples;
+  this->filter_bank_cache_ = filter_bank_cache;
 }
 
 AudioResampler::~AudioResampler() {
-  ExternalRAMAllocator<int16_t> int16_allocator(ExternalRAMAllocator<int16_t>::ALLOW_FAILURE);
   ExternalRAMAllocator<float> float_allocator(ExternalRAMAllocator<float>::ALLOW_FAILURE);
 
-  if (this->input_buffer_ != nullptr) {
-    int16_allocator.deallocate(this->input_buffer_, this->internal_buffer_samples_);
-  }
-  if (this->output_buffer_ != nullptr) {
-    int16_allocator.deallocate(this->output_buffer_, this->internal_buffer_samples_);
-  }
   if (this->float_input_buffer_ != nullptr) {
     float_allocator.deallocate(this->float_input_buffer_, this->internal_buffer_samples_);
   }
@@ -42,130 +104,190 @@ AudioResampler::~AudioResampler() {
     resampleFree(this->resampler_);
     this->resampler_ = nullptr;
   }
-
-  // dsps_fird_s16_aexx_free(&this->fir_filter_);
 }
 
 esp_err_t AudioResampler::allocate_buffers_() {
-  ExternalRAMAllocator<int16_t> int16_allocator(ExternalRAMAllocator<int16_t>::ALLOW_FAILURE);
   ExternalRAMAllocator<float> float_allocator(ExternalRAMAllocator<float>::ALLOW_FAILURE);
 
-  if (this->input_buffer_ == nullptr)
-    this->input_buffer_ = int16_allocator.allocate(this->internal_buffer_samples_);
-  if (this->output_buffer_ == nullptr)
-    this->output_buffer_ = int16_allocator.allocate(this->internal_buffer_samples_);
-
   if (this->float_input_buffer_ == nullptr)
     this->float_input_buffer_ = float_allocator.allocate(this->internal_buffer_samples_);
 
   if (this->float_output_buffer_ == nullptr)
     this->float_output_buffer_ = float_allocator.allocate(this->internal_buffer_samples_);
 
-  if ((this->input_buffer_ == nullptr) || (this->output_buffer_ == nullptr) || (this->float_input_buffer_ == nullptr) ||
-      (this->float_output_buffer_ == nullptr)) {
+  if ((this->float_input_buffer_ == nullptr) || (this->float_output_buffer_ == nullptr)) {
     return ESP_ERR_NO_MEM;
   }
 
+  this->stats_.buffer_bytes = 2 * this->internal_buffer_samples_ * sizeof(float);
+
   return ESP_OK;
 }
 
-esp_err_t AudioResampler::start(media_player::StreamInfo &stream_info, uint32_t target_sample_rate,
-                                ResampleInfo &resample_info) {
-  esp_err_t err = this->allocate_buffers_();
-  if (err != ESP_OK) {
-    return err;
-  }
+void AudioResampler::deinterleave_to_float_(const uint8_t *input, size_t frames) {
+  const uint8_t channels = this->stream_info_.channels;
+  const size_t plane_length = this->internal_buffer_samples_ / channels;
+  const size_t frame_bytes = channels * this->input_bytes_per_sample_;
 
-  this->stream_info_ = stream_info;
+  for (uint8_t channel = 0; channel < channels; ++channel) {
+    const uint8_t *source = input + channel * this->input_bytes_per_sample_;
+    float *plane = this->float_input_buffer_ + channel * plane_length;
 
-  this->input_buffer_current_ = this->input_buffer_;
-  this->input_buffer_length_ = 0;
-  this->float_input_buffer_current_ = this->float_input_buffer_;
-  this->float_input_buffer_length_ = 0;
+    for (size_t i = 0; i < frames; ++i) {
+      plane[i] = static_cast<float>(read_aligned_sample(source, this->input_bytes_per_sample_)) / 2147483648.0f;
+      source += frame_bytes;
+    }
+  }
+}
 
-  this->output_buffer_current_ = this->output_buffer_;
-  this->output_buffer_length_ = 0;
-  this->float_output_buffer_current_ = this->float_output_buffer_;
-  this->float_output_buffer_length_ = 0;
+void AudioResampler::interleave_from_float_(uint8_t *output, size_t frames) {
+  const uint8_t channels = this->stream_info_.channels;
+  const size_t plane_length = this->internal_buffer_samples_ / channels;
+  const size_t frame_bytes = channels * this->output_bytes_per_sample_;
 
-  resample_info.mono_to_stereo = (stream_info.channels != 2);
+  for (uint8_t channel = 0; channel < channels; ++channel) {
+    const float *plane = this->float_output_buffer_ + channel * plane_length;
+    uint8_t *destination = output + channel * this->output_bytes_per_sample_;
 
-  if ((stream_info.channels > OUTPUT_CHANNELS) || (stream_info_.bits_per_sample != OUTPUT_BITS_PER_SAMPLE)) {
-    return ESP_ERR_NOT_SUPPORTED;
+    for (size_t i = 0; i < frames; ++i) {
+      write_float_sample(plane[i], destination, this->output_bytes_per_sample_);
+      destination += frame_bytes;
+    }
   }
+}
 
-  if (stream_info.channels > 0) {
-    this->channel_factor_ = 2 / stream_info.channels;
+esp_err_t AudioResampler::start(media_player::StreamInfo &stream_info, uint32_t target_sample_rate,
+                                uint8_t target_bits_per_sample, ResampleInfo &resample_info) {
+  this->stream_info_ = stream_info;
+  this->stats_.reset();
+  this->lowpass_ratio_ = 1.0;
+  this->pre_filter_ = false;
+  this->post_filter_ = false;
+
+  if ((stream_info.channels == 0) || (stream_info.channels > MAX_CHANNELS) ||
+      ((stream_info.bits_per_sample != 16) && (stream_info.bits_per_sample != 24) &&
+       (stream_info.bits_per_sample != 32)) ||
+      ((target_bits_per_sample != 16) && (target_bits_per_sample != 32))) {
+    return ESP_ERR_NOT_SUPPORTED;
   }
 
-  if (stream_info.sample_rate != target_sample_rate) {
-    // if (stream_info.sample_rate == 48000) {
-    //   // Special case, we can do this a lot faster with esp-dsp code!
-    //   const uint8_t decimation = 48000 / 16000;
-    //   const float fir_out_offset = 0;  //((FIR_FILTER_LENGTH / decimation / 2) - 1);
-
-    //   int8_t shift = this->generate_q15_fir_coefficients_(this->fir_filter_coeffecients_, (uint32_t)
-    //   FIR_FILTER_LENGTH,
-    //                                                       (float) 0.5 / decimation);
-    //   // dsps_16_array_rev(this->fir_filter_coeffecients_, (uint32_t) FIR_FILTER_LENGTH);
-    //   dsps_fird_init_s16(&this->fir_filter_, this->fir_filter_coeffecients_, this->fir_delay_, FIR_FILTER_LENGTH,
-    //                      decimation, fir_out_offset, -shift);
-    //   this->decimation_filter_ = true;
-    //   this->needs_resampling_ = true;
-    //   // memset(this->fir_delay_, 0, FIR_FILTER_LENGTH*sizeof(int16_t));
-    // } else
-    {
-      int flags = 0;
-
-      resample_info.resample = true;
-
-      this->sample_ratio_ = static_cast<float>(target_sample_rate) / static_cast<float>(stream_info.sample_rate);
-
-      if (this->sample_ratio_ < 1.0) {
-        this->lowpass_ratio_ -= (10.24 / 16);
-
-        if (this->lowpass_ratio_ < 0.84) {
-          this->lowpass_ratio_ = 0.84;
-        }
-
-        if (this->lowpass_ratio_ < this->sample_ratio_) {
-          // avoid discontinuities near unity sample ratios
-          this->lowpass_ratio_ = this->sample_ratio_;
-        }
+  this->input_bytes_per_sample_ = stream_info.bits_per_sample / 8;
+  this->output_bytes_per_sample_ = target_bits_per_sample / 8;
+
+  resample_info.resample = (stream_info.sample_rate != target_sample_rate) || this->compensate_drift_;
+  resample_info.quality = this->quality_;
+  resample_info.compensate_drift = this->compensate_drift_;
+  this->ratio_correction_ = 0.0f;
+
+  const ResamplerProfile &profile = RESAMPLER_PROFILES[static_cast<uint8_t>(this->quality_)];
+
+  if (resample_info.resample) {
+    this->sample_ratio_ = static_cast<float>(target_sample_rate) / static_cast<float>(stream_info.sample_rate);
+
+    // Common rate pairs reduce to a small rational ratio and use a precomputed polyphase filter. Only 16 bit streams
+    // converted to 16 bit samples use the narrower Q15 filter. Its ratio is fixed, so it can't compensate for drift.
+    if (this->compensate_drift_) {
+      this->polyphase_resampler_.reset();
+    } else {
+      if (this->polyphase_resampler_ == nullptr) {
+        this->polyphase_resampler_ = make_unique<PolyphaseResampler>();
       }
-      if (this->lowpass_ratio_ * this->sample_ratio_ < 0.98 && USE_PRE_POST_FILTER) {
-        float cutoff = this->lowpass_ratio_ * this->sample_ratio_ / 2.0;
-        biquad_lowpass(&this->lowpass_coeff_, cutoff);
-        this->pre_filter_ = true;
+      bool wide =
+          (this->input_bytes_per_sample_ != sizeof(int16_t)) || (this->output_bytes_per_sample_ != sizeof(int16_t));
+      if (this->polyphase_resampler_->start(stream_info.sample_rate, target_sample_rate, stream_info.channels, wide,
+                                            profile.polyphase_taps, this->filter_bank_cache_) != ESP_OK) {
+        // Fall back to the general sinc resampler
+        this->polyphase_resampler_.reset();
       }
+    }
+  }
 
-      if (this->lowpass_ratio_ / this->sample_ratio_ < 0.98 && USE_PRE_POST_FILTER && !this->pre_filter_) {
-        float cutoff = this->lowpass_ratio_ / this->sample_ratio_ / 2.0;
-        biquad_lowpass(&this->lowpass_coeff_, cutoff);
-        this->post_filter_ = true;
+  if (resample_info.resample && (this->polyphase_resampler_ == nullptr)) {
+    esp_err_t err = this->allocate_buffers_();
+    if (err != ESP_OK) {
+      return err;
+    }
+
+    int flags = profile.sinc_flags;
+    BiquadCoefficients lowpass_coeff;
+
+    if (this->sample_ratio_ < 1.0) {
+      this->lowpass_ratio_ -= (10.24 / 16);
+
+      if (this->lowpass_ratio_ < 0.84) {
+        this->lowpass_ratio_ = 0.84;
+      }
+
+      if (this->lowpass_ratio_ < this->sample_ratio_) {
+        // avoid discontinuities near unity sample ratios
+        this->lowpass_ratio_ = this->sample_ratio_;
       }
+    }
+    if (this->lowpass_ratio_ * this->sample_ratio_ < 0.98 && profile.pre_post_filter) {
+      float cutoff = this->lowpass_ratio_ * this->sample_ratio_ / 2.0;
+      biquad_lowpass(&lowpass_coeff, cutoff);
+      this->pre_filter_ = true;
+    }
+
+    if (this->lowpass_ratio_ / this->sample_ratio_ < 0.98 && profile.pre_post_filter && !this->pre_filter_) {
+      float cutoff = this->lowpass_ratio_ / this->sample_ratio_ / 2.0;
+      biquad_lowpass(&lowpass_coeff, cutoff);
+      this->post_filter_ = true;
+    }
+
+    if (this->pre_filter_ || this->post_filter_) {
+      // Two identical sections give a fourth order lowpass
+      this->lowpass_.start(stream_info.channels, 2);
+      this->lowpass_.set_section(0, lowpass_coeff);
+      this->lowpass_.set_section(1, lowpass_coeff);
+    }
+
+    float lowpass_ratio = 1.0;
+    if (this->sample_ratio_ < 1.0) {
+      lowpass_ratio = this->sample_ratio_ * this->lowpass_ratio_;
+    } else if (this->lowpass_ratio_ < 1.0) {
+      lowpass_ratio = this->lowpass_ratio_;
+    }
+    if (lowpass_ratio < 1.0) {
+      flags |= INCLUDE_LOWPASS;
+    }
 
-      if (this->pre_filter_ || this->post_filter_) {
-        for (int i = 0; i < stream_info.channels; ++i) {
-          biquad_init(&this->lowpass_[i][0], &this->lowpass_coeff_, 1.0);
-          biquad_init(&this->lowpass_[i][1], &this->lowpass_coeff_, 1.0);
-        }
+    const uint16_t taps = profile.sinc_taps;
+    const uint16_t filters = profile.sinc_filters;
+    const FilterBankKey key = {taps, static_cast<uint16_t>(filters + 1), lowpass_ratio,
+                               (flags & BLACKMAN_HARRIS) ? FilterWindow::BLACKMAN_HARRIS_4_TERM : FilterWindow::HANN,
+                               FilterFormat::FLOAT};
+
+    if ((this->resampler_ != nullptr) && (this->sinc_filter_bank_->key == key) &&
+        (this->resampler_->numChannels == stream_info.channels) &&
+        ((this->resampler_->flags & SUBSAMPLE_INTERPOLATE) == (flags & SUBSAMPLE_INTERPOLATE))) {
+      // Same filters as the previous stream, so only its history needs clearing
+      resampleReset(this->resampler_);
+    } else {
+      if (this->resampler_ != nullptr) {
+        resampleFree(this->resampler_);
+        this->resampler_ = nullptr;
       }
+      this->sinc_filter_bank_.reset();
 
-      if (this->sample_ratio_ < 1.0) {
-        this->resampler_ = resampleInit(stream_info.channels, NUM_TAPS, NUM_FILTERS,
-                                        this->sample_ratio_ * this->lowpass_ratio_, flags | INCLUDE_LOWPASS);
-      } else if (this->lowpass_ratio_ < 1.0) {
-        this->resampler_ =
-            resampleInit(stream_info.channels, NUM_TAPS, NUM_FILTERS, this->lowpass_ratio_, flags | INCLUDE_LOWPASS);
+      auto design = [=](void *coefficients) {
+        resampleDesignFilters(static_cast<float *>(coefficients), taps, filters, lowpass_ratio, flags);
+      };
+      if (this->filter_bank_cache_ != nullptr) {
+        this->sinc_filter_bank_ = this->filter_bank_cache_->get(key, design);
       } else {
-        this->resampler_ = resampleInit(stream_info.channels, NUM_TAPS, NUM_FILTERS, 1.0, flags);
+        this->sinc_filter_bank_ = FilterBank::create(key, design);
+      }
+      if (this->sinc_filter_bank_ == nullptr) {
+        return ESP_ERR_NO_MEM;
       }
 
-      resampleAdvancePosition(this->resampler_, NUM_TAPS / 2.0);
+      this->resampler_ =
+          resampleInitShared(stream_info.channels, taps, filters,
+                             static_cast<const float *>(this->sinc_filter_bank_->coefficients), flags);
     }
-  } else {
-    resample_info.resample = false;
+
+    resampleAdvancePosition(this->resampler_, taps / 2.0);
   }
 
   this->resample_info_ = resample_info;
@@ -174,241 +296,113 @@ esp_err_t AudioResampler::start(media_player::StreamInfo &stream_info, uint32_t
 
 AudioResamplerState AudioResampler::resample(bool stop_gracefully) {
   if (stop_gracefully) {
-    if ((this->input_ring_buffer_->available() == 0) && (this->output_ring_buffer_->available() == 0) &&
-        (this->input_buffer_length_ == 0) && (this->output_buffer_length_ == 0)) {
+    if ((this->input_ring_buffer_->available() == 0) && (this->output_ring_buffer_->available() == 0)) {
       return AudioResamplerState::FINISHED;
     }
   }
 
-  if (this->output_buffer_length_ > 0) {
-    size_t bytes_free = this->output_ring_buffer_->free();
-    size_t bytes_to_write = std::min(this->output_buffer_length_, bytes_free);
-
-    if (bytes_to_write > 0) {
-      size_t bytes_written = this->output_ring_buffer_->write((void *) this->output_buffer_current_, bytes_to_write);
-
-      this->output_buffer_current_ += bytes_written / sizeof(int16_t);
-      this->output_buffer_length_ -= bytes_written;
-    }
-
-    return AudioResamplerState::RESAMPLING;
-  }
+  // Samples are indiviudal 16, 24, or 32 bit values. Frames include 1 sample for mono and 2 samples for stereo
+  // Be careful converting between bytes, samples, and frames!
+  // 1 sample = input_bytes_per_sample_ bytes
+  // if mono:
+  //    1 frame = 1 sample
+  // if stereo:
+  //    1 frame = 2 samples (left and right)
+  // Output frames have as many samples as input frames
 
   //////
-  // Refill input buffer
+  // Get regions of the ring buffers to process in place
   //////
 
-  // Depending on if we are converting mono to stereo or if we are upsampling, we may need to restrict how many input
-  // samples we transfer
-  size_t max_input_samples = this->internal_buffer_samples_;
-
-  // Mono to stereo -> cut in half
-  max_input_samples /= (2 / this->stream_info_.channels);
-
-  if (this->sample_ratio_ > 1.0) {
-    // Upsampling -> reduce by a factor of the ceiling of sample_ratio_
-    uint32_t upsampling_factor = std::ceil(this->sample_ratio_);
-    max_input_samples /= upsampling_factor;
-  }
+  uint8_t *output_buffer;
+  const size_t output_frame_bytes = this->stream_info_.channels * this->output_bytes_per_sample_;
+  size_t output_frames_free =
+      this->output_ring_buffer_->acquire_write(&output_buffer, this->internal_buffer_samples_ * output_frame_bytes) /
+      output_frame_bytes;
 
-  // Move old data to the start of the buffer
-  if (this->input_buffer_length_ > 0) {
-    memmove((void *) this->input_buffer_, (void *) this->input_buffer_current_, this->input_buffer_length_);
+  if (output_frames_free == 0) {
+    // Output ring buffer is full
+    return AudioResamplerState::RESAMPLING;
   }
-  this->input_buffer_current_ = this->input_buffer_;
-
-  // Copy new data to the end of the of the buffer
-  size_t bytes_available = this->input_ring_buffer_->available();
-  size_t bytes_to_read = std::min(bytes_available, max_input_samples * sizeof(int16_t) - this->input_buffer_length_);
 
-  if (bytes_to_read > 0) {
-    int16_t *new_input_buffer_data = this->input_buffer_ + this->input_buffer_length_ / sizeof(int16_t);
-    size_t bytes_read = this->input_ring_buffer_->read((void *) new_input_buffer_data, bytes_to_read);
-
-    this->input_buffer_length_ += bytes_read;
+  float sample_ratio = this->sample_ratio_;
+  if (this->resample_info_.compensate_drift) {
+    sample_ratio *= 1.0f + this->ratio_correction_;
   }
 
+  // Limited by the internal buffers and by how many frames can fit in the output region
+  size_t max_input_frames = this->internal_buffer_samples_ / this->stream_info_.channels;
   if (this->resample_info_.resample) {
-    if (this->decimation_filter_) {
-      if (this->resample_info_.mono_to_stereo) {
-        if (this->input_buffer_length_ > 0) {
-          size_t available_samples = this->input_buffer_length_ / sizeof(int16_t);
-
-          if (available_samples / 3 == 0) {
-            this->input_buffer_current_ = this->input_buffer_;
-            this->input_buffer_length_ = 0;
-          } else {
-            dsps_fird_s16_ae32(&this->fir_filter_, this->input_buffer_current_, this->output_buffer_,
-                               available_samples / 3);
-
-            size_t output_samples = available_samples / 3;
-
-            this->input_buffer_current_ += output_samples * 3;
-            this->input_buffer_length_ -= output_samples * 3 * sizeof(int16_t);
-
-            this->output_buffer_current_ = this->output_buffer_;
-            this->output_buffer_length_ += output_samples * sizeof(int16_t);
-          }
-        }
-      } else {
-        // Interleaved stereo samples
-        // TODO: This doesn't sound correct! I need to use separate filters for each channel so the delay line isn't
-        // mixed
-        size_t available_samples = this->input_buffer_length_ / sizeof(int16_t);
-        for (int i = 0; i < available_samples / 2; ++i) {
-          // split interleaved samples into two separate streams
-          this->output_buffer_[i] = this->input_buffer_[2 * i];
-          this->output_buffer_[i + available_samples / 2] = this->input_buffer_[2 * i + 1];
-        }
-        std::memcpy(this->input_buffer_, this->output_buffer_, available_samples * sizeof(int16_t));
-        dsps_fird_s16_ae32(&this->fir_filter_, this->input_buffer_, this->output_buffer_, (available_samples / 3) / 2);
-        dsps_fird_s16_ae32(&this->fir_filter_, this->input_buffer_ + available_samples / 2,
-                           this->output_buffer_ + (available_samples / 3) / 2, (available_samples / 3) / 2);
-        std::memcpy(this->input_buffer_, this->output_buffer_, available_samples * sizeof(int16_t));
-        for (int i = 0; i < available_samples / 2; ++i) {
-          this->output_buffer_[2 * i] = this->input_buffer_[i];
-          this->output_buffer_[2 * i + 1] = this->input_buffer_[available_samples / 2 + i];
-        }
-
-        size_t output_samples = available_samples / 3;
-
-        this->input_buffer_current_ += output_samples * 3;
-        this->input_buffer_length_ -= output_samples * 3 * sizeof(int16_t);
-
-        this->output_buffer_current_ = this->output_buffer_;
-        this->output_buffer_length_ += output_samples * sizeof(int16_t);
-      }
-    } else {
-      if (this->input_buffer_length_ > 0) {
-        // Samples are indiviudal int16 values. Frames include 1 sample for mono and 2 samples for stereo
-        // Be careful converting between bytes, samples, and frames!
-        // 1 sample = 2 bytes = sizeof(int16_t)
-        // if mono:
-        //    1 frame = 1 sample
-        // if stereo:
-        //    1 frame = 2 samples (left and right)
-
-        size_t samples_read = this->input_buffer_length_ / sizeof(int16_t);
-
-        for (int i = 0; i < samples_read; ++i) {
-          this->float_input_buffer_[i] = static_cast<float>(this->input_buffer_[i]) / 32768.0f;
-        }
-
-        size_t frames_read = samples_read / this->stream_info_.channels;
-
-        if (this->pre_filter_) {
-          for (int i = 0; i < this->stream_info_.channels; ++i) {
-            biquad_apply_buffer(&this->lowpass_[i][0], this->float_input_buffer_ + i, frames_read,
-                                this->stream_info_.channels);
-            biquad_apply_buffer(&this->lowpass_[i][1], this->float_input_buffer_ + i, frames_read,
-                                this->stream_info_.channels);
-          }
-        }
-
-        ResampleResult res;
-
-        res = resampleProcessInterleaved(this->resampler_, this->float_input_buffer_, frames_read,
-                                         this->float_output_buffer_,
-                                         this->internal_buffer_samples_ / this->channel_factor_, this->sample_ratio_);
-
-        size_t frames_used = res.input_used;
-        size_t samples_used = frames_used * this->stream_info_.channels;
-
-        size_t frames_generated = res.output_generated;
-        if (this->post_filter_) {
-          for (int i = 0; i < this->stream_info_.channels; ++i) {
-            biquad_apply_buffer(&this->lowpass_[i][0], this->float_output_buffer_ + i, frames_generated,
-                                this->stream_info_.channels);
-            biquad_apply_buffer(&this->lowpass_[i][1], this->float_output_buffer_ + i, frames_generated,
-                                this->stream_info_.channels);
-          }
-        }
-
-        size_t samples_generated = frames_generated * this->stream_info_.channels;
-
-        for (int i = 0; i < samples_generated; ++i) {
-          this->output_buffer_[i] = static_cast<int16_t>(this->float_output_buffer_[i] * 32767);
-        }
-
-        this->input_buffer_current_ += samples_used;
-        this->input_buffer_length_ -= samples_used * sizeof(int16_t);
-
-        this->output_buffer_current_ = this->output_buffer_;
-        this->output_buffer_length_ += samples_generated * sizeof(int16_t);
-      }
-    }
+    max_input_frames = std::min(max_input_frames, static_cast<size_t>(output_frames_free / sample_ratio) + 1);
   } else {
-    size_t bytes_to_transfer =
-        std::min(this->internal_buffer_samples_ / this->channel_factor_ * sizeof(int16_t), this->input_buffer_length_);
-    std::memcpy((void *) this->output_buffer_, (void *) this->input_buffer_current_, bytes_to_transfer);
-
-    this->input_buffer_current_ += bytes_to_transfer / sizeof(int16_t);
-    this->input_buffer_length_ -= bytes_to_transfer;
-
-    this->output_buffer_current_ = this->output_buffer_;
-    this->output_buffer_length_ += bytes_to_transfer;
+    max_input_frames = std::min(max_input_frames, output_frames_free);
   }
 
-  if (this->resample_info_.mono_to_stereo) {
-    // Convert mono to stereo
-    for (int i = this->output_buffer_length_ / (sizeof(int16_t)) - 1; i >= 0; --i) {
-      this->output_buffer_[2 * i] = this->output_buffer_[i];
-      this->output_buffer_[2 * i + 1] = this->output_buffer_[i];
-    }
+  uint8_t *input_buffer;
+  const size_t input_frame_bytes = this->stream_info_.channels * this->input_bytes_per_sample_;
+  size_t input_frames =
+      this->input_ring_buffer_->acquire_read(&input_buffer, max_input_frames * input_frame_bytes) / input_frame_bytes;
 
-    this->output_buffer_length_ *= 2;  // double the bytes for stereo samples
+  if (input_frames == 0) {
+    // Not enough data for a full frame yet
+    return AudioResamplerState::RESAMPLING;
   }
-  return AudioResamplerState::RESAMPLING;
-}
 
-int16_t AudioResampler::float_to_q15_(float q, uint32_t shift) { return (int16_t) (q * pow(2, 15 + shift)); }
+  size_t frames_used = 0;
+  size_t frames_generated = 0;
+
+  if (this->resample_info_.resample && (this->polyphase_resampler_ != nullptr)) {
+    this->polyphase_resampler_->process(input_buffer, this->input_bytes_per_sample_, input_frames, output_buffer,
+                                        this->output_bytes_per_sample_, output_frames_free, frames_used,
+                                        frames_generated);
+  } else if (this->resample_info_.resample) {
+    const uint8_t channels = this->stream_info_.channels;
+    const size_t plane_length = this->internal_buffer_samples_ / channels;
+    float *input_planes[MAX_CHANNELS];
+    float *output_planes[MAX_CHANNELS];
+    for (uint8_t channel = 0; channel < channels; ++channel) {
+      input_planes[channel] = this->float_input_buffer_ + channel * plane_length;
+      output_planes[channel] = this->float_output_buffer_ + channel * plane_length;
+    }
 
-int8_t AudioResampler::generate_q15_fir_coefficients_(int16_t *fir_coeffs, const unsigned int fir_len, const float ft) {
-  // Even or odd length of the FIR filter
-  const bool is_odd = (fir_len % 2) ? (true) : (false);
-  const float fir_order = (float) (fir_len - 1);
+    this->deinterleave_to_float_(input_buffer, input_frames);
+    if (this->pre_filter_) {
+      this->lowpass_.process(input_planes, input_frames);
+    }
 
-  // Window coefficients
-  float *fir_window = (float *) malloc(fir_len * sizeof(float));
-  dsps_wind_blackman_harris_f32(fir_window, fir_len);
+    ResampleResult res = resampleProcess(this->resampler_, input_planes, input_frames, output_planes,
+                                         std::min(plane_length, output_frames_free), sample_ratio);
 
-  float *float_coeffs = (float *) malloc(fir_len * sizeof(float));
+    frames_used = res.input_used;
+    frames_generated = res.output_generated;
 
-  float max_coeff = 0.0;
-  float min_coeff = 0.0;
-  for (int i = 0; i < fir_len; i++) {
-    if ((i == fir_order / 2) && (is_odd)) {
-      float_coeffs[i] = 2 * ft;
-    } else {
-      float_coeffs[i] = sinf((2 * M_PI * ft * (i - fir_order / 2))) / (M_PI * (i - fir_order / 2));
+    if (this->post_filter_) {
+      this->lowpass_.process(output_planes, frames_generated);
     }
+    this->interleave_from_float_(output_buffer, frames_generated);
+  } else {
+    frames_used = input_frames;
+    frames_generated = input_frames;
 
-    float_coeffs[i] *= fir_window[i];
-    if (float_coeffs[i] > max_coeff) {
-      max_coeff = float_coeffs[i];
-    }
-    if (float_coeffs[i] < min_coeff) {
-      min_coeff = float_coeffs[i];
+    size_t samples_to_transfer = input_frames * this->stream_info_.channels;
+    if (this->input_bytes_per_sample_ == this->output_bytes_per_sample_) {
+      std::memcpy((void *) output_buffer, (void *) input_buffer, samples_to_transfer * this->input_bytes_per_sample_);
+    } else {
+      convert_samples(input_buffer, this->input_bytes_per_sample_, output_buffer, this->output_bytes_per_sample_,
+                      samples_to_transfer);
     }
   }
 
-  float max_abs_coeffs = fmaxf(fabsf(min_coeff), max_coeff);
+  this->input_ring_buffer_->commit_read(frames_used * input_frame_bytes);
+  this->stats_.bytes_read += frames_used * input_frame_bytes;
 
-  int32_t shift = 0;
-  for (int i = 1; i < 15; ++i) {
-    if (max_abs_coeffs < pow(2, -i)) {
-      ++shift;
-    }
-  }
-
-  for (int i = 0; i < fir_len; ++i) {
-    fir_coeffs[i] = float_to_q15_(float_coeffs[i], shift);
+  if (this->capture_ != nullptr) {
+    this->capture_->append(output_buffer, frames_generated * output_frame_bytes);
   }
+  this->output_ring_buffer_->commit_write(frames_generated * output_frame_bytes);
+  this->stats_.bytes_written += frames_generated * output_frame_bytes;
 
-  free(fir_window);
-  free(float_coeffs);
-
-  return shift;
+  return AudioResamplerState::RESAMPLING;
 }
 
 }  // namespace nabu
@@ -2,19 +2,21 @@
 
 #ifdef USE_ESP_IDF
 
-#include "biquad.h"
+#include "audio_pcm_cache.h"
+#include "audio_ring_buffer.h"
+#include "audio_stats.h"
+#include "biquad_cascade.h"
+#include "filter_bank_cache.h"
+#include "polyphase_resampler.h"
 #include "resampler.h"
 
 #include "esp_dsp.h"
 
 #include "esphome/components/media_player/media_player.h"
-#include "esphome/core/ring_buffer.h"
 
 namespace esphome {
 namespace nabu {
 
-static const uint32_t FIR_FILTER_LENGTH = 96;
-
 enum class AudioResamplerState : uint8_t {
   INITIALIZED = 0,
   RESAMPLING,
@@ -22,75 +24,105 @@ enum class AudioResamplerState : uint8_t {
   FAILED,
 };
 
+/// @brief Trades resampling quality for CPU time. Each level roughly doubles the filter length of the one below.
+enum class ResamplerQuality : uint8_t {
+  FAST = 0,  // Short filters; enough for speech
+  BALANCED,
+  HIGH,  // Longest filters; for music
+};
+
 struct ResampleInfo {
   bool resample;
-  bool mono_to_stereo;
+  ResamplerQuality quality;
+  bool compensate_drift;
 };
 
 class AudioResampler {
  public:
-  AudioResampler(esphome::RingBuffer *input_ring_buffer, esphome::RingBuffer *output_ring_buffer,
-                 size_t internal_buffer_samples);
+  /// @param internal_buffer_samples capacity of the float buffers used while resampling; also bounds how many samples
+  /// are processed at once
+  /// @param filter_bank_cache optional cache shared between resamplers; filters at the same rates are designed once
+  AudioResampler(AudioRingBuffer *input_ring_buffer, AudioRingBuffer *output_ring_buffer,
+                 size_t internal_buffer_samples, FilterBankCache *filter_bank_cache = nullptr);
   ~AudioResampler();
 
-  /// @brief Sets up the various bits necessary to resample
+  /// @brief Sets up the various bits necessary to resample. Can be called again for the next stream; filters and
+  /// buffers that still fit are reused and only their history is cleared.
   /// @param stream_info the incoming sample rate, bits per sample, and number of channels
   /// @param target_sample_rate the necessary sample rate to convert to
+  /// @param target_bits_per_sample the sample size to convert to; either 16 or 32 bits
   /// @return ESP_OK if it is able to convert the incoming stream or an error otherwise
-  esp_err_t start(media_player::StreamInfo &stream_info, uint32_t target_sample_rate, ResampleInfo &resample_info);
+  esp_err_t start(media_player::StreamInfo &stream_info, uint32_t target_sample_rate, uint8_t target_bits_per_sample,
+                  ResampleInfo &resample_info);
 
   AudioResamplerState resample(bool stop_gracefully);
 
+  /// @brief Sets the quality used from the next call to start
+  void set_quality(ResamplerQuality quality) { this->quality_ = quality; }
+
+  /// @brief Sets whether the next stream started has its ratio adjusted by set_ratio_correction. Such a stream always
+  /// uses the general sinc resampler, even if its sample rate already matches.
+  void set_drift_compensation(bool compensate_drift) { this->compensate_drift_ = compensate_drift; }
+
+  /// @brief Scales the resampling ratio by 1 + correction from the next call to resample, to follow a source whose
+  /// clock differs from the speaker's. Only used with drift compensation.
+  void set_ratio_correction(float correction) { this->ratio_correction_ = correction; }
+
+  /// @brief Copies all output into capture as well as the output ring buffer. Set to nullptr to stop capturing.
+  void set_capture(PcmCapture *capture) { this->capture_ = capture; }
+
+  const AudioStageStats &get_stats() const { return this->stats_; }
+
  protected:
   esp_err_t allocate_buffers_();
 
-  esphome::RingBuffer *input_ring_buffer_;
-  esphome::RingBuffer *output_ring_buffer_;
-  size_t internal_buffer_samples_;
+  /// @brief Converts interleaved input samples into one float plane per channel
+  void deinterleave_to_float_(const uint8_t *input, size_t frames);
 
-  int16_t *input_buffer_{nullptr};
-  int16_t *input_buffer_current_{nullptr};
-  size_t input_buffer_length_;
+  /// @brief Converts the float planes of resampled audio into interleaved output samples
+  void interleave_from_float_(uint8_t *output, size_t frames);
 
-  int16_t *output_buffer_{nullptr};
-  int16_t *output_buffer_current_{nullptr};
-  size_t output_buffer_length_;
+  // Samples are converted and resampled directly between regions of these ring buffers
+  AudioRingBuffer *input_ring_buffer_;
+  AudioRingBuffer *output_ring_buffer_;
+  size_t internal_buffer_samples_;
 
+  // Only allocated when the general sinc resampler is used. Each holds one plane per channel, each plane
+  // internal_buffer_samples_ / channels long, to match the planar sample histories in the resampler.
   float *float_input_buffer_{nullptr};
-  float *float_input_buffer_current_{nullptr};
-  size_t float_input_buffer_length_;
-
   float *float_output_buffer_{nullptr};
-  float *float_output_buffer_current_{nullptr};
-  size_t float_output_buffer_length_;
 
   media_player::StreamInfo stream_info_;
   ResampleInfo resample_info_;
-  // bool needs_resampling_{false};
-  // bool needs_mono_to_stereo_{false};
+
+  uint8_t input_bytes_per_sample_{sizeof(int16_t)};
+  uint8_t output_bytes_per_sample_{sizeof(int16_t)};
+
+  // Used for rate pairs with a small rational ratio; otherwise resampler_ is used
+  std::unique_ptr<PolyphaseResampler> polyphase_resampler_;
 
   Resample *resampler_{nullptr};
+  // The filters resampler_ borrows
+  std::shared_ptr<const FilterBank> sinc_filter_bank_;
+
+  FilterBankCache *filter_bank_cache_;
 
-  Biquad lowpass_[2][2];
-  BiquadCoefficients lowpass_coeff_;
+  // Applied before resampling when downsampling, otherwise after
+  BiquadCascade lowpass_;
+
+  ResamplerQuality quality_{ResamplerQuality::HIGH};
+  bool compensate_drift_{false};
+  float ratio_correction_{0.0f};
 
   float sample_ratio_{1.0};
   float lowpass_ratio_{1.0};
-  uint8_t channel_factor_{1};
 
   bool pre_filter_{false};
   bool post_filter_{false};
 
-  // The following is used to create faster decimation filter when we resample from 48 kHz to 16 kHz
-  // TODO: There seems to be some aliasing still...
-  fir_s16_t fir_filter_;
-
-  bool decimation_filter_{false};
-  alignas(16) int16_t fir_filter_coeffecients_[FIR_FILTER_LENGTH];
-  alignas(16) int16_t fir_delay_[FIR_FILTER_LENGTH];
+  PcmCapture *capture_{nullptr};
 
-  int16_t float_to_q15_(float q, uint32_t shift);
-  int8_t generate_q15_fir_coefficients_(int16_t *fir_coeffs, const unsigned int fir_len, const float ft);
+  AudioStageStats stats_;
 };
 }  // namespace nabu
 }  // namespace esphome
@@ -0,0 +1,194 @@
+#ifdef USE_ESP_IDF
+
+#include "audio_ring_buffer.h"
+
+#include "esphome/core/helpers.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace nabu {
+
+AudioRingBuffer::~AudioRingBuffer() {
+  if (this->storage_ != nullptr) {
+    ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+    allocator.deallocate(this->storage_, this->length_ + this->max_region_length_);
+  }
+}
+
+std::unique_ptr<AudioRingBuffer> AudioRingBuffer::create(size_t length, size_t max_region_length) {
+  if (length == 0) {
+    return nullptr;
+  }
+
+  size_t capacity = 1;
+  while (capacity < length) {
+    capacity <<= 1;
+  }
+
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  uint8_t *storage = allocator.allocate(capacity + max_region_length);
+  if (storage == nullptr) {
+    return nullptr;
+  }
+
+  return std::unique_ptr<AudioRingBuffer>(new AudioRingBuffer(storage, capacity, max_region_length));
+}
+
+size_t AudioRingBuffer::read(void *data, size_t length) {
+  uint8_t *destination = static_cast<uint8_t *>(data);
+  length = std::min(length, this->consumer_available_(length));
+
+  // Copy in at most two parts, straight from the ring, so reads don't touch the slack area
+  const size_t read_index = this->read_position_.load(std::memory_order_relaxed) & this->mask_;
+  size_t first_part = std::min(length, this->length_ - read_index);
+  std::memcpy(destination, this->storage_ + read_index, first_part);
+  std::memcpy(destination + first_part, this->storage_, length - first_part);
+
+  this->commit_read(length);
+  return length;
+}
+
+size_t AudioRingBuffer::write(const void *data, size_t length) {
+  const uint8_t *source = static_cast<const uint8_t *>(data);
+  length = std::min(length, this->producer_free_(length));
+
+  const size_t write_position = this->write_position_.load(std::memory_order_relaxed);
+  const size_t write_index = write_position & this->mask_;
+  size_t first_part = std::min(length, this->length_ - write_index);
+  std::memcpy(this->storage_ + write_index, source, first_part);
+  std::memcpy(this->storage_, source + first_part, length - first_part);
+
+  // Data was already written to its final place; only advance the write position
+  this->write_position_.store(write_position + length, std::memory_order_release);
+  this->check_available_watermark_();
+
+  return length;
+}
+
+size_t AudioRingBuffer::acquire_read(uint8_t **data, size_t length) {
+  length = std::min({length, this->consumer_available_(length), this->max_region_length_});
+
+  const size_t read_index = this->read_position_.load(std::memory_order_relaxed) & this->mask_;
+  size_t contiguous_length = this->length_ - read_index;
+  if (length > contiguous_length) {
+    // The region wraps around; mirror the bytes at the start of the ring into the slack area after the end
+    size_t wrapped_length = length - contiguous_length;
+    if (wrapped_length > this->mirrored_length_) {
+      std::memcpy(this->storage_ + this->length_ + this->mirrored_length_, this->storage_ + this->mirrored_length_,
+                  wrapped_length - this->mirrored_length_);
+      this->mirrored_length_ = wrapped_length;
+    }
+  }
+
+  *data = this->storage_ + read_index;
+  return length;
+}
+
+void AudioRingBuffer::commit_read(size_t length) {
+  const size_t read_position = this->read_position_.load(std::memory_order_relaxed);
+  if ((read_position & this->mask_) + length >= this->length_) {
+    // The mirrored bytes are consumed once the read index wraps around
+    this->mirrored_length_ = 0;
+  }
+  this->read_position_.store(read_position + length, std::memory_order_release);
+  this->check_free_watermark_();
+}
+
+size_t AudioRingBuffer::acquire_write(uint8_t **data, size_t length) {
+  *data = this->storage_ + (this->write_position_.load(std::memory_order_relaxed) & this->mask_);
+  return std::min({length, this->producer_free_(length), this->max_region_length_});
+}
+
+void AudioRingBuffer::commit_write(size_t length) {
+  const size_t write_position = this->write_position_.load(std::memory_order_relaxed);
+  const size_t end_index = (write_position & this->mask_) + length;
+  if (end_index > this->length_) {
+    // Move any bytes that spilled into the slack area to the start of the ring
+    std::memcpy(this->storage_, this->storage_ + this->length_, end_index - this->length_);
+  }
+  this->write_position_.store(write_position + length, std::memory_order_release);
+  this->check_available_watermark_();
+}
+
+void AudioRingBuffer::reset() {
+  // Skip the read position ahead to the write position; the producer's state is untouched
+  const size_t write_position = this->write_position_.load(std::memory_order_acquire);
+  this->consumer_write_position_ = write_position;
+  this->mirrored_length_ = 0;
+  this->read_position_.store(write_position, std::memory_order_release);
+  this->check_free_watermark_();
+}
+
+void AudioRingBuffer::notify_when_available(size_t length) {
+  if (length > this->length_) {
+    // Never met; a full ring buffer can only change when its consumer reads, so the caller isn't waiting on it
+    this->available_watermark_.store(0, std::memory_order_release);
+    return;
+  }
+  this->available_task_ = xTaskGetCurrentTaskHandle();
+  this->available_watermark_.store(std::max<size_t>(length, 1), std::memory_order_release);
+  // The producer may have committed the bytes before the watermark was set. The fence pairs with the one in
+  // check_available_watermark_, so at least one side sees the other's store and the notification isn't lost.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  this->check_available_watermark_();
+}
+
+void AudioRingBuffer::notify_when_free(size_t length) {
+  if (length > this->length_) {
+    // Never met; an empty ring buffer can only change when its producer writes, so the caller isn't waiting on it
+    this->free_watermark_.store(0, std::memory_order_release);
+    return;
+  }
+  this->free_task_ = xTaskGetCurrentTaskHandle();
+  this->free_watermark_.store(std::max<size_t>(length, 1), std::memory_order_release);
+  // The consumer may have committed the bytes before the watermark was set
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  this->check_free_watermark_();
+}
+
+size_t AudioRingBuffer::producer_free_(size_t length) {
+  const size_t write_position = this->write_position_.load(std::memory_order_relaxed);
+  size_t free_bytes = this->length_ - (write_position - this->producer_read_position_);
+  if (free_bytes < length) {
+    this->producer_read_position_ = this->read_position_.load(std::memory_order_acquire);
+    free_bytes = this->length_ - (write_position - this->producer_read_position_);
+  }
+  return free_bytes;
+}
+
+size_t AudioRingBuffer::consumer_available_(size_t length) {
+  const size_t read_position = this->read_position_.load(std::memory_order_relaxed);
+  size_t available_bytes = this->consumer_write_position_ - read_position;
+  if (available_bytes < length) {
+    this->consumer_write_position_ = this->write_position_.load(std::memory_order_acquire);
+    available_bytes = this->consumer_write_position_ - read_position;
+  }
+  return available_bytes;
+}
+
+void AudioRingBuffer::check_available_watermark_() {
+  // Orders the caller's position store before the watermark load
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  size_t watermark = this->available_watermark_.load(std::memory_order_acquire);
+  // Only one side can clear the watermark, so the task is notified once per request
+  if ((watermark > 0) && (this->available() >= watermark) &&
+      this->available_watermark_.compare_exchange_strong(watermark, 0, std::memory_order_acq_rel)) {
+    xTaskNotifyGive(this->available_task_);
+  }
+}
+
+void AudioRingBuffer::check_free_watermark_() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  size_t watermark = this->free_watermark_.load(std::memory_order_acquire);
+  if ((watermark > 0) && (this->free() >= watermark) &&
+      this->free_watermark_.compare_exchange_strong(watermark, 0, std::memory_order_acq_rel)) {
+    xTaskNotifyGive(this->free_task_);
+  }
+}
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,148 @@
+#pragma once
+
+#ifdef USE_ESP_IDF
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome {
+namespace nabu {
+
+/// @brief Single producer, single consumer byte ring buffer that hands out contiguous regions of its storage, so
+/// pipeline stages can parse and produce audio directly in the buffer instead of copying through private buffers.
+///
+/// It is lock-free: the producer only advances the write position and the consumer only advances the read position.
+/// Both positions count bytes since creation and wrap naturally, so their difference is always the fill level. The
+/// capacity is a power of two, so a position maps to a storage index with a mask. Each side's state sits on its own
+/// cache line, and each side keeps a copy of the other's position that it only reloads when it runs out of bytes or
+/// space, so the two tasks rarely touch the same line.
+///
+/// The storage is followed by a slack area of max_region_length bytes. A write region that runs past the end of the
+/// ring spills into the slack and is copied to the start when committed. A read region that wraps around the end has
+/// its wrapped bytes mirrored into the slack when acquired. Only the wrapped part of a region is ever copied, so
+/// regions far from the end cost nothing.
+///
+/// Instead of polling, a task can ask to be notified once the fill level crosses a watermark: the consumer when enough
+/// bytes are available, and the producer when enough bytes are free. Notifications are FreeRTOS direct-to-task
+/// notifications, so the task blocks with ulTaskNotifyTake and can wait on several ring buffers at once.
+class AudioRingBuffer {
+ public:
+  ~AudioRingBuffer();
+
+  /// @brief Allocates a ring buffer
+  /// @param length capacity in bytes; rounded up to the next power of two
+  /// @param max_region_length largest contiguous region acquire_read and acquire_write will return; 0 if only read and
+  /// write are used
+  /// @return the ring buffer or nullptr if the allocation failed
+  static std::unique_ptr<AudioRingBuffer> create(size_t length, size_t max_region_length);
+
+  /// @brief Copies up to length bytes out of the ring buffer
+  /// @return the number of bytes copied
+  size_t read(void *data, size_t length);
+
+  /// @brief Copies up to length bytes into the ring buffer
+  /// @return the number of bytes copied
+  size_t write(const void *data, size_t length);
+
+  /// @brief Gets a contiguous region of readable bytes. Does not consume them; call commit_read afterwards.
+  /// @param data set to the start of the region
+  /// @param length the most bytes the caller wants
+  /// @return the size of the region; at most the smaller of length, available(), and max_region_length
+  size_t acquire_read(uint8_t **data, size_t length);
+
+  /// @brief Consumes length bytes from the start of the last region returned by acquire_read
+  void commit_read(size_t length);
+
+  /// @brief Gets a contiguous region of free bytes to write into. Call commit_write afterwards to publish them.
+  /// @param data set to the start of the region
+  /// @param length the most bytes the caller wants
+  /// @return the size of the region; at most the smaller of length, free(), and max_region_length
+  size_t acquire_write(uint8_t **data, size_t length);
+
+  /// @brief Publishes length bytes from the start of the last region returned by acquire_write
+  void commit_write(size_t length);
+
+  /// @brief Number of bytes that can be read
+  size_t available() const {
+    // Load the read position first, so a concurrent read can only make the result smaller than the true fill level
+    const size_t read_position = this->read_position_.load(std::memory_order_acquire);
+    return this->write_position_.load(std::memory_order_acquire) - read_position;
+  }
+
+  /// @brief Number of bytes that can be written
+  size_t free() const {
+    const size_t write_position = this->write_position_.load(std::memory_order_acquire);
+    return this->length_ - (write_position - this->read_position_.load(std::memory_order_acquire));
+  }
+
+  /// @brief Capacity in bytes
+  size_t size() const { return this->length_; }
+
+  /// @brief Bytes consumed since creation, including those discarded by reset; wraps around
+  size_t get_read_position() const { return this->read_position_.load(std::memory_order_acquire); }
+
+  /// @brief Bytes published since creation; wraps around
+  size_t get_write_position() const { return this->write_position_.load(std::memory_order_acquire); }
+
+  /// @brief Discards all data. Acts on the consumer side, so it must not run at the same time as a read, but the
+  /// producer can keep writing.
+  void reset();
+
+  /// @brief Notifies the calling task once at least length bytes are available. Replaces any earlier request from the
+  /// consumer. If the bytes are already available, the task is notified immediately. A length larger than the
+  /// capacity, e.g., available() + 1 on a full ring buffer, only cancels the earlier request.
+  void notify_when_available(size_t length);
+
+  /// @brief Notifies the calling task once at least length bytes are free. Replaces any earlier request from the
+  /// producer. If the bytes are already free, the task is notified immediately. A length larger than the capacity,
+  /// e.g., free() + 1 on an empty ring buffer, only cancels the earlier request.
+  void notify_when_free(size_t length);
+
+ protected:
+  // Large enough for the ESP32 and ESP32-S3 data caches
+  static const size_t CACHE_LINE_SIZE = 64;
+
+  AudioRingBuffer(uint8_t *storage, size_t length, size_t max_region_length)
+      : storage_(storage), length_(length), mask_(length - 1), max_region_length_(max_region_length) {}
+
+  /// @brief Free bytes as seen by the producer. Only reloads the read position if fewer than length bytes seem free.
+  size_t producer_free_(size_t length);
+
+  /// @brief Available bytes as seen by the consumer. Only reloads the write position if fewer than length bytes seem
+  /// available.
+  size_t consumer_available_(size_t length);
+
+  void check_available_watermark_();
+  void check_free_watermark_();
+
+  // Shared and never modified after creation
+  uint8_t *storage_;
+  size_t length_;
+  size_t mask_;
+  size_t max_region_length_;
+
+  // Owned by the producer
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> write_position_{0};
+  size_t producer_read_position_{0};  // Last read position the producer loaded
+
+  // Owned by the consumer
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> read_position_{0};
+  size_t consumer_write_position_{0};  // Last write position the consumer loaded
+  size_t mirrored_length_{0};          // Bytes at the start of storage_ already copied into the slack area
+
+  // A watermark of 0 means no task is waiting. Each task handle is written before its watermark is set.
+  alignas(CACHE_LINE_SIZE) TaskHandle_t available_task_{nullptr};
+  std::atomic<size_t> available_watermark_{0};
+  TaskHandle_t free_task_{nullptr};
+  std::atomic<size_t> free_watermark_{0};
+};
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
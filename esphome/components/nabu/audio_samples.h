@@ -0,0 +1,33 @@
+#pragma once
+
+#ifdef USE_ESP_IDF
+
+#include <cstdint>
+
+namespace esphome {
+namespace nabu {
+
+// Reads a 16, 24 (packed), or 32 bit little endian sample as a 32 bit sample aligned to the most significant bit
+inline int32_t read_aligned_sample(const uint8_t *input, uint8_t bytes_per_sample) {
+  if (bytes_per_sample == sizeof(int16_t)) {
+    return static_cast<int32_t>(*reinterpret_cast<const int16_t *>(input)) * 65536;
+  } else if (bytes_per_sample == 3) {
+    return static_cast<int32_t>((static_cast<uint32_t>(input[0]) << 8) | (static_cast<uint32_t>(input[1]) << 16) |
+                                (static_cast<uint32_t>(input[2]) << 24));
+  }
+  return *reinterpret_cast<const int32_t *>(input);
+}
+
+// Writes a 32 bit sample aligned to the most significant bit as a 16 or 32 bit sample
+inline void write_aligned_sample(int32_t sample, uint8_t *output, uint8_t bytes_per_sample) {
+  if (bytes_per_sample == sizeof(int16_t)) {
+    *reinterpret_cast<int16_t *>(output) = static_cast<int16_t>(sample >> 16);
+  } else {
+    *reinterpret_cast<int32_t *>(output) = sample;
+  }
+}
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#ifdef USE_ESP_IDF
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace nabu {
+
+// Throughput counters for a single pipeline stage (reader, decoder, or resampler). Each stage updates the byte
+// counters itself; the pipeline task that drives the stage measures the processing time, the wall clock duration, and
+// the output ring buffer's peak. On the device, the pipeline logs the counters at debug level when each stream ends;
+// tests/host/nabu/pipeline_benchmark.cpp reports them for files run through the stages on a host.
+struct AudioStageStats {
+  uint64_t bytes_read{0};       // Bytes copied out of the stage's input (source data or input ring buffer)
+  uint64_t bytes_written{0};    // Bytes copied into the stage's output ring buffer
+  uint64_t processing_us{0};    // Time spent inside the stage's read/decode/resample calls
+  uint32_t duration_ms{0};      // Wall clock time from the stage starting until it finished
+  size_t buffer_bytes{0};       // Internal buffer memory allocated by the stage
+  size_t peak_output_bytes{0};  // Most bytes waiting in the stage's output ring buffer at once
+
+  void reset() {
+    this->bytes_read = 0;
+    this->bytes_written = 0;
+    this->processing_us = 0;
+    this->duration_ms = 0;
+    this->buffer_bytes = 0;
+    this->peak_output_bytes = 0;
+  }
+};
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,163 @@
+#ifdef USE_ESP_IDF
+
+#include "biquad_cascade.h"
+
+#include "esphome/core/helpers.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace esphome {
+namespace nabu {
+
+static const int COEFFICIENT_FRACTIONAL_BITS = 28;
+
+static int32_t to_q3_28(float coefficient) {
+  return static_cast<int32_t>(
+      clamp<float>(std::round(coefficient * (1 << COEFFICIENT_FRACTIONAL_BITS)), INT32_MIN, INT32_MAX));
+}
+
+esp_err_t BiquadCascade::start(uint8_t channels, uint8_t sections) {
+  if ((channels == 0) || (channels > MAX_CHANNELS) || (sections > MAX_SECTIONS)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  this->channels_ = channels;
+  this->sections_ = sections;
+
+  const BiquadCoefficients pass_through = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  for (uint8_t section = 0; section < sections; ++section) {
+    this->set_section(section, pass_through);
+  }
+  this->reset();
+
+  return ESP_OK;
+}
+
+void BiquadCascade::set_section(uint8_t section, const BiquadCoefficients &coefficients, float gain) {
+  if (section >= this->sections_) {
+    return;
+  }
+
+  // The biquad library names the feedforward coefficients a and the feedback coefficients b
+  Section &s = this->section_[section];
+  s.n0 = coefficients.a0 * gain;
+  s.n1 = coefficients.a1 * gain;
+  s.n2 = coefficients.a2 * gain;
+  s.d1 = coefficients.b1;
+  s.d2 = coefficients.b2;
+
+  s.q_n0 = to_q3_28(s.n0);
+  s.q_n1 = to_q3_28(s.n1);
+  s.q_n2 = to_q3_28(s.n2);
+  s.q_d1 = to_q3_28(s.d1);
+  s.q_d2 = to_q3_28(s.d2);
+}
+
+void BiquadCascade::reset() {
+  std::memset(this->float_state_, 0, sizeof(this->float_state_));
+  std::memset(this->q31_state_, 0, sizeof(this->q31_state_));
+}
+
+void BiquadCascade::process(float *buffer, size_t frames) {
+  float *samples[MAX_CHANNELS] = {buffer, buffer + 1};
+  if (this->channels_ == 1) {
+    this->process_float_<1>(samples, 1, frames);
+  } else {
+    this->process_float_<2>(samples, 2, frames);
+  }
+}
+
+void BiquadCascade::process(float *const *planes, size_t frames) {
+  if (this->channels_ == 1) {
+    this->process_float_<1>(planes, 1, frames);
+  } else {
+    this->process_float_<2>(planes, 1, frames);
+  }
+}
+
+void BiquadCascade::process(int32_t *buffer, size_t frames) {
+  if (this->channels_ == 1) {
+    this->process_q31_<1>(buffer, frames);
+  } else {
+    this->process_q31_<2>(buffer, frames);
+  }
+}
+
+template<uint8_t Channels> void BiquadCascade::process_float_(float *const *samples, size_t stride, size_t frames) {
+  for (uint8_t section = 0; section < this->sections_; ++section) {
+    const float n0 = this->section_[section].n0;
+    const float n1 = this->section_[section].n1;
+    const float n2 = this->section_[section].n2;
+    const float d1 = this->section_[section].d1;
+    const float d2 = this->section_[section].d2;
+
+    float s0[Channels];
+    float s1[Channels];
+    float *sample[Channels];
+    for (uint8_t channel = 0; channel < Channels; ++channel) {
+      s0[channel] = this->float_state_[section][channel][0];
+      s1[channel] = this->float_state_[section][channel][1];
+      sample[channel] = samples[channel];
+    }
+
+    for (size_t i = 0; i < frames; ++i) {
+      for (uint8_t channel = 0; channel < Channels; ++channel) {
+        const float x = *sample[channel];
+        const float y = n0 * x + s0[channel];
+        s0[channel] = n1 * x - d1 * y + s1[channel];
+        s1[channel] = n2 * x - d2 * y;
+        *sample[channel] = y;
+        sample[channel] += stride;
+      }
+    }
+
+    for (uint8_t channel = 0; channel < Channels; ++channel) {
+      this->float_state_[section][channel][0] = s0[channel];
+      this->float_state_[section][channel][1] = s1[channel];
+    }
+  }
+}
+
+template<uint8_t Channels> void BiquadCascade::process_q31_(int32_t *buffer, size_t frames) {
+  const int64_t rounding = static_cast<int64_t>(1) << (COEFFICIENT_FRACTIONAL_BITS - 1);
+
+  for (uint8_t section = 0; section < this->sections_; ++section) {
+    const int64_t n0 = this->section_[section].q_n0;
+    const int64_t n1 = this->section_[section].q_n1;
+    const int64_t n2 = this->section_[section].q_n2;
+    const int64_t d1 = this->section_[section].q_d1;
+    const int64_t d2 = this->section_[section].q_d2;
+
+    int64_t s0[Channels];
+    int64_t s1[Channels];
+    for (uint8_t channel = 0; channel < Channels; ++channel) {
+      s0[channel] = this->q31_state_[section][channel][0];
+      s1[channel] = this->q31_state_[section][channel][1];
+    }
+
+    int32_t *sample = buffer;
+    for (size_t i = 0; i < frames; ++i) {
+      for (uint8_t channel = 0; channel < Channels; ++channel) {
+        const int64_t x = sample[channel];
+        // The clipped output feeds back, so the state stays bounded even if the output saturates
+        const int64_t y =
+            clamp<int64_t>((n0 * x + s0[channel] + rounding) >> COEFFICIENT_FRACTIONAL_BITS, INT32_MIN, INT32_MAX);
+        s0[channel] = n1 * x - d1 * y + s1[channel];
+        s1[channel] = n2 * x - d2 * y;
+        sample[channel] = static_cast<int32_t>(y);
+      }
+      sample += Channels;
+    }
+
+    for (uint8_t channel = 0; channel < Channels; ++channel) {
+      this->q31_state_[section][channel][0] = s0[channel];
+      this->q31_state_[section][channel][1] = s1[channel];
+    }
+  }
+}
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#ifdef USE_ESP_IDF
+
+#include "biquad.h"
+
+#include "esp_err.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace nabu {
+
+/// @brief Runs a chain of biquad sections over blocks of samples in Direct Form II Transposed.
+///
+/// Each section keeps its coefficients and two state variables per channel. A block is filtered one section at a
+/// time, with that section's coefficients and state held in locals for the whole block, and with every channel
+/// handled in the same loop. Float blocks can be interleaved or planar. Interleaved Q31 blocks are filtered in fixed
+/// point with coefficients in Q3.28 and 64 bit state.
+class BiquadCascade {
+ public:
+  static const uint8_t MAX_CHANNELS = 2;
+  static const uint8_t MAX_SECTIONS = 8;
+
+  /// @brief Sets up the cascade with every section passing audio through unchanged and silent state
+  /// @param channels number of channels in each frame; 1 or 2
+  /// @param sections number of biquad sections in the chain
+  /// @return ESP_OK or ESP_ERR_INVALID_ARG if there are too many channels or sections
+  esp_err_t start(uint8_t channels, uint8_t sections);
+
+  /// @brief Sets the coefficients of one section. All channels share them.
+  /// @param section index of the section to set
+  /// @param coefficients as computed by biquad_lowpass or biquad_highpass
+  /// @param gain multiplies the feedforward coefficients
+  void set_section(uint8_t section, const BiquadCoefficients &coefficients, float gain = 1.0f);
+
+  /// @brief Clears the state of every section, e.g., after a discontinuity in the audio
+  void reset();
+
+  /// @brief Filters interleaved float frames in place
+  void process(float *buffer, size_t frames);
+
+  /// @brief Filters planar float frames in place
+  /// @param planes one pointer per channel to frames contiguous samples
+  void process(float *const *planes, size_t frames);
+
+  /// @brief Filters interleaved Q31 frames in place. Results are clipped to the Q31 range.
+  void process(int32_t *buffer, size_t frames);
+
+  uint8_t get_channels() const { return this->channels_; }
+  uint8_t get_sections() const { return this->sections_; }
+
+ protected:
+  // y = n0 * x + s0, s0 = n1 * x - d1 * y + s1, s1 = n2 * x - d2 * y
+  struct Section {
+    float n0, n1, n2, d1, d2;
+    int32_t q_n0, q_n1, q_n2, q_d1, q_d2;  // Q3.28
+  };
+
+  template<uint8_t Channels> void process_float_(float *const *samples, size_t stride, size_t frames);
+  template<uint8_t Channels> void process_q31_(int32_t *buffer, size_t frames);
+
+  uint8_t channels_{0};
+  uint8_t sections_{0};
+
+  Section section_[MAX_SECTIONS];
+  float float_state_[MAX_SECTIONS][MAX_CHANNELS][2];
+  int64_t q31_state_[MAX_SECTIONS][MAX_CHANNELS][2];  // Q3.59
+};
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
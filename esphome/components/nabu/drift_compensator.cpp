@@ -0,0 +1,116 @@
+#ifdef USE_ESP_IDF
+
+#include "drift_compensator.h"
+
+#include "esphome/core/helpers.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace esphome {
+namespace nabu {
+
+static const uint32_t UPDATE_INTERVAL_MS = 1000;
+
+// An interval this long means the buffer wasn't being read, e.g., while paused, so its level says nothing about the
+// clocks
+static const uint32_t MAX_INTERVAL_MS = 3 * UPDATE_INTERVAL_MS;
+
+// Intervals to wait before taking the target level, so the buffer has filled from the stream's initial burst
+static const uint8_t SETTLE_INTERVALS = 5;
+
+// Weight of each new interval's consumption rate in the running average
+static const float RATE_SMOOTHING = 0.1f;
+
+// The controller settles over a few minutes without overshooting (natural frequency of 1 / 120 s, critically
+// damped). Its output is in the unit of the ratio correction per second of level error.
+static const float PROPORTIONAL_GAIN = 1.0f / 60.0f;
+static const float INTEGRAL_GAIN = 1.0f / (120.0f * 120.0f);
+
+// Largest correction; about 5 cents of pitch, which is inaudible, and much more than typical crystal tolerances
+static const float MAX_CORRECTION = 0.003f;
+
+// Highest target level, leaving room in the buffer to see a source that is too fast
+static const size_t MAX_TARGET_PERCENT = 75;
+// Above this level, the source is assumed to be held back by the buffer rather than sending in real time
+static const size_t SATURATED_PERCENT = 90;
+// How closely the rates bytes arrive and leave at must match before the target is taken; well above any clock
+// difference, but below the bursts of a file sent as fast as possible
+static const float RATE_TRACKING_TOLERANCE = 0.1f;
+
+void DriftCompensator::start(size_t buffer_size) {
+  this->buffer_size_ = buffer_size;
+  this->target_bytes_ = 0.0f;
+  this->locked_ = false;
+  this->started_ = false;
+  this->level_sum_ = 0;
+  this->level_count_ = 0;
+  this->intervals_ = 0;
+  this->bytes_per_second_ = 0.0f;
+  this->integral_ = 0.0f;
+  this->correction_ = 0.0f;
+}
+
+float DriftCompensator::update(size_t buffered_bytes, size_t read_position, size_t write_position, uint32_t now_ms) {
+  if (!this->started_) {
+    this->started_ = true;
+    this->interval_start_ms_ = now_ms;
+    this->interval_start_read_position_ = read_position;
+    this->interval_start_write_position_ = write_position;
+  }
+
+  this->level_sum_ += buffered_bytes;
+  ++this->level_count_;
+
+  const uint32_t elapsed_ms = now_ms - this->interval_start_ms_;
+  if (elapsed_ms < UPDATE_INTERVAL_MS) {
+    return this->correction_;
+  }
+
+  const float level = static_cast<float>(this->level_sum_) / this->level_count_;
+  const float rate = static_cast<float>(read_position - this->interval_start_read_position_) * 1000.0f / elapsed_ms;
+  const float input_rate =
+      static_cast<float>(write_position - this->interval_start_write_position_) * 1000.0f / elapsed_ms;
+
+  this->interval_start_ms_ = now_ms;
+  this->interval_start_read_position_ = read_position;
+  this->interval_start_write_position_ = write_position;
+  this->level_sum_ = 0;
+  this->level_count_ = 0;
+
+  const bool saturated = level > static_cast<float>(this->buffer_size_ * SATURATED_PERCENT / 100);
+  if ((rate <= 0.0f) || (elapsed_ms > MAX_INTERVAL_MS) || saturated) {
+    return this->correction_;
+  }
+
+  if (!this->locked_) {
+    // The stream starts in a burst, so only the rate of the last interval before locking is used
+    this->bytes_per_second_ = rate;
+    if (this->intervals_ < SETTLE_INTERVALS) {
+      ++this->intervals_;
+    } else if (std::abs(input_rate - rate) <= RATE_TRACKING_TOLERANCE * rate) {
+      this->target_bytes_ = std::min(level, static_cast<float>(this->buffer_size_ * MAX_TARGET_PERCENT / 100));
+      this->locked_ = true;
+    }
+    return this->correction_;
+  }
+  this->bytes_per_second_ += RATE_SMOOTHING * (rate - this->bytes_per_second_);
+  if (this->bytes_per_second_ <= 0.0f) {
+    return this->correction_;
+  }
+
+  // A level above the target means the source is faster than the speaker, so the input is consumed faster by
+  // producing fewer output samples per input sample
+  const float error_seconds = (level - this->target_bytes_) / this->bytes_per_second_;
+  const float max_integral = MAX_CORRECTION / INTEGRAL_GAIN;
+  this->integral_ = clamp<float>(this->integral_ + error_seconds * elapsed_ms / 1000.0f, -max_integral, max_integral);
+  this->correction_ = clamp<float>(-(PROPORTIONAL_GAIN * error_seconds + INTEGRAL_GAIN * this->integral_),
+                                   -MAX_CORRECTION, MAX_CORRECTION);
+
+  return this->correction_;
+}
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+
+#ifdef USE_ESP_IDF
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace nabu {
+
+/// @brief Keeps the latency of a live stream constant when its clock runs slightly faster or slower than the I2S
+/// clock.
+///
+/// A live source, such as an internet radio station, sends audio at the rate of its own clock, while the speaker
+/// consumes it at the rate of the I2S clock. Any difference slowly fills or drains the buffer between them. The
+/// compensator watches that buffer's fill level, converted to seconds of audio with the measured rate the buffer is
+/// consumed at, and steers it back to a target with a PI controller. The result is a small correction to the
+/// resampling ratio. Since the level in seconds changes at exactly the rate difference less the correction, the
+/// controller behaves the same for any bitrate.
+///
+/// Levels are averaged over each update interval, so the jitter of variable sized compressed frames is smoothed out.
+///
+/// The level only says something about the clocks while the source sends in real time. The target is only taken once
+/// the rate bytes arrive at tracks the rate they are consumed at, and intervals with a nearly full buffer are ignored:
+/// the source is then held back by the buffer, e.g., because it sends a file as fast as it can, and the level stays
+/// high regardless of the clocks.
+class DriftCompensator {
+ public:
+  /// @brief Starts following a new stream. The target level is taken from the buffer once the stream has settled.
+  /// @param buffer_size the buffer's capacity in bytes
+  void start(size_t buffer_size);
+
+  /// @brief Adds a measurement of the buffer and updates the correction once per interval
+  /// @param buffered_bytes bytes currently in the buffer
+  /// @param read_position total bytes read from the buffer so far; may wrap around
+  /// @param write_position total bytes written to the buffer so far; may wrap around
+  /// @param now_ms current time in milliseconds
+  /// @return the correction to multiply the resampling ratio (output over input rate) by 1 + correction with;
+  /// negative when the source is faster than the speaker
+  float update(size_t buffered_bytes, size_t read_position, size_t write_position, uint32_t now_ms);
+
+  float get_correction() const { return this->correction_; }
+
+ protected:
+  size_t buffer_size_{0};
+  float target_bytes_{0.0f};
+  bool locked_{false};
+
+  // Measurements within the current interval
+  bool started_{false};
+  uint32_t interval_start_ms_{0};
+  size_t interval_start_read_position_{0};
+  size_t interval_start_write_position_{0};
+  uint64_t level_sum_{0};
+  uint32_t level_count_{0};
+  uint8_t intervals_{0};
+
+  float bytes_per_second_{0.0f};
+  float integral_{0.0f};
+  float correction_{0.0f};
+};
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,88 @@
+#ifdef USE_ESP_IDF
+
+#include "filter_bank_cache.h"
+
+#include <algorithm>
+
+namespace esphome {
+namespace nabu {
+
+static size_t coefficient_bytes(FilterFormat format) {
+  switch (format) {
+    case FilterFormat::Q15:
+      return sizeof(int16_t);
+    case FilterFormat::Q31:
+      return sizeof(int32_t);
+    default:
+      return sizeof(float);
+  }
+}
+
+FilterBank::~FilterBank() {
+  if (this->coefficients != nullptr) {
+    ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+    allocator.deallocate(static_cast<uint8_t *>(this->coefficients), this->bytes);
+  }
+}
+
+std::shared_ptr<FilterBank> FilterBank::create(const FilterBankKey &key, const std::function<void(void *)> &design) {
+  auto bank = std::make_shared<FilterBank>();
+  bank->key = key;
+  bank->bytes = static_cast<size_t>(key.filters) * key.taps * coefficient_bytes(key.format);
+
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  bank->coefficients = allocator.allocate(bank->bytes);
+  if (bank->coefficients == nullptr) {
+    return nullptr;
+  }
+
+  design(bank->coefficients);
+  return bank;
+}
+
+std::shared_ptr<const FilterBank> FilterBankCache::get(const FilterBankKey &key,
+                                                       const std::function<void(void *)> &design) {
+  // Evicted banks are only released after the lock is dropped, as freeing them may take a while
+  std::vector<std::shared_ptr<const FilterBank>> evicted;
+
+  LockGuard guard(this->lock_);
+
+  for (Entry &entry : this->entries_) {
+    if (entry.bank->key == key) {
+      entry.last_used = ++this->use_counter_;
+      return entry.bank;
+    }
+  }
+
+  // Designed while holding the lock, so pipelines starting at the same rates at once share a single bank
+  std::shared_ptr<const FilterBank> bank = FilterBank::create(key, design);
+  if (bank == nullptr) {
+    return nullptr;
+  }
+
+  // Banks held by a resampler stay, as evicting them frees nothing
+  while (this->used_bytes_ + bank->bytes > this->max_bytes_) {
+    auto least_recent = this->entries_.end();
+    for (auto it = this->entries_.begin(); it != this->entries_.end(); ++it) {
+      if ((it->bank.use_count() == 1) &&
+          ((least_recent == this->entries_.end()) || ((int32_t) (it->last_used - least_recent->last_used) < 0))) {
+        least_recent = it;
+      }
+    }
+    if (least_recent == this->entries_.end()) {
+      break;
+    }
+    this->used_bytes_ -= least_recent->bank->bytes;
+    evicted.push_back(std::move(least_recent->bank));
+    this->entries_.erase(least_recent);
+  }
+
+  this->used_bytes_ += bank->bytes;
+  this->entries_.push_back({bank, ++this->use_counter_});
+  return bank;
+}
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
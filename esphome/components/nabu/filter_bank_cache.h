@@ -0,0 +1,90 @@
+#pragma once
+
+#ifdef USE_ESP_IDF
+
+#include "esphome/core/helpers.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace esphome {
+namespace nabu {
+
+enum class FilterWindow : uint8_t {
+  HANN = 0,
+  BLACKMAN_HARRIS_4_TERM,
+  KAISER,
+};
+
+enum class FilterFormat : uint8_t {
+  FLOAT = 0,
+  Q15,  // int16_t
+  Q31,  // int32_t
+};
+
+/// @brief Everything that determines the coefficients of a filter bank
+struct FilterBankKey {
+  uint16_t taps;        // Coefficients per filter
+  uint16_t filters;     // Filters in the bank, e.g., the phases of a polyphase filter
+  float lowpass_ratio;  // Cutoff as a fraction of the input Nyquist frequency
+  FilterWindow window;
+  FilterFormat format;
+
+  bool operator==(const FilterBankKey &other) const {
+    return (this->taps == other.taps) && (this->filters == other.filters) &&
+           (this->lowpass_ratio == other.lowpass_ratio) && (this->window == other.window) &&
+           (this->format == other.format);
+  }
+};
+
+/// @brief A bank of FIR filters, stored one after another in a single allocation
+struct FilterBank {
+  ~FilterBank();
+
+  /// @brief Allocates a bank and fills in its coefficients
+  /// @param design writes filters * taps coefficients of the key's format to the bank's coefficients
+  /// @return the bank or nullptr if it couldn't be allocated
+  static std::shared_ptr<FilterBank> create(const FilterBankKey &key, const std::function<void(void *)> &design);
+
+  FilterBankKey key;
+  void *coefficients{nullptr};
+  size_t bytes{0};
+};
+
+/// @brief Least recently used cache of filter banks, with a cap on its memory.
+///
+/// Designing a resampling filter takes thousands of sin, cos, and Bessel function evaluations, yet only depends on the
+/// rate pair, so every track and announcement at the same rates can share one bank. Banks are read only once
+/// designed. Only banks no resampler holds are evicted. All functions are safe to call from any task.
+class FilterBankCache {
+ public:
+  /// @param max_bytes the most memory held across all banks; banks in use are kept even if they exceed it
+  explicit FilterBankCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+  /// @brief Looks up a bank and marks it as recently used. Designs and adds it if it isn't cached.
+  /// @param design writes the coefficients of a new bank; see FilterBank::create
+  /// @return the bank or nullptr if it couldn't be allocated
+  std::shared_ptr<const FilterBank> get(const FilterBankKey &key, const std::function<void(void *)> &design);
+
+  size_t get_used_bytes() const { return this->used_bytes_; }
+
+ protected:
+  struct Entry {
+    std::shared_ptr<const FilterBank> bank;
+    uint32_t last_used;
+  };
+
+  Mutex lock_;
+  std::vector<Entry> entries_;
+  uint32_t use_counter_{0};
+  size_t used_bytes_{0};
+  size_t max_bytes_;
+};
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -4,12 +4,53 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
-#include <vector>
 
 #include "flac_decoder.h"
+
+#include <array>
+#include <utility>
+
 namespace flac {
 
-FLACDecoderResult FLACDecoder::read_header(size_t buffer_length) {
+namespace {
+
+/* Restores the samples of a subframe predicted with a fixed order, so the compiler can fully unroll the dot product
+ * and keep the coefficients in registers. Accumulator is int32_t when the prediction cannot overflow, int64_t
+ * otherwise. */
+template<uint32_t Order, typename Accumulator>
+void restore_linear_prediction_kernel(uint32_t block_size, int32_t *samples, const int32_t *coefs, int32_t shift) {
+  int32_t order_coefs[Order];
+  for (uint32_t j = 0; j < Order; ++j) {
+    order_coefs[j] = coefs[j];
+  }
+
+  for (uint32_t i = Order; i < block_size; ++i) {
+    const int32_t *history = samples + i - Order;
+    Accumulator sum = 0;
+#pragma GCC unroll 32
+    for (uint32_t j = 0; j < Order; ++j) {
+      sum += static_cast<Accumulator>(history[j]) * order_coefs[j];
+    }
+    samples[i] += static_cast<int32_t>(sum >> shift);
+  }
+}
+
+using RestoreLinearPredictionKernel = void (*)(uint32_t, int32_t *, const int32_t *, int32_t);
+
+template<typename Accumulator, std::size_t... Orders>
+constexpr std::array<RestoreLinearPredictionKernel, sizeof...(Orders)> make_kernel_table(
+    std::index_sequence<Orders...>) {
+  return {{&restore_linear_prediction_kernel<Orders + 1, Accumulator>...}};
+}
+
+// Kernels indexed by order - 1
+constexpr auto NARROW_KERNELS = make_kernel_table<int32_t>(std::make_index_sequence<FLAC_MAX_LPC_ORDER>{});
+constexpr auto WIDE_KERNELS = make_kernel_table<int64_t>(std::make_index_sequence<FLAC_MAX_LPC_ORDER>{});
+
+}  // namespace
+
+FLACDecoderResult FLACDecoder::read_header(const uint8_t *buffer, size_t buffer_length) {
+  this->buffer_ = buffer;
   this->buffer_index_ = 0;
   this->bytes_left_ = buffer_length;
   this->bit_buffer_ = 0;
@@ -18,20 +59,25 @@ FLACDecoderResult FLACDecoder::read_header(size_t buffer_length) {
   this->out_of_data_ = (buffer_length == 0);
 
   if (!this->partial_header_read_) {
+    if (buffer_length < 4) {
+      return FLAC_DECODER_HEADER_OUT_OF_DATA;
+    }
+
     // File must start with 'fLaC'
     if (this->read_uint(32) != FLAC_MAGIC_NUMBER) {
       return FLAC_DECODER_ERROR_BAD_MAGIC_NUMBER;
     }
+    this->partial_header_read_ = true;
   }
 
   while (!this->partial_header_last_ || (this->partial_header_length_ > 0)) {
-    if (this->bytes_left_ == 0) {
-      // We'll try to finish reading it once more data is loaded
-      this->partial_header_read_ = true;
-      return FLAC_DECODER_HEADER_OUT_OF_DATA;
-    }
-
     if (this->partial_header_length_ == 0) {
+      if (this->bytes_remaining() < 4) {
+        // We'll try to finish reading it once more data is loaded
+        this->release_bit_buffer();
+        return FLAC_DECODER_HEADER_OUT_OF_DATA;
+      }
+
       this->partial_header_last_ = this->read_uint(1) != 0;
       this->partial_header_type_ = this->read_uint(7);
       this->partial_header_length_ = this->read_uint(24);
@@ -39,6 +85,11 @@ FLACDecoderResult FLACDecoder::read_header(size_t buffer_length) {
 
     if (this->partial_header_type_ == 0) {
       // Stream info block
+      if (this->bytes_remaining() < this->partial_header_length_) {
+        this->release_bit_buffer();
+        return FLAC_DECODER_HEADER_OUT_OF_DATA;
+      }
+
       this->min_block_size_ = this->read_uint(16);
       this->max_block_size_ = this->read_uint(16);
       this->read_uint(24);
@@ -47,22 +98,31 @@ FLACDecoderResult FLACDecoder::read_header(size_t buffer_length) {
       this->sample_rate_ = this->read_uint(20);
       this->num_channels_ = this->read_uint(3) + 1;
       this->sample_depth_ = this->read_uint(5) + 1;
-      this->num_samples_ = this->read_uint(36);
-      this->read_uint(128);
+      this->read_uint(4);
+      this->num_samples_ = this->read_uint(32);
+
+      // MD5 signature
+      for (int i = 0; i < 4; ++i) {
+        this->read_uint(32);
+      }
 
       this->partial_header_length_ = 0;
     } else {
-      // Variable block
-      while (this->partial_header_length_ > 0) {
-        if (this->bytes_left_ == 0) {
-          break;
-        }
-        this->read_uint(8);
-        --this->partial_header_length_;
+      // Variable block; skip over it directly in the input buffer
+      this->release_bit_buffer();
+      std::size_t bytes_to_skip = std::min<std::size_t>(this->bytes_left_, this->partial_header_length_);
+      this->buffer_index_ += bytes_to_skip;
+      this->bytes_left_ -= bytes_to_skip;
+      this->partial_header_length_ -= bytes_to_skip;
+
+      if (this->partial_header_length_ > 0) {
+        return FLAC_DECODER_HEADER_OUT_OF_DATA;
       }
     }  // variable block
   }
 
+  this->release_bit_buffer();
+
   if ((this->sample_rate_ == 0) || (this->num_channels_ == 0) || (this->sample_depth_ == 0) ||
       (this->max_block_size_ == 0)) {
     return FLAC_DECODER_ERROR_BAD_HEADER;
@@ -72,7 +132,9 @@ FLACDecoderResult FLACDecoder::read_header(size_t buffer_length) {
   return FLAC_DECODER_SUCCESS;
 }  // read_header
 
-FLACDecoderResult FLACDecoder::decode_frame(size_t buffer_length, int16_t *output_buffer, uint32_t *num_samples) {
+FLACDecoderResult FLACDecoder::decode_frame(const uint8_t *buffer, size_t buffer_length, uint8_t *output_buffer,
+                                            uint32_t *num_samples) {
+  this->buffer_ = buffer;
   this->buffer_index_ = 0;
   this->bytes_left_ = buffer_length;
   this->out_of_data_ = false;
@@ -83,6 +145,9 @@ FLACDecoderResult FLACDecoder::decode_frame(size_t buffer_length, int16_t *outpu
     // freed in free_buffers()
     esphome::ExternalRAMAllocator<int32_t> allocator(esphome::ExternalRAMAllocator<int32_t>::ALLOW_FAILURE);
     this->block_samples_ = allocator.allocate(this->max_block_size_ * this->num_channels_);
+    if (!this->block_samples_) {
+      return FLAC_DECODER_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
   }
 
   if (this->bytes_left_ == 0) {
@@ -135,6 +200,11 @@ FLACDecoderResult FLACDecoder::decode_frame(size_t buffer_length, int16_t *outpu
     return FLAC_DECODER_ERROR_BAD_BLOCK_SIZE_CODE;
   }
 
+  if (block_size > this->max_block_size_) {
+    // Subframes are decoded in place, so the block must fit in block_samples_
+    return FLAC_DECODER_ERROR_BAD_BLOCK_SIZE_CODE;
+  }
+
   // Assuming that we have sample rate from header
   if (sample_rate_code == 12) {
     this->read_uint(8);
@@ -145,30 +215,57 @@ FLACDecoderResult FLACDecoder::decode_frame(size_t buffer_length, int16_t *outpu
   this->read_uint(8);
 
   // Output buffer size should be max_block_size * num_channels
-  this->decode_subframes(block_size, this->sample_depth_, channel_assignment);
-  *num_samples = block_size * this->num_channels_;
-
-  if (this->bytes_left_ < 2) {
+  FLACDecoderResult result = this->decode_subframes(block_size, this->sample_depth_, channel_assignment);
+  if (this->out_of_data_) {
+    // Anything read past the end of the buffer is garbage, so only the missing data is meaningful
+    result = FLAC_DECODER_ERROR_OUT_OF_DATA;
+  }
+  if (result != FLAC_DECODER_SUCCESS) {
     this->bit_buffer_ = previous_bit_buffer;
     this->bit_buffer_length_ = previous_bit_buffer_length;
-    return FLAC_DECODER_ERROR_OUT_OF_DATA;
+    return result;
   }
 
   // Footer
   this->align_to_byte();
   this->read_uint(16);
 
-  int32_t addend = 0;
-  if (this->sample_depth_ == 8) {
-    addend = 128;
+  if (this->out_of_data_) {
+    this->bit_buffer_ = previous_bit_buffer;
+    this->bit_buffer_length_ = previous_bit_buffer_length;
+    return FLAC_DECODER_ERROR_OUT_OF_DATA;
   }
 
+  // The next frame starts at the byte following the footer
+  this->release_bit_buffer();
+
+  *num_samples = block_size * this->num_channels_;
+
   // Copy samples to output buffer
   std::size_t output_index = 0;
-  for (uint32_t i = 0; i < block_size; i++) {
-    for (uint32_t j = 0; j < this->num_channels_; j++) {
-      output_buffer[output_index] = this->block_samples_[(j * block_size) + i] + addend;
-      output_index++;
+  if (this->sample_depth_ > 16) {
+    // Keep the full precision and left justify, so every depth has the same full scale range
+    int32_t *wide_output_buffer = reinterpret_cast<int32_t *>(output_buffer);
+    uint32_t shift = 32 - this->sample_depth_;
+    for (uint32_t i = 0; i < block_size; i++) {
+      for (uint32_t j = 0; j < this->num_channels_; j++) {
+        uint32_t sample = static_cast<uint32_t>(this->block_samples_[(j * block_size) + i]);
+        wide_output_buffer[output_index] = static_cast<int32_t>(sample << shift);
+        output_index++;
+      }
+    }
+  } else {
+    int32_t addend = 0;
+    if (this->sample_depth_ == 8) {
+      addend = 128;
+    }
+
+    int16_t *narrow_output_buffer = reinterpret_cast<int16_t *>(output_buffer);
+    for (uint32_t i = 0; i < block_size; i++) {
+      for (uint32_t j = 0; j < this->num_channels_; j++) {
+        narrow_output_buffer[output_index] = this->block_samples_[(j * block_size) + i] + addend;
+        output_index++;
+      }
     }
   }
 
@@ -183,8 +280,6 @@ void FLACDecoder::free_buffers() {
     this->block_samples_ = nullptr;
   }
 
-  this->block_result_.clear();
-  this->block_result_.shrink_to_fit();
 }  // free_buffers
 
 FLACDecoderResult FLACDecoder::decode_subframes(uint32_t block_size, uint32_t sample_depth,
@@ -250,93 +345,90 @@ FLACDecoderResult FLACDecoder::decode_subframe(uint32_t block_size, uint32_t sam
 
   sample_depth -= shift;
 
+  int32_t *samples = this->block_samples_ + block_samples_offset;
+
   FLACDecoderResult result = FLAC_DECODER_SUCCESS;
   if (type == 0) {
     // Constant
-    int32_t value = this->read_sint(sample_depth) << shift;
+    int32_t value = this->read_sint(sample_depth);
     for (std::size_t i = 0; i < block_size; i++) {
-      this->block_samples_[block_samples_offset + i] = value;
+      samples[i] = value;
     }
   } else if (type == 1) {
     // Verbatim
     for (std::size_t i = 0; i < block_size; i++) {
-      this->block_samples_[block_samples_offset + i] = (this->read_sint(sample_depth) << shift);
+      samples[i] = this->read_sint(sample_depth);
     }
   } else if ((8 <= type) && (type <= 12)) {
     // Fixed prediction
-    result = this->decode_fixed_subframe(block_size, block_samples_offset, type - 8, sample_depth);
+    result = this->decode_fixed_subframe(block_size, samples, type - 8, sample_depth);
   } else if ((32 <= type) && (type <= 63)) {
     // LPC (linear predictive coding)
-    result = this->decode_lpc_subframe(block_size, block_samples_offset, type - 31, sample_depth);
-    if (result != FLAC_DECODER_SUCCESS) {
-      return result;
-    }
-    if (shift > 0) {
-      for (std::size_t i = 0; i < block_size; i++) {
-        this->block_samples_[block_samples_offset + i] <<= shift;
-      }
-    }
+    result = this->decode_lpc_subframe(block_size, samples, type - 31, sample_depth);
   } else {
     result = FLAC_DECODER_ERROR_RESERVED_SUBFRAME_TYPE;
   }
 
+  if ((result == FLAC_DECODER_SUCCESS) && (shift > 0)) {
+    // Restore wasted bits
+    for (std::size_t i = 0; i < block_size; i++) {
+      samples[i] <<= shift;
+    }
+  }
+
   return result;
 }  // decode_subframe
 
-FLACDecoderResult FLACDecoder::decode_fixed_subframe(uint32_t block_size, std::size_t block_samples_offset,
-                                                     uint32_t pre_order, uint32_t sample_depth) {
+FLACDecoderResult FLACDecoder::decode_fixed_subframe(uint32_t block_size, int32_t *samples, uint32_t pre_order,
+                                                     uint32_t sample_depth) {
   if (pre_order > 4) {
     return FLAC_DECODER_ERROR_BAD_FIXED_PREDICTION_ORDER;
   }
 
-  FLACDecoderResult result = FLAC_DECODER_SUCCESS;
-
-  this->block_result_.clear();
   for (std::size_t i = 0; i < pre_order; i++) {
-    this->block_result_.push_back(this->read_sint(sample_depth));
+    samples[i] = this->read_sint(sample_depth);
   }
-  result = decode_residuals(block_size);
+
+  FLACDecoderResult result = this->decode_residuals(block_size, samples, pre_order);
   if (result != FLAC_DECODER_SUCCESS) {
     return result;
   }
-  restore_linear_prediction(FLAC_FIXED_COEFFICIENTS[pre_order], 0);
-
-  std::copy(this->block_result_.begin(), this->block_result_.end(), this->block_samples_ + block_samples_offset);
+  // The fixed coefficients' magnitudes add up to 2^order, so the prediction needs order more bits than the samples
+  this->restore_linear_prediction(block_size, samples, FLAC_FIXED_COEFFICIENTS[pre_order], pre_order, 0,
+                                  sample_depth + pre_order > 32);
 
   return result;
 }  // decode_fixed_subframe
 
-FLACDecoderResult FLACDecoder::decode_lpc_subframe(uint32_t block_size, std::size_t block_samples_offset,
-                                                   uint32_t lpc_order, uint32_t sample_depth) {
-  FLACDecoderResult result = FLAC_DECODER_SUCCESS;
-
-  this->block_result_.clear();
+FLACDecoderResult FLACDecoder::decode_lpc_subframe(uint32_t block_size, int32_t *samples, uint32_t lpc_order,
+                                                   uint32_t sample_depth) {
   for (std::size_t i = 0; i < lpc_order; i++) {
-    this->block_result_.push_back(this->read_sint(sample_depth));
+    samples[i] = this->read_sint(sample_depth);
   }
 
   uint32_t precision = this->read_uint(4) + 1;
   int32_t shift = this->read_sint(5);
+  if (shift < 0) {
+    return FLAC_DECODER_ERROR_BAD_LPC_SHIFT;
+  }
 
-  std::vector<int16_t> coefs;
-  coefs.resize(lpc_order + 1);
   for (std::size_t i = 0; i < lpc_order; i++) {
-    coefs[lpc_order - i - 1] = this->read_sint(precision);
+    this->lpc_coefs_[lpc_order - i - 1] = this->read_sint(precision);
   }
-  coefs[lpc_order] = 1 << shift;
 
-  result = decode_residuals(block_size);
+  FLACDecoderResult result = this->decode_residuals(block_size, samples, lpc_order);
   if (result != FLAC_DECODER_SUCCESS) {
     return result;
   }
-  restore_linear_prediction(coefs, shift);
-
-  std::copy(this->block_result_.begin(), this->block_result_.end(), this->block_samples_ + block_samples_offset);
+  // Same bound libFLAC uses to decide whether a 32-bit sum is safe
+  uint32_t order_bits = 31 - __builtin_clz(lpc_order);
+  this->restore_linear_prediction(block_size, samples, this->lpc_coefs_, lpc_order, shift,
+                                  sample_depth + precision + order_bits > 32);
 
   return result;
 }  // decode_lpc_subframe
 
-FLACDecoderResult FLACDecoder::decode_residuals(uint32_t block_size) {
+FLACDecoderResult FLACDecoder::decode_residuals(uint32_t block_size, int32_t *samples, uint32_t order) {
   uint32_t method = this->read_uint(2);
   if (method >= 2) {
     return FLAC_DECODER_ERROR_RESERVED_RESIDUAL_CODING_METHOD;
@@ -351,87 +443,146 @@ FLACDecoderResult FLACDecoder::decode_residuals(uint32_t block_size) {
 
   uint32_t partition_order = this->read_uint(4);
   uint32_t num_partitions = 1 << partition_order;
-  if ((block_size % num_partitions) != 0) {
+  if (((block_size % num_partitions) != 0) || ((block_size >> partition_order) < order)) {
     return FLAC_DECODER_ERROR_BLOCK_SIZE_NOT_DIVISIBLE_RICE;
   }
 
+  // The first partition is shortened by the warm-up samples
+  int32_t *residuals = samples + order;
   for (std::size_t i = 0; i < num_partitions; i++) {
     uint32_t count = block_size >> partition_order;
     if (i == 0) {
-      count -= this->block_result_.size();
+      count -= order;
     }
     uint32_t param = this->read_uint(param_bits);
     if (param < escape_param) {
-      for (std::size_t j = 0; j < count; j++) {
-        this->block_result_.push_back(this->read_rice_sint(param));
-      }
+      this->decode_rice_partition(residuals, count, param);
     } else {
       std::size_t num_bits = this->read_uint(5);
       for (std::size_t j = 0; j < count; j++) {
-        this->block_result_.push_back(this->read_sint(num_bits));
+        residuals[j] = this->read_sint(num_bits);
       }
     }
+    residuals += count;
   }  // for each partition
 
   return FLAC_DECODER_SUCCESS;
 }  // decode_residuals
 
-void FLACDecoder::restore_linear_prediction(const std::vector<int16_t> &coefs, int32_t shift) {
-  for (std::size_t i = 0; i < this->block_result_.size() - coefs.size() + 1; i++) {
-    int32_t sum = 0;
-    for (std::size_t j = 0; j < coefs.size(); ++j) {
-      sum += (this->block_result_[i + j] * coefs[j]);
-    }
-    this->block_result_[i + coefs.size() - 1] = (sum >> shift);
+void FLACDecoder::restore_linear_prediction(uint32_t block_size, int32_t *samples, const int32_t *coefs,
+                                            uint32_t order, int32_t shift, bool wide_sums) {
+  if ((order == 0) || (order > FLAC_MAX_LPC_ORDER)) {
+    // Order 0 is a fixed subframe that only has residuals
+    return;
+  }
+
+  if (wide_sums) {
+    WIDE_KERNELS[order - 1](block_size, samples, coefs, shift);
+  } else {
+    NARROW_KERNELS[order - 1](block_size, samples, coefs, shift);
   }
 }  // restore_linear_prediction
 
-uint32_t FLACDecoder::read_uint(std::size_t num_bits) {
-  if (this->bytes_left_ == 0) {
-    this->out_of_data_ = true;
-    return 0;
+void FLACDecoder::decode_rice_partition(int32_t *output, uint32_t count, uint32_t param) {
+  for (uint32_t i = 0; i < count; ++i) {
+    if (this->bit_buffer_length_ < 32) {
+      this->refill_bit_buffer();
+    }
+
+    // The quotient is unary coded as a run of zeros terminated by a one
+    uint32_t quotient = 0;
+    uint32_t zeros = (this->bit_buffer_ == 0) ? 64 : __builtin_clzll(this->bit_buffer_);
+    while (zeros >= this->bit_buffer_length_) {
+      // Every buffered bit is a zero, so count them and continue with the next bytes
+      quotient += this->bit_buffer_length_;
+      this->bit_buffer_ = 0;
+      this->bit_buffer_length_ = 0;
+      this->refill_bit_buffer();
+      if (this->bit_buffer_length_ == 0) {
+        this->out_of_data_ = true;
+        return;
+      }
+      zeros = (this->bit_buffer_ == 0) ? 64 : __builtin_clzll(this->bit_buffer_);
+    }
+    quotient += zeros;
+
+    // Drop the zeros and the terminating one
+    this->bit_buffer_length_ -= zeros + 1;
+    this->bit_buffer_ = (zeros < 63) ? (this->bit_buffer_ << (zeros + 1)) : 0;
+
+    uint32_t value = (quotient << param) | this->read_uint(param);
+    output[i] = static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+  }
+}  // decode_rice_partition
+
+void FLACDecoder::refill_bit_buffer() {
+  if (this->bytes_left_ >= sizeof(uint64_t)) {
+    // Load a big-endian word and keep as many whole bytes as fit. The bits below the new length are the start of the
+    // following bytes, so OR-ing them in again on the next refill leaves them unchanged.
+    uint64_t next_word;
+    std::memcpy(&next_word, this->buffer_ + this->buffer_index_, sizeof(next_word));
+    next_word = __builtin_bswap64(next_word);
+
+    std::size_t num_bytes = (64 - this->bit_buffer_length_) / 8;
+    this->bit_buffer_ |= next_word >> this->bit_buffer_length_;
+    this->bit_buffer_length_ += num_bytes * 8;
+    this->buffer_index_ += num_bytes;
+    this->bytes_left_ -= num_bytes;
+    return;
   }
 
-  while (this->bit_buffer_length_ < num_bits) {
-    uint8_t next_byte = this->buffer_[this->buffer_index_];
+  while ((this->bit_buffer_length_ <= 56) && (this->bytes_left_ > 0)) {
+    uint64_t next_byte = this->buffer_[this->buffer_index_];
+    this->bit_buffer_ |= next_byte << (56 - this->bit_buffer_length_);
+    this->bit_buffer_length_ += 8;
     this->buffer_index_++;
     this->bytes_left_--;
-    if (this->bytes_left_ == 0) {
+  }
+}  // refill_bit_buffer
+
+uint32_t FLACDecoder::read_uint(std::size_t num_bits) {
+  if (num_bits == 0) {
+    return 0;
+  }
+
+  if (this->bit_buffer_length_ < num_bits) {
+    this->refill_bit_buffer();
+    if (this->bit_buffer_length_ < num_bits) {
       this->out_of_data_ = true;
       return 0;
     }
-
-    this->bit_buffer_ = (this->bit_buffer_ << 8) | next_byte;
-    this->bit_buffer_length_ += 8;
   }
 
+  uint32_t result = this->bit_buffer_ >> (64 - num_bits);
+  this->bit_buffer_ <<= num_bits;
   this->bit_buffer_length_ -= num_bits;
-  uint32_t result = this->bit_buffer_ >> this->bit_buffer_length_;
-  if (num_bits < 32) {
-    result &= FLAC_UINT_MASK[num_bits];
-  }
 
   return result;
 }  // read_uint
 
 int32_t FLACDecoder::read_sint(std::size_t num_bits) {
+  if (num_bits == 0) {
+    return 0;
+  }
+
+  // Sign extend from the top bit that was read
   uint32_t next_int = this->read_uint(num_bits);
-  return (int32_t) next_int - (((int32_t) next_int >> (num_bits - 1)) << num_bits);
+  return static_cast<int32_t>(next_int << (32 - num_bits)) >> (32 - num_bits);
 }  // read_sint
 
-int64_t FLACDecoder::read_rice_sint(uint8_t param) {
-  long value = 0;
-  while (this->read_uint(1) == 0) {
-    value++;
-    if (this->out_of_data_) {
-      return 0;
-    }
-  }
-  value = (value << param) | this->read_uint(param);
-  return (value >> 1) ^ -(value & 1);
-}  // read_rice_sint
+void FLACDecoder::align_to_byte() {
+  std::size_t padding_bits = this->bit_buffer_length_ % 8;
+  this->bit_buffer_ <<= padding_bits;
+  this->bit_buffer_length_ -= padding_bits;
+}  // align_to_byte
 
-void FLACDecoder::align_to_byte() { this->bit_buffer_length_ -= (this->bit_buffer_length_ % 8); }  // align_to_byte
+void FLACDecoder::release_bit_buffer() {
+  std::size_t unread_bytes = this->bit_buffer_length_ / 8;
+  this->buffer_index_ -= unread_bytes;
+  this->bytes_left_ += unread_bytes;
+  this->bit_buffer_ = 0;
+  this->bit_buffer_length_ = 0;
+}  // release_bit_buffer
 
 }  // namespace flac
 #endif
\ No newline at end of file
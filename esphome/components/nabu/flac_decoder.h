@@ -13,19 +13,12 @@
 #include "esphome/core/ring_buffer.h"
 
 #include <cstdint>
-#include <vector>
 
 namespace flac {
 
 // 'fLaC'
 const static uint32_t FLAC_MAGIC_NUMBER = 0x664C6143;
 
-const static uint32_t FLAC_UINT_MASK[] = {
-    0x00000000, 0x00000001, 0x00000003, 0x00000007, 0x0000000f, 0x0000001f, 0x0000003f, 0x0000007f, 0x000000ff,
-    0x000001ff, 0x000003ff, 0x000007ff, 0x00000fff, 0x00001fff, 0x00003fff, 0x00007fff, 0x0000ffff, 0x0001ffff,
-    0x0003ffff, 0x0007ffff, 0x000fffff, 0x001fffff, 0x003fffff, 0x007fffff, 0x00ffffff, 0x01ffffff, 0x03ffffff,
-    0x07ffffff, 0x0fffffff, 0x1fffffff, 0x3fffffff, 0x7fffffff, 0xffffffff};
-
 enum FLACDecoderResult {
   FLAC_DECODER_SUCCESS = 0,
   FLAC_DECODER_NO_MORE_FRAMES = 1,
@@ -40,33 +33,34 @@ enum FLACDecoderResult {
   FLAC_DECODER_ERROR_BAD_FIXED_PREDICTION_ORDER = 10,
   FLAC_DECODER_ERROR_RESERVED_RESIDUAL_CODING_METHOD = 11,
   FLAC_DECODER_ERROR_BLOCK_SIZE_NOT_DIVISIBLE_RICE = 12,
+  FLAC_DECODER_ERROR_BAD_LPC_SHIFT = 13,
+  FLAC_DECODER_ERROR_MEMORY_ALLOCATION_FAILED = 14,
 };
 
-// Coefficients for fixed linear prediction
-const static std::vector<int16_t> FLAC_FIXED_COEFFICIENTS[] = {
-    {1}, {1, 1}, {-1, 2, 1}, {1, -3, 3, 1}, {-1, 4, -6, 4, 1}};
+// Highest prediction order allowed for LPC subframes
+const static uint32_t FLAC_MAX_LPC_ORDER = 32;
+
+// Coefficients for fixed linear prediction, oldest sample first
+const static int32_t FLAC_FIXED_COEFFICIENTS[][4] = {{}, {1}, {-1, 2}, {1, -3, 3}, {-1, 4, -6, 4}};
 
 /* Basic FLAC decoder ported from:
  * https://www.nayuki.io/res/simple-flac-implementation/simple-decode-flac-to-wav.py
  */
 class FLACDecoder {
  public:
-  /* buffer - FLAC data
-   * buffer_size - size of the data buffer
-   * min_buffer_size - min bytes in buffer before fill_buffer is called
-   */
-  FLACDecoder(uint8_t *buffer) : buffer_(buffer) {}
+  FLACDecoder() {}
 
   ~FLACDecoder() { this->free_buffers(); }
 
-  /* Reads FLAC header from buffer.
+  /* Reads FLAC header from buffer, which holds buffer_length bytes of FLAC data.
    * Must be called before decode_frame. */
-  FLACDecoderResult read_header(size_t buffer_length);
+  FLACDecoderResult read_header(const uint8_t *buffer, size_t buffer_length);
 
-  /* Decodes a single frame of audio.
-   * Copies num_samples into output_buffer.
+  /* Decodes a single frame of audio from buffer, which holds buffer_length bytes of FLAC data.
+   * Copies num_samples interleaved samples into output_buffer, each get_output_bytes_per_sample() bytes wide.
    * Use get_output_buffer_size() to allocate output_buffer. */
-  FLACDecoderResult decode_frame(size_t buffer_length, int16_t *output_buffer, uint32_t *num_samples);
+  FLACDecoderResult decode_frame(const uint8_t *buffer, size_t buffer_length, uint8_t *output_buffer,
+                                 uint32_t *num_samples);
 
   /* Frees internal memory. */
   void free_buffers();
@@ -86,6 +80,10 @@ class FLACDecoder {
   /* Maximum number of output samples per frame (after read_header()) */
   uint32_t get_output_buffer_size() { return this->max_block_size_ * this->num_channels_; }
 
+  /* Size of an output sample (after read_header()). Streams deeper than 16 bits are output as 32 bit samples, aligned
+   * to the most significant bit. */
+  uint32_t get_output_bytes_per_sample() { return (this->sample_depth_ > 16) ? sizeof(int32_t) : sizeof(int16_t); }
+
   std::size_t get_bytes_index() { return this->buffer_index_; }
 
   /* Number of unread bytes in the input buffer. */
@@ -98,35 +96,47 @@ class FLACDecoder {
   /* Decodes a subframe by type. */
   FLACDecoderResult decode_subframe(uint32_t block_size, uint32_t sample_depth, std::size_t block_samples_offset);
 
-  /* Decodes a subframe with fixed coefficients. */
-  FLACDecoderResult decode_fixed_subframe(uint32_t block_size, std::size_t block_samples_offset, uint32_t pre_order,
+  /* Decodes a subframe with fixed coefficients into samples. */
+  FLACDecoderResult decode_fixed_subframe(uint32_t block_size, int32_t *samples, uint32_t pre_order,
                                           uint32_t sample_depth);
 
-  /* Decodes a subframe with dynamic coefficients. */
-  FLACDecoderResult decode_lpc_subframe(uint32_t block_size, std::size_t block_samples_offset, uint32_t lpc_order,
+  /* Decodes a subframe with dynamic coefficients into samples. */
+  FLACDecoderResult decode_lpc_subframe(uint32_t block_size, int32_t *samples, uint32_t lpc_order,
                                         uint32_t sample_depth);
 
-  /* Decodes prediction residuals. */
-  FLACDecoderResult decode_residuals(uint32_t block_size);
+  /* Decodes prediction residuals into samples, after the order warm-up samples. */
+  FLACDecoderResult decode_residuals(uint32_t block_size, int32_t *samples, uint32_t order);
+
+  /* Completes predicted samples in place by adding the prediction to each residual.
+   * Uses a kernel unrolled for the order; wide_sums selects 64-bit accumulation for predictions that can overflow. */
+  void restore_linear_prediction(uint32_t block_size, int32_t *samples, const int32_t *coefs, uint32_t order,
+                                 int32_t shift, bool wide_sums);
 
-  /* Completes predicted samples. */
-  void restore_linear_prediction(const std::vector<int16_t> &coefs, int32_t shift);
+  /* Decodes count rice-encoded signed integers into output. */
+  void decode_rice_partition(int32_t *output, uint32_t count, uint32_t param);
 
-  /* Reads an unsigned integer of arbitrary bit size. */
+  /* Loads as many whole bytes from the input buffer into the bit buffer as fit.
+   * Only call when bit_buffer_length_ <= 56. */
+  void refill_bit_buffer();
+
+  /* Reads an unsigned integer of up to 32 bits. */
   uint32_t read_uint(std::size_t num_bits);
 
-  /* Reads a singed integer of arbitrary bit size. */
+  /* Reads a singed integer of up to 32 bits. */
   int32_t read_sint(std::size_t num_bits);
 
-  /* Reads a rice-encoded signed integer. */
-  int64_t read_rice_sint(uint8_t param);
-
   /* Forces input buffer to be byte-aligned. */
   void align_to_byte();
 
+  /* Hands whole unread bytes in the bit buffer back to the input buffer. Must be byte-aligned. */
+  void release_bit_buffer();
+
+  /* Number of unread bytes, including those loaded into the bit buffer. Must be byte-aligned. */
+  std::size_t bytes_remaining() { return this->bytes_left_ + this->bit_buffer_length_ / 8; }
+
  private:
   /* Pointer to input buffer with FLAC data. */
-  uint8_t *buffer_ = nullptr;
+  const uint8_t *buffer_ = nullptr;
 
   /* Next index to read from the input buffer. */
   std::size_t buffer_index_ = 0;
@@ -134,10 +144,10 @@ class FLACDecoder {
   /* Number of byte that haven't been read from the input buffer yet. */
   std::size_t bytes_left_ = 0;
 
-  /* Number of bits in the bit buffer. */
+  /* Number of valid bits in the bit buffer. */
   std::size_t bit_buffer_length_ = 0;
 
-  /* Last read bits from input buffer. */
+  /* Bits read ahead from the input buffer, aligned to the most significant bit. */
   uint64_t bit_buffer_ = 0;
 
   /* True if input buffer is empty and cannot be filled. */
@@ -164,8 +174,8 @@ class FLACDecoder {
   /* Buffer of decoded samples at full precision (all channels). */
   int32_t *block_samples_ = nullptr;
 
-  /* Buffer of decoded samples at full precision (single channel). */
-  std::vector<int32_t, esphome::ExternalRAMAllocator<int32_t>> block_result_;
+  /* Quantized coefficients of the current LPC subframe, oldest sample first. */
+  int32_t lpc_coefs_[FLAC_MAX_LPC_ORDER];
 
   bool partial_header_read_{false};
   bool partial_header_last_{false};
@@ -0,0 +1,116 @@
+#ifdef USE_ESP_IDF
+
+#include "http_connection_pool.h"
+
+#include "esphome/core/hal.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace esphome {
+namespace nabu {
+
+// Servers commonly close idle keep-alive connections after 60 to 75 seconds; stay well below that
+static const uint32_t MAX_IDLE_MS = 30000;
+
+HttpConnectionPool::~HttpConnectionPool() {
+  for (IdleConnection &connection : this->idle_connections_) {
+    close_(connection.client);
+  }
+}
+
+esp_http_client_handle_t HttpConnectionPool::acquire(const std::string &uri) {
+  const std::string origin = get_origin_(uri);
+
+  // Connections are only closed after the lock is dropped, as closing them may take a while
+  std::vector<esp_http_client_handle_t> expired;
+  esp_http_client_handle_t client = nullptr;
+
+  {
+    LockGuard guard(this->lock_);
+    this->remove_expired_(expired);
+
+    // Most recently used first, as it is the most likely to still be open on the server's end
+    auto connection = std::find_if(this->idle_connections_.rbegin(), this->idle_connections_.rend(),
+                                   [&origin](const IdleConnection &idle) { return idle.origin == origin; });
+    if (connection != this->idle_connections_.rend()) {
+      client = connection->client;
+      this->idle_connections_.erase(std::next(connection).base());
+    }
+  }
+
+  for (esp_http_client_handle_t expired_client : expired) {
+    close_(expired_client);
+  }
+
+  if ((client != nullptr) && (esp_http_client_set_url(client, uri.c_str()) != ESP_OK)) {
+    close_(client);
+    client = nullptr;
+  }
+
+  return client;
+}
+
+void HttpConnectionPool::release(const std::string &uri, esp_http_client_handle_t client) {
+  std::vector<esp_http_client_handle_t> expired;
+
+  {
+    LockGuard guard(this->lock_);
+    this->remove_expired_(expired);
+
+    if (this->max_idle_connections_ == 0) {
+      expired.push_back(client);
+    } else {
+      if (this->idle_connections_.size() >= this->max_idle_connections_) {
+        expired.push_back(this->idle_connections_.front().client);
+        this->idle_connections_.erase(this->idle_connections_.begin());
+      }
+      this->idle_connections_.push_back({get_origin_(uri), client, millis()});
+    }
+  }
+
+  for (esp_http_client_handle_t expired_client : expired) {
+    close_(expired_client);
+  }
+}
+
+void HttpConnectionPool::close_expired() {
+  std::vector<esp_http_client_handle_t> expired;
+
+  {
+    LockGuard guard(this->lock_);
+    this->remove_expired_(expired);
+  }
+
+  for (esp_http_client_handle_t expired_client : expired) {
+    close_(expired_client);
+  }
+}
+
+std::string HttpConnectionPool::get_origin_(const std::string &uri) {
+  size_t host_start = uri.find("://");
+  host_start = (host_start == std::string::npos) ? 0 : host_start + 3;
+  return str_lower_case(uri.substr(0, uri.find_first_of("/?#", host_start)));
+}
+
+void HttpConnectionPool::close_(esp_http_client_handle_t client) {
+  esp_http_client_close(client);
+  esp_http_client_cleanup(client);
+}
+
+void HttpConnectionPool::remove_expired_(std::vector<esp_http_client_handle_t> &expired) {
+  const uint32_t now = millis();
+  // Connections are kept in the order they were released, so the expired ones are at the front
+  auto first_fresh =
+      std::find_if(this->idle_connections_.begin(), this->idle_connections_.end(),
+                   [now](const IdleConnection &idle) { return (now - idle.idle_since_ms) < MAX_IDLE_MS; });
+  for (auto connection = this->idle_connections_.begin(); connection != first_fresh; ++connection) {
+    expired.push_back(connection->client);
+  }
+  this->idle_connections_.erase(this->idle_connections_.begin(), first_fresh);
+}
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+
+#ifdef USE_ESP_IDF
+
+#include "esphome/core/helpers.h"
+
+#include <esp_http_client.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace nabu {
+
+/// @brief Keeps the connections of completely read HTTP responses open, so later streams from the same server skip
+/// the TCP and TLS handshakes.
+///
+/// Back-to-back announcements and playlist tracks usually come from the same Home Assistant server. Connections idle
+/// for too long are closed, as the server likely closed its end already; close_expired() must be called periodically
+/// for that, as acquire() and release() only do it when a stream starts or ends. All functions are safe to call from
+/// any task.
+class HttpConnectionPool {
+ public:
+  /// @param max_idle_connections the most connections kept open while unused; the oldest is closed first
+  explicit HttpConnectionPool(size_t max_idle_connections) : max_idle_connections_(max_idle_connections) {}
+  ~HttpConnectionPool();
+
+  /// @brief Takes an idle connection to the server of the uri and points it at the uri
+  /// @return the connection or nullptr if none to that server is open
+  esp_http_client_handle_t acquire(const std::string &uri);
+
+  /// @brief Hands back a connection whose response was read completely, so a later stream can reuse it
+  /// @param uri the last uri requested on the connection
+  void release(const std::string &uri, esp_http_client_handle_t client);
+
+  /// @brief Closes the connections that were idle for too long
+  void close_expired();
+
+ protected:
+  struct IdleConnection {
+    std::string origin;
+    esp_http_client_handle_t client;
+    uint32_t idle_since_ms;
+  };
+
+  /// @brief Returns the scheme, host, and port part of a uri
+  static std::string get_origin_(const std::string &uri);
+
+  static void close_(esp_http_client_handle_t client);
+
+  /// @brief Moves connections that were idle too long to expired. Must hold lock_.
+  void remove_expired_(std::vector<esp_http_client_handle_t> &expired);
+
+  Mutex lock_;
+  std::vector<IdleConnection> idle_connections_;
+  size_t max_idle_connections_;
+};
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -1,8 +1,13 @@
 """Nabu Media Player Setup."""
 
+from array import array
 import hashlib
+import io
 import logging
+import math
 from pathlib import Path
+import sys
+import wave
 from magic import Magic
 
 import esphome.codegen as cg
@@ -47,9 +52,20 @@ DOMAIN = "file"
 TYPE_LOCAL = "local"
 TYPE_WEB = "web"
 
+CONF_ANNOUNCEMENT_RESAMPLER_QUALITY = "announcement_resampler_quality"
+CONF_CURVE = "curve"
 CONF_DECIBEL_REDUCTION = "decibel_reduction"
 
 CONF_FILES = "files"
+CONF_MEDIA_RESAMPLER_QUALITY = "media_resampler_quality"
+CONF_PCM_CACHE_SIZE = "pcm_cache_size"
+CONF_TRANSCODE_FILES = "transcode_files"
+
+# Resampling filter used when transcoding files; zero crossings of the sinc on each side and the Kaiser window shape
+TRANSCODE_ZERO_CROSSINGS = 16
+TRANSCODE_KAISER_BETA = 8.6
+# Phases of the resampling filter are quantized to this many steps when the rate ratio needs more
+TRANSCODE_MAX_PHASES = 1024
 CONF_SAMPLE_RATE = "sample_rate"
 CONF_VOLUME_INCREMENT = "volume_increment"
 
@@ -64,6 +80,19 @@ NabuMediaPlayer = nabu_ns.class_(
     i2c.I2CDevice,
 )
 
+ResamplerQuality = nabu_ns.enum("ResamplerQuality", is_class=True)
+RESAMPLER_QUALITIES = {
+    "fast": ResamplerQuality.FAST,
+    "balanced": ResamplerQuality.BALANCED,
+    "high": ResamplerQuality.HIGH,
+}
+
+DuckingCurve = nabu_ns.enum("DuckingCurve", is_class=True)
+DUCKING_CURVES = {
+    "linear": DuckingCurve.LINEAR,
+    "smooth": DuckingCurve.SMOOTH,
+}
+
 DuckingSetAction = nabu_ns.class_(
     "DuckingSetAction", automation.Action, cg.Parented.template(NabuMediaPlayer)
 )
@@ -184,10 +213,145 @@ CONFIG_SCHEMA = media_player.MEDIA_PLAYER_SCHEMA.extend(
         ),
         cv.Optional(CONF_VOLUME_INCREMENT, default=0.05): cv.percentage,
         cv.Optional(CONF_FILES): cv.ensure_list(MEDIA_FILE_TYPE_SCHEMA),
+        cv.Optional(CONF_PCM_CACHE_SIZE, default=524288): cv.int_range(min=0),
+        cv.Optional(CONF_TRANSCODE_FILES, default=False): cv.boolean,
+        cv.Optional(CONF_MEDIA_RESAMPLER_QUALITY, default="high"): cv.enum(
+            RESAMPLER_QUALITIES, lower=True
+        ),
+        cv.Optional(CONF_ANNOUNCEMENT_RESAMPLER_QUALITY, default="fast"): cv.enum(
+            RESAMPLER_QUALITIES, lower=True
+        ),
     }
 ).extend(i2c.i2c_device_schema(0x18))
 
 
+def _bessel_i0(x):
+    total = term = 1.0
+    k = 1
+    while term > 1e-12 * total:
+        term *= (x / (2 * k)) ** 2
+        total += term
+        k += 1
+    return total
+
+
+def _resample(channel_samples, in_rate, out_rate):
+    """Resamples each channel with a Kaiser windowed sinc filter, evaluated per output phase."""
+    g = math.gcd(in_rate, out_rate)
+    up, down = out_rate // g, in_rate // g
+    phases = min(up, TRANSCODE_MAX_PHASES)
+
+    # Lowpass at the lower Nyquist frequency, widening the filter when downsampling
+    cutoff = min(1.0, out_rate / in_rate)
+    half_length = math.ceil(TRANSCODE_ZERO_CROSSINGS / cutoff)
+    window_norm = _bessel_i0(TRANSCODE_KAISER_BETA)
+
+    def kernel(fraction):
+        taps = []
+        for k in range(-half_length + 1, half_length + 1):
+            distance = k - fraction
+            x = distance / half_length
+            if abs(x) >= 1.0:
+                taps.append(0.0)
+                continue
+            window = _bessel_i0(TRANSCODE_KAISER_BETA * math.sqrt(1.0 - x * x))
+            arg = math.pi * cutoff * distance
+            sinc = 1.0 if arg == 0.0 else math.sin(arg) / arg
+            taps.append(cutoff * sinc * window / window_norm)
+        return taps
+
+    kernels = [kernel(phase / phases) for phase in range(phases)]
+
+    frames = len(channel_samples[0])
+    out_frames = frames * up // down
+    padding = [0.0] * half_length
+    resampled = []
+    for samples in channel_samples:
+        padded = padding + samples + padding
+        output = []
+        for n in range(out_frames):
+            position = n * down
+            index = position // up
+            taps = kernels[(position % up) * phases // up]
+            # Input sample index + k sits at padded index + half_length
+            start = index + 1
+            output.append(sum(map(float.__mul__, padded[start : start + 2 * half_length], taps)))
+        resampled.append(output)
+    return resampled
+
+
+def _transcode_to_raw(data, sample_rate):
+    """Converts PCM WAV data to headerless PCM at sample_rate.
+
+    Keeps the channel count; 8 and 16 bit sources become 16 bit samples, deeper sources become 32 bit samples.
+    Returns the samples and their StreamInfo fields, or None if the data isn't a PCM WAV file.
+    """
+    try:
+        with wave.open(io.BytesIO(data), "rb") as wav:
+            channels = wav.getnchannels()
+            sample_width = wav.getsampwidth()
+            in_rate = wav.getframerate()
+            frames = wav.readframes(wav.getnframes())
+    except (wave.Error, EOFError):
+        return None
+
+    # Normalize every sample to a float in [-1, 1)
+    if sample_width == 1:
+        values = [(b - 128) / 128.0 for b in frames]
+    elif sample_width == 2:
+        ints = array("h", frames)
+        if sys.byteorder == "big":
+            ints.byteswap()
+        values = [v / 32768.0 for v in ints]
+    elif sample_width == 3:
+        values = [
+            int.from_bytes(frames[i : i + 3], "little", signed=True) / 8388608.0
+            for i in range(0, len(frames) - 2, 3)
+        ]
+    elif sample_width == 4:
+        ints = array("i", frames)
+        if sys.byteorder == "big":
+            ints.byteswap()
+        values = [v / 2147483648.0 for v in ints]
+    else:
+        return None
+
+    channel_samples = [values[c::channels] for c in range(channels)]
+    if in_rate != sample_rate:
+        channel_samples = _resample(channel_samples, in_rate, sample_rate)
+
+    bits_per_sample = 16 if sample_width <= 2 else 32
+    full_scale = float(1 << (bits_per_sample - 1))
+    low, high = -full_scale, full_scale - 1
+    interleaved = array("h" if bits_per_sample == 16 else "i")
+    for frame in zip(*channel_samples):
+        for v in frame:
+            interleaved.append(int(min(max(round(v * full_scale), low), high)))
+    if sys.byteorder == "big":
+        interleaved.byteswap()
+
+    return interleaved.tobytes(), channels, bits_per_sample, sample_rate
+
+
+def _load_transcoded(data, sample_rate):
+    """Returns the result of _transcode_to_raw, reusing a copy stored from an earlier build when possible."""
+    h = hashlib.new("sha256")
+    h.update(data)
+    h.update(sample_rate.to_bytes(4, "little"))
+    path = external_files.compute_local_file_dir(DOMAIN) / f"{h.hexdigest()[:16]}.raw"
+
+    if path.is_file():
+        stored = path.read_bytes()
+        channels, bits_per_sample = stored[0], stored[1]
+        return stored[2:], channels, bits_per_sample, sample_rate
+
+    result = _transcode_to_raw(data, sample_rate)
+    if result is not None:
+        samples, channels, bits_per_sample, _ = result
+        path.write_bytes(bytes([channels, bits_per_sample]) + samples)
+    return result
+
+
 async def to_code(config):
     esp32.add_idf_component(
         name="esp-dsp",
@@ -207,6 +371,13 @@ async def to_code(config):
     cg.add(var.set_sample_rate(config[CONF_SAMPLE_RATE]))
 
     cg.add(var.set_volume_increment(config[CONF_VOLUME_INCREMENT]))
+    cg.add(var.set_pcm_cache_size(config[CONF_PCM_CACHE_SIZE]))
+    cg.add(var.set_media_resampler_quality(config[CONF_MEDIA_RESAMPLER_QUALITY]))
+    cg.add(
+        var.set_announcement_resampler_quality(
+            config[CONF_ANNOUNCEMENT_RESAMPLER_QUALITY]
+        )
+    )
 
     if files_list := config.get(CONF_FILES):
         for file_config in files_list:
@@ -231,11 +402,28 @@ async def to_code(config):
             elif "flac" in file_type:
                 media_file_type = MEDIA_FILE_TYPE_ENUM["FLAC"]
 
+            stream_info = None
+            if config[CONF_TRANSCODE_FILES]:
+                transcoded = _load_transcoded(data, config[CONF_SAMPLE_RATE])
+                if transcoded is None:
+                    _LOGGER.warning(
+                        "%s is not a PCM WAV file, so it is embedded without transcoding",
+                        file_config[CONF_ID],
+                    )
+                else:
+                    data, channels, bits_per_sample, sample_rate = transcoded
+                    media_file_type = MEDIA_FILE_TYPE_ENUM["RAW"]
+                    stream_info = cg.StructInitializer(
+                        media_player.media_player_ns.struct("StreamInfo"),
+                        ("channels", channels),
+                        ("bits_per_sample", bits_per_sample),
+                        ("sample_rate", sample_rate),
+                    )
+
             rhs = [HexInt(x) for x in data]
             prog_arr = cg.progmem_array(file_config[CONF_RAW_DATA_ID], rhs)
 
-            media_files_struct = cg.StructInitializer(
-                MediaFile,
+            media_file_fields = [
                 (
                     "data",
                     prog_arr,
@@ -248,7 +436,11 @@ async def to_code(config):
                     "file_type",
                     media_file_type,
                 ),
-            )
+            ]
+            if stream_info is not None:
+                media_file_fields.append(("stream_info", stream_info))
+
+            media_files_struct = cg.StructInitializer(MediaFile, *media_file_fields)
 
             cg.new_Pvariable(
                 file_config[CONF_ID],
@@ -260,9 +452,10 @@ DUCKING_SET_SCHEMA = cv.Schema(
     {
         cv.GenerateID(): cv.use_id(NabuMediaPlayer),
         cv.Required(CONF_DECIBEL_REDUCTION): cv.templatable(
-            cv.int_range(min=0, max=51)
+            cv.float_range(min=0.0, max=120.0)
         ),
         cv.Optional(CONF_DURATION, default="0.0s"): cv.templatable(cv.positive_time_period_seconds),
+        cv.Optional(CONF_CURVE, default="linear"): cv.enum(DUCKING_CURVES, lower=True),
     }
 )
 
@@ -272,11 +465,12 @@ async def ducking_set_to_code(config, action_id, template_arg, args):
     var = cg.new_Pvariable(action_id, template_arg)
     await cg.register_parented(var, config[CONF_ID])
     decibel_reduction = await cg.templatable(
-        config[CONF_DECIBEL_REDUCTION], args, cg.uint8
+        config[CONF_DECIBEL_REDUCTION], args, cg.float_
     )
     cg.add(var.set_decibel_reduction(decibel_reduction))
     duration = await cg.templatable(
         config[CONF_DURATION], args, cg.float_
     )
     cg.add(var.set_duration(duration))
+    cg.add(var.set_curve(config[CONF_CURVE]))
     return var
@@ -5,7 +5,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#if defined(__XTENSA__)
 #include <xtensa/config/core-isa.h>
+#endif
 
 #define ASSERT(x) /* do nothing */
 
@@ -49,6 +51,7 @@ typedef long long Word64;
 
 static __inline Word64 MADD64(Word64 sum64, int x, int y) { return (sum64 + ((long long) x * y)); }
 
+#if defined(__XTENSA__)
 static __inline int MULSHIFT32(int x, int y) {
   /* important rules for smull RdLo, RdHi, Rm, Rs:
    *     RdHi and Rm can't be the same register
@@ -70,10 +73,21 @@ static __inline int FASTABS(int x) {
   asm volatile("abs %0, %1" : "=r"(ret) : "r"(x));
   return ret;
 }
+#else
+/* portable versions, for building on other architectures such as a host running tests */
+static __inline int MULSHIFT32(int x, int y) { return (int) (((long long) x * y) >> 32); }
+
+static __inline int FASTABS(int x) { return abs(x); }
+#endif
 
 static __inline Word64 SAR64(Word64 x, int n) { return x >> n; }
 
+#if defined(__XTENSA__)
+/* nsau returns 32 for 0, like the decoder expects */
 static __inline int CLZ(int x) { return __builtin_clz(x); }
+#else
+static __inline int CLZ(int x) { return x == 0 ? 32 : __builtin_clz(x); }
+#endif
 
 /* clip to range [-2^n, 2^n - 1] */
 #define CLIP_2N(y, n) \
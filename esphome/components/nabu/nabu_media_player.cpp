@@ -35,21 +35,29 @@ namespace nabu {
 //      - FLAC
 //      - WAV
 //      - MP3 (based on the libhelix decoder - a random mp3 file may be incompatible)
-//    - ``AudioResampler`` handles converting the sample rate to the configured output sample rate and converting mono
-//      to stereo
-//      - The quality is not good, and it is slow! Please send audio at the configured sample rate to avoid these issues
+//    - ``AudioResampler`` handles converting the sample rate to the configured output sample rate. Mono audio stays
+//      mono, which halves the memory bandwidth of mono announcements through the mixer
+//      - Each pipeline has a quality profile from YAML; announcements default to ``fast`` and media to ``high``. A
+//        pipeline drops to the next lower profile if resampling a stream takes too much CPU time. Sending audio at the
+//        configured sample rate avoids resampling entirely, except for live media streams
+//      - Internet radio media streams (recognized by their Icecast "icy-" headers) are always resampled, so the ratio
+//        can follow the server's clock. The reader's buffer level is held constant once the stream arrives in real
+//        time, so the buffer never overflows or runs dry
 //    - Each task will always run once started, but they will not doing anything until they are needed
 //    - FreeRTOS Event Groups make up the inter-task communication
 //    - The ``AudioPipeline`` sets up an output ring buffer for the Reader and Decoder parts. The next part/task
 //      automatically pulls from the previous ring buffer
+//    - Enqueued media is prefetched by a second media pipeline. It only writes to the mixer once the current media
+//      pipeline finishes, so the media plays without a gap, and then takes the current pipeline's place
 //  - The streams are mixed together in the ``AudioMixer`` task
 //    - Each stream has a corresponding input buffer that the ``AudioResampler`` feeds directly
 //    - Pausing the media stream is done here
-//    - Media stream ducking is done here
+//    - Media stream ducking is done here. The gain changes smoothly every sample while transitioning, following a
+//      linear or smooth curve in dB
 //    - The output ring buffer feeds the ``speaker_task`` directly. It is kept small intentionally to avoid latency when
 //      pausing
 //  - Audio output is handled by the ``speaker_task``. It configures the I2S bus and copies audio from the mixer's
-//    output ring buffer to the DMA buffers
+//    output ring buffer to the DMA buffers, expanding mono audio to stereo on the way
 //  - Media player commands are received by the ``control`` function. The commands are added to the
 //    ``media_control_command_queue_`` to be processed in the component's loop
 //    - Starting a stream intializes the appropriate pipeline or stops it if it is already running
@@ -76,6 +84,12 @@ static const UBaseType_t ANNOUNCEMENT_PIPELINE_TASK_PRIORITY = 7;
 static const UBaseType_t MIXER_TASK_PRIORITY = 10;
 static const UBaseType_t SPEAKER_TASK_PRIORITY = 23;
 
+// Enough for one media and one announcement stream to each keep a connection to its server
+static const size_t MAX_IDLE_HTTP_CONNECTIONS = 2;
+
+// Holds the filters for a few common rate pairs, e.g., 44.1 kHz -> 48 kHz and 22.05 kHz -> 48 kHz with Q31 coefficients
+static const size_t MAX_FILTER_BANK_CACHE_BYTES = 192 * 1024;
+
 #define STATS_TASK_PRIO 3
 #define STATS_TICKS pdMS_TO_TICKS(5000)
 #define ARRAY_SIZE_OFFSET 5  // Increase this if print_real_time_stats returns ESP_ERR_INVALID_SIZE
@@ -201,6 +215,13 @@ void NabuMediaPlayer::setup() {
   this->speaker_command_queue_ = xQueueCreate(QUEUE_COUNT, sizeof(CommandEvent));
   this->speaker_event_queue_ = xQueueCreate(QUEUE_COUNT, sizeof(TaskEvent));
 
+  if (this->pcm_cache_size_ > 0) {
+    this->pcm_cache_ = make_unique<AudioPcmCache>(this->pcm_cache_size_);
+  }
+
+  this->connection_pool_ = make_unique<HttpConnectionPool>(MAX_IDLE_HTTP_CONNECTIONS);
+  this->filter_bank_cache_ = make_unique<FilterBankCache>(MAX_FILTER_BANK_CACHE_BYTES);
+
   if (!this->parent_->try_lock()) {
     ESP_LOGE(TAG, "Couldn't lock I2S port");
     this->mark_failed();
@@ -317,20 +338,31 @@ void NabuMediaPlayer::speaker_task(void *params) {
       }
     }
 
-    size_t delay_ms = 10;
-    size_t bytes_to_read = DMA_BUFFER_SIZE * sizeof(int16_t) * NUMBER_OF_CHANNELS;
-    size_t bytes_read = 0;
-
-    bytes_read = this_speaker->audio_mixer_->read((uint8_t *) buffer, bytes_to_read, (delay_ms / portTICK_PERIOD_MS));
+    const uint8_t bytes_per_sample = this_speaker->audio_mixer_->get_bits_per_sample() / 8;
+    uint8_t channels = NUMBER_OF_CHANNELS;
+    size_t frames_read = this_speaker->audio_mixer_->read((uint8_t *) buffer, DMA_BUFFER_SIZE, channels);
+
+    if (frames_read > 0) {
+      if (channels == 1) {
+        // Expand mono to stereo in place, starting from the end; this is the only copy of the audio in stereo
+        if (bytes_per_sample == sizeof(int16_t)) {
+          for (int i = frames_read - 1; i >= 0; --i) {
+            buffer[2 * i] = buffer[i];
+            buffer[2 * i + 1] = buffer[i];
+          }
+        } else {
+          int32_t *wide_buffer = reinterpret_cast<int32_t *>(buffer);
+          for (int i = frames_read - 1; i >= 0; --i) {
+            wide_buffer[2 * i] = wide_buffer[i];
+            wide_buffer[2 * i + 1] = wide_buffer[i];
+          }
+        }
+      }
 
-    if (bytes_read > 0) {
+      // The mixer already outputs samples in the I2S slot size, so they are written without converting
+      const size_t bytes_read = frames_read * NUMBER_OF_CHANNELS * bytes_per_sample;
       size_t bytes_written;
-      if (this_speaker->bits_per_sample_ == I2S_BITS_PER_SAMPLE_16BIT) {
-        i2s_write(this_speaker->parent_->get_port(), buffer, bytes_read, &bytes_written, portMAX_DELAY);
-      } else {
-        i2s_write_expand(this_speaker->parent_->get_port(), buffer, bytes_read, I2S_BITS_PER_SAMPLE_16BIT,
-                         this_speaker->bits_per_sample_, &bytes_written, portMAX_DELAY);
-      }
+      i2s_write(this_speaker->parent_->get_port(), buffer, bytes_read, &bytes_written, portMAX_DELAY);
 
       if (bytes_written != bytes_read) {
         event.type = EventType::WARNING;
@@ -364,11 +396,13 @@ void NabuMediaPlayer::speaker_task(void *params) {
   }
 }
 
-esp_err_t NabuMediaPlayer::start_pipeline_(AudioPipelineType type, bool url) {
+esp_err_t NabuMediaPlayer::start_pipeline_(AudioPipelineType type, bool url, bool enqueue) {
   esp_err_t err = ESP_OK;
 
   if (this->audio_mixer_ == nullptr) {
     this->audio_mixer_ = make_unique<AudioMixer>();
+    // 24 and 32 bit I2S use 32 bit slots, so the pipelines and mixer keep 32 bit samples to preserve hi-res audio
+    this->audio_mixer_->set_bits_per_sample((this->bits_per_sample_ > I2S_BITS_PER_SAMPLE_16BIT) ? 32 : 16);
     err = this->audio_mixer_->start("mixer", MIXER_TASK_PRIORITY);
     if (err != ESP_OK) {
       return err;
@@ -385,7 +419,32 @@ esp_err_t NabuMediaPlayer::start_pipeline_(AudioPipelineType type, bool url) {
 
   if (type == AudioPipelineType::MEDIA) {
     if (this->media_pipeline_ == nullptr) {
-      this->media_pipeline_ = make_unique<AudioPipeline>(this->audio_mixer_.get(), type);
+      this->media_pipeline_ =
+          make_unique<AudioPipeline>(this->audio_mixer_.get(), type, this->pcm_cache_.get(),
+                                     this->connection_pool_.get(), this->filter_bank_cache_.get(),
+                                     this->media_resampler_quality_);
+    }
+
+    if (enqueue && (this->media_pipeline_state_ == AudioPipelineState::PLAYING)) {
+      if (this->next_media_pipeline_ == nullptr) {
+        this->next_media_pipeline_ =
+            make_unique<AudioPipeline>(this->audio_mixer_.get(), type, this->pcm_cache_.get(),
+                                       this->connection_pool_.get(), this->filter_bank_cache_.get(),
+                                       this->media_resampler_quality_);
+      }
+
+      // Prefetches and decodes while the current media plays, then continues from its last sample
+      if (url) {
+        return this->next_media_pipeline_->start(this->media_url_.value(), this->sample_rate_, "next",
+                                                 MEDIA_PIPELINE_TASK_PRIORITY, this->media_pipeline_.get());
+      }
+      return this->next_media_pipeline_->start(this->media_file_.value(), this->sample_rate_, "next",
+                                               MEDIA_PIPELINE_TASK_PRIORITY, this->media_pipeline_.get());
+    }
+
+    if (this->next_media_pipeline_ != nullptr) {
+      // New media replaces any enqueued media
+      this->next_media_pipeline_->stop();
     }
 
     if (url) {
@@ -404,7 +463,10 @@ esp_err_t NabuMediaPlayer::start_pipeline_(AudioPipelineType type, bool url) {
     this->is_paused_ = false;
   } else if (type == AudioPipelineType::ANNOUNCEMENT) {
     if (this->announcement_pipeline_ == nullptr) {
-      this->announcement_pipeline_ = make_unique<AudioPipeline>(this->audio_mixer_.get(), type);
+      this->announcement_pipeline_ =
+          make_unique<AudioPipeline>(this->audio_mixer_.get(), type, this->pcm_cache_.get(),
+                                     this->connection_pool_.get(), this->filter_bank_cache_.get(),
+                                     this->announcement_resampler_quality_);
     }
 
     if (url) {
@@ -429,7 +491,7 @@ void NabuMediaPlayer::watch_media_commands_() {
       if (media_command.announce.has_value() && media_command.announce.value()) {
         err = this->start_pipeline_(AudioPipelineType::ANNOUNCEMENT, true);
       } else {
-        err = this->start_pipeline_(AudioPipelineType::MEDIA, true);
+        err = this->start_pipeline_(AudioPipelineType::MEDIA, true, media_command.enqueue.value_or(false));
       }
     }
 
@@ -437,7 +499,7 @@ void NabuMediaPlayer::watch_media_commands_() {
       if (media_command.announce.has_value() && media_command.announce.value()) {
         err = this->start_pipeline_(AudioPipelineType::ANNOUNCEMENT, false);
       } else {
-        err = this->start_pipeline_(AudioPipelineType::MEDIA, false);
+        err = this->start_pipeline_(AudioPipelineType::MEDIA, false, media_command.enqueue.value_or(false));
       }
     }
 
@@ -476,6 +538,10 @@ void NabuMediaPlayer::watch_media_commands_() {
           if (media_command.announce.has_value() && media_command.announce.value()) {
             this->announcement_pipeline_->stop();
           } else {
+            if (this->next_media_pipeline_ != nullptr) {
+              // Stopped first, otherwise it starts playing once the media pipeline stops
+              this->next_media_pipeline_->stop();
+            }
             this->media_pipeline_->stop();
             this->is_paused_ = false;
           }
@@ -568,6 +634,11 @@ void NabuMediaPlayer::loop() {
   this->watch_mixer_();
   this->watch_speaker_();
 
+  if (this->connection_pool_ != nullptr) {
+    // Don't keep sockets to servers that likely closed their end while nothing plays
+    this->connection_pool_->close_expired();
+  }
+
   // Determine state of the media player
   media_player::MediaPlayerState old_state = this->state;
 
@@ -577,6 +648,18 @@ void NabuMediaPlayer::loop() {
   if (this->media_pipeline_ != nullptr)
     this->media_pipeline_state_ = this->media_pipeline_->get_state();
 
+  if (this->next_media_pipeline_ != nullptr) {
+    this->next_media_pipeline_state_ = this->next_media_pipeline_->get_state();
+
+    if ((this->media_pipeline_state_ == AudioPipelineState::STOPPED) &&
+        (this->next_media_pipeline_state_ != AudioPipelineState::STOPPED)) {
+      // The current media finished and the enqueued media already continues from its last sample. The finished
+      // pipeline is kept to prefetch the next enqueued media.
+      std::swap(this->media_pipeline_, this->next_media_pipeline_);
+      std::swap(this->media_pipeline_state_, this->next_media_pipeline_state_);
+    }
+  }
+
   if (this->announcement_pipeline_state_ != AudioPipelineState::STOPPED) {
     this->state = media_player::MEDIA_PLAYER_STATE_ANNOUNCING;
     if (this->is_idle_muted_ && !this->is_muted_) {
@@ -610,14 +693,32 @@ void NabuMediaPlayer::loop() {
   }
 }
 
-void NabuMediaPlayer::set_ducking_reduction(uint8_t decibel_reduction, float duration) {
+void NabuMediaPlayer::set_media_resampler_quality(ResamplerQuality quality) {
+  this->media_resampler_quality_ = quality;
+  if (this->media_pipeline_ != nullptr) {
+    this->media_pipeline_->set_resampler_quality(quality);
+  }
+  if (this->next_media_pipeline_ != nullptr) {
+    this->next_media_pipeline_->set_resampler_quality(quality);
+  }
+}
+
+void NabuMediaPlayer::set_announcement_resampler_quality(ResamplerQuality quality) {
+  this->announcement_resampler_quality_ = quality;
+  if (this->announcement_pipeline_ != nullptr) {
+    this->announcement_pipeline_->set_resampler_quality(quality);
+  }
+}
+
+void NabuMediaPlayer::set_ducking_reduction(float decibel_reduction, float duration, DuckingCurve curve) {
   if (this->audio_mixer_ != nullptr) {
     CommandEvent command_event;
     command_event.command = CommandEventType::DUCK;
     command_event.decibel_reduction = decibel_reduction;
+    command_event.ducking_curve = curve;
 
-    // Convert the duration in seconds to number of samples, accounting for the sample rate and number of channels
-    command_event.transition_samples = static_cast<size_t>(duration * this->sample_rate_ * NUMBER_OF_CHANNELS);
+    // Convert the duration in seconds to number of frames; the mixer's output may be mono or stereo
+    command_event.transition_frames = static_cast<size_t>(duration * this->sample_rate_);
     this->audio_mixer_->send_command(&command_event);
   }
 }
@@ -631,6 +732,8 @@ void NabuMediaPlayer::control(const media_player::MediaPlayerCall &call) {
     media_command.announce = false;
   }
 
+  media_command.enqueue = call.get_enqueue().value_or(false);
+
   if (call.get_media_url().has_value()) {
     std::string new_uri = call.get_media_url().value();
 
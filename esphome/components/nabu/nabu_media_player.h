@@ -37,6 +37,7 @@ struct MediaCallCommand {
   optional<media_player::MediaPlayerCommand> command;
   optional<float> volume;
   optional<bool> announce;
+  optional<bool> enqueue;
   optional<bool> new_url;
   optional<bool> new_file;
 };
@@ -55,9 +56,10 @@ class NabuMediaPlayer : public Component,
   bool is_muted() const override { return this->is_muted_; }
 
   /// @brief Sets the ducking level for the media stream in the mixer
-  /// @param decibel_reduction (uint8_t) The dB reduction level. For example, 0 is no change, 10 is a reduction by 10 dB
+  /// @param decibel_reduction (float) The dB reduction level. For example, 0 is no change, 10 is a reduction by 10 dB
   /// @param duration (float) The duration (in seconds) for transitioning to the new ducking level
-  void set_ducking_reduction(uint8_t decibel_reduction, float duration);
+  /// @param curve (DuckingCurve) The shape of the transition
+  void set_ducking_reduction(float decibel_reduction, float duration, DuckingCurve curve = DuckingCurve::LINEAR);
 
   void set_dout_pin(uint8_t pin) { this->dout_pin_ = pin; }
   void set_bits_per_sample(i2s_bits_per_sample_t bits_per_sample) { this->bits_per_sample_ = bits_per_sample; }
@@ -65,6 +67,14 @@ class NabuMediaPlayer : public Component,
 
   void set_volume_increment(float volume_increment) { this->volume_increment_ = volume_increment; }
 
+  /// @brief Sets the memory for caching decoded local media files; 0 disables the cache. Must be set before setup.
+  void set_pcm_cache_size(size_t pcm_cache_size) { this->pcm_cache_size_ = pcm_cache_size; }
+
+  /// @brief Sets the highest resampling quality for each pipeline type. Setting it again restores it for the next
+  /// stream, if an earlier stream had lowered the quality.
+  void set_media_resampler_quality(ResamplerQuality quality);
+  void set_announcement_resampler_quality(ResamplerQuality quality);
+
  protected:
   // Receives commands from HA or from the voice assistant component
   // Sends commands to the media_control_commanda_queue_
@@ -95,17 +105,35 @@ class NabuMediaPlayer : public Component,
   void watch_media_commands_();
 
   std::unique_ptr<AudioPipeline> media_pipeline_;
+  // Prefetches enqueued media while the media pipeline plays, then takes its place once it finishes
+  std::unique_ptr<AudioPipeline> next_media_pipeline_;
   std::unique_ptr<AudioPipeline> announcement_pipeline_;
   std::unique_ptr<AudioMixer> audio_mixer_;
 
+  // Shared by both pipelines, so a sound cached by one plays from the cache on the other
+  std::unique_ptr<AudioPcmCache> pcm_cache_;
+  size_t pcm_cache_size_{0};
+
+  // Shared by all pipelines, so consecutive streams from the same server reuse a connection
+  std::unique_ptr<HttpConnectionPool> connection_pool_;
+
+  // Shared by all pipelines, so streams at the same rates skip designing the resampling filters again
+  std::unique_ptr<FilterBankCache> filter_bank_cache_;
+
+  // Announcements are mostly speech, so they resample with the cheapest filters by default
+  ResamplerQuality media_resampler_quality_{ResamplerQuality::HIGH};
+  ResamplerQuality announcement_resampler_quality_{ResamplerQuality::FAST};
+
   // Monitors the mixer task
   void watch_mixer_();
 
   // Starts the ``type`` pipeline with a ``url`` or file. Starts the mixer, pipeline, and speaker tasks if necessary.
-  // Unpauses if starting media in paused state
-  esp_err_t start_pipeline_(AudioPipelineType type, bool url);
+  // Unpauses if starting media in paused state. Enqueued media plays once the current media finishes, replacing any
+  // media enqueued before.
+  esp_err_t start_pipeline_(AudioPipelineType type, bool url, bool enqueue = false);
 
   AudioPipelineState media_pipeline_state_{AudioPipelineState::STOPPED};
+  AudioPipelineState next_media_pipeline_state_{AudioPipelineState::STOPPED};
   AudioPipelineState announcement_pipeline_state_{AudioPipelineState::STOPPED};
 
   void watch_speaker_();
@@ -129,11 +157,16 @@ class NabuMediaPlayer : public Component,
 };
 
 template<typename... Ts> class DuckingSetAction : public Action<Ts...>, public Parented<NabuMediaPlayer> {
-  TEMPLATABLE_VALUE(uint8_t, decibel_reduction)
+  TEMPLATABLE_VALUE(float, decibel_reduction)
   TEMPLATABLE_VALUE(float, duration)
+  void set_curve(DuckingCurve curve) { this->curve_ = curve; }
   void play(Ts... x) override {
-    this->parent_->set_ducking_reduction(this->decibel_reduction_.value(x...), this->duration_.value(x...));
+    this->parent_->set_ducking_reduction(this->decibel_reduction_.value(x...), this->duration_.value(x...),
+                                         this->curve_);
   }
+
+ protected:
+  DuckingCurve curve_{DuckingCurve::LINEAR};
 };
 
 }  // namespace nabu
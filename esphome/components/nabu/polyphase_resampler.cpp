@@ -0,0 +1,259 @@
+#ifdef USE_ESP_IDF
+
+#include "polyphase_resampler.h"
+
+#include "audio_samples.h"
+
+#include "esphome/core/helpers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace esphome {
+namespace nabu {
+
+// Upper bound on the number of phases (L); 22.05 kHz -> 48 kHz needs 320
+static const uint32_t MAX_INTERPOLATION = 320;
+
+// Upper bound on how much faster the input rate can be than the output rate; 48 kHz -> 16 kHz needs 3
+static const uint32_t MAX_DECIMATION_RATIO = 6;
+
+// Cutoff as a fraction of the lower Nyquist frequency. Centers the transition band slightly below Nyquist.
+static const float CUTOFF_RATIO = 0.94f;
+
+static const float PI = 3.14159265358979f;
+
+// Kaiser window shape; gives about 90 dB of stopband attenuation
+static const float KAISER_BETA = 8.96f;
+
+// Zeroth order modified Bessel function of the first kind, for the Kaiser window
+static float bessel_i0(float x) {
+  float sum = 1.0f;
+  float term = 1.0f;
+  for (int k = 1; k < 50; ++k) {
+    float factor = x / (2.0f * k);
+    term *= factor * factor;
+    sum += term;
+    if (term < sum * 1e-8f) {
+      break;
+    }
+  }
+  return sum;
+}
+
+static uint32_t greatest_common_divisor(uint32_t a, uint32_t b) {
+  while (b != 0) {
+    uint32_t remainder = a % b;
+    a = b;
+    b = remainder;
+  }
+  return a;
+}
+
+template<typename Sample, typename Coefficient, typename Accumulator>
+static inline Accumulator dot_product(const Sample *history, const Coefficient *coefficients, uint16_t taps) {
+  Accumulator sum = 0;
+  for (uint16_t i = 0; i < taps; ++i) {
+    sum += static_cast<Accumulator>(history[i]) * coefficients[i];
+  }
+  return sum;
+}
+
+// Designs the L phases of a Kaiser windowed sinc prototype, each normalized to unity gain
+static void design_phases(void *coefficients, uint32_t interpolation, uint16_t taps, float cutoff, bool wide) {
+  // Prototype low pass filter at the upsampled rate, with a cutoff at the lower of the two Nyquist frequencies.
+  // Designed in single precision, as the ESP32 has no double precision FPU.
+  const uint32_t length = interpolation * taps;
+  const float center = (length - 1) / 2.0f;
+  const float window_scale = 1.0f / bessel_i0(KAISER_BETA);
+
+  // Tap j of the prototype at a phase multiplies the input sample j samples before the newest one
+  auto prototype = [=](uint32_t phase, uint16_t j) {
+    float n = static_cast<float>(phase + j * interpolation) - center;
+    float x = 2.0f * cutoff * n;
+    float sinc = (std::fabs(x) < 1e-6f) ? 1.0f : std::sin(PI * x) / (PI * x);
+    float r = n / center;
+    return sinc * bessel_i0(KAISER_BETA * std::sqrt(std::max(0.0f, 1.0f - r * r))) * window_scale;
+  };
+
+  for (uint32_t phase = 0; phase < interpolation; ++phase) {
+    float phase_sum = 0.0f;
+    for (uint16_t j = 0; j < taps; ++j) {
+      phase_sum += prototype(phase, j);
+    }
+
+    // Normalize every phase to unity gain, so no phase modulates the level
+    for (uint16_t j = 0; j < taps; ++j) {
+      float coefficient = prototype(phase, j) / phase_sum;
+      size_t index = phase * taps + (taps - 1 - j);  // Oldest sample first
+      if (wide) {
+        static_cast<int32_t *>(coefficients)[index] =
+            static_cast<int32_t>(clamp<float>(std::round(coefficient * 2147483648.0f), INT32_MIN, INT32_MAX));
+      } else {
+        static_cast<int16_t *>(coefficients)[index] =
+            static_cast<int16_t>(clamp<float>(std::round(coefficient * 32768.0f), INT16_MIN, INT16_MAX));
+      }
+    }
+  }
+}
+
+PolyphaseResampler::~PolyphaseResampler() { this->free_buffers_(); }
+
+void PolyphaseResampler::free_buffers_() {
+  this->filter_bank_.reset();
+  if (this->history_ != nullptr) {
+    ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+    allocator.deallocate(static_cast<uint8_t *>(this->history_), this->history_bytes_);
+    this->history_ = nullptr;
+  }
+}
+
+esp_err_t PolyphaseResampler::start(uint32_t input_sample_rate, uint32_t output_sample_rate, uint8_t channels,
+                                    bool wide, uint16_t base_taps, FilterBankCache *filter_bank_cache) {
+  if ((input_sample_rate == 0) || (output_sample_rate == 0) || (channels == 0) || (base_taps == 0)) {
+    this->free_buffers_();
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  uint32_t divisor = greatest_common_divisor(input_sample_rate, output_sample_rate);
+  this->interpolation_ = output_sample_rate / divisor;
+  this->decimation_ = input_sample_rate / divisor;
+
+  if ((this->interpolation_ > MAX_INTERPOLATION) ||
+      (this->decimation_ > MAX_DECIMATION_RATIO * this->interpolation_)) {
+    this->free_buffers_();
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  this->channels_ = channels;
+  this->wide_ = wide;
+
+  // The filter spans base_taps input samples, scaled up by the decimation ratio when downsampling to keep the same
+  // transition band. Rounded up to a multiple of 4 so the dot products unroll cleanly.
+  uint32_t taps = (base_taps * std::max(this->interpolation_, this->decimation_) + this->interpolation_ - 1) /
+                  this->interpolation_;
+  this->taps_ = (taps + 3) & ~3u;
+
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  const size_t history_bytes = 2 * this->taps_ * channels * (wide ? sizeof(int32_t) : sizeof(int16_t));
+  if ((this->history_ != nullptr) && (this->history_bytes_ != history_bytes)) {
+    allocator.deallocate(static_cast<uint8_t *>(this->history_), this->history_bytes_);
+    this->history_ = nullptr;
+  }
+  if (this->history_ == nullptr) {
+    this->history_bytes_ = history_bytes;
+    this->history_ = allocator.allocate(this->history_bytes_);
+  }
+
+  // The cutoff, as a fraction of the upsampled rate, and the length fully determine the filter
+  const uint32_t interpolation = this->interpolation_;
+  const uint16_t phase_taps = this->taps_;
+  const float cutoff = CUTOFF_RATIO / (2.0f * std::max(this->interpolation_, this->decimation_));
+  const FilterBankKey key = {phase_taps, static_cast<uint16_t>(interpolation), 2.0f * cutoff * interpolation,
+                             FilterWindow::KAISER, wide ? FilterFormat::Q31 : FilterFormat::Q15};
+
+  if ((this->filter_bank_ == nullptr) || !(this->filter_bank_->key == key)) {
+    // Released first, so the cache can evict it to make room
+    this->filter_bank_.reset();
+
+    auto design = [=](void *coefficients) { design_phases(coefficients, interpolation, phase_taps, cutoff, wide); };
+    if (filter_bank_cache != nullptr) {
+      this->filter_bank_ = filter_bank_cache->get(key, design);
+    } else {
+      this->filter_bank_ = FilterBank::create(key, design);
+    }
+  }
+
+  if ((this->filter_bank_ == nullptr) || (this->history_ == nullptr)) {
+    this->free_buffers_();
+    return ESP_ERR_NO_MEM;
+  }
+
+  std::memset(this->history_, 0, this->history_bytes_);
+  this->history_index_ = 0;
+  this->phase_ = this->interpolation_;  // Load an input sample before the first output sample
+
+  return ESP_OK;
+}
+
+void PolyphaseResampler::process(const uint8_t *input, uint8_t input_bytes_per_sample, size_t input_frames,
+                                 uint8_t *output, uint8_t output_bytes_per_sample, size_t output_frames,
+                                 size_t &frames_used, size_t &frames_generated) {
+  if (this->wide_) {
+    this->process_<int32_t, int32_t, int64_t>(input, input_bytes_per_sample, input_frames, output,
+                                              output_bytes_per_sample, output_frames, frames_used, frames_generated);
+  } else {
+    this->process_<int16_t, int16_t, int32_t>(input, input_bytes_per_sample, input_frames, output,
+                                              output_bytes_per_sample, output_frames, frames_used, frames_generated);
+  }
+}
+
+template<typename Sample, typename Coefficient, typename Accumulator>
+void PolyphaseResampler::process_(const uint8_t *input, uint8_t input_bytes_per_sample, size_t input_frames,
+                                  uint8_t *output, uint8_t output_bytes_per_sample, size_t output_frames,
+                                  size_t &frames_used, size_t &frames_generated) {
+  // Sums are in the coefficient's fixed point format
+  const int shift = sizeof(Coefficient) * 8 - 1;
+  const Accumulator rounding = static_cast<Accumulator>(1) << (shift - 1);
+  const Accumulator sample_min = std::numeric_limits<Sample>::min();
+  const Accumulator sample_max = std::numeric_limits<Sample>::max();
+
+  Sample *history = static_cast<Sample *>(this->history_);
+  const Coefficient *coefficients = static_cast<const Coefficient *>(this->filter_bank_->coefficients);
+  const uint16_t taps = this->taps_;
+
+  frames_used = 0;
+  frames_generated = 0;
+
+  while (frames_generated < output_frames) {
+    while (this->phase_ >= this->interpolation_) {
+      if (frames_used == input_frames) {
+        return;
+      }
+
+      for (uint8_t channel = 0; channel < this->channels_; ++channel) {
+        Sample sample;
+        if (sizeof(Sample) == sizeof(int16_t)) {
+          sample = *reinterpret_cast<const int16_t *>(input);
+        } else {
+          sample = read_aligned_sample(input, input_bytes_per_sample);
+        }
+        input += input_bytes_per_sample;
+
+        Sample *channel_history = history + channel * 2 * taps;
+        channel_history[this->history_index_] = sample;
+        channel_history[this->history_index_ + taps] = sample;
+      }
+      if (++this->history_index_ == taps) {
+        this->history_index_ = 0;
+      }
+
+      ++frames_used;
+      this->phase_ -= this->interpolation_;
+    }
+
+    const Coefficient *phase_coefficients = coefficients + this->phase_ * taps;
+    for (uint8_t channel = 0; channel < this->channels_; ++channel) {
+      const Sample *window = history + channel * 2 * taps + this->history_index_;
+      Accumulator sum = dot_product<Sample, Coefficient, Accumulator>(window, phase_coefficients, taps);
+      Accumulator sample = clamp<Accumulator>((sum + rounding) >> shift, sample_min, sample_max);
+
+      if (sizeof(Sample) == sizeof(int16_t)) {
+        *reinterpret_cast<int16_t *>(output) = static_cast<int16_t>(sample);
+      } else {
+        write_aligned_sample(static_cast<int32_t>(sample), output, output_bytes_per_sample);
+      }
+      output += output_bytes_per_sample;
+    }
+
+    ++frames_generated;
+    this->phase_ += this->decimation_;
+  }
+}
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
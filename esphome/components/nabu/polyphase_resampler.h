@@ -0,0 +1,79 @@
+#pragma once
+
+#ifdef USE_ESP_IDF
+
+#include "filter_bank_cache.h"
+
+#include "esp_err.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace esphome {
+namespace nabu {
+
+/// @brief Resamples by a fixed rational ratio (interpolate by L, decimate by M) with a precomputed polyphase filter.
+///
+/// The Kaiser windowed sinc prototype is split into L phases when started, so each output sample is a single dot
+/// product between one phase and the most recent input samples, with no interpolation between filters at run time.
+/// Samples are filtered as integers: 16 bit streams use Q15 coefficients with 32 bit sums, and everything else uses
+/// Q31 coefficients with 64 bit sums on samples aligned to the most significant bit. Common rate pairs reduce to
+/// small ratios, e.g., 44.1 kHz -> 48 kHz is 160/147, 48 kHz -> 16 kHz is 1/3, and 22.05 kHz -> 48 kHz is 320/147.
+class PolyphaseResampler {
+ public:
+  ~PolyphaseResampler();
+
+  /// @brief Designs the filter and clears the history. Restarting with the same rates and format keeps the filter.
+  /// @param input_sample_rate incoming sample rate
+  /// @param output_sample_rate sample rate to convert to
+  /// @param channels number of interleaved channels
+  /// @param wide true to filter 32 bit samples with Q31 coefficients; false for 16 bit in and out
+  /// @param base_taps coefficients per phase when the output rate is at least the input rate; more taps give a
+  /// sharper transition band for proportionally more CPU
+  /// @param filter_bank_cache optional cache to share the filter through; designed privately if nullptr
+  /// @return ESP_OK, ESP_ERR_NOT_SUPPORTED if the rates don't reduce to a ratio with a small enough filter, or
+  /// ESP_ERR_NO_MEM if the filter or history couldn't be allocated
+  esp_err_t start(uint32_t input_sample_rate, uint32_t output_sample_rate, uint8_t channels, bool wide,
+                  uint16_t base_taps, FilterBankCache *filter_bank_cache = nullptr);
+
+  /// @brief Resamples interleaved frames
+  /// @param input incoming samples; each input_bytes_per_sample bytes (2, 3, or 4; only 2 if not wide)
+  /// @param input_frames number of frames available in input
+  /// @param output resampled samples; each output_bytes_per_sample bytes (2 or 4; only 2 if not wide)
+  /// @param output_frames number of frames that fit in output
+  /// @param frames_used set to the number of input frames consumed
+  /// @param frames_generated set to the number of output frames written
+  void process(const uint8_t *input, uint8_t input_bytes_per_sample, size_t input_frames, uint8_t *output,
+               uint8_t output_bytes_per_sample, size_t output_frames, size_t &frames_used, size_t &frames_generated);
+
+ protected:
+  template<typename Sample, typename Coefficient, typename Accumulator>
+  void process_(const uint8_t *input, uint8_t input_bytes_per_sample, size_t input_frames, uint8_t *output,
+                uint8_t output_bytes_per_sample, size_t output_frames, size_t &frames_used, size_t &frames_generated);
+
+  void free_buffers_();
+
+  uint32_t interpolation_{1};  // L
+  uint32_t decimation_{1};     // M
+  uint16_t taps_{0};           // Coefficients per phase
+  uint8_t channels_{0};
+  bool wide_{false};
+
+  // L phases of taps_ coefficients each, ordered oldest input sample first; int16_t if narrow, int32_t if wide
+  std::shared_ptr<const FilterBank> filter_bank_;
+
+  // Each channel has 2 * taps_ samples. Every input sample is stored twice, taps_ apart, so the most recent taps_
+  // samples are always contiguous, oldest first, starting at history_index_.
+  void *history_{nullptr};
+  size_t history_bytes_{0};
+  uint16_t history_index_{0};
+
+  // Position of the next output sample between input samples, in units of 1 / L input samples
+  uint32_t phase_{0};
+};
+
+}  // namespace nabu
+}  // namespace esphome
+
+#endif
@@ -15,9 +15,50 @@
 #include "esphome/core/helpers.h"
 #include "esp_dsp.h"
 
-static void init_filter(Resample *cxt, float *filter, float fraction, float lowpass_ratio);
+static void init_filter(int num_taps, int flags, float *temp_filter, float *filter, float fraction,
+                        float lowpass_ratio);
 static float subsample(Resample *cxt, float *source, float offset);
 
+// Filters passed to resampleInitShared() belong to the caller, so resampleFree() leaves them alone
+#define SHARED_FILTERS 0x8
+
+static Resample *create_context(int numChannels, int numTaps, int numFilters, int flags) {
+  if ((numTaps & 3) || numTaps <= 0 || numTaps > 1024) {
+    fprintf(stderr, "must 4-1024 filter taps, and a multiple of 4!\n");
+    return NULL;
+  }
+
+  if (numFilters < 2 || numFilters > 1024) {
+    fprintf(stderr, "must be 2-1024 filters!\n");
+    return NULL;
+  }
+
+  Resample *cxt = (Resample *) calloc(1, sizeof(Resample));
+  int i;
+
+  cxt->numChannels = numChannels;
+  cxt->numSamples = numTaps * 16;
+  cxt->numFilters = numFilters;
+  cxt->numTaps = numTaps;
+  cxt->flags = flags;
+
+  // note that we actually have one more than the specified number of filters
+  esphome::ExternalRAMAllocator<float> float_allocator(esphome::ExternalRAMAllocator<float>::ALLOW_FAILURE);
+  cxt->filters = (float **) calloc(cxt->numFilters + 1, sizeof(float *));
+  cxt->buffers = (float **) calloc(numChannels, sizeof(float *));
+
+  for (i = 0; i < numChannels; ++i) {
+    cxt->buffers[i] = float_allocator.allocate(cxt->numSamples);
+    memset(cxt->buffers[i], 0, cxt->numSamples * sizeof(float));
+    // cxt->buffers [i] = calloc (cxt->numSamples, sizeof (float));
+  }
+
+  cxt->outputOffset = numTaps / 2;
+  cxt->inputIndex = numTaps;
+
+  return cxt;
+}
+
 // Initialize a resampler context with the specified characteristics. The returned context pointer
 // is used for all subsequent calls to the resampler (and should not be dereferenced). A NULL
 // return indicates an error. For the flags parameter, note that SUBSAMPLE_INTERPOLATE and
@@ -77,7 +118,6 @@ static float subsample(Resample *cxt, float *source, float offset);
 //    load and so can be large on systems with lots of RAM).
 
 Resample *resampleInit(int numChannels, int numTaps, int numFilters, float lowpassRatio, int flags) {
-  Resample *cxt = (Resample *) calloc(1, sizeof(Resample));
   int i;
 
   if (lowpassRatio > 0.0 && lowpassRatio < 1.0)
@@ -87,47 +127,59 @@ Resample *resampleInit(int numChannels, int numTaps, int numFilters, float lowpa
     lowpassRatio = 1.0;
   }
 
-  if ((numTaps & 3) || numTaps <= 0 || numTaps > 1024) {
-    fprintf(stderr, "must 4-1024 filter taps, and a multiple of 4!\n");
-    return NULL;
-  }
+  Resample *cxt = create_context(numChannels, numTaps, numFilters, flags & ~SHARED_FILTERS);
 
-  if (numFilters < 2 || numFilters > 1024) {
-    fprintf(stderr, "must be 2-1024 filters!\n");
+  if (!cxt)
     return NULL;
-  }
 
-  cxt->numChannels = numChannels;
-  cxt->numSamples = numTaps * 16;
-  cxt->numFilters = numFilters;
-  cxt->numTaps = numTaps;
-  cxt->flags = flags;
-
-  // note that we actually have one more than the specified number of filters
   esphome::ExternalRAMAllocator<float> float_allocator(esphome::ExternalRAMAllocator<float>::ALLOW_FAILURE);
-  cxt->filters = (float **) calloc(cxt->numFilters + 1, sizeof(float *));
-  cxt->tempFilter = float_allocator.allocate(numTaps);
-  // cxt->tempFilter = malloc (numTaps * sizeof (float));
+  float *temp_filter = float_allocator.allocate(numTaps);
 
   for (i = 0; i <= cxt->numFilters; ++i) {
     cxt->filters[i] = float_allocator.allocate(cxt->numTaps);
     memset(cxt->filters[i], 0, cxt->numTaps * sizeof(float));
     // cxt->filters [i] = calloc (cxt->numTaps, sizeof (float));
-    init_filter(cxt, cxt->filters[i], (float) i / cxt->numFilters, lowpassRatio);
+    init_filter(cxt->numTaps, cxt->flags, temp_filter, cxt->filters[i], (float) i / cxt->numFilters, lowpassRatio);
   }
 
-  free(cxt->tempFilter);
-  cxt->tempFilter = NULL;
-  cxt->buffers = (float **) calloc(numChannels, sizeof(float *));
+  free(temp_filter);
 
-  for (i = 0; i < numChannels; ++i) {
-    cxt->buffers[i] = float_allocator.allocate(cxt->numSamples);
-    memset(cxt->buffers[i], 0, cxt->numSamples * sizeof(float));
-    // cxt->buffers [i] = calloc (cxt->numSamples, sizeof (float));
-  }
+  return cxt;
+}
 
-  cxt->outputOffset = numTaps / 2;
-  cxt->inputIndex = numTaps;
+// Design the numFilters + 1 filters a context with these characteristics uses, one after another in a single
+// block of (numFilters + 1) * numTaps floats. Any number of contexts can then share the block through
+// resampleInitShared(), which skips designing the filters again. The lowpassRatio and flags are as for
+// resampleInit().
+
+void resampleDesignFilters(float *filters, int numTaps, int numFilters, float lowpassRatio, int flags) {
+  int i;
+
+  if (!(lowpassRatio > 0.0 && lowpassRatio < 1.0))
+    lowpassRatio = 1.0;
+
+  esphome::ExternalRAMAllocator<float> float_allocator(esphome::ExternalRAMAllocator<float>::ALLOW_FAILURE);
+  float *temp_filter = float_allocator.allocate(numTaps);
+
+  for (i = 0; i <= numFilters; ++i)
+    init_filter(numTaps, flags, temp_filter, filters + i * numTaps, (float) i / numFilters, lowpassRatio);
+
+  free(temp_filter);
+}
+
+// Initialize a resampler context that uses filters designed by resampleDesignFilters() with the same
+// numTaps, numFilters, and flags. The filters must outlive the context and aren't modified by it.
+
+Resample *resampleInitShared(int numChannels, int numTaps, int numFilters, const float *filters, int flags) {
+  int i;
+
+  Resample *cxt = create_context(numChannels, numTaps, numFilters, flags | SHARED_FILTERS);
+
+  if (!cxt)
+    return NULL;
+
+  for (i = 0; i <= cxt->numFilters; ++i)
+    cxt->filters[i] = (float *) filters + i * numTaps;
 
   return cxt;
 }
@@ -156,7 +208,8 @@ void resampleReset(Resample *cxt) {
 //
 // This is the "non-interleaved" version of the resampler where the audio sample buffers for
 // different channels are passed in as an array of float pointers. There is also an
-// "interleaved" version (see below).
+// "interleaved" version (see below). The planar layout matches the sample histories, so
+// input is loaded in contiguous blocks and this version is preferred.
 
 ResampleResult resampleProcess(Resample *cxt, const float *const *input, int numInputFrames, float *const *output,
                                int numOutputFrames, float ratio) {
@@ -174,12 +227,21 @@ ResampleResult resampleProcess(Resample *cxt, const float *const *input, int num
           cxt->inputIndex -= cxt->numSamples - cxt->numTaps;
         }
 
+        // load every frame needed for the next output at once, as one block copy per channel
+        int num_frames = (int) floor(cxt->outputOffset - (cxt->inputIndex - half_taps)) + 1;
+
+        if (num_frames > numInputFrames)
+          num_frames = numInputFrames;
+
+        if (num_frames > cxt->numSamples - cxt->inputIndex)
+          num_frames = cxt->numSamples - cxt->inputIndex;
+
         for (i = 0; i < cxt->numChannels; ++i)
-          cxt->buffers[i][cxt->inputIndex] = input[i][res.input_used];
+          memcpy(cxt->buffers[i] + cxt->inputIndex, input[i] + res.input_used, num_frames * sizeof(float));
 
-        cxt->inputIndex++;
-        res.input_used++;
-        numInputFrames--;
+        cxt->inputIndex += num_frames;
+        res.input_used += num_frames;
+        numInputFrames -= num_frames;
       } else
         break;
     } else {
@@ -347,8 +409,9 @@ float resampleGetPosition(Resample *cxt) { return cxt->outputOffset + (cxt->numT
 void resampleFree(Resample *cxt) {
   int i;
 
-  for (i = 0; i <= cxt->numFilters; ++i)
-    free(cxt->filters[i]);
+  if (!(cxt->flags & SHARED_FILTERS))
+    for (i = 0; i <= cxt->numFilters; ++i)
+      free(cxt->filters[i]);
 
   free(cxt->filters);
 
@@ -375,10 +438,11 @@ void resampleFree(Resample *cxt) {
 
 //     return sum;
 // }
+// esp-dsp selects the fastest implementation for the target; the ESP32 and ESP32-S3 have
+// optimized assembly versions, and other targets use the portable C version
 static float apply_filter(float *A, float *B, int num_taps) {
   float sum;
-  //dsps_dotprod_f32_aes3(A, B, &sum, num_taps);
-  dsps_dotprod_f32_ansi(A, B, &sum, num_taps);
+  dsps_dotprod_f32(A, B, &sum, num_taps);
   return sum;
 }
 #endif
@@ -432,7 +496,8 @@ static float apply_filter (float *A, float *B, int num_taps)
 #define M_PI 3.14159265358979324
 #endif
 
-static void init_filter(Resample *cxt, float *filter, float fraction, float lowpass_ratio) {
+static void init_filter(int num_taps, int flags, float *temp_filter, float *filter, float fraction,
+                        float lowpass_ratio) {
   const float a0 = 0.35875;
   const float a1 = 0.48829;
   const float a2 = 0.14128;
@@ -446,31 +511,31 @@ static void init_filter(Resample *cxt, float *filter, float fraction, float lowp
   // Note that with this scaling, the odd terms of the Blackman-Harris calculation appear to be negated
   // with respect to the reference formula version.
 
-  for (i = 0; i < cxt->numTaps; ++i) {
-    float dist = fabs((cxt->numTaps / 2 - 1) + fraction - i) * M_PI;
-    float ratio = dist / (cxt->numTaps / 2);
+  for (i = 0; i < num_taps; ++i) {
+    float dist = fabs((num_taps / 2 - 1) + fraction - i) * M_PI;
+    float ratio = dist / (num_taps / 2);
     float value;
 
     if (dist != 0.0) {
       value = sin(dist * lowpass_ratio) / (dist * lowpass_ratio);
 
-      if (cxt->flags & BLACKMAN_HARRIS)
+      if (flags & BLACKMAN_HARRIS)
         value *= a0 + a1 * cos(ratio) + a2 * cos(2 * ratio) + a3 * cos(3 * ratio);
       else
         value *= 0.5 * (1.0 + cos(ratio));  // Hann window
     } else
       value = 1.0;
 
-    filter_sum += cxt->tempFilter[i] = value;
+    filter_sum += temp_filter[i] = value;
   }
 
   // filter should have unity DC gain
 
   float scaler = 1.0 / filter_sum, error = 0.0;
 
-  for (i = cxt->numTaps / 2; i < cxt->numTaps; i = cxt->numTaps - i - (i >= cxt->numTaps / 2)) {
-    filter[i] = (cxt->tempFilter[i] *= scaler) - error;
-    error += filter[i] - cxt->tempFilter[i];
+  for (i = num_taps / 2; i < num_taps; i = num_taps - i - (i >= num_taps / 2)) {
+    filter[i] = (temp_filter[i] *= scaler) - error;
+    error += filter[i] - temp_filter[i];
   }
 }
 
@@ -26,7 +26,7 @@
 
 typedef struct {
   int numChannels, numSamples, numFilters, numTaps, inputIndex, flags;
-  float *tempFilter, outputOffset;
+  float outputOffset;
   float **buffers, **filters;
 } Resample;
 
@@ -39,6 +39,8 @@ extern "C" {
 #endif
 
 Resample *resampleInit(int numChannels, int numTaps, int numFilters, float lowpassRatio, int flags);
+void resampleDesignFilters(float *filters, int numTaps, int numFilters, float lowpassRatio, int flags);
+Resample *resampleInitShared(int numChannels, int numTaps, int numFilters, const float *filters, int flags);
 ResampleResult resampleProcess(Resample *cxt, const float *const *input, int numInputFrames, float *const *output,
                                int numOutputFrames, float ratio);
 ResampleResult resampleProcessInterleaved(Resample *cxt, const float *input, int numInputFrames, float *output,
@@ -18,7 +18,7 @@ from esphome.components.i2s_audio import (
 )
 
 CODEOWNERS = ["@kahrendt"]
-DEPENDENCIES = ["i2s_audio"]
+DEPENDENCIES = ["i2s_audio", "nabu"]
 
 CONF_ADC_PIN = "adc_pin"
 CONF_ADC_TYPE = "adc_type"
@@ -102,6 +102,7 @@ CONFIG_SCHEMA = cv.All(
         key=CONF_ADC_TYPE,
     ),
     validate_esp32_variant,
+    cv.only_with_esp_idf,
 )
 
 
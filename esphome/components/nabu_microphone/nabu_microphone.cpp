@@ -7,12 +7,11 @@
 #include "esphome/core/hal.h"
 #include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
-#include "esphome/core/ring_buffer.h"
 
 namespace esphome {
 namespace nabu_microphone {
 
-static const size_t RING_BUFFER_LENGTH = 64;  // Measured in milliseconds
+static const size_t RING_BUFFER_LENGTH = 64;  // Measured in milliseconds; rounded up to a power of two bytes
 static const size_t QUEUE_LENGTH = 10;
 
 static const size_t DMA_BUF_COUNT = 4;
@@ -39,7 +38,8 @@ enum TaskNotificationBits : uint32_t {
 
 void NabuMicrophoneChannel::setup() {
   const size_t ring_buffer_size = RING_BUFFER_LENGTH * this->parent_->get_sample_rate() / 1000 * sizeof(int16_t);
-  this->ring_buffer_ = RingBuffer::create(ring_buffer_size);
+  // Only read and write are used, so no region slack is needed
+  this->ring_buffer_ = nabu::AudioRingBuffer::create(ring_buffer_size, 0);
   if (this->ring_buffer_ == nullptr) {
     ESP_LOGE(TAG, "Could not allocate ring buffer");
     this->mark_failed();
@@ -190,10 +190,6 @@ void NabuMicrophone::read_task_(void *params) {
           event.err = err;
           xQueueSend(this_microphone->event_queue_, &event, portMAX_DELAY);
         } else {
-          // TODO: Is this the ideal spot to reset the ring buffers?
-          this_microphone->channel_1_->get_ring_buffer()->reset();
-          this_microphone->channel_2_->get_ring_buffer()->reset();
-
           event.type = i2s_audio::TaskEventType::STARTED;
           xQueueSend(this_microphone->event_queue_, &event, portMAX_DELAY);
 
@@ -7,8 +7,8 @@
 
 #include "esphome/components/i2s_audio/i2s_audio.h"
 #include "esphome/components/microphone/microphone.h"
+#include "esphome/components/nabu/audio_ring_buffer.h"
 #include "esphome/core/component.h"
-#include "esphome/core/ring_buffer.h"
 
 namespace esphome {
 namespace nabu_microphone {
@@ -78,25 +78,29 @@ class NabuMicrophoneChannel : public microphone::Microphone, public Component {
  public:
   void setup() override;
 
-  void start() override { this->parent_->start(); }
+  void start() override {
+    // The component reading this channel starts it, so it can discard old audio from the consumer side
+    this->ring_buffer_->reset();
+    this->parent_->start();
+  }
 
   void set_parent(NabuMicrophone *nabu_microphone) { this->parent_ = nabu_microphone; }
 
   void stop() override {};
   void loop() override;
 
-  size_t read(int16_t *buf, size_t len) override { return this->ring_buffer_->read((void *) buf, len, 0); };
+  size_t read(int16_t *buf, size_t len) override { return this->ring_buffer_->read((void *) buf, len); };
   size_t available() override { return this->ring_buffer_->available(); }
   void reset() override { this->ring_buffer_->reset(); }
 
-  RingBuffer *get_ring_buffer() { return this->ring_buffer_.get(); }
+  nabu::AudioRingBuffer *get_ring_buffer() { return this->ring_buffer_.get(); }
 
   void set_amplify(bool amplify) { this->amplify_ = amplify; }
   bool get_amplify() { return this->amplify_; }
 
  protected:
   NabuMicrophone *parent_;
-  std::unique_ptr<RingBuffer> ring_buffer_;
+  std::unique_ptr<nabu::AudioRingBuffer> ring_buffer_;
 
   bool amplify_;
 };
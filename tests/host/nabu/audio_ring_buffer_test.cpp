@@ -0,0 +1,157 @@
+// Stress test of AudioRingBuffer with a producer and a consumer task.
+//
+// The producer writes a stream where each byte is a function of its position in the stream, through both write() and
+// acquire_write()/commit_write() with random lengths. The consumer reads it back through both read() and
+// acquire_read()/commit_read(), checks every byte against its position, and randomly discards everything with reset().
+// The read position counts the discarded bytes too, so the consumer always knows which bytes come next. Both sides
+// block on the watermark notifications when they run out of bytes or space, so a lost notification shows up as a
+// timeout.
+
+#include "esphome/components/nabu/audio_ring_buffer.h"
+
+#include "host/check.h"
+
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace esphome::nabu;
+
+struct TestCase {
+  size_t length;
+  size_t max_region_length;
+};
+
+// 6000 rounds up to 8192; the regions are deliberately not powers of two, so they wrap at every offset
+static const TestCase TEST_CASES[] = {
+    {4096, 1500},
+    {6000, 4000},
+    {65536, 16384},
+};
+
+static const uint64_t STREAM_BYTES = 64 * 1024 * 1024;
+// About one in this many consumer steps discards everything buffered
+static const uint32_t RESET_ONE_IN = 200;
+// Longer than any wait should take; a wait this long means a notification was lost
+static const TickType_t WAIT_TICKS = pdMS_TO_TICKS(2000);
+
+static uint8_t stream_byte(uint64_t position) {
+  const uint64_t mixed = position * 0x9E3779B97F4A7C15ULL;
+  return static_cast<uint8_t>(mixed >> 56);
+}
+
+static void produce(AudioRingBuffer *ring_buffer, size_t max_region_length, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::vector<uint8_t> source(max_region_length);
+  uint64_t position = 0;
+
+  while (position < STREAM_BYTES) {
+    const size_t wanted = std::min<uint64_t>(1 + random() % max_region_length, STREAM_BYTES - position);
+    size_t written;
+    if (random() % 2) {
+      for (size_t i = 0; i < wanted; ++i) {
+        source[i] = stream_byte(position + i);
+      }
+      written = ring_buffer->write(source.data(), wanted);
+    } else {
+      uint8_t *region;
+      const size_t region_length = ring_buffer->acquire_write(&region, wanted);
+      CHECK(region_length <= max_region_length, "region of %zu bytes", region_length);
+      // Fill the whole region, but only publish part of it sometimes
+      for (size_t i = 0; i < region_length; ++i) {
+        region[i] = stream_byte(position + i);
+      }
+      written = (region_length > 0) ? region_length - random() % (region_length / 4 + 1) : 0;
+      ring_buffer->commit_write(written);
+    }
+    position += written;
+
+    CHECK(ring_buffer->free() <= ring_buffer->size(), "%zu bytes free", ring_buffer->free());
+    if (written == 0) {
+      ring_buffer->notify_when_free(1);
+      const uint32_t notified = ulTaskNotifyTake(pdTRUE, WAIT_TICKS);
+      CHECK((notified > 0) || (ring_buffer->free() > 0), "producer waited %" PRIu32 " ms for space",
+            static_cast<uint32_t>(WAIT_TICKS));
+    }
+  }
+}
+
+// Returns the number of bytes checked
+static uint64_t consume(AudioRingBuffer *ring_buffer, size_t max_region_length, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::vector<uint8_t> destination(max_region_length);
+  uint64_t checked = 0;
+
+  while (ring_buffer->get_read_position() < STREAM_BYTES) {
+    const uint64_t position = ring_buffer->get_read_position();
+
+    if (random() % RESET_ONE_IN == 0) {
+      ring_buffer->reset();
+      CHECK(ring_buffer->get_read_position() >= position, "read position went back from %" PRIu64, position);
+      continue;
+    }
+
+    const size_t wanted = 1 + random() % max_region_length;
+    size_t read;
+    if (random() % 2) {
+      read = ring_buffer->read(destination.data(), wanted);
+      for (size_t i = 0; i < read; ++i) {
+        if (destination[i] != stream_byte(position + i)) {
+          CHECK(false, "read() returned a wrong byte at %" PRIu64, position + i);
+          break;
+        }
+      }
+    } else {
+      uint8_t *region;
+      const size_t region_length = ring_buffer->acquire_read(&region, wanted);
+      CHECK(region_length <= std::min(wanted, max_region_length), "region of %zu bytes", region_length);
+      for (size_t i = 0; i < region_length; ++i) {
+        if (region[i] != stream_byte(position + i)) {
+          CHECK(false, "acquire_read() returned a wrong byte at %" PRIu64, position + i);
+          break;
+        }
+      }
+      // Sometimes leave part of the region for the next acquire, which then returns those bytes again
+      read = (region_length > 0) ? region_length - random() % (region_length / 4 + 1) : 0;
+      ring_buffer->commit_read(read);
+    }
+    checked += read;
+
+    CHECK(ring_buffer->available() <= ring_buffer->size(), "%zu bytes available", ring_buffer->available());
+    if ((read == 0) && (ring_buffer->get_read_position() < STREAM_BYTES)) {
+      ring_buffer->notify_when_available(1);
+      const uint32_t notified = ulTaskNotifyTake(pdTRUE, WAIT_TICKS);
+      CHECK((notified > 0) || (ring_buffer->available() > 0), "consumer waited %" PRIu32 " ms for bytes",
+            static_cast<uint32_t>(WAIT_TICKS));
+    }
+  }
+  return checked;
+}
+
+int main() {
+  const uint32_t seed = std::random_device()();
+  printf("seed %" PRIu32 "\n", seed);
+
+  for (const TestCase &test_case : TEST_CASES) {
+    auto ring_buffer = AudioRingBuffer::create(test_case.length, test_case.max_region_length);
+    CHECK(ring_buffer != nullptr, "creating a %zu byte ring buffer failed", test_case.length);
+    if (ring_buffer == nullptr) {
+      continue;
+    }
+
+    std::thread producer(produce, ring_buffer.get(), test_case.max_region_length, seed);
+    const uint64_t checked = consume(ring_buffer.get(), test_case.max_region_length, seed + 1);
+    producer.join();
+
+    CHECK(ring_buffer->get_write_position() == STREAM_BYTES, "wrote %zu bytes", ring_buffer->get_write_position());
+    printf("%zu byte ring buffer (%zu requested), %zu byte regions: checked %" PRIu64 " of %" PRIu64 " bytes\n",
+           ring_buffer->size(), test_case.length, test_case.max_region_length, checked, STREAM_BYTES);
+  }
+
+  return host::check_failures > 0 ? 1 : 0;
+}
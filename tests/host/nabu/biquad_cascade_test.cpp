@@ -0,0 +1,233 @@
+// Checks every BiquadCascade variant against a double precision Direct Form II Transposed reference.
+//
+// A tone plus noise is filtered in blocks of random length, so the state must carry over between blocks. The
+// interleaved and planar float variants must match each other exactly and come as close to the reference as
+// biquad_apply_buffer, the library's Direct Form I filter, does. The Q31 variant must track the reference to well
+// beyond 16 bit audio's precision, and must clip, not wrap around, when a filter's overshoot exceeds full scale.
+
+#include "esphome/components/nabu/biquad_cascade.h"
+
+#include "host/check.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace esphome::nabu;
+
+static const size_t FRAMES = 48000;
+static const size_t MAX_BLOCK_FRAMES = 700;
+static const double Q31_SCALE = 2147483648.0;
+
+// Relative to the reference's output power. Float rounding limits both float filters, to about 90 dB for poles close
+// to the unit circle, where Direct Form II Transposed rounds a few dB worse than Direct Form I. Q31 is limited by its
+// coefficients' 28 fractional bits.
+static const double MAX_FLOAT_SNR_LOSS_DB = 6.0;
+static const double MIN_Q31_SNR_DB = 120.0;
+
+struct Section {
+  bool highpass;
+  double frequency;  // In units of the sample rate, as biquad_lowpass and biquad_highpass take it
+  float gain;
+};
+
+struct TestCase {
+  const char *name;
+  uint8_t channels;
+  std::vector<Section> sections;
+};
+
+static BiquadCoefficients design(const Section &section) {
+  BiquadCoefficients coefficients;
+  if (section.highpass) {
+    biquad_highpass(&coefficients, section.frequency);
+  } else {
+    biquad_lowpass(&coefficients, section.frequency);
+  }
+  return coefficients;
+}
+
+static std::vector<float> make_signal(uint8_t channels, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> noise(-0.2f, 0.2f);
+  std::vector<float> signal(FRAMES * channels);
+  for (size_t i = 0; i < FRAMES; ++i) {
+    for (uint8_t channel = 0; channel < channels; ++channel) {
+      signal[i * channels + channel] = 0.5f * std::sin(0.01f * i + channel) + noise(random);
+    }
+  }
+  return signal;
+}
+
+/// @brief The cascade in double precision, with the same float coefficients
+/// @param clip clips each section's output to the Q31 range and feeds the clipped output back, like the Q31 variant
+static std::vector<double> filter_reference(const TestCase &test_case, const std::vector<double> &input,
+                                            bool clip = false) {
+  std::vector<double> output(input.begin(), input.end());
+  for (const Section &section : test_case.sections) {
+    const BiquadCoefficients c = design(section);
+    const double n0 = c.a0 * section.gain, n1 = c.a1 * section.gain, n2 = c.a2 * section.gain;
+    for (uint8_t channel = 0; channel < test_case.channels; ++channel) {
+      double s0 = 0.0, s1 = 0.0;
+      for (size_t i = channel; i < output.size(); i += test_case.channels) {
+        const double x = output[i];
+        double y = n0 * x + s0;
+        if (clip) {
+          y = std::min(std::max(y, -1.0), (Q31_SCALE - 1) / Q31_SCALE);
+        }
+        s0 = n1 * x - c.b1 * y + s1;
+        s1 = n2 * x - c.b2 * y;
+        output[i] = y;
+      }
+    }
+  }
+  return output;
+}
+
+static std::vector<float> filter_df1(const TestCase &test_case, std::vector<float> samples) {
+  for (const Section &section : test_case.sections) {
+    const BiquadCoefficients coefficients = design(section);
+    for (uint8_t channel = 0; channel < test_case.channels; ++channel) {
+      Biquad biquad;
+      biquad_init(&biquad, &coefficients, section.gain);
+      biquad_apply_buffer(&biquad, samples.data() + channel, FRAMES, test_case.channels);
+    }
+  }
+  return samples;
+}
+
+static void start_cascade(BiquadCascade &cascade, const TestCase &test_case) {
+  CHECK(cascade.start(test_case.channels, test_case.sections.size()) == ESP_OK, "starting failed");
+  for (size_t i = 0; i < test_case.sections.size(); ++i) {
+    cascade.set_section(i, design(test_case.sections[i]), test_case.sections[i].gain);
+  }
+}
+
+// Calls process(block, frames) over the buffer in blocks of random length, with the block pointing at its first frame
+template<typename Process> static void process_in_blocks(uint32_t seed, Process process) {
+  std::mt19937 random(seed);
+  size_t frame = 0;
+  while (frame < FRAMES) {
+    const size_t frames = std::min<size_t>(1 + random() % MAX_BLOCK_FRAMES, FRAMES - frame);
+    process(frame, frames);
+    frame += frames;
+  }
+}
+
+template<typename T> static double snr_db(const std::vector<double> &reference, const std::vector<T> &output,
+                                         double scale) {
+  double signal_power = 0.0;
+  double error_power = 0.0;
+  for (size_t i = 0; i < reference.size(); ++i) {
+    const double error = output[i] / scale - reference[i];
+    signal_power += reference[i] * reference[i];
+    error_power += error * error;
+  }
+  return 10 * std::log10(signal_power / error_power);
+}
+
+static void check_variants(const TestCase &test_case, uint32_t seed) {
+  const uint8_t channels = test_case.channels;
+  const std::vector<float> input = make_signal(channels, seed);
+  const std::vector<double> reference = filter_reference(test_case, std::vector<double>(input.begin(), input.end()));
+  const std::vector<float> df1 = filter_df1(test_case, input);
+
+  BiquadCascade cascade;
+  start_cascade(cascade, test_case);
+  std::vector<float> interleaved = input;
+  process_in_blocks(seed, [&](size_t frame, size_t frames) {
+    cascade.process(interleaved.data() + frame * channels, frames);
+  });
+
+  start_cascade(cascade, test_case);
+  std::vector<std::vector<float>> planes(channels, std::vector<float>(FRAMES));
+  for (size_t i = 0; i < FRAMES; ++i) {
+    for (uint8_t channel = 0; channel < channels; ++channel) {
+      planes[channel][i] = input[i * channels + channel];
+    }
+  }
+  process_in_blocks(seed + 1, [&](size_t frame, size_t frames) {
+    float *block[BiquadCascade::MAX_CHANNELS];
+    for (uint8_t channel = 0; channel < channels; ++channel) {
+      block[channel] = planes[channel].data() + frame;
+    }
+    cascade.process(block, frames);
+  });
+
+  start_cascade(cascade, test_case);
+  std::vector<int32_t> q31(input.size());
+  for (size_t i = 0; i < input.size(); ++i) {
+    q31[i] = static_cast<int32_t>(std::lround(input[i] * Q31_SCALE));
+  }
+  process_in_blocks(seed + 2, [&](size_t frame, size_t frames) {
+    cascade.process(q31.data() + frame * channels, frames);
+  });
+
+  size_t planar_mismatches = 0;
+  for (size_t i = 0; i < FRAMES; ++i) {
+    for (uint8_t channel = 0; channel < channels; ++channel) {
+      planar_mismatches += (planes[channel][i] != interleaved[i * channels + channel]);
+    }
+  }
+  const double df1_snr_db = snr_db(reference, df1, 1.0);
+  const double float_snr_db = snr_db(reference, interleaved, 1.0);
+  const double q31_snr_db = snr_db(reference, q31, Q31_SCALE);
+
+  printf("%-24s SNR: DF1 %3.0f dB, float cascade %3.0f dB, Q31 cascade %3.0f dB; %zu planar mismatches\n",
+         test_case.name, df1_snr_db, float_snr_db, q31_snr_db, planar_mismatches);
+  CHECK(float_snr_db >= df1_snr_db - MAX_FLOAT_SNR_LOSS_DB, "%s: float SNR of %.0f dB, DF1 has %.0f dB",
+        test_case.name, float_snr_db, df1_snr_db);
+  CHECK(q31_snr_db >= MIN_Q31_SNR_DB, "%s: Q31 SNR of %.0f dB", test_case.name, q31_snr_db);
+  CHECK(planar_mismatches == 0, "%s: planar differs from interleaved in %zu samples", test_case.name,
+        planar_mismatches);
+}
+
+// A Butterworth lowpass overshoots a full scale square wave, which the Q31 variant must clip
+static void check_q31_clipping() {
+  const TestCase test_case{"clipping", 1, {{false, 0.05, 1.0f}, {false, 0.05, 1.0f}}};
+  BiquadCascade cascade;
+  start_cascade(cascade, test_case);
+
+  // Each section overshoots by about 4%
+  std::vector<int32_t> q31(FRAMES);
+  std::vector<double> input(FRAMES);
+  for (size_t i = 0; i < FRAMES; ++i) {
+    q31[i] = static_cast<int32_t>(std::lround((((i / 200) % 2) ? -0.98 : 0.98) * Q31_SCALE));
+    input[i] = q31[i] / Q31_SCALE;
+  }
+  const std::vector<double> unclipped = filter_reference(test_case, input);
+  const std::vector<double> reference = filter_reference(test_case, input, true);
+  cascade.process(q31.data(), FRAMES);
+
+  size_t overshoots = 0;
+  size_t wrong = 0;
+  for (size_t i = 0; i < FRAMES; ++i) {
+    overshoots += (std::abs(unclipped[i]) > 1.0);
+    // Far above the rounding, but far below a wrap around or a run away state
+    wrong += (std::abs(q31[i] / Q31_SCALE - reference[i]) > 1e-6);
+  }
+  printf("%-24s %zu samples would overshoot, %zu wrong\n", test_case.name, overshoots, wrong);
+  CHECK(overshoots > 0, "the square wave didn't overshoot");
+  CHECK(wrong == 0, "%zu samples differ from the clipped reference", wrong);
+}
+
+int main() {
+  const TestCase test_cases[] = {
+      {"mono lowpass", 1, {{false, 0.2, 1.0f}, {false, 0.2, 1.0f}}},
+      {"stereo lowpass", 2, {{false, 0.2, 1.0f}, {false, 0.2, 1.0f}}},
+      // Poles close to the unit circle, like the resampler's lowpass at low rates, need the most precision
+      {"stereo narrow lowpass", 2, {{false, 0.02, 1.0f}, {false, 0.02, 1.0f}}},
+      {"stereo band with gain", 2, {{true, 0.005, 0.9f}, {false, 0.1, 1.0f}, {false, 0.1, 1.1f}}},
+  };
+  uint32_t seed = 1;
+  for (const TestCase &test_case : test_cases) {
+    check_variants(test_case, seed);
+    seed += 3;
+  }
+  check_q31_clipping();
+
+  return host::check_failures > 0 ? 1 : 0;
+}
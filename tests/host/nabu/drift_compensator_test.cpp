@@ -0,0 +1,177 @@
+// Simulates an hour of a live stream with DriftCompensator steering how fast the buffer is consumed.
+//
+// The source sends compressed frames at the rate of its own clock, after an initial burst, and each frame reaches the
+// buffer after a random network delay. The sink reads whole frames at the rate of the speaker's clock, divided by
+// 1 + the correction, like the resampler does when it produces a fixed number of output samples. With the source's
+// clock off by 0.1%, the compensator must lock, correct by about that much, and hold the buffer's level steady without
+// it ever overflowing or running dry. A source that sends a file as fast as it can must not be compensated at all.
+
+#include "esphome/components/nabu/drift_compensator.h"
+
+#include "host/check.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <random>
+
+using namespace esphome::nabu;
+
+// Like the pipeline's raw file ring buffer
+static const size_t BUFFER_SIZE = 64 * 1024;
+
+// A 128 kbps MP3 stream at 44.1 kHz
+static const double FRAME_SECONDS = 1152.0 / 44100.0;
+static const size_t FRAME_BYTES = 418;
+static const double BYTES_PER_SECOND = FRAME_BYTES / FRAME_SECONDS;
+
+static const uint32_t TICK_MS = 10;
+static const uint32_t DURATION_S = 3600;
+// The server sends this much audio as soon as the stream starts
+static const double INITIAL_BURST_S = 3.0;
+static const uint32_t MAX_NETWORK_DELAY_MS = 200;
+
+// The level must settle within this long, then stay within LEVEL_RANGE_S for the rest of the hour. Without
+// compensation, a 0.1% difference moves it that far in under two minutes. The level is averaged over
+// LEVEL_AVERAGE_S, as single measurements swing with the network delay.
+static const uint32_t SETTLE_S = 600;
+static const double LEVEL_RANGE_S = 0.1;
+static const uint32_t LEVEL_AVERAGE_S = 10;
+// How close the average correction after settling must come to the exact rate difference; 5% of a 0.1% difference
+static const double CORRECTION_TOLERANCE = 50e-6;
+
+struct Result {
+  double mean_correction;  // Over the time after settling
+  float max_abs_correction;
+  uint32_t first_correction_ms;  // UINT32_MAX if the correction stayed 0
+  double settled_level_min_s;
+  double settled_level_max_s;
+  size_t overflow_bytes;
+  size_t underrun_bytes;
+};
+
+/// @param source_ppm how much faster the source's clock runs than the speaker's, in parts per million
+/// @param download the source sends a file as fast as the buffer takes it instead of streaming in real time
+static Result simulate(double source_ppm, bool download) {
+  std::mt19937 random(1);
+  std::uniform_int_distribution<uint32_t> network_delay(0, MAX_NETWORK_DELAY_MS);
+
+  DriftCompensator compensator;
+  compensator.start(BUFFER_SIZE);
+
+  // Frames sent but not yet arrived, by arrival time; the network keeps them in order
+  std::deque<uint32_t> in_flight;
+  double next_frame_ms = -INITIAL_BURST_S * 1000.0;
+  uint32_t last_arrival_ms = 0;
+
+  // Positions start just short of wrapping around, which they do within the first minute
+  size_t write_position = SIZE_MAX - 500000;
+  size_t read_position = write_position;
+  double sink_demand = 0.0;
+  double level_sum_s = 0.0;
+  double correction_sum = 0.0;
+  uint32_t settled_ticks = 0;
+
+  Result result{};
+  result.first_correction_ms = UINT32_MAX;
+  result.settled_level_min_s = INFINITY;
+  result.settled_level_max_s = 0.0;
+
+  const double source_frame_ms = FRAME_SECONDS * 1000.0 / (1.0 + source_ppm * 1e-6);
+  for (uint32_t now_ms = 0; now_ms < DURATION_S * 1000; now_ms += TICK_MS) {
+    if (download) {
+      while (BUFFER_SIZE - (write_position - read_position) >= FRAME_BYTES) {
+        write_position += FRAME_BYTES;
+      }
+    } else {
+      while (next_frame_ms <= now_ms) {
+        const uint32_t sent_ms = std::max(0.0, next_frame_ms);
+        last_arrival_ms = std::max(last_arrival_ms, sent_ms + network_delay(random));
+        in_flight.push_back(last_arrival_ms);
+        next_frame_ms += source_frame_ms;
+      }
+      while (!in_flight.empty() && (in_flight.front() <= now_ms)) {
+        in_flight.pop_front();
+        if (BUFFER_SIZE - (write_position - read_position) >= FRAME_BYTES) {
+          write_position += FRAME_BYTES;
+        } else {
+          result.overflow_bytes += FRAME_BYTES;
+        }
+      }
+    }
+
+    // The resampler consumes input 1 + correction times slower than the speaker plays it. Playback starts once the
+    // first frames had time to arrive.
+    if (now_ms >= MAX_NETWORK_DELAY_MS) {
+      sink_demand += BYTES_PER_SECOND * TICK_MS / 1000.0 / (1.0 + compensator.get_correction());
+    }
+    while (sink_demand >= FRAME_BYTES) {
+      sink_demand -= FRAME_BYTES;
+      if (write_position - read_position >= FRAME_BYTES) {
+        read_position += FRAME_BYTES;
+      } else {
+        result.underrun_bytes += FRAME_BYTES;
+      }
+    }
+
+    const size_t buffered = write_position - read_position;
+    const float correction = compensator.update(buffered, read_position, write_position, now_ms);
+
+    if ((correction != 0.0f) && (result.first_correction_ms == UINT32_MAX)) {
+      result.first_correction_ms = now_ms;
+    }
+    result.max_abs_correction = std::max(result.max_abs_correction, std::abs(correction));
+    if (now_ms >= SETTLE_S * 1000) {
+      correction_sum += correction;
+      level_sum_s += buffered / BYTES_PER_SECOND;
+      ++settled_ticks;
+      if (settled_ticks % (LEVEL_AVERAGE_S * 1000 / TICK_MS) == 0) {
+        const double level_s = level_sum_s / (LEVEL_AVERAGE_S * 1000 / TICK_MS);
+        result.settled_level_min_s = std::min(result.settled_level_min_s, level_s);
+        result.settled_level_max_s = std::max(result.settled_level_max_s, level_s);
+        level_sum_s = 0.0;
+      }
+    }
+  }
+  result.mean_correction = correction_sum / settled_ticks;
+  return result;
+}
+
+static void print_result(const char *name, const Result &result) {
+  printf("%-24s correction %+5.0f ppm (largest %4.0f), first after %6.1f s, level %.3f to %.3f s, overflow %zu, "
+         "underrun %zu bytes\n",
+         name, result.mean_correction * 1e6, result.max_abs_correction * 1e6,
+         (result.first_correction_ms == UINT32_MAX) ? NAN : result.first_correction_ms / 1000.0,
+         result.settled_level_min_s, result.settled_level_max_s, result.overflow_bytes, result.underrun_bytes);
+}
+
+static void check_compensated(const char *name, double source_ppm) {
+  const Result result = simulate(source_ppm, false);
+  print_result(name, result);
+
+  // Consuming 1 + ppm times faster takes a correction of 1 / (1 + ppm) - 1
+  const double expected = 1.0 / (1.0 + source_ppm * 1e-6) - 1.0;
+  CHECK(result.first_correction_ms < 30 * 1000, "no correction within 30 s");
+  CHECK(std::abs(result.mean_correction - expected) <= CORRECTION_TOLERANCE,
+        "correction of %.0f ppm instead of %.0f ppm", result.mean_correction * 1e6, expected * 1e6);
+  CHECK(result.settled_level_max_s - result.settled_level_min_s <= LEVEL_RANGE_S,
+        "level moved between %.3f and %.3f s", result.settled_level_min_s, result.settled_level_max_s);
+  CHECK(result.overflow_bytes == 0, "%zu bytes didn't fit", result.overflow_bytes);
+  CHECK(result.underrun_bytes == 0, "ran dry for %zu bytes", result.underrun_bytes);
+}
+
+int main() {
+  check_compensated("source 0.1% fast", 1000.0);
+  check_compensated("source 0.1% slow", -1000.0);
+  check_compensated("matched clocks", 0.0);
+
+  // The level stays high because the buffer holds the source back, so it says nothing about the clocks
+  const Result download = simulate(0.0, true);
+  print_result("file sent at full speed", download);
+  CHECK(download.max_abs_correction == 0.0f, "corrected by up to %.0f ppm for a download",
+        download.max_abs_correction * 1e6);
+
+  return host::check_failures > 0 ? 1 : 0;
+}
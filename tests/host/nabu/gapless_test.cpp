@@ -0,0 +1,192 @@
+// Checks the gapless handoff between two media pipelines.
+//
+// One continuous signal is cut into two WAV files. The second file is started with the first pipeline as its
+// previous pipeline while the first still plays, like an enqueued track. A speaker thread drains the mixer in real
+// time, and the audio it reads must be the uncut signal, sample for sample, without running dry in between. A second
+// case stops the enqueued pipeline before the first finishes, which must leave the first file's audio untouched.
+
+#include "esphome/components/nabu/audio_mixer.h"
+#include "esphome/components/nabu/audio_pipeline.h"
+
+#include "host/check.h"
+
+#include <freertos/task.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace esphome;
+using namespace esphome::nabu;
+
+static const uint32_t SAMPLE_RATE = 48000;
+static const uint8_t CHANNELS = 2;
+// Frames read from the mixer at once, like the speaker task
+static const size_t OUTPUT_FRAMES = 512;
+static const size_t WAV_HEADER_SIZE = 44;
+
+static const UBaseType_t PIPELINE_TASK_PRIORITY = 2;
+// How long after starting the second file the first file's pipeline stops it, in the stop case
+static const uint32_t STOP_NEXT_AFTER_MS = 100;
+// Time for the pipelines to finish and the mixer to drain beyond the length of the audio
+static const uint32_t SETTLE_MS = 2000;
+
+static std::vector<int16_t> make_signal(size_t frames) {
+  std::vector<int16_t> signal(frames * CHANNELS);
+  for (size_t i = 0; i < frames; ++i) {
+    const int16_t sample = static_cast<int16_t>(8000 * std::sin(i * 0.0123 + 0.5) + 1000 * std::sin(i * 0.71));
+    signal[CHANNELS * i] = sample;
+    signal[CHANNELS * i + 1] = -sample;
+  }
+  return signal;
+}
+
+static void put_u16(uint8_t *destination, uint16_t value) { std::memcpy(destination, &value, sizeof(value)); }
+static void put_u32(uint8_t *destination, uint32_t value) { std::memcpy(destination, &value, sizeof(value)); }
+
+static std::vector<uint8_t> make_wav(const int16_t *samples, size_t sample_count) {
+  const uint32_t data_size = sample_count * sizeof(int16_t);
+  std::vector<uint8_t> wav(WAV_HEADER_SIZE + data_size);
+  std::memcpy(&wav[0], "RIFF", 4);
+  put_u32(&wav[4], wav.size() - 8);
+  std::memcpy(&wav[8], "WAVEfmt ", 8);
+  put_u32(&wav[16], 16);
+  put_u16(&wav[20], 1);  // PCM
+  put_u16(&wav[22], CHANNELS);
+  put_u32(&wav[24], SAMPLE_RATE);
+  put_u32(&wav[28], SAMPLE_RATE * CHANNELS * sizeof(int16_t));
+  put_u16(&wav[32], CHANNELS * sizeof(int16_t));
+  put_u16(&wav[34], 16);
+  std::memcpy(&wav[36], "data", 4);
+  put_u32(&wav[40], data_size);
+  std::memcpy(&wav[WAV_HEADER_SIZE], samples, data_size);
+  return wav;
+}
+
+/// @brief Reads the mixer's output in real time until stopped, like the speaker task
+class Speaker {
+ public:
+  explicit Speaker(AudioMixer *mixer) : mixer_(mixer), thread_(&Speaker::run_, this) {}
+
+  /// @brief Stops reading and returns every sample read
+  std::vector<int16_t> stop() {
+    this->done_ = true;
+    this->thread_.join();
+    return std::move(this->output_);
+  }
+
+  size_t frames_read() const { return this->frames_read_; }
+  /// @brief Reads that came up short while more audio was expected, after the first audio arrived
+  size_t underruns() const { return this->underruns_; }
+  void set_expected_frames(size_t frames) { this->expected_frames_ = frames; }
+
+ protected:
+  void run_() {
+    std::vector<uint8_t> buffer(OUTPUT_FRAMES * CHANNELS * sizeof(int16_t));
+    auto next_read = std::chrono::steady_clock::now();
+    while (!this->done_) {
+      uint8_t channels = CHANNELS;
+      const size_t frames = this->mixer_->read(buffer.data(), OUTPUT_FRAMES, channels);
+      CHECK((frames == 0) || (channels == CHANNELS), "the mixer returned %u channels", channels);
+
+      const size_t frames_read = this->frames_read_;
+      if ((frames_read > 0) && (frames < OUTPUT_FRAMES) && (frames_read + frames < this->expected_frames_)) {
+        ++this->underruns_;
+      }
+      const int16_t *samples = reinterpret_cast<const int16_t *>(buffer.data());
+      this->output_.insert(this->output_.end(), samples, samples + frames * CHANNELS);
+      this->frames_read_ = frames_read + frames;
+
+      next_read += std::chrono::microseconds(OUTPUT_FRAMES * 1000000 / SAMPLE_RATE);
+      std::this_thread::sleep_until(next_read);
+    }
+  }
+
+  AudioMixer *mixer_;
+  std::vector<int16_t> output_;
+  std::atomic<size_t> frames_read_{0};
+  std::atomic<size_t> underruns_{0};
+  std::atomic<size_t> expected_frames_{SIZE_MAX};
+  std::atomic<bool> done_{false};
+  std::thread thread_;
+};
+
+/// @brief Plays the signal cut after first_frames, with the rest enqueued as a second file
+/// @param stop_next stops the second file's pipeline before the first finishes; only the first file must play then
+static void check_handoff(AudioMixer *mixer, size_t first_frames, size_t second_frames, bool stop_next) {
+  const std::vector<int16_t> signal = make_signal(first_frames + second_frames);
+  const std::vector<uint8_t> first_wav = make_wav(signal.data(), first_frames * CHANNELS);
+  const std::vector<uint8_t> second_wav =
+      make_wav(signal.data() + first_frames * CHANNELS, second_frames * CHANNELS);
+  media_player::MediaFile first_file{first_wav.data(), first_wav.size(), media_player::MediaFileType::WAV, {}};
+  media_player::MediaFile second_file{second_wav.data(), second_wav.size(), media_player::MediaFileType::WAV, {}};
+
+  const size_t expected_frames = stop_next ? first_frames : first_frames + second_frames;
+
+  // The pipelines' tasks run until the process exits, so the pipelines are never destroyed
+  auto *first = new AudioPipeline(mixer, AudioPipelineType::MEDIA);
+  auto *second = new AudioPipeline(mixer, AudioPipelineType::MEDIA);
+
+  Speaker speaker(mixer);
+  speaker.set_expected_frames(expected_frames);
+  CHECK(first->start(&first_file, SAMPLE_RATE, "media", PIPELINE_TASK_PRIORITY) == ESP_OK, "starting failed");
+  CHECK(second->start(&second_file, SAMPLE_RATE, "next", PIPELINE_TASK_PRIORITY, first) == ESP_OK,
+        "enqueueing failed");
+  if (stop_next) {
+    vTaskDelay(pdMS_TO_TICKS(STOP_NEXT_AFTER_MS));
+    CHECK(second->get_state() == AudioPipelineState::PLAYING, "the enqueued pipeline isn't waiting");
+    CHECK(second->stop() == ESP_OK, "stopping the enqueued pipeline failed");
+  }
+
+  const uint32_t timeout_ms = (first_frames + second_frames) * 1000 / SAMPLE_RATE + SETTLE_MS;
+  const auto start = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(timeout_ms)) {
+    // Also empties the pipelines' info queues, like the media player's loop
+    const bool stopped = (first->get_state() == AudioPipelineState::STOPPED) &&
+                         (second->get_state() == AudioPipelineState::STOPPED);
+    if (stopped && (speaker.frames_read() >= expected_frames) && (mixer->available() == 0)) {
+      break;
+    }
+    vTaskDelay(pdMS_TO_TICKS(16));
+  }
+  // Leaves time for audio beyond the expected end to show up
+  vTaskDelay(pdMS_TO_TICKS(50));
+  const size_t underruns = speaker.underruns();
+  const std::vector<int16_t> output = speaker.stop();
+
+  const size_t output_frames = output.size() / CHANNELS;
+  CHECK(output_frames == expected_frames, "%zu frames played, expected %zu", output_frames, expected_frames);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < std::min(output.size(), expected_frames * CHANNELS); ++i) {
+    if (output[i] != signal[i]) {
+      if (mismatches == 0) {
+        CHECK(false, "first wrong sample at frame %zu: %d instead of %d", i / CHANNELS, output[i], signal[i]);
+      }
+      ++mismatches;
+    }
+  }
+  CHECK(underruns == 0, "the mixer ran dry %zu times", underruns);
+  printf("%zu + %zu frames%s: %zu frames played, %zu wrong samples, %zu underruns\n", first_frames, second_frames,
+         stop_next ? ", second stopped" : "", output_frames, mismatches, underruns);
+}
+
+int main() {
+  // The mixer's task runs until the process exits, so it is never destroyed
+  auto *mixer = new AudioMixer();
+  mixer->set_bits_per_sample(16);
+  if (mixer->start("mixer", PIPELINE_TASK_PRIORITY) != ESP_OK) {
+    fprintf(stderr, "starting the mixer failed\n");
+    return 1;
+  }
+
+  check_handoff(mixer, 48000, 72000, false);
+  // A cut that isn't a multiple of any buffer size
+  check_handoff(mixer, 30011, 20000, false);
+  check_handoff(mixer, 48000, 72000, true);
+
+  return host::check_failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,306 @@
+// Runs media files through the reader, decoder, resampler, and mixer on the host and reports each stage's throughput.
+//
+// The stages are driven round robin from one thread, with the same ring buffer sizes as AudioPipeline, so each
+// stage's time is only its own work. The mixer runs in its own task, like on the device; its time is the CPU time of
+// that task. Files are served by the host esp_http_client, so the reader runs its normal HTTP path.
+//
+// Usage: pipeline_benchmark [--sample-rate HZ] [--quality fast|balanced|high] [--min-realtime FACTOR] [--verbose]
+//                           FILE...
+// With --min-realtime, it fails if the whole chain runs less than FACTOR times faster than real time, or if the
+// output's length doesn't match the input's.
+
+#include "esphome/components/nabu/audio_decoder.h"
+#include "esphome/components/nabu/audio_mixer.h"
+#include "esphome/components/nabu/audio_reader.h"
+#include "esphome/components/nabu/audio_resampler.h"
+#include "esphome/components/nabu/audio_ring_buffer.h"
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+#include "host/http_server.h"
+#include "host/memory.h"
+
+#include <freertos/task.h>
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace esphome;
+using namespace esphome::nabu;
+
+// Same sizes as AudioPipeline
+static const size_t HTTP_BUFFER_SIZE = 64 * 1024;
+static const size_t MAX_FRAME_SIZE = 64 * 1024;
+static const size_t BUFFER_SIZE_SAMPLES = 32768;
+static const size_t BUFFER_SIZE_BYTES = BUFFER_SIZE_SAMPLES * sizeof(int16_t);
+
+// Frames read from the mixer at once, like the speaker task
+static const size_t OUTPUT_FRAMES = 1024;
+
+static const uint8_t BITS_PER_SAMPLE = 16;
+static const char *const MIXER_TASK_NAME = "mixer";
+
+static const size_t NO_PEAK = SIZE_MAX;
+
+// The output may differ from the input's length by the resampler's rounding at either end
+static const double MAX_LENGTH_ERROR = 0.01;
+
+struct StageResult {
+  const char *name;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t processing_us;
+  uint64_t output_samples;  // 0 for the reader, which outputs encoded bytes
+  size_t peak_output_bytes;  // NO_PEAK if not measured
+};
+
+struct FileResult {
+  bool ok;
+  double audio_seconds;
+  uint64_t total_processing_us;
+};
+
+static uint32_t task_cpu_us(const char *name) {
+  std::vector<TaskStatus_t> statuses(uxTaskGetNumberOfTasks());
+  const UBaseType_t count = uxTaskGetSystemState(statuses.data(), statuses.size(), nullptr);
+  for (UBaseType_t i = 0; i < count; ++i) {
+    if (strcmp(statuses[i].pcTaskName, name) == 0) {
+      return statuses[i].ulRunTimeCounter;
+    }
+  }
+  return 0;
+}
+
+static void print_stage(const StageResult &stage, double audio_seconds) {
+  const double seconds = stage.processing_us / 1e6;
+  char samples_per_second[32] = "-";
+  if (stage.output_samples > 0 && seconds > 0) {
+    snprintf(samples_per_second, sizeof(samples_per_second), "%.0f", stage.output_samples / seconds);
+  }
+  char realtime[32] = "-";
+  if (seconds > 0) {
+    snprintf(realtime, sizeof(realtime), "%.1f", audio_seconds / seconds);
+  }
+  char peak[32] = "-";
+  if (stage.peak_output_bytes != NO_PEAK) {
+    snprintf(peak, sizeof(peak), "%zu", stage.peak_output_bytes);
+  }
+  printf("  %-9s %13" PRIu64 " %13" PRIu64 " %10.2f %14s %10s %10s\n", stage.name, stage.bytes_read,
+         stage.bytes_written, stage.processing_us / 1000.0, samples_per_second, realtime, peak);
+}
+
+static FileResult benchmark_file(AudioMixer *mixer, const std::string &path, uint32_t sample_rate,
+                                 ResamplerQuality quality) {
+  FileResult result{false, 0, 0};
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    fprintf(stderr, "%s: can't open the file\n", path.c_str());
+    return result;
+  }
+  std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+  // The reader tells the file type from the extension, so keep the file's name in the URL
+  const std::string url = "http://benchmark.local/" + path.substr(path.find_last_of('/') + 1);
+  host::http_serve(url, std::move(contents));
+
+  host::reset_peak_allocated_bytes();
+  const uint32_t mixer_start_cpu_us = task_cpu_us(MIXER_TASK_NAME);
+
+  auto raw_file_ring_buffer = AudioRingBuffer::create(HTTP_BUFFER_SIZE, MAX_FRAME_SIZE);
+  auto decoded_ring_buffer = AudioRingBuffer::create(BUFFER_SIZE_BYTES, MAX_FRAME_SIZE);
+  AudioRingBuffer *media_ring_buffer = mixer->get_media_ring_buffer();
+
+  AudioReader reader(raw_file_ring_buffer.get(), MAX_FRAME_SIZE, nullptr);
+  media_player::MediaFileType file_type = media_player::MediaFileType::NONE;
+  if (reader.start(url, file_type) != ESP_OK) {
+    fprintf(stderr, "%s: the reader failed to start\n", path.c_str());
+    return result;
+  }
+
+  AudioDecoder decoder(raw_file_ring_buffer.get(), decoded_ring_buffer.get(), MAX_FRAME_SIZE);
+  if (decoder.start(file_type) != ESP_OK) {
+    fprintf(stderr, "%s: the decoder failed to start\n", path.c_str());
+    return result;
+  }
+
+  AudioResampler resampler(decoded_ring_buffer.get(), media_ring_buffer, BUFFER_SIZE_SAMPLES);
+  resampler.set_quality(quality);
+  media_player::StreamInfo stream_info;
+  ResampleInfo resample_info{};
+
+  std::vector<uint8_t> output(OUTPUT_FRAMES * 2 * BITS_PER_SAMPLE / 8);
+  uint64_t output_samples = 0;
+  uint64_t reader_us = 0, decoder_us = 0, resampler_us = 0;
+  size_t reader_peak = 0, decoder_peak = 0, resampler_peak = 0, mixer_peak = 0;
+  bool reader_done = false, decoder_done = false, resampler_started = false, resampler_done = false;
+
+  while (!resampler_done || (media_ring_buffer->available() > 0) || (mixer->available() > 0)) {
+    const uint64_t progress_before = reader.get_stats().bytes_written + decoder.get_stats().bytes_written +
+                                     resampler.get_stats().bytes_written + output_samples;
+
+    if (!reader_done) {
+      const uint32_t start_us = micros();
+      const AudioReaderState reader_state = reader.read();
+      reader_us += micros() - start_us;
+      reader_peak = std::max(reader_peak, raw_file_ring_buffer->available());
+      if (reader_state == AudioReaderState::FAILED) {
+        fprintf(stderr, "%s: reading failed\n", path.c_str());
+        return result;
+      }
+      reader_done = (reader_state == AudioReaderState::FINISHED);
+    }
+
+    if (!decoder_done) {
+      const uint32_t start_us = micros();
+      const AudioDecoderState decoder_state = decoder.decode(reader_done);
+      decoder_us += micros() - start_us;
+      decoder_peak = std::max(decoder_peak, decoded_ring_buffer->available());
+      if (decoder_state == AudioDecoderState::FAILED) {
+        fprintf(stderr, "%s: decoding failed\n", path.c_str());
+        return result;
+      }
+      decoder_done = (decoder_state == AudioDecoderState::FINISHED);
+    }
+
+    if (!resampler_started && decoder.get_stream_info().has_value()) {
+      stream_info = decoder.get_stream_info().value();
+      if (resampler.start(stream_info, sample_rate, BITS_PER_SAMPLE, resample_info) != ESP_OK) {
+        fprintf(stderr, "%s: the resampler failed to start\n", path.c_str());
+        return result;
+      }
+      mixer->set_media_channels(stream_info.channels);
+      resampler_started = true;
+    }
+
+    if (resampler_started && !resampler_done) {
+      const uint32_t start_us = micros();
+      const AudioResamplerState resampler_state = resampler.resample(decoder_done);
+      resampler_us += micros() - start_us;
+      resampler_peak = std::max(resampler_peak, media_ring_buffer->available());
+      if (resampler_state == AudioResamplerState::FAILED) {
+        fprintf(stderr, "%s: resampling failed\n", path.c_str());
+        return result;
+      }
+      resampler_done = (resampler_state == AudioResamplerState::FINISHED);
+    }
+
+    mixer_peak = std::max(mixer_peak, mixer->available());
+    uint8_t channels = 0;
+    const size_t frames = mixer->read(output.data(), OUTPUT_FRAMES, channels);
+    output_samples += frames * channels;
+
+    const uint64_t progress_after = reader.get_stats().bytes_written + decoder.get_stats().bytes_written +
+                                    resampler.get_stats().bytes_written + output_samples;
+    if (progress_after == progress_before) {
+      // Only the mixer task can make progress
+      vTaskDelay(pdMS_TO_TICKS(1));
+    }
+  }
+
+  const uint64_t mixer_us = task_cpu_us(MIXER_TASK_NAME) - mixer_start_cpu_us;
+  const size_t peak_bytes = host::peak_allocated_bytes();
+
+  const size_t bytes_per_sample = BITS_PER_SAMPLE / 8;
+  const uint64_t decoded_samples = decoder.get_stats().bytes_written / (stream_info.bits_per_sample / 8);
+  const uint64_t resampled_samples = resampler.get_stats().bytes_written / bytes_per_sample;
+  result.audio_seconds = static_cast<double>(decoded_samples) / stream_info.channels / stream_info.sample_rate;
+
+  const StageResult stages[] = {
+      {"reader", reader.get_stats().bytes_read, reader.get_stats().bytes_written, reader_us, 0, reader_peak},
+      {"decoder", decoder.get_stats().bytes_read, decoder.get_stats().bytes_written, decoder_us, decoded_samples,
+       decoder_peak},
+      {"resampler", resampler.get_stats().bytes_read, resampler.get_stats().bytes_written, resampler_us,
+       resampled_samples, resampler_peak},
+      {"mixer", resampler.get_stats().bytes_written, output_samples * bytes_per_sample, mixer_us, output_samples,
+       mixer_peak},
+  };
+
+  printf("%s: %s, %u channel(s), %" PRIu32 " Hz, %u bits; %.2f s of audio resampled to %" PRIu32 " Hz\n",
+         path.c_str(), media_player::media_player_file_type_to_string(file_type), stream_info.channels,
+         stream_info.sample_rate, stream_info.bits_per_sample, result.audio_seconds, sample_rate);
+  printf("  %-9s %13s %13s %10s %14s %10s %10s\n", "stage", "bytes read", "bytes written", "cpu ms", "samples/s",
+         "realtime", "peak out");
+  for (const StageResult &stage : stages) {
+    print_stage(stage, result.audio_seconds);
+    result.total_processing_us += stage.processing_us;
+  }
+  const StageResult total = {"total", reader.get_stats().bytes_read, output_samples * bytes_per_sample,
+                             result.total_processing_us, output_samples, NO_PEAK};
+  print_stage(total, result.audio_seconds);
+  printf("  peak memory allocated for buffers, including the mixer's: %zu bytes\n", peak_bytes);
+
+  const double expected_samples = static_cast<double>(decoded_samples) * sample_rate / stream_info.sample_rate;
+  if (std::abs(output_samples - expected_samples) > expected_samples * MAX_LENGTH_ERROR) {
+    fprintf(stderr, "%s: expected about %.0f output samples, got %" PRIu64 "\n", path.c_str(), expected_samples,
+            output_samples);
+    return result;
+  }
+
+  result.ok = true;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  uint32_t sample_rate = 48000;
+  ResamplerQuality quality = ResamplerQuality::HIGH;
+  double min_realtime = 0;
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if ((arg == "--sample-rate") && (i + 1 < argc)) {
+      sample_rate = strtoul(argv[++i], nullptr, 10);
+    } else if ((arg == "--quality") && (i + 1 < argc)) {
+      const std::string name = argv[++i];
+      quality = (name == "fast") ? ResamplerQuality::FAST
+                                 : (name == "balanced") ? ResamplerQuality::BALANCED : ResamplerQuality::HIGH;
+    } else if ((arg == "--min-realtime") && (i + 1 < argc)) {
+      min_realtime = strtod(argv[++i], nullptr);
+    } else if (arg == "--verbose") {
+      host::set_log_level(ESPHOME_LOG_LEVEL_VERBOSE);
+    } else {
+      paths.push_back(arg);
+    }
+  }
+
+  if (paths.empty()) {
+    fprintf(stderr,
+            "usage: %s [--sample-rate HZ] [--quality fast|balanced|high] [--min-realtime FACTOR] [--verbose] FILE...\n",
+            argv[0]);
+    return 2;
+  }
+
+  // Never destroyed, as its task keeps running until the program exits
+  AudioMixer *mixer = new AudioMixer();
+  mixer->set_bits_per_sample(BITS_PER_SAMPLE);
+  if (mixer->start(MIXER_TASK_NAME) != ESP_OK) {
+    fprintf(stderr, "the mixer failed to start\n");
+    return 1;
+  }
+
+  bool ok = true;
+  for (const std::string &path : paths) {
+    const FileResult result = benchmark_file(mixer, path, sample_rate, quality);
+    if (!result.ok) {
+      ok = false;
+      continue;
+    }
+    const double realtime = result.audio_seconds * 1e6 / std::max<uint64_t>(result.total_processing_us, 1);
+    if (realtime < min_realtime) {
+      fprintf(stderr, "%s: ran %.1f times faster than real time; expected at least %.1f\n", path.c_str(), realtime,
+              min_realtime);
+      ok = false;
+    }
+  }
+
+  return ok ? 0 : 1;
+}
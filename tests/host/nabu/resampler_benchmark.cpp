@@ -0,0 +1,264 @@
+// Measures the CPU time and THD+N of each resampler quality at common and uncommon rate pairs.
+//
+// A half scale tone in 16 bit stereo is resampled to 16 bit stereo, once at 1 kHz and once near the top of the band,
+// where a filter with too wide a transition band lets the tone's image through. THD+N is everything in the output
+// besides the best fitting sine, relative to that sine. The CPU time is the best of several runs, per second of audio.
+// The table it prints is the one in audio_resampler.cpp.
+//
+// Usage: resampler_benchmark [--max-polyphase-thdn DB]
+// With --max-polyphase-thdn, it fails if any result on the polyphase path is above DB. Those should all sit near the
+// 16 bit noise floor.
+
+#include "esphome/components/nabu/audio_resampler.h"
+#include "esphome/components/nabu/audio_ring_buffer.h"
+#include "esphome/components/nabu/filter_bank_cache.h"
+#include "esphome/components/nabu/polyphase_resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+using namespace esphome;
+using namespace esphome::nabu;
+
+static const uint8_t CHANNELS = 2;
+static const uint32_t SECONDS = 2;
+static const double AMPLITUDE = 0.5;
+static const uint32_t CPU_RUNS = 15;
+
+static const size_t RING_BUFFER_SIZE = 65536;
+static const size_t INTERNAL_BUFFER_SAMPLES = 32768;
+static const size_t INPUT_CHUNK_BYTES = 4096;
+
+// Samples per least squares fit; short enough that the sinc resampler's slowly drifting phase fits well
+static const size_t FIT_BLOCK = 16384;
+// The sinc resampler's ratio may be off by this much, so the tone's frequency is searched for within it
+static const double MAX_RATIO_ERROR = 1e-4;
+static const int FREQUENCY_SEARCH_STEPS = 40;
+
+static const char *const QUALITY_NAMES[] = {"fast", "balanced", "high"};
+
+struct RatePair {
+  uint32_t input_rate;
+  uint32_t output_rate;
+  double high_frequency;  // Near the top of the band the lower of the two rates passes
+};
+
+static const RatePair RATE_PAIRS[] = {
+    {44100, 48000, 15000}, {22050, 48000, 9000}, {16000, 48000, 7000},  {22050, 16000, 7000},
+    {48100, 48000, 15000}, {11025, 48000, 4000}, {11025, 16000, 4000},
+};
+
+static double cpu_us() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+// Fills sines and cosines of the tone over a block by rotating a phasor; much faster than calling sin and cos
+static void tone_basis(double frequency, uint32_t rate, size_t start, std::vector<double> &sines,
+                       std::vector<double> &cosines) {
+  const double step = 2 * M_PI * frequency / rate;
+  const double step_sin = std::sin(step);
+  const double step_cos = std::cos(step);
+  double sine = std::sin(step * start);
+  double cosine = std::cos(step * start);
+  for (size_t i = 0; i < FIT_BLOCK; ++i) {
+    sines[i] = sine;
+    cosines[i] = cosine;
+    const double next_sine = sine * step_cos + cosine * step_sin;
+    cosine = cosine * step_cos - sine * step_sin;
+    sine = next_sine;
+  }
+}
+
+// Residual power over the fitted tone's power, fitting a * sin + b * cos + c to each block of the first channel
+static double residual_ratio(const std::vector<int16_t> &output, double frequency, uint32_t rate, size_t skip) {
+  const size_t frames = output.size() / CHANNELS;
+  std::vector<double> sines(FIT_BLOCK);
+  std::vector<double> cosines(FIT_BLOCK);
+  double tone_power = 0.0;
+  double residual_power = 0.0;
+  for (size_t start = skip; start + FIT_BLOCK + skip <= frames; start += FIT_BLOCK) {
+    tone_basis(frequency, rate, start, sines, cosines);
+
+    // Normal equations of the least squares fit, solved by Gauss-Jordan elimination
+    double system[3][4] = {};
+    for (size_t i = start; i < start + FIT_BLOCK; ++i) {
+      const double basis[3] = {sines[i - start], cosines[i - start], 1.0};
+      for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 3; ++column) {
+          system[row][column] += basis[row] * basis[column];
+        }
+        system[row][3] += basis[row] * output[i * CHANNELS];
+      }
+    }
+    for (int pivot = 0; pivot < 3; ++pivot) {
+      for (int row = 0; row < 3; ++row) {
+        if (row != pivot) {
+          const double factor = system[row][pivot] / system[pivot][pivot];
+          for (int column = 0; column < 4; ++column) {
+            system[row][column] -= factor * system[pivot][column];
+          }
+        }
+      }
+    }
+    double fit[3];
+    for (int row = 0; row < 3; ++row) {
+      fit[row] = system[row][3] / system[row][row];
+    }
+
+    for (size_t i = start; i < start + FIT_BLOCK; ++i) {
+      const double tone = fit[0] * sines[i - start] + fit[1] * cosines[i - start];
+      const double residual = output[i * CHANNELS] - tone - fit[2];
+      tone_power += tone * tone;
+      residual_power += residual * residual;
+    }
+  }
+  return residual_power / tone_power;
+}
+
+// Golden section search for the frequency the tone came out at
+static double thd_plus_noise_db(const std::vector<int16_t> &output, double frequency, uint32_t rate) {
+  const size_t skip = rate / 10;  // Leaves out the filters' start up
+  double low = frequency * (1.0 - MAX_RATIO_ERROR);
+  double high = frequency * (1.0 + MAX_RATIO_ERROR);
+  for (int step = 0; step < FREQUENCY_SEARCH_STEPS; ++step) {
+    const double a = low + (high - low) * 0.382;
+    const double b = low + (high - low) * 0.618;
+    if (residual_ratio(output, a, rate, skip) < residual_ratio(output, b, rate, skip)) {
+      high = b;
+    } else {
+      low = a;
+    }
+  }
+  return 10 * std::log10(residual_ratio(output, (low + high) / 2, rate, skip));
+}
+
+/// @brief Resamples a tone and returns the output
+/// @param cpu_us_per_second set to the CPU time spent resampling per second of audio
+static std::vector<int16_t> resample_tone(ResamplerQuality quality, const RatePair &pair, double frequency,
+                                          FilterBankCache *cache, double &cpu_us_per_second) {
+  auto input_ring_buffer = AudioRingBuffer::create(RING_BUFFER_SIZE, RING_BUFFER_SIZE);
+  auto output_ring_buffer = AudioRingBuffer::create(RING_BUFFER_SIZE, RING_BUFFER_SIZE);
+  AudioResampler resampler(input_ring_buffer.get(), output_ring_buffer.get(), INTERNAL_BUFFER_SAMPLES, cache);
+  resampler.set_quality(quality);
+
+  media_player::StreamInfo stream_info;
+  stream_info.channels = CHANNELS;
+  stream_info.bits_per_sample = 16;
+  stream_info.sample_rate = pair.input_rate;
+  ResampleInfo resample_info;
+  if (resampler.start(stream_info, pair.output_rate, 16, resample_info) != ESP_OK) {
+    fprintf(stderr, "the resampler failed to start\n");
+    exit(1);
+  }
+
+  std::vector<int16_t> input(pair.input_rate * SECONDS * CHANNELS);
+  for (size_t i = 0; i < input.size() / CHANNELS; ++i) {
+    for (uint8_t channel = 0; channel < CHANNELS; ++channel) {
+      input[i * CHANNELS + channel] = static_cast<int16_t>(
+          std::lround(AMPLITUDE * INT16_MAX * std::sin(2 * M_PI * frequency * i / pair.input_rate + channel)));
+    }
+  }
+
+  const uint8_t *input_bytes = reinterpret_cast<const uint8_t *>(input.data());
+  const size_t input_length = input.size() * sizeof(int16_t);
+  size_t input_written = 0;
+  std::vector<int16_t> output;
+  int16_t chunk[2048];
+  double resample_us = 0.0;
+  while (true) {
+    if (input_written < input_length) {
+      input_written += input_ring_buffer->write(input_bytes + input_written,
+                                                std::min(input_length - input_written, INPUT_CHUNK_BYTES));
+    }
+    const double start_us = cpu_us();
+    const AudioResamplerState state = resampler.resample(input_written == input_length);
+    resample_us += cpu_us() - start_us;
+
+    size_t bytes_read;
+    while ((bytes_read = output_ring_buffer->read(chunk, sizeof(chunk))) > 0) {
+      output.insert(output.end(), chunk, chunk + bytes_read / sizeof(int16_t));
+    }
+    if ((state == AudioResamplerState::FINISHED) || (state == AudioResamplerState::FAILED)) {
+      break;
+    }
+  }
+
+  cpu_us_per_second = resample_us / SECONDS;
+  return output;
+}
+
+// Whether AudioResampler takes the polyphase path for this pair, as it does whenever the polyphase resampler starts
+static bool uses_polyphase(const RatePair &pair) {
+  PolyphaseResampler polyphase;
+  return polyphase.start(pair.input_rate, pair.output_rate, CHANNELS, false, 16) == ESP_OK;
+}
+
+static std::string format_rate(uint32_t rate) {
+  char text[16];
+  snprintf(text, sizeof(text), "%g", rate / 1000.0);
+  return text;
+}
+
+int main(int argc, char **argv) {
+  bool check_polyphase = false;
+  double max_polyphase_thdn_db = 0.0;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if ((arg == "--max-polyphase-thdn") && (i + 1 < argc)) {
+      check_polyphase = true;
+      max_polyphase_thdn_db = strtod(argv[++i], nullptr);
+    } else {
+      fprintf(stderr, "usage: %s [--max-polyphase-thdn DB]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  printf("//   quality    rates             path        CPU    THD+N at 1 kHz    THD+N near the top of the band\n");
+  bool ok = true;
+  for (const RatePair &pair : RATE_PAIRS) {
+    const bool polyphase = uses_polyphase(pair);
+    const size_t qualities = sizeof(QUALITY_NAMES) / sizeof(QUALITY_NAMES[0]);
+
+    // The qualities take turns, so a busy moment on the host slows them all down alike
+    FilterBankCache cache(1 << 20);
+    std::vector<double> best_cpu_us(qualities, INFINITY);
+    std::vector<std::vector<int16_t>> outputs(qualities);
+    for (uint32_t run = 0; run < CPU_RUNS; ++run) {
+      for (size_t quality = 0; quality < qualities; ++quality) {
+        double cpu_us_per_second;
+        outputs[quality] =
+            resample_tone(static_cast<ResamplerQuality>(quality), pair, 1000.0, &cache, cpu_us_per_second);
+        best_cpu_us[quality] = std::min(best_cpu_us[quality], cpu_us_per_second);
+      }
+    }
+
+    const std::string rates = format_rate(pair.input_rate) + " -> " + format_rate(pair.output_rate) + " kHz";
+    for (size_t quality = 0; quality < qualities; ++quality) {
+      const double low_db = thd_plus_noise_db(outputs[quality], 1000.0, pair.output_rate);
+
+      double cpu_us_per_second;
+      const std::vector<int16_t> output = resample_tone(static_cast<ResamplerQuality>(quality), pair,
+                                                        pair.high_frequency, &cache, cpu_us_per_second);
+      const double high_db = thd_plus_noise_db(output, pair.high_frequency, pair.output_rate);
+
+      printf("//   %-10s %-17s %-9s %5.1f ms       %4.0f dB           %4.0f dB at %g kHz\n", QUALITY_NAMES[quality],
+             rates.c_str(), polyphase ? "polyphase" : "sinc", best_cpu_us[quality] / 1000.0, low_db, high_db,
+             pair.high_frequency / 1000.0);
+
+      if (check_polyphase && polyphase && (std::max(low_db, high_db) > max_polyphase_thdn_db)) {
+        fprintf(stderr, "%s %s: THD+N above %.0f dB on the polyphase path\n", QUALITY_NAMES[quality], rates.c_str(),
+                max_polyphase_thdn_db);
+        ok = false;
+      }
+    }
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+// Host build of esp_http_client, answering requests from the bodies registered with host::http_serve()
+
+#include <esp_http_client.h>
+
+#include "host/http_server.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Body {
+  std::vector<uint8_t> data;
+  std::string content_type;
+};
+
+std::mutex &server_mutex = *new std::mutex;
+std::map<std::string, Body> &bodies = *new std::map<std::string, Body>;
+size_t connections_opened = 0;
+
+std::string get_origin(const std::string &url) {
+  const size_t scheme_end = url.find("://");
+  const size_t host_start = (scheme_end == std::string::npos) ? 0 : scheme_end + 3;
+  return url.substr(0, url.find('/', host_start));
+}
+
+}  // namespace
+
+struct esp_http_client {
+  std::string url;
+  http_event_handle_cb event_handler;
+  void *user_data;
+  std::map<std::string, std::string> headers;
+
+  bool connected{false};
+  const Body *body{nullptr};
+  int status_code{0};
+  size_t position{0};
+};
+
+namespace host {
+
+void http_serve(const std::string &url, std::vector<uint8_t> body, const std::string &content_type) {
+  std::lock_guard<std::mutex> lock(server_mutex);
+  bodies[url] = Body{std::move(body), content_type};
+}
+
+size_t http_connections_opened() {
+  std::lock_guard<std::mutex> lock(server_mutex);
+  return connections_opened;
+}
+
+}  // namespace host
+
+static void send_header(esp_http_client_handle_t client, const char *key, const std::string &value) {
+  if (client->event_handler == nullptr) {
+    return;
+  }
+  esp_http_client_event_t event{};
+  event.event_id = HTTP_EVENT_ON_HEADER;
+  event.client = client;
+  event.user_data = client->user_data;
+  event.header_key = const_cast<char *>(key);
+  event.header_value = const_cast<char *>(value.c_str());
+  client->event_handler(&event);
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) {
+  if ((config == nullptr) || (config->url == nullptr)) {
+    return nullptr;
+  }
+  esp_http_client_handle_t client = new esp_http_client();
+  client->url = config->url;
+  client->event_handler = config->event_handler;
+  client->user_data = config->user_data;
+  return client;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url) {
+  if (get_origin(client->url) != get_origin(url)) {
+    // Like ESP-IDF, a different host closes the connection
+    client->connected = false;
+  }
+  client->url = url;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_get_url(esp_http_client_handle_t client, char *url, int len) {
+  snprintf(url, len, "%s", client->url.c_str());
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value) {
+  client->headers[key] = value;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key) {
+  client->headers.erase(key);
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void *data) {
+  client->user_data = data;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len) {
+  std::lock_guard<std::mutex> lock(server_mutex);
+  if (!client->connected) {
+    client->connected = true;
+    ++connections_opened;
+  }
+
+  auto found = bodies.find(client->url);
+  if (found == bodies.end()) {
+    client->body = nullptr;
+    client->status_code = 404;
+    return ESP_OK;
+  }
+
+  client->body = &found->second;
+  client->status_code = 200;
+  client->position = 0;
+
+  auto range = client->headers.find("Range");
+  if ((range != client->headers.end()) && (range->second.compare(0, 6, "bytes=") == 0)) {
+    const size_t start = strtoul(range->second.c_str() + 6, nullptr, 10);
+    if (start < client->body->data.size()) {
+      client->status_code = 206;
+      client->position = start;
+    }
+  }
+  return ESP_OK;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+  if (client->body == nullptr) {
+    return 0;
+  }
+  if (!client->body->content_type.empty()) {
+    send_header(client, "Content-Type", client->body->content_type);
+  }
+  send_header(client, "Accept-Ranges", "bytes");
+  return static_cast<int64_t>(client->body->data.size() - client->position);
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) { return client->status_code; }
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client) { return false; }
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len) {
+  if (!client->connected || (client->body == nullptr)) {
+    return -1;
+  }
+  const size_t bytes_to_read = std::min(static_cast<size_t>(len), client->body->data.size() - client->position);
+  memcpy(buffer, client->body->data.data() + client->position, bytes_to_read);
+  client->position += bytes_to_read;
+  return static_cast<int>(bytes_to_read);
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client) {
+  return (client->body != nullptr) && (client->position == client->body->data.size());
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+  client->connected = false;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+  delete client;
+  return ESP_OK;
+}
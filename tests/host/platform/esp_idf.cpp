@@ -0,0 +1,48 @@
+// Host build of the ESP-IDF and esp-dsp functions the nabu component uses
+
+#include <esp_dsp.h>
+#include <esp_err.h>
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+    case ESP_OK:
+      return "ESP_OK";
+    case ESP_FAIL:
+      return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+      return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+      return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+      return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+      return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+      return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+      return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+      return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE:
+      return "ESP_ERR_INVALID_RESPONSE";
+    default:
+      return "UNKNOWN ERROR";
+  }
+}
+
+esp_err_t dsps_dotprod_f32_ansi(const float *src1, const float *src2, float *dest, int len) {
+  float acc = 0;
+  for (int i = 0; i < len; i++) {
+    acc += src1[i] * src2[i];
+  }
+  *dest = acc;
+  return ESP_OK;
+}
+
+esp_err_t dsps_mulc_s16_ansi(const int16_t *input, int16_t *output, int len, int16_t C, int step_in, int step_out) {
+  for (int i = 0; i < len; i++) {
+    int32_t acc = static_cast<int32_t>(input[i * step_in]) * C;
+    output[i * step_out] = static_cast<int16_t>(acc >> 15);
+  }
+  return ESP_OK;
+}
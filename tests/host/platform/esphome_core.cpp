@@ -0,0 +1,92 @@
+// Host build of the ESPHome core functions the nabu component uses
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#include "host/memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <strings.h>
+#include <thread>
+
+namespace esphome {
+
+static const auto START_TIME = std::chrono::steady_clock::now();
+
+uint32_t millis() {
+  return static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - START_TIME).count());
+}
+
+uint32_t micros() {
+  return static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START_TIME).count());
+}
+
+void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+void delayMicroseconds(uint32_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+
+bool str_equals_case_insensitive(const std::string &a, const std::string &b) {
+  return strcasecmp(a.c_str(), b.c_str()) == 0;
+}
+
+bool str_startswith(const std::string &str, const std::string &start) { return str.rfind(start, 0) == 0; }
+
+bool str_endswith(const std::string &str, const std::string &end) {
+  return (str.size() >= end.size()) && (str.compare(str.size() - end.size(), end.size(), end) == 0);
+}
+
+std::string str_lower_case(const std::string &str) {
+  std::string result = str;
+  std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return std::tolower(c); });
+  return result;
+}
+
+static std::atomic<int> log_level{ESPHOME_LOG_LEVEL_WARN};
+
+void esp_log_printf_(int level, const char *tag, int line, const char *format, ...) {
+  if (level > log_level.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  static const char LEVEL_LETTERS[] = "?EWICDVV";
+  char message[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  fprintf(stderr, "[%c][%s:%d]: %s\n", LEVEL_LETTERS[std::min(level, 7)], tag, line, message);
+}
+
+}  // namespace esphome
+
+namespace host {
+
+static std::atomic<size_t> current_bytes{0};
+static std::atomic<size_t> peak_bytes{0};
+
+void set_log_level(int level) { esphome::log_level.store(level, std::memory_order_relaxed); }
+
+size_t allocated_bytes() { return current_bytes.load(); }
+
+size_t peak_allocated_bytes() { return peak_bytes.load(); }
+
+void reset_peak_allocated_bytes() { peak_bytes.store(current_bytes.load()); }
+
+void track_allocation(size_t bytes) {
+  const size_t now = current_bytes.fetch_add(bytes) + bytes;
+  size_t peak = peak_bytes.load();
+  while ((now > peak) && !peak_bytes.compare_exchange_weak(peak, now)) {
+  }
+}
+
+void track_deallocation(size_t bytes) { current_bytes.fetch_sub(bytes); }
+
+}  // namespace host
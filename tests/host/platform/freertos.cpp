@@ -0,0 +1,274 @@
+// Host build of the FreeRTOS API: each task is a thread, and every blocking call waits on one shared condition
+// variable, which is simple and fast enough for the few tasks a pipeline runs.
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct HostTask {
+  std::string name;
+  UBaseType_t number;
+  UBaseType_t priority;
+  uint32_t notification_count{0};
+  clockid_t cpu_clock;
+  bool has_cpu_clock{false};
+};
+
+struct HostEventGroup {
+  EventBits_t bits{0};
+};
+
+struct HostQueue {
+  size_t item_size;
+  size_t length;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+namespace {
+
+// Never destroyed, as tasks still block on them while the program exits
+std::mutex &state_mutex = *new std::mutex;
+std::condition_variable &state_changed = *new std::condition_variable;
+std::vector<HostTask *> &tasks = *new std::vector<HostTask *>;
+
+thread_local HostTask *current_task = nullptr;
+
+const auto start_time = std::chrono::steady_clock::now();
+
+std::chrono::steady_clock::time_point deadline(TickType_t ticks) {
+  if (ticks == portMAX_DELAY) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks * portTICK_PERIOD_MS);
+}
+
+template<typename Predicate>
+bool wait_until(std::unique_lock<std::mutex> &lock, TickType_t ticks, Predicate predicate) {
+  if (ticks == portMAX_DELAY) {
+    state_changed.wait(lock, predicate);
+    return true;
+  }
+  return state_changed.wait_until(lock, deadline(ticks), predicate);
+}
+
+HostTask *register_task(const char *name, UBaseType_t priority) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  HostTask *task = new HostTask();
+  task->name = name;
+  task->number = tasks.size() + 1;
+  task->priority = priority;
+  tasks.push_back(task);
+  return task;
+}
+
+uint32_t cpu_time_us(const HostTask *task) {
+  timespec time;
+  if (!task->has_cpu_clock || (clock_gettime(task->cpu_clock, &time) != 0)) {
+    return 0;
+  }
+  return static_cast<uint32_t>(time.tv_sec * 1000000ULL + time.tv_nsec / 1000);
+}
+
+}  // namespace
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *parameters,
+                               UBaseType_t priority, StackType_t *stack_buffer, StaticTask_t *task_buffer) {
+  HostTask *task = register_task(name, priority);
+  std::thread([task, task_code, parameters]() {
+    {
+      std::lock_guard<std::mutex> lock(state_mutex);
+      current_task = task;
+      task->has_cpu_clock = (pthread_getcpuclockid(pthread_self(), &task->cpu_clock) == 0);
+    }
+    task_code(parameters);
+  }).detach();
+  return task;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task) {
+  TaskHandle_t task = xTaskCreateStatic(task_code, name, stack_depth, parameters, priority, nullptr, nullptr);
+  if (created_task != nullptr) {
+    *created_task = task;
+  }
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if ((task != nullptr) && (task != current_task)) {
+    fprintf(stderr, "vTaskDelete: a host task can only delete itself\n");
+    abort();
+  }
+  {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    if (current_task != nullptr) {
+      current_task->has_cpu_clock = false;
+    }
+  }
+  pthread_exit(nullptr);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+TickType_t xTaskGetTickCount() {
+  return static_cast<TickType_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count() /
+      portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  if (current_task == nullptr) {
+    // The main thread, or another thread the test started itself, becomes a task the first time it asks
+    current_task = register_task("main", 1);
+    std::lock_guard<std::mutex> lock(state_mutex);
+    current_task->has_cpu_clock = (pthread_getcpuclockid(pthread_self(), &current_task->cpu_clock) == 0);
+  }
+  return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  ++task->notification_count;
+  state_changed.notify_all();
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait) {
+  HostTask *task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(state_mutex);
+  wait_until(lock, ticks_to_wait, [task] { return task->notification_count > 0; });
+  const uint32_t count = task->notification_count;
+  if (count > 0) {
+    task->notification_count = clear_count_on_exit ? 0 : count - 1;
+  }
+  return count;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks() {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  return tasks.size();
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *task_status_array, UBaseType_t array_size, uint32_t *total_run_time) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  if (array_size < tasks.size()) {
+    return 0;
+  }
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    task_status_array[i].xHandle = tasks[i];
+    task_status_array[i].pcTaskName = tasks[i]->name.c_str();
+    task_status_array[i].xTaskNumber = tasks[i]->number;
+    task_status_array[i].uxCurrentPriority = tasks[i]->priority;
+    task_status_array[i].ulRunTimeCounter = cpu_time_us(tasks[i]);
+  }
+  if (total_run_time != nullptr) {
+    *total_run_time = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count());
+  }
+  return tasks.size();
+}
+
+EventGroupHandle_t xEventGroupCreate() { return new HostEventGroup(); }
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t event_group, EventBits_t bits_to_set) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  event_group->bits |= bits_to_set;
+  state_changed.notify_all();
+  return event_group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t event_group, EventBits_t bits_to_clear) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  const EventBits_t bits = event_group->bits;
+  event_group->bits &= ~bits_to_clear;
+  return bits;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t event_group) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  return event_group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t event_group, EventBits_t bits_to_wait_for, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all_bits, TickType_t ticks_to_wait) {
+  auto satisfied = [event_group, bits_to_wait_for, wait_for_all_bits] {
+    const EventBits_t set_bits = event_group->bits & bits_to_wait_for;
+    return wait_for_all_bits ? (set_bits == bits_to_wait_for) : (set_bits != 0);
+  };
+
+  std::unique_lock<std::mutex> lock(state_mutex);
+  const bool waited = wait_until(lock, ticks_to_wait, satisfied);
+  const EventBits_t bits = event_group->bits;
+  if (waited && clear_on_exit) {
+    event_group->bits &= ~bits_to_wait_for;
+  }
+  return bits;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t queue_length, UBaseType_t item_size) {
+  return new HostQueue{item_size, queue_length, {}};
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait, bool to_front) {
+  std::unique_lock<std::mutex> lock(state_mutex);
+  if (!wait_until(lock, ticks_to_wait, [queue] { return queue->items.size() < queue->length; })) {
+    return pdFALSE;
+  }
+  const uint8_t *item_bytes = static_cast<const uint8_t *>(item);
+  std::vector<uint8_t> copy(item_bytes, item_bytes + queue->item_size);
+  if (to_front) {
+    queue->items.push_front(std::move(copy));
+  } else {
+    queue->items.push_back(std::move(copy));
+  }
+  state_changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+  return queue_send(queue, item, ticks_to_wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+  return queue_send(queue, item, ticks_to_wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+  std::unique_lock<std::mutex> lock(state_mutex);
+  if (!wait_until(lock, ticks_to_wait, [queue] { return !queue->items.empty(); })) {
+    return pdFALSE;
+  }
+  memcpy(buffer, queue->items.front().data(), queue->item_size);
+  queue->items.pop_front();
+  state_changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  queue->items.clear();
+  state_changed.notify_all();
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(state_mutex);
+  return queue->items.size();
+}
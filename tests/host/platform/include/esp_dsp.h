@@ -0,0 +1,10 @@
+#pragma once
+
+// Host build of the esp-dsp functions the nabu component uses; only the portable ANSI C versions exist
+
+#include "esp_err.h"
+
+esp_err_t dsps_dotprod_f32_ansi(const float *src1, const float *src2, float *dest, int len);
+esp_err_t dsps_mulc_s16_ansi(const int16_t *input, int16_t *output, int len, int16_t C, int step_in, int step_out);
+
+#define dsps_dotprod_f32 dsps_dotprod_f32_ansi
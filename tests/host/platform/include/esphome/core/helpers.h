@@ -0,0 +1,102 @@
+#pragma once
+
+// Host build of the ESPHome helpers the nabu component uses
+
+// Same standard headers as ESPHome's, which the component relies on
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "esphome/core/optional.h"
+#include "host/memory.h"
+
+namespace esphome {
+
+using std::clamp;
+using std::make_unique;
+
+template<typename T, typename U> T remap(U value, U min, U max, T min_out, T max_out) {
+  return (value - min) * (max_out - min_out) / (max - min) + min_out;
+}
+
+bool str_equals_case_insensitive(const std::string &a, const std::string &b);
+bool str_startswith(const std::string &str, const std::string &start);
+bool str_endswith(const std::string &str, const std::string &end);
+std::string str_lower_case(const std::string &str);
+
+class Mutex {
+ public:
+  Mutex() = default;
+  Mutex(const Mutex &) = delete;
+  Mutex &operator=(const Mutex &) = delete;
+
+  void lock() { this->mutex_.lock(); }
+  bool try_lock() { return this->mutex_.try_lock(); }
+  void unlock() { this->mutex_.unlock(); }
+
+ private:
+  std::mutex mutex_;
+};
+
+class LockGuard {
+ public:
+  LockGuard(Mutex &mutex) : mutex_(mutex) { this->mutex_.lock(); }
+  ~LockGuard() { this->mutex_.unlock(); }
+
+ private:
+  Mutex &mutex_;
+};
+
+/// @brief Allocates from the heap on the host; the bytes are counted for host::peak_allocated_bytes()
+template<class T> class RAMAllocator {
+ public:
+  using value_type = T;
+
+  enum Flags {
+    NONE = 0,
+    REFUSE_INTERNAL = 1 << 0,
+    ALLOW_FAILURE = 1 << 1,
+  };
+
+  RAMAllocator() = default;
+  RAMAllocator(uint8_t flags) : flags_(flags) {}
+  template<class U> constexpr RAMAllocator(const RAMAllocator<U> &other) : flags_{other.flags_} {}
+
+  T *allocate(size_t n) {
+    T *ptr = static_cast<T *>(malloc(n * sizeof(T)));
+    if (ptr == nullptr) {
+      if (!(this->flags_ & ALLOW_FAILURE)) {
+        abort();
+      }
+      return nullptr;
+    }
+    host::track_allocation(n * sizeof(T));
+    return ptr;
+  }
+
+  void deallocate(T *p, size_t n) {
+    if (p != nullptr) {
+      host::track_deallocation(n * sizeof(T));
+      free(p);
+    }
+  }
+
+ private:
+  template<class U> friend class RAMAllocator;
+
+  uint8_t flags_{NONE};
+};
+
+template<class T> using ExternalRAMAllocator = RAMAllocator<T>;
+
+}  // namespace esphome
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <optional>
+
+namespace esphome {
+
+using std::nullopt;
+using std::optional;
+
+}  // namespace esphome
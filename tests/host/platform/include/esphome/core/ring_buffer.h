@@ -0,0 +1,7 @@
+#pragma once
+
+// The nabu component only includes this for the FreeRTOS types; its audio goes through AudioRingBuffer
+
+#include <freertos/FreeRTOS.h>
+
+#include <memory>
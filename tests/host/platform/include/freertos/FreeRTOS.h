@@ -0,0 +1,37 @@
+#pragma once
+
+// Host build of the FreeRTOS API the nabu component uses. Tasks run as threads, and the tick is one millisecond.
+
+#include <cstddef>
+#include <cstdint>
+
+// Like ESP-IDF's, which pulls it in through its port layer
+#include "esp_err.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t EventBits_t;
+// Like ESP-IDF, stack sizes are in bytes
+typedef uint8_t StackType_t;
+
+typedef struct StaticTask {
+  uint8_t unused;
+} StaticTask_t;
+
+typedef struct HostTask *TaskHandle_t;
+typedef struct HostQueue *QueueHandle_t;
+typedef struct HostEventGroup *EventGroupHandle_t;
+
+typedef void (*TaskFunction_t)(void *);
+
+#define pdFALSE ((BaseType_t) 0)
+#define pdTRUE ((BaseType_t) 1)
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+
+#define portMAX_DELAY ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t) 1)
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+
+#define tskNO_AFFINITY ((BaseType_t) 0x7FFFFFFF)
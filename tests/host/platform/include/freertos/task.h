@@ -0,0 +1,28 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct TaskStatus {
+  TaskHandle_t xHandle;
+  const char *pcTaskName;
+  UBaseType_t xTaskNumber;
+  UBaseType_t uxCurrentPriority;
+  // CPU time the task's thread used, in microseconds
+  uint32_t ulRunTimeCounter;
+} TaskStatus_t;
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *parameters,
+                               UBaseType_t priority, StackType_t *stack_buffer, StaticTask_t *task_buffer);
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task);
+/// @brief Only a task deleting itself (nullptr or its own handle) is supported on the host
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
+
+UBaseType_t uxTaskGetNumberOfTasks();
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *task_status_array, UBaseType_t array_size, uint32_t *total_run_time);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+
+namespace host {
+
+/// @brief Number of failed CHECKs so far; a test's main returns non-zero if any failed
+inline std::atomic<int> check_failures{0};
+
+}  // namespace host
+
+/// @brief Reports a failure with a printf style message if condition is false, and carries on
+#define CHECK(condition, ...) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+      fprintf(stderr, __VA_ARGS__); \
+      fputc('\n', stderr); \
+      ++host::check_failures; \
+    } \
+  } while (0)
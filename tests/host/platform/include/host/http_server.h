@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace host {
+
+/// @brief Answers requests for url with body, like a server that accepts range requests
+/// @param content_type sent as the Content-Type header; left out if empty
+void http_serve(const std::string &url, std::vector<uint8_t> body, const std::string &content_type = "");
+
+/// @brief Number of connections esp_http_client_open() made, not counting reused ones
+size_t http_connections_opened();
+
+}  // namespace host
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+namespace host {
+
+/// @brief Bytes currently allocated through ExternalRAMAllocator and RAMAllocator
+size_t allocated_bytes();
+
+/// @brief Most bytes allocated through ExternalRAMAllocator and RAMAllocator at once since the last reset
+size_t peak_allocated_bytes();
+
+/// @brief Starts tracking the peak over again from the bytes currently allocated
+void reset_peak_allocated_bytes();
+
+void track_allocation(size_t bytes);
+void track_deallocation(size_t bytes);
+
+}  // namespace host